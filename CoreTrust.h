@@ -1,3 +1,6 @@
+#ifndef CORETRUST_H
+#define CORETRUST_H
+
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -63,7 +66,7 @@ enum {
     CORETRUST_POLICY_BAA_USER =             1ULL << 42,
 };
 
-void printPolicyInformation(CoreTrustPolicyFlags policyFlags) {
+static void printPolicyInformation(CoreTrustPolicyFlags policyFlags) {
     printf("CoreTrust policy flags (0x%llx):\n", policyFlags);
     if (policyFlags & CORETRUST_POLICY_BASIC) {
         printf(" - Basic\n");
@@ -209,29 +212,27 @@ enum {
     CORETRUST_DIGEST_TYPE_SHA512 = 16
 };
 
-void printDigestType(CoreTrustDigestType digestType) {
+static const char *digestTypeToString(CoreTrustDigestType digestType) {
     switch (digestType) {
         case CORETRUST_DIGEST_TYPE_SHA1:
-            printf("SHA-1");
-            break;
+            return "SHA-1";
         case CORETRUST_DIGEST_TYPE_SHA224:
-            printf("SHA-224");
-            break;
+            return "SHA-224";
         case CORETRUST_DIGEST_TYPE_SHA256:
-            printf("SHA-256");
-            break;
+            return "SHA-256";
         case CORETRUST_DIGEST_TYPE_SHA384:
-            printf("SHA-384");
-            break;
+            return "SHA-384";
         case CORETRUST_DIGEST_TYPE_SHA512:
-            printf("SHA-512");
-            break;
+            return "SHA-512";
         default:
-            printf("unknown");
-            break;
+            return "unknown";
     }
 }
 
+static void printDigestType(CoreTrustDigestType digestType) {
+    printf("%s", digestTypeToString(digestType));
+}
+
 /*! @function CTEvaluateAMFICodeSignatureCMS
  @abstract Verify CMS signature and certificates against the AMFI policies
  @param cmsData  pointer to beginning of the binary (BER-encoded) CMS object
@@ -292,3 +293,5 @@ CT_int CTVerifyAmfiCMS(
     CoreTrustDigestType maxDigestType,
     CoreTrustDigestType *hashAgilityDigestType,
     const CT_uint8_t **hashAgilityDigestData, CT_size_t *hashAgilityDigestLen);
+
+#endif // CORETRUST_H
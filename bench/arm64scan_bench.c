@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <choma/PatchFinder.h>
+#include <choma/arm64.h>
+
+#include "LazyFat.h"
+#include "SectionCache.h"
+#include "Arm64Scan.h"
+#include "Clock.h"
+
+// Instruction scans over a text section (e.g. __TEXT_EXEC,__text of a kernelcache):
+// a full pfsec_find_next_inst pass against the batched scan, and a bl xref search decoding every instruction
+// against the batched classifier that only decodes candidate lanes
+
+// Matches nothing, so every scan covers the whole section
+#define BENCH_ABSENT_INST 0x00000001
+#define BENCH_ABSENT_MASK 0xffffffff
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4) {
+        printf("Usage: %s <binary> <segment> <section> [fileset entry]\n", argv[0]);
+        return -1;
+    }
+
+    LazyFat *fat = lazy_fat_init_from_path(argv[1]);
+    LazyFatSlice *slice = fat ? lazy_fat_find_preferred_slice(fat) : NULL;
+    if (!slice && fat) slice = &fat->slices[0];
+    MachO *macho = slice ? lazy_fat_slice_get_macho(fat, slice) : NULL;
+    if (!macho) {
+        printf("Error: failed to load %s!\n", argv[1]);
+        lazy_fat_free(fat);
+        return -1;
+    }
+    PFSection *section = pfsec_init_from_macho(macho, argc > 4 ? argv[4] : NULL, argv[2], argv[3]);
+    if (!section || section->size < sizeof(uint32_t)) {
+        printf("Error: section %s,%s not found!\n", argv[2], argv[3]);
+        lazy_fat_free(fat);
+        return -1;
+    }
+    // Both sides read from memory so only the scanning is compared
+    pfsec_set_cached(section, true);
+    SectionCache *cache = section_cache_init(section, section->size);
+    if (!cache) {
+        pfsec_free(section);
+        lazy_fat_free(fat);
+        return -1;
+    }
+    uint64_t instCount = section->size / sizeof(uint32_t);
+    double megaInsts = (double)instCount / 1e6;
+    printf("%s,%s: %llu instructions at 0x%llx\n", argv[2], argv[3], (unsigned long long)instCount, (unsigned long long)section->vmaddr);
+
+    uint64_t start = clock_now_ns();
+    uint64_t found = pfsec_find_next_inst(section, section->vmaddr, 0, BENCH_ABSENT_INST, BENCH_ABSENT_MASK);
+    double seconds = (double)(clock_now_ns() - start) / 1e9;
+    printf("find_next_inst  pfsec:   %8.1f M inst/s (%llx)\n", megaInsts / seconds, (unsigned long long)found);
+
+    start = clock_now_ns();
+    found = arm64_scan_section_find_next_inst(cache, section->vmaddr, 0, BENCH_ABSENT_INST, BENCH_ABSENT_MASK);
+    seconds = (double)(clock_now_ns() - start) / 1e9;
+    printf("find_next_inst  batched: %8.1f M inst/s (%llx)\n", megaInsts / seconds, (unsigned long long)found);
+
+    // Target of the first bl in the section, a function that is usually called from many places
+    uint64_t blAddr = arm64_scan_section_find_next_inst(cache, section->vmaddr, 0, 0x94000000, 0xfc000000);
+    uint64_t target = 0;
+    bool isBl;
+    if (!blAddr || arm64_dec_b_l(section_cache_read32(cache, blAddr), blAddr, &target, &isBl) != 0) {
+        printf("No bl in the section, skipping the xref benchmark\n");
+    }
+    else {
+        start = clock_now_ns();
+        uint64_t scalarCount = 0;
+        for (uint64_t i = 0; i < instCount; i++) {
+            uint64_t vmaddr = section->vmaddr + i * sizeof(uint32_t);
+            uint64_t branchTarget;
+            if (arm64_dec_b_l(pfsec_read32(section, vmaddr), vmaddr, &branchTarget, &isBl) == 0 && branchTarget == target) scalarCount++;
+        }
+        seconds = (double)(clock_now_ns() - start) / 1e9;
+        printf("bl xrefs        decode:  %8.1f M inst/s (%llu xrefs to 0x%llx)\n", megaInsts / seconds, (unsigned long long)scalarCount, (unsigned long long)target);
+
+        start = clock_now_ns();
+        size_t batchedCount = arm64_scan_section_find_xrefs(cache, section->vmaddr, 0, target, ARM64_CLASS_B_L, NULL, 0);
+        seconds = (double)(clock_now_ns() - start) / 1e9;
+        printf("bl xrefs        batched: %8.1f M inst/s (%zu xrefs)\n", megaInsts / seconds, batchedCount);
+    }
+
+    section_cache_free(cache);
+    pfsec_free(section);
+    lazy_fat_free(fat);
+    return 0;
+}
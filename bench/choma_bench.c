@@ -0,0 +1,475 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <choma/MemoryStream.h>
+#include <choma/FileStream.h>
+#include <choma/BufferedStream.h>
+#include <choma/MachO.h>
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+
+#include "LazyFat.h"
+#include "Clock.h"
+
+// Microbenchmarks of the ChOma primitives on the scan's hot path, run on the preferred slice of a binary
+// Every benchmark runs in batches long enough to time reliably: the warmup batches also pick the batch size,
+// then each repetition times one batch. Reported per operation: median and median absolute deviation over the
+// repetitions, min, ops/s and bytes/s from the median. -j writes every sample as JSON for comparing builds
+
+#define BENCH_DEFAULT_SIZES "64,4096,65536,1048576"
+#define BENCH_DEFAULT_WARMUP 3
+#define BENCH_DEFAULT_REPETITIONS 15
+#define BENCH_MIN_BATCH_NANOS 2000000ULL
+#define BENCH_MAX_SIZES 16
+#define BENCH_OFFSET_COUNT 1024 // precomputed random offsets / addresses, used round robin
+
+typedef struct BenchContext {
+    MemoryStream *fileStream;
+    MemoryStream *bufferedStream;
+    size_t fileSize;
+    MachO *macho;
+    CS_SuperBlob *superblob;
+    uint32_t superblobSize;
+    CS_DecodedSuperBlob *decoded;
+    CS_DecodedBlob *codeDirectory;
+    size_t codeDirectorySize;
+    uint8_t *scratch;
+    uint64_t offsets[BENCH_OFFSET_COUNT];
+    uint64_t vmaddrs[BENCH_OFFSET_COUNT];
+    uint64_t sink; // results are folded in here so nothing is optimized away
+} BenchContext;
+
+// Runs iterations operations with the given parameter, returns 0 on success
+typedef int (*BenchFunction)(BenchContext *context, uint64_t param, uint64_t iterations);
+
+typedef struct BenchResult {
+    char name[64];
+    uint64_t param;
+    uint64_t iterations; // per repetition
+    uint64_t bytesPerOp;
+    double *samples; // nanoseconds per operation, one per repetition
+    unsigned sampleCount;
+    double median;
+    double mad;
+    double min;
+    double max;
+} BenchResult;
+
+typedef struct BenchOptions {
+    unsigned warmup;
+    unsigned repetitions;
+    const char *filter;
+} BenchOptions;
+
+static uint64_t bench_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Random offsets for reads of size bytes, aligned the way the scan's reads are
+static void bench_fill_offsets(BenchContext *context, uint64_t size, uint64_t limit)
+{
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ size;
+    uint64_t range = limit - size;
+    for (int i = 0; i < BENCH_OFFSET_COUNT; i++) {
+        context->offsets[i] = range ? (bench_random(&state) % range) & ~7ULL : 0;
+    }
+}
+
+static int bench_stream_read(BenchContext *context, MemoryStream *stream, uint64_t size, uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (memory_stream_read(stream, context->offsets[i % BENCH_OFFSET_COUNT], size, context->scratch) != 0) return -1;
+        context->sink += context->scratch[0];
+    }
+    return 0;
+}
+
+static int bench_stream_read_file(BenchContext *context, uint64_t size, uint64_t iterations)
+{
+    return bench_stream_read(context, context->fileStream, size, iterations);
+}
+
+static int bench_stream_read_buffered(BenchContext *context, uint64_t size, uint64_t iterations)
+{
+    return bench_stream_read(context, context->bufferedStream, size, iterations);
+}
+
+// Searches for a pattern that is not in the range, so every call scans all size bytes
+static int bench_find_memory(BenchContext *context, MemoryStream *stream, uint64_t size, uint64_t iterations)
+{
+    uint8_t pattern[8] = { 0xde, 0xc0, 0xad, 0x0b, 0xfe, 0xca, 0xef, 0xbe };
+    uint8_t mask[8] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    for (uint64_t i = 0; i < iterations; i++) {
+        uint64_t start = context->offsets[i % BENCH_OFFSET_COUNT];
+        uint64_t found = 0;
+        if (memory_stream_find_memory(stream, start, start + size, pattern, mask, sizeof(pattern), sizeof(uint32_t), &found) == 0) {
+            context->sink += found;
+        }
+    }
+    return 0;
+}
+
+static int bench_find_memory_file(BenchContext *context, uint64_t size, uint64_t iterations)
+{
+    return bench_find_memory(context, context->fileStream, size, iterations);
+}
+
+static int bench_find_memory_buffered(BenchContext *context, uint64_t size, uint64_t iterations)
+{
+    return bench_find_memory(context, context->bufferedStream, size, iterations);
+}
+
+static int bench_superblob_decode(BenchContext *context, uint64_t param, uint64_t iterations)
+{
+    (void)param;
+    for (uint64_t i = 0; i < iterations; i++) {
+        CS_DecodedSuperBlob *decoded = csd_superblob_decode(context->superblob);
+        if (!decoded) return -1;
+        context->sink += (uintptr_t)decoded->firstBlob;
+        csd_superblob_free(decoded);
+    }
+    return 0;
+}
+
+static int bench_superblob_find_blob(BenchContext *context, uint64_t param, uint64_t iterations)
+{
+    (void)param;
+    static const uint32_t slots[] = { CSSLOT_CODEDIRECTORY, CSSLOT_REQUIREMENTS, CSSLOT_ENTITLEMENTS, CSSLOT_SIGNATURESLOT };
+    for (uint64_t i = 0; i < iterations; i++) {
+        uint32_t index = 0;
+        CS_DecodedBlob *blob = csd_superblob_find_blob(context->decoded, slots[i % (sizeof(slots) / sizeof(slots[0]))], &index);
+        context->sink += (uintptr_t)blob + index;
+    }
+    return 0;
+}
+
+static int bench_blob_read(BenchContext *context, uint64_t size, uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (csd_blob_read(context->codeDirectory, 0, size, context->scratch) != 0) return -1;
+        context->sink += context->scratch[size - 1];
+    }
+    return 0;
+}
+
+static int bench_code_directory_hash(BenchContext *context, uint64_t param, uint64_t iterations)
+{
+    (void)param;
+    uint8_t cdhash[CS_CDHASH_LEN];
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (csd_code_directory_calculate_hash(context->codeDirectory, cdhash) != 0) return -1;
+        context->sink += cdhash[0];
+    }
+    return 0;
+}
+
+static int bench_translate_vmaddr(BenchContext *context, uint64_t param, uint64_t iterations)
+{
+    (void)param;
+    for (uint64_t i = 0; i < iterations; i++) {
+        uint64_t fileoff = 0;
+        MachOSegment *segment = NULL;
+        if (macho_translate_vmaddr_to_fileoff(context->macho, context->vmaddrs[i % BENCH_OFFSET_COUNT], &fileoff, &segment) == 0) {
+            context->sink += fileoff;
+        }
+    }
+    return 0;
+}
+
+static int bench_compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double bench_median(double *values, unsigned count)
+{
+    qsort(values, count, sizeof(double), bench_compare_doubles);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2.0;
+}
+
+static void bench_summarize(BenchResult *result)
+{
+    double *sorted = malloc(result->sampleCount * sizeof(double));
+    if (!sorted) return;
+    memcpy(sorted, result->samples, result->sampleCount * sizeof(double));
+    result->median = bench_median(sorted, result->sampleCount);
+    result->min = sorted[0];
+    result->max = sorted[result->sampleCount - 1];
+    for (unsigned i = 0; i < result->sampleCount; i++) {
+        sorted[i] = result->samples[i] > result->median ? result->samples[i] - result->median : result->median - result->samples[i];
+    }
+    result->mad = bench_median(sorted, result->sampleCount);
+    free(sorted);
+}
+
+static int bench_run(BenchContext *context, const BenchOptions *options, const char *name, BenchFunction function,
+                     uint64_t param, uint64_t bytesPerOp, BenchResult *result)
+{
+    memset(result, 0, sizeof(BenchResult));
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->param = param;
+    result->bytesPerOp = bytesPerOp;
+
+    // Double the batch until it is long enough, then run the remaining warmup batches at that size
+    uint64_t iterations = 1;
+    for (;;) {
+        uint64_t start = clock_now_ns();
+        if (function(context, param, iterations) != 0) return -1;
+        if (clock_now_ns() - start >= BENCH_MIN_BATCH_NANOS || iterations >= (1ULL << 40)) break;
+        iterations *= 2;
+    }
+    for (unsigned i = 1; i < options->warmup; i++) {
+        if (function(context, param, iterations) != 0) return -1;
+    }
+
+    result->iterations = iterations;
+    result->samples = calloc(options->repetitions, sizeof(double));
+    if (!result->samples) return -1;
+    for (unsigned i = 0; i < options->repetitions; i++) {
+        uint64_t start = clock_now_ns();
+        if (function(context, param, iterations) != 0) {
+            free(result->samples);
+            result->samples = NULL;
+            return -1;
+        }
+        result->samples[i] = (double)(clock_now_ns() - start) / (double)iterations;
+        result->sampleCount++;
+    }
+    bench_summarize(result);
+    return 0;
+}
+
+static void bench_print_result(const BenchResult *result)
+{
+    double opsPerSecond = 1e9 / result->median;
+    printf("%-24s %10llu %12.1f %10.1f %7.2f%% %12.1f %14.0f", result->name, (unsigned long long)result->param, result->median, result->mad,
+           result->median > 0 ? 100.0 * result->mad / result->median : 0.0, result->min, opsPerSecond);
+    if (result->bytesPerOp) {
+        printf(" %10.3f", (double)result->bytesPerOp * opsPerSecond / 1e9);
+    }
+    else {
+        printf(" %10s", "-");
+    }
+    printf("\n");
+}
+
+static void bench_print_json_string(FILE *output, const char *string)
+{
+    fputc('"', output);
+    for (const char *cur = string; *cur; cur++) {
+        if (*cur == '"' || *cur == '\\') fprintf(output, "\\%c", *cur);
+        else if ((unsigned char)*cur < 0x20) fprintf(output, "\\u%04x", *cur);
+        else fputc(*cur, output);
+    }
+    fputc('"', output);
+}
+
+static int bench_write_json(const char *path, const char *binary, const BenchOptions *options, const BenchResult *results, unsigned resultCount)
+{
+    FILE *output = fopen(path, "w");
+    if (!output) {
+        printf("Error: failed to open %s for writing!\n", path);
+        return -1;
+    }
+    fprintf(output, "{\n  \"binary\": ");
+    bench_print_json_string(output, binary);
+    fprintf(output, ",\n  \"warmup\": %u,\n  \"repetitions\": %u,\n  \"results\": [\n", options->warmup, options->repetitions);
+    for (unsigned i = 0; i < resultCount; i++) {
+        const BenchResult *result = &results[i];
+        double opsPerSecond = 1e9 / result->median;
+        fprintf(output, "    {\"name\": \"%s\", \"param\": %llu, \"iterations\": %llu, \"bytes_per_op\": %llu, "
+                        "\"median_ns\": %.3f, \"mad_ns\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f, \"ops_per_sec\": %.1f, \"bytes_per_sec\": %.1f, \"samples_ns\": [",
+                result->name, (unsigned long long)result->param, (unsigned long long)result->iterations, (unsigned long long)result->bytesPerOp,
+                result->median, result->mad, result->min, result->max, opsPerSecond, (double)result->bytesPerOp * opsPerSecond);
+        for (unsigned j = 0; j < result->sampleCount; j++) {
+            fprintf(output, "%s%.3f", j ? ", " : "", result->samples[j]);
+        }
+        fprintf(output, "]}%s\n", i + 1 < resultCount ? "," : "");
+    }
+    fprintf(output, "  ]\n}\n");
+    if (fclose(output) != 0) {
+        printf("Error: failed to write %s!\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Random addresses inside the slice's segments that are backed by the file
+static int bench_fill_vmaddrs(BenchContext *context)
+{
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+    uint32_t mapped = 0;
+    for (uint32_t i = 0; i < context->macho->segmentCount; i++) {
+        if (context->macho->segments[i]->command.filesize) mapped++;
+    }
+    if (!mapped) return -1;
+    for (int i = 0; i < BENCH_OFFSET_COUNT; i++) {
+        uint32_t pick = (uint32_t)(bench_random(&state) % mapped);
+        for (uint32_t j = 0; j < context->macho->segmentCount; j++) {
+            struct segment_command_64 command = context->macho->segments[j]->command;
+            if (!command.filesize) continue;
+            if (pick-- == 0) {
+                context->vmaddrs[i] = command.vmaddr + bench_random(&state) % command.filesize;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+static uint8_t *bench_read_file(const char *path, size_t *sizeOut)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat s;
+    uint8_t *data = NULL;
+    if (fstat(fd, &s) == 0 && s.st_size > 0 && (data = malloc(s.st_size)) != NULL) {
+        size_t done = 0;
+        while (done < (size_t)s.st_size) {
+            ssize_t r = pread(fd, data + done, s.st_size - done, done);
+            if (r <= 0) break;
+            done += r;
+        }
+        if (done != (size_t)s.st_size) {
+            free(data);
+            data = NULL;
+        }
+        *sizeOut = s.st_size;
+    }
+    close(fd);
+    return data;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argv[1][0] == '-') {
+        printf("Usage: %s <binary> [-s <sizes>] [-w <warmup batches>] [-r <repetitions>] [-f <name filter>] [-j <json output>]\n", argv[0]);
+        return -1;
+    }
+    const char *binary = argv[1];
+    const char *sizesString = BENCH_DEFAULT_SIZES;
+    const char *jsonPath = NULL;
+    BenchOptions options = { BENCH_DEFAULT_WARMUP, BENCH_DEFAULT_REPETITIONS, NULL };
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-s")) sizesString = argv[i + 1];
+        else if (!strcmp(argv[i], "-w")) options.warmup = (unsigned)strtoul(argv[i + 1], NULL, 0);
+        else if (!strcmp(argv[i], "-r")) options.repetitions = (unsigned)strtoul(argv[i + 1], NULL, 0);
+        else if (!strcmp(argv[i], "-f")) options.filter = argv[i + 1];
+        else if (!strcmp(argv[i], "-j")) jsonPath = argv[i + 1];
+        else {
+            printf("Error: unknown option %s!\n", argv[i]);
+            return -1;
+        }
+    }
+    if (options.warmup == 0) options.warmup = 1;
+    if (options.repetitions == 0) {
+        printf("Error: invalid repetition count!\n");
+        return -1;
+    }
+
+    uint64_t sizes[BENCH_MAX_SIZES];
+    unsigned sizeCount = 0;
+    for (const char *cur = sizesString; *cur && sizeCount < BENCH_MAX_SIZES; ) {
+        char *end = NULL;
+        uint64_t size = strtoull(cur, &end, 0);
+        if (end == cur || size == 0) {
+            printf("Error: invalid size list %s!\n", sizesString);
+            return -1;
+        }
+        sizes[sizeCount++] = size;
+        cur = *end == ',' ? end + 1 : end;
+    }
+
+    BenchContext context = { 0 };
+    uint8_t *fileData = bench_read_file(binary, &context.fileSize);
+    LazyFat *fat = lazy_fat_init_from_path(binary);
+    LazyFatSlice *slice = fat ? lazy_fat_find_preferred_slice(fat) : NULL;
+    if (!slice && fat && fat->sliceCount) slice = &fat->slices[0];
+    context.macho = slice ? lazy_fat_slice_get_macho(fat, slice) : NULL;
+    context.superblob = slice ? lazy_fat_slice_read_code_signature(fat, slice) : NULL;
+    context.decoded = context.superblob ? csd_superblob_decode(context.superblob) : NULL;
+    context.codeDirectory = context.decoded ? csd_superblob_find_blob(context.decoded, CSSLOT_CODEDIRECTORY, NULL) : NULL;
+    if (!fileData || !context.macho || !context.codeDirectory || bench_fill_vmaddrs(&context) != 0) {
+        printf("Error: %s is not a signed Mach-O!\n", binary);
+        if (context.decoded) csd_superblob_free(context.decoded);
+        free(context.superblob);
+        lazy_fat_free(fat);
+        free(fileData);
+        return -1;
+    }
+    context.superblobSize = BIG_TO_HOST(context.superblob->length);
+    context.codeDirectorySize = csd_blob_get_size(context.codeDirectory);
+    context.fileStream = file_stream_init_from_path(binary, 0, FILE_STREAM_SIZE_AUTO, 0);
+    context.bufferedStream = buffered_stream_init_from_buffer_nocopy(fileData, context.fileSize, 0);
+    uint64_t maxSize = context.codeDirectorySize;
+    for (unsigned i = 0; i < sizeCount; i++) {
+        if (sizes[i] > maxSize) maxSize = sizes[i];
+    }
+    context.scratch = malloc(maxSize);
+    if (!context.fileStream || !context.bufferedStream || !context.scratch) {
+        printf("Error: failed to set up streams!\n");
+        return -1;
+    }
+
+    unsigned resultCapacity = sizeCount * 5 + 8, resultCount = 0;
+    BenchResult *results = calloc(resultCapacity, sizeof(BenchResult));
+    if (!results) return -1;
+    printf("%s: %zu bytes, code signature %u bytes, code directory %zu bytes\n", binary, context.fileSize, context.superblobSize, context.codeDirectorySize);
+    printf("%-24s %10s %12s %10s %8s %12s %14s %10s\n", "benchmark", "param", "median ns", "MAD ns", "MAD", "min ns", "ops/s", "GB/s");
+
+#define BENCH(benchName, function, param, bytesPerOp) do { \
+        if ((!options.filter || strstr(benchName, options.filter)) && resultCount < resultCapacity) { \
+            if (bench_run(&context, &options, benchName, function, param, bytesPerOp, &results[resultCount]) != 0) { \
+                printf("Error: %s failed!\n", benchName); \
+            } \
+            else { \
+                bench_print_result(&results[resultCount++]); \
+            } \
+        } \
+    } while (0)
+
+    for (unsigned i = 0; i < sizeCount; i++) {
+        if (sizes[i] > context.fileSize) continue;
+        bench_fill_offsets(&context, sizes[i], context.fileSize);
+        BENCH("stream_read.file", bench_stream_read_file, sizes[i], sizes[i]);
+        BENCH("stream_read.buffered", bench_stream_read_buffered, sizes[i], sizes[i]);
+        BENCH("find_memory.file", bench_find_memory_file, sizes[i], sizes[i]);
+        BENCH("find_memory.buffered", bench_find_memory_buffered, sizes[i], sizes[i]);
+    }
+    BENCH("superblob_decode", bench_superblob_decode, 0, context.superblobSize);
+    BENCH("superblob_find_blob", bench_superblob_find_blob, 0, 0);
+    for (unsigned i = 0; i < sizeCount; i++) {
+        if (sizes[i] < context.codeDirectorySize) BENCH("blob_read", bench_blob_read, sizes[i], sizes[i]);
+    }
+    BENCH("blob_read", bench_blob_read, context.codeDirectorySize, context.codeDirectorySize);
+    BENCH("code_directory_hash", bench_code_directory_hash, 0, context.codeDirectorySize);
+    BENCH("vmaddr_to_fileoff", bench_translate_vmaddr, 0, 0);
+#undef BENCH
+
+    int r = 0;
+    if (jsonPath) r = bench_write_json(jsonPath, binary, &options, results, resultCount);
+    fprintf(stderr, "checksum %016llx\n", (unsigned long long)context.sink);
+
+    for (unsigned i = 0; i < resultCount; i++) {
+        free(results[i].samples);
+    }
+    free(results);
+    free(context.scratch);
+    memory_stream_free(context.fileStream);
+    memory_stream_free(context.bufferedStream);
+    csd_superblob_free(context.decoded);
+    free(context.superblob);
+    lazy_fat_free(fat);
+    free(fileData);
+    return r;
+}
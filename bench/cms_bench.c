@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Cms.h"
+#include "Clock.h"
+
+// Parse rate of the CMS pre-screen parser on a CMS blob read from disk (e.g. extracted with -c)
+
+#define BENCH_MIN_NANOS 1000000000ULL
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        printf("Usage: %s <path to CMS data>\n", argv[0]);
+        return -1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        printf("Error: failed to open %s!\n", argv[1]);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (!data || fread(data, 1, size, f) != (size_t)size) {
+        printf("Error: failed to read %s!\n", argv[1]);
+        fclose(f);
+        free(data);
+        return -1;
+    }
+    fclose(f);
+
+    CmsInfo info;
+    CmsParseResult result = cms_parse(data, size, &info);
+    printf("result=%s certs=%u signers=%u digest=%s signer=%016llx\n", cms_parse_result_to_string(result),
+           info.certificateCount, info.signerCount, cms_digest_algorithm_to_string(info.digestAlgorithm),
+           (unsigned long long)cms_info_get_signer_id(&info));
+
+    uint64_t iterations = 0, signers = 0;
+    uint64_t start = clock_now_ns();
+    uint64_t elapsed = 0;
+    do {
+        for (int i = 0; i < 1024; i++) {
+            cms_parse(data, size, &info);
+            signers += info.signerCount;
+        }
+        iterations += 1024;
+        elapsed = clock_now_ns() - start;
+    } while (elapsed < BENCH_MIN_NANOS);
+
+    double seconds = (double)elapsed / 1e9;
+    printf("%.2f M blobs/s, %.2f GB/s (%llu signers seen)\n", (double)iterations / seconds / 1e6,
+           (double)iterations * size / seconds / 1e9, (unsigned long long)signers);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Hash.h"
+#include "Clock.h"
+
+// Throughput of every hash backend supported on this machine, in GB/s
+// Single-buffer backends hash one large buffer, multi-buffer backends hash code-page sized messages
+
+#define BENCH_BUFFER_SIZE (64 * 1024 * 1024)
+#define BENCH_PAGE_SIZE 0x4000
+#define BENCH_MIN_NANOS 500000000ULL
+
+static double bench_single(HashAlgorithm algorithm, const uint8_t *buf, size_t size)
+{
+    uint8_t digest[HASH_MAX_DIGEST_SIZE];
+    uint64_t bytes = 0;
+    uint64_t start = clock_now_ns();
+    uint64_t elapsed = 0;
+    do {
+        hash_digest(algorithm, buf, size, digest);
+        bytes += size;
+        elapsed = clock_now_ns() - start;
+    } while (elapsed < BENCH_MIN_NANOS);
+    return (double)bytes / (double)elapsed;
+}
+
+static double bench_pages(HashAlgorithm algorithm, const uint8_t *buf, size_t size)
+{
+    size_t pageCount = size / BENCH_PAGE_SIZE;
+    const uint8_t **pages = malloc(pageCount * sizeof(*pages));
+    uint8_t *digests = malloc(pageCount * HASH_MAX_DIGEST_SIZE);
+    if (!pages || !digests) {
+        free(pages);
+        free(digests);
+        return 0.0;
+    }
+    for (size_t i = 0; i < pageCount; i++) pages[i] = buf + i * BENCH_PAGE_SIZE;
+
+    uint64_t bytes = 0;
+    uint64_t start = clock_now_ns();
+    uint64_t elapsed = 0;
+    do {
+        hash_digest_many(algorithm, pages, BENCH_PAGE_SIZE, pageCount, digests);
+        bytes += pageCount * BENCH_PAGE_SIZE;
+        elapsed = clock_now_ns() - start;
+    } while (elapsed < BENCH_MIN_NANOS);
+
+    free(pages);
+    free(digests);
+    return (double)bytes / (double)elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = BENCH_BUFFER_SIZE;
+    if (argc > 1) {
+        size = strtoull(argv[1], NULL, 0);
+        if (size < BENCH_PAGE_SIZE) size = BENCH_PAGE_SIZE;
+    }
+
+    uint8_t *buf = malloc(size);
+    if (!buf) {
+        printf("Error: failed to allocate %zu bytes!\n", size);
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) buf[i] = (uint8_t)(i * 131 + 7);
+
+    printf("%-8s %-10s %-10s %10s %10s\n", "algo", "backend", "mode", "GB/s", "selected");
+    size_t backendCount = 0;
+    const HashBackend *const *backends = hash_get_all_backends(&backendCount);
+    for (HashAlgorithm algorithm = 0; algorithm < HASH_ALGORITHM_COUNT; algorithm++) {
+        const HashBackend *selected = hash_get_backend(algorithm);
+        const HashBackend *selectedMulti = hash_get_multi_backend(algorithm);
+
+        for (size_t i = 0; i < backendCount; i++) {
+            const HashBackend *backend = backends[i];
+            if (backend->algorithm != algorithm) continue;
+            if (!backend->isSupported()) {
+                printf("%-8s %-10s %-10s %10s\n", hash_algorithm_to_string(algorithm), backend->name, "-", "unsupported");
+                continue;
+            }
+            hash_set_backend(algorithm, backend->name);
+            if (backend->compress) {
+                printf("%-8s %-10s %-10s %10.2f %10s\n", hash_algorithm_to_string(algorithm), backend->name, "stream",
+                       bench_single(algorithm, buf, size), backend == selected ? "*" : "");
+            }
+            printf("%-8s %-10s %-10s %10.2f %10s\n", hash_algorithm_to_string(algorithm), backend->name, "pages",
+                   bench_pages(algorithm, buf, size), (backend->digestMany ? backend == selectedMulti : (!selectedMulti && backend == selected)) ? "*" : "");
+        }
+
+        // Put the startup choice back for the next algorithm's comparisons
+        if (selected) hash_set_backend(algorithm, selected->name);
+        if (selectedMulti) hash_set_backend(algorithm, selectedMulti->name);
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <choma/BufferedStream.h>
+
+#include "PieceStream.h"
+#include "Clock.h"
+
+// Edit-heavy rewrite of a file: random small inserts and deletes (like growing a signature and shifting
+// load commands), then writing the result out. Compares ChOma's buffered stream, where every edit moves
+// the tail, with the piece table, where an edit touches O(log n) pieces and the file is written once
+
+#define BENCH_EDITS 2000
+#define BENCH_EDIT_SIZE 64
+
+static uint64_t bench_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void bench_edits(MemoryStream *stream, bool pieces, const uint8_t *edit)
+{
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+    for (int i = 0; i < BENCH_EDITS; i++) {
+        size_t size = memory_stream_get_size(stream);
+        uint64_t offset = bench_random(&state) % (size - BENCH_EDIT_SIZE);
+        if (i & 1) {
+            if (pieces) piece_stream_delete(stream, offset, BENCH_EDIT_SIZE);
+            else memory_stream_delete(stream, offset, BENCH_EDIT_SIZE);
+        }
+        else {
+            if (pieces) piece_stream_insert(stream, offset, BENCH_EDIT_SIZE, edit);
+            else memory_stream_insert(stream, offset, BENCH_EDIT_SIZE, edit);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        printf("Usage: %s <input file> <scratch output file>\n", argv[0]);
+        return -1;
+    }
+
+    uint8_t edit[BENCH_EDIT_SIZE];
+    memset(edit, 0xcc, sizeof(edit));
+
+    // Buffered stream: the whole file in memory, edited in place, written with one fwrite
+    uint64_t start = clock_now_ns();
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        printf("Error: failed to open %s!\n", argv[1]);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= BENCH_EDIT_SIZE) {
+        printf("Error: %s is too small!\n", argv[1]);
+        fclose(f);
+        return -1;
+    }
+    uint8_t *data = malloc(size);
+    if (!data || fread(data, 1, size, f) != (size_t)size) {
+        printf("Error: failed to read %s!\n", argv[1]);
+        fclose(f);
+        free(data);
+        return -1;
+    }
+    fclose(f);
+    MemoryStream *buffered = buffered_stream_init_from_buffer(data, size, MEMORY_STREAM_FLAG_MUTABLE | MEMORY_STREAM_FLAG_AUTO_EXPAND);
+    free(data);
+    if (!buffered) return -1;
+    bench_edits(buffered, false, edit);
+    size_t outSize = memory_stream_get_size(buffered);
+    uint8_t *out = malloc(outSize);
+    memory_stream_read(buffered, 0, outSize, out);
+    f = fopen(argv[2], "wb");
+    if (f) {
+        fwrite(out, 1, outSize, f);
+        fclose(f);
+    }
+    free(out);
+    memory_stream_free(buffered);
+    uint64_t bufferedNanos = clock_now_ns() - start;
+
+    // Piece table: the file stays mapped, only the edits are copied
+    start = clock_now_ns();
+    MemoryStream *pieces = piece_stream_init_from_path(argv[1]);
+    if (!pieces) return -1;
+    bench_edits(pieces, true, edit);
+    size_t pieceCount = piece_stream_get_piece_count(pieces);
+    int r = piece_stream_write_to_path(pieces, argv[2]);
+    memory_stream_free(pieces);
+    uint64_t pieceNanos = clock_now_ns() - start;
+
+    printf("%ld bytes, %d edits of %d bytes\n", size, BENCH_EDITS, BENCH_EDIT_SIZE);
+    printf("buffered stream: %.2f ms\n", (double)bufferedNanos / 1e6);
+    printf("piece stream:    %.2f ms (%zu pieces)%s\n", (double)pieceNanos / 1e6, pieceCount, r == 0 ? "" : ", write failed");
+    return 0;
+}
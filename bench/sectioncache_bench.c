@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <choma/PatchFinder.h>
+
+#include "LazyFat.h"
+#include "SectionCache.h"
+#include "Clock.h"
+
+// Patchfinder style access to one section (a linear instruction scan plus pointer chasing at random addresses)
+// through uncached pfsec reads and through the page cache at a given memory cap
+
+#define BENCH_RANDOM_READS 1000000
+
+static uint64_t bench_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4) {
+        printf("Usage: %s <binary> <segment> <section> [cache size in MiB] [fileset entry]\n", argv[0]);
+        return -1;
+    }
+    size_t maxBytes = argc > 4 ? strtoull(argv[4], NULL, 0) * 1024 * 1024 : SECTION_CACHE_DEFAULT_MAX_BYTES;
+
+    LazyFat *fat = lazy_fat_init_from_path(argv[1]);
+    LazyFatSlice *slice = fat ? lazy_fat_find_preferred_slice(fat) : NULL;
+    if (!slice && fat) slice = &fat->slices[0];
+    MachO *macho = slice ? lazy_fat_slice_get_macho(fat, slice) : NULL;
+    if (!macho) {
+        printf("Error: failed to load %s!\n", argv[1]);
+        lazy_fat_free(fat);
+        return -1;
+    }
+    PFSection *section = pfsec_init_from_macho(macho, argc > 5 ? argv[5] : NULL, argv[2], argv[3]);
+    if (!section || section->size < sizeof(uint32_t)) {
+        printf("Error: section %s,%s not found!\n", argv[2], argv[3]);
+        lazy_fat_free(fat);
+        return -1;
+    }
+    uint64_t words = section->size / sizeof(uint32_t);
+    printf("%s,%s: %llu bytes at 0x%llx\n", argv[2], argv[3], (unsigned long long)section->size, (unsigned long long)section->vmaddr);
+
+    SectionCache *cache = section_cache_init(section, maxBytes);
+    if (!cache) {
+        pfsec_free(section);
+        lazy_fat_free(fat);
+        return -1;
+    }
+
+    for (int cached = 0; cached < 2; cached++) {
+        uint64_t checksum = 0, state = 0x9e3779b97f4a7c15ULL;
+        uint64_t start = clock_now_ns();
+        for (uint64_t i = 0; i < words; i++) {
+            uint64_t vmaddr = section->vmaddr + i * sizeof(uint32_t);
+            checksum += cached ? section_cache_read32(cache, vmaddr) : pfsec_read32(section, vmaddr);
+        }
+        uint64_t linearNanos = clock_now_ns() - start;
+
+        start = clock_now_ns();
+        for (int i = 0; i < BENCH_RANDOM_READS; i++) {
+            uint64_t vmaddr = section->vmaddr + (bench_random(&state) % words) * sizeof(uint32_t);
+            checksum += cached ? section_cache_read32(cache, vmaddr) : pfsec_read32(section, vmaddr);
+        }
+        uint64_t randomNanos = clock_now_ns() - start;
+
+        printf("%s: linear %.2f M reads/s, random %.2f M reads/s (checksum %016llx)\n", cached ? "page cache" : "pfsec     ",
+               (double)words / ((double)linearNanos / 1e9) / 1e6,
+               (double)BENCH_RANDOM_READS / ((double)randomNanos / 1e9) / 1e6, (unsigned long long)checksum);
+    }
+    section_cache_print_stats(cache, stdout);
+
+    section_cache_free(cache);
+    pfsec_free(section);
+    lazy_fat_free(fat);
+    return 0;
+}
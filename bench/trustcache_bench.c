@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "TrustCache.h"
+#include "Clock.h"
+
+// Lookup rate of the trust cache membership check, with and without the Bloom filter
+// A v1 trust cache with random entries is written to a temporary file and mapped like a real one
+
+#define BENCH_LOOKUPS 1000000
+
+static uint64_t gBenchState = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t bench_next(void)
+{
+    gBenchState ^= gBenchState << 13;
+    gBenchState ^= gBenchState >> 7;
+    gBenchState ^= gBenchState << 17;
+    return gBenchState;
+}
+
+static void bench_fill(uint8_t *cdhash)
+{
+    uint64_t words[3] = { bench_next(), bench_next(), bench_next() };
+    memcpy(cdhash, words, TRUST_CACHE_CDHASH_LEN);
+}
+
+static int bench_compare_entry(const void *a, const void *b)
+{
+    return memcmp(a, b, TRUST_CACHE_CDHASH_LEN);
+}
+
+static void bench_run(const TrustCacheSet *set, const uint8_t *queries, const char *name)
+{
+    uint64_t found = 0;
+    uint64_t start = clock_now_ns();
+    for (uint64_t i = 0; i < BENCH_LOOKUPS; i++) {
+        found += trust_cache_set_lookup(set, queries + i * TRUST_CACHE_CDHASH_LEN) >= 0;
+    }
+    uint64_t elapsed = clock_now_ns() - start;
+    printf("%-8s %d lookups in %.1f ms (%.1f ns/lookup, %llu found)\n", name, BENCH_LOOKUPS, (double)elapsed / 1e6,
+           (double)elapsed / BENCH_LOOKUPS, (unsigned long long)found);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t entryCount = argc > 1 ? strtoull(argv[1], NULL, 0) : 1000000;
+    unsigned hitPercent = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 0) : 10;
+    if (entryCount == 0 || hitPercent > 100) {
+        printf("Usage: %s [entry count] [percent of lookups that hit]\n", argv[0]);
+        return -1;
+    }
+
+    // v1 entries: cdhash, hash type, flags
+    size_t stride = 22;
+    uint8_t *entries = calloc(entryCount, stride);
+    uint8_t *queries = malloc((size_t)BENCH_LOOKUPS * TRUST_CACHE_CDHASH_LEN);
+    if (!entries || !queries) {
+        printf("Error: allocation failed!\n");
+        return -1;
+    }
+    for (uint64_t i = 0; i < entryCount; i++) {
+        bench_fill(entries + i * stride);
+        entries[i * stride + 20] = 2;
+    }
+    qsort(entries, entryCount, stride, bench_compare_entry);
+    for (uint64_t i = 0; i < BENCH_LOOKUPS; i++) {
+        uint8_t *query = queries + i * TRUST_CACHE_CDHASH_LEN;
+        if (bench_next() % 100 < hitPercent) {
+            memcpy(query, entries + (bench_next() % entryCount) * stride, TRUST_CACHE_CDHASH_LEN);
+        }
+        else {
+            bench_fill(query);
+        }
+    }
+
+    char path[] = "/tmp/trustcache_bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Error: failed to create temporary file!\n");
+        return -1;
+    }
+    TrustCacheHeader header = { .version = 1, .entryCount = (uint32_t)entryCount };
+    FILE *f = fdopen(fd, "wb");
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(entries, stride, entryCount, f);
+    fclose(f);
+    free(entries);
+
+    TrustCacheSet *set = trust_cache_set_init();
+    uint64_t start = clock_now_ns();
+    int r = trust_cache_set_add_file(set, path);
+    unlink(path);
+    if (r != 0) {
+        trust_cache_set_free(set);
+        return -1;
+    }
+    printf("loaded %llu entries in %.1f ms\n", (unsigned long long)trust_cache_set_get_entry_count(set),
+           (double)(clock_now_ns() - start) / 1e6);
+    bench_run(set, queries, "search");
+
+    start = clock_now_ns();
+    trust_cache_set_build_filter(set, TRUST_CACHE_DEFAULT_BLOOM_BITS);
+    printf("built filter (%llu KiB) in %.1f ms\n", (unsigned long long)(set->bloom.blockCount * 64 / 1024),
+           (double)(clock_now_ns() - start) / 1e6);
+    bench_run(set, queries, "filtered");
+
+    trust_cache_set_free(set);
+    free(queries);
+    return 0;
+}
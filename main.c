@@ -1,17 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <TargetConditionals.h>
-
-#include <choma/MachO.h>
-#include <choma/FAT.h>
-#include <choma/MemoryStream.h>
-#include <choma/FileStream.h>
-#include <choma/Host.h>
-#include <choma/CSBlob.h>
-#include <choma/CodeDirectory.h>
+#include <unistd.h>
+#include <signal.h>
 
 #include "CoreTrust.h"
+#include "Evaluator.h"
+#include "Verifier.h"
+#include "Scan.h"
+#include "Pipeline.h"
+#include "WorkerPool.h"
+#include "Trace.h"
+#include "Snapshot.h"
+#include "Store.h"
+#include "Closure.h"
+#include "Bundle.h"
+#include "Sweep.h"
+#include "Pack.h"
+#include "Watch.h"
+#include "PageSample.h"
+#include "TrustCache.h"
+#include "Clock.h"
 
 char *get_argument_value(int argc, char *argv[], const char *flag) {
   for (int i = 0; i < argc; i++) {
@@ -33,63 +42,41 @@ bool argument_exists(int argc, char *argv[], const char *flag) {
   return false;
 }
 
-char *extract_preferred_slice(const char *fatPath)
-{
-    FAT *fat = fat_init_from_path(fatPath);
-    if (!fat) return NULL;
-    MachO *macho = fat_find_preferred_slice(fat);
-
-#if TARGET_OS_MAC && !TARGET_OS_IPHONE
-    if (!macho) {
-        // Check for arm64v8 first
-        macho = fat_find_slice(fat, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64_V8);
-        if (!macho) {
-            // If that fails, check for regular arm64
-            macho = fat_find_slice(fat, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64_ALL);
-            if (!macho) {
-                // If that fails, check for arm64e with ABI v2
-                macho = fat_find_slice(fat, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64E | CPU_SUBTYPE_ARM64E_ABI_V2);
-                if (!macho) {
-                    // If that fails, check for arm64e
-                    macho = fat_find_slice(fat, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64E);
-                    if (!macho) {
-                        fat_free(fat);
-                        return NULL;
-                    }
-                }
-            }
-        }
-    }
-#else
-    if (!macho) {
-        fat_free(fat);
-        return NULL;
+// Every --trustcache argument is loaded, *setOut stays NULL if there are none
+int load_trust_caches(int argc, char *argv[], TrustCacheSet **setOut) {
+  *setOut = NULL;
+  TrustCacheSet *set = NULL;
+  for (int i = 0; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--trustcache")) continue;
+    if (!set) {
+      set = trust_cache_set_init();
+      if (!set) return -1;
     }
-#endif // TARGET_OS_MAC && !TARGET_OS_IPHONE
-
-    if (macho->machHeader.filetype == MH_OBJECT) {
-        printf("Error: MachO is an object file, please use a MachO executable or dynamic library!\n");
-        fat_free(fat);
-        return NULL;
-    }
-
-    if (macho->machHeader.filetype == MH_DSYM) {
-        printf("Error: MachO is a dSYM file, please use a MachO executable or dynamic library!\n");
-        fat_free(fat);
-        return NULL;
+    if (trust_cache_set_add_file(set, argv[++i]) != 0) {
+      trust_cache_set_free(set);
+      return -1;
     }
-    
-    char *temp = strdup("/tmp/XXXXXX");
-    int fd = mkstemp(temp);
-
-    MemoryStream *outStream = file_stream_init_from_path(temp, 0, 0, FILE_STREAM_FLAG_WRITABLE | FILE_STREAM_FLAG_AUTO_EXPAND);
-    MemoryStream *machoStream = macho_get_stream(macho);
-    memory_stream_copy_data(machoStream, 0, outStream, 0, memory_stream_get_size(machoStream));
+  }
+  if (set && argument_exists(argc, argv, "--trustcache-bloom") &&
+      trust_cache_set_build_filter(set, TRUST_CACHE_DEFAULT_BLOOM_BITS) != 0) {
+    trust_cache_set_free(set);
+    return -1;
+  }
+  *setOut = set;
+  return 0;
+}
 
-    fat_free(fat);
-    memory_stream_free(outStream);
-    close(fd);
-    return temp;
+void print_trust_cache_membership(TrustCacheSet *trustCaches, const VerifierResult *result) {
+  if (!result->hasComputedCDHash) {
+    printf("Error: failed to calculate CD hash for the trust cache lookup!\n");
+    return;
+  }
+  const char *trustCache = trust_cache_set_get_path(trustCaches, trust_cache_set_lookup(trustCaches, result->computedCDHash));
+  if (trustCache) {
+    printf("CD hash is in trust cache %s.\n", trustCache);
+  } else {
+    printf("CD hash is not in any of the trust caches.\n");
+  }
 }
 
 void print_usage(const char *self) {
@@ -97,75 +84,99 @@ void print_usage(const char *self) {
   printf("\t-i: input file\n");
   printf("\t-c: input CMS\n");
   printf("\t-C: input code directory\n");
+  printf("\t-p: pipeline mode, read NUL delimited paths from stdin (find -print0)\n");
+  printf("\t-t: pipeline thread counts per stage (prefetch,parse,evaluate,cdhash,output)\n");
+  printf("\t-q: pipeline queue depth between stages\n");
+  printf("\t-R: pipeline reader (mmap, pread, uring or auto)\n");
+  printf("\t-D: reads in flight per prefetch thread with the uring reader\n");
+  printf("\t-B: pipeline per-file byte budget for the signature, CMS and code directories\n");
+  printf("\t-T: pipeline per-file time budget in milliseconds for the parse and hash stages\n");
+  printf("\t-r: retry over budget files without limits on a low priority thread at the end\n");
+  printf("\t-e: pre-screen CMS blobs and skip the CoreTrust call for empty, malformed or signerless ones\n");
+  printf("\t-a: audit entitlements, requirements and launch constraints against the code directory special slots\n");
+  printf("\t-w: run the scan in n worker processes instead of threads, a crashing file only takes down its worker\n");
+  printf("\t--worker-timeout: kill a worker that spends longer than this many milliseconds on one file (default 60000, 0 for none)\n");
+  printf("\t-s: print pipeline stage statistics to stderr when done\n");
+  printf("\t-S: print pipeline stage statistics to stderr every n seconds\n");
+  printf("\t--trustcache: look up the cdhash in a trust cache (repeatable, v0/v1/v2 payloads or raw sorted cdhashes)\n");
+  printf("\t--trustcache-bloom: put a Bloom filter in front of the trust cache lookups\n");
+  printf("\t--snapshot: also write the pipeline results to a binary snapshot for diff\n");
+  printf("\t--store: also append the pipeline results to an indexed results store directory for query\n");
+  printf("\t--trace: write per-phase spans of every pipeline thread to a Chrome trace file (open in Perfetto)\n");
   printf("\t-h: print this help message\n");
+  printf("Subcommands:\n");
+  printf("\tdiff <old snapshot> <new snapshot>: list added, removed and changed binaries\n");
+  printf("\tquery <store> [--cdhash <hex>] [--team <id>] [--identifier <id>] [--path <path>] [--under <prefix>] [--policy <mask>] [--no-policy <mask>] [--agility <version>] [--no-agility <version>] [--evaluated] [-s]: list stored results matching every filter\n");
+  printf("\tclosure <executable> [--root <dir>] [-j <threads>]: evaluate every dylib the executable loads and report the weakest link\n");
+  printf("\tbundle <bundle> [-j <threads>]: verify the resource seal of a bundle and its nested code, exits with 1 if it is broken\n");
+  printf("\tsweep (-i <binary> | -c <CMS> -C <code directory>) -m <spec> [-j <threads>] [--changed]: evaluate single mutations of a signature\n");
+  printf("\tpack <output> [-j <threads>]: pack the CMS and code directory of every binary in a NUL delimited path list on stdin\n");
+  printf("\treplay <pack> [-j <threads>] [-n <rounds>] [--list]: evaluate every entry of a pack\n");
+  printf("\twatch <dir> [<dir> ...] [-j <threads>] [-d <debounce ms>] [-W <backend>] [--poll <ms>] [--initial]: evaluate binaries as they are written, until interrupted\n");
+  printf("\tpages [<binary> ...] [-k <random pages>] [--seed <n>] [--tamper <pages>] [--full] [-j <threads>] [-s]: verify a seeded sample of code pages (first, last, entry point, __text and k random ones) of the given binaries or a NUL delimited path list on stdin, a mismatch escalates to every page, exits with 1 if any binary is tampered\n");
   printf("Examples:\n");
   printf("\t%s -i <path to input binary>\n", self);
   printf("\t%s -c <path to CMS data> -C <path to code directory>\n", self);
+  printf("\tfind / -type f -print0 | %s -p -t 8,4,4,2,1 -s\n", self);
+  printf("\tfind /usr/lib -type f -print0 | %s -p --trace scan.json\n", self);
+  printf("\tfind ~/Downloads -type f -print0 | %s -p -w 8\n", self);
+  printf("\t%s closure /Applications/Safari.app/Contents/MacOS/Safari -s\n", self);
+  printf("\t%s bundle /Applications/Xcode.app -j 8 -s\n", self);
+  printf("\t%s sweep -i <binary> -m 'cd.flags=0-0xffff;cd.hashType=1-4;cms.bitflip=*' --changed -s\n", self);
+  printf("\tfind / -type f -print0 | %s pack corpus.ctpack -s\n", self);
+  printf("\t%s replay corpus.ctpack -n 10 -s\n", self);
+  printf("\t%s watch build/Products staging -d 500 -s\n", self);
+  printf("\tfind /Applications -type f -print0 | %s pages -k 32 --tamper 4 -s | grep tampered\n", self);
+  printf("\tfind /System -type f -print0 | %s -p --trustcache static.tc --trustcache loadable.tc\n", self);
+  printf("\tfind / -type f -print0 | %s -p --snapshot new.snap > /dev/null && %s diff old.snap new.snap\n", self, self);
+  printf("\tfind /Applications -type f -print0 | %s -p --store results > /dev/null && %s query results --policy 0x20 --no-agility 2 -s\n", self, self);
   exit(-1);
 }
 
-void evaluate_code_signature(CT_uint8_t *cmsData, CT_size_t cmsLen,
-                             CT_uint8_t *codeDirectoryData,
-                             CT_size_t codeDirectoryLen,
-                             CS_DecodedSuperBlob *superblob) {
-  const CT_uint8_t *leafCert = NULL;
-  CT_size_t leafCertLen = 0;
-  CoreTrustPolicyFlags policyFlags = 0;
-  CoreTrustDigestType cmsDigestType = 0;
-  CoreTrustDigestType hashAgilityDigestType = 0;
-  const CT_uint8_t *digestData = NULL;
-  CT_size_t digestLen = 0;
-
-  CT_int result = CTEvaluateAMFICodeSignatureCMS(
-      cmsData, cmsLen, codeDirectoryData, codeDirectoryLen, false, &leafCert,
-      &leafCertLen, &policyFlags, &cmsDigestType, &hashAgilityDigestType,
-      &digestData, &digestLen);
-
-  if (result == 0) {
-    if (policyFlags == 0) {
-      printf("CoreTrust evaluation was successful, but there were no matching "
-             "policies found for the certificate.\n");
-      return;
-    }
-
-    printf("CoreTrust evaluation was successful!\n");
-    printPolicyInformation(policyFlags);
-
-    if (hashAgilityDigestType != 0) {
-      printf("CMS uses Apple Hash Agility V2, chosen hash type is ");
-      printDigestType(hashAgilityDigestType);
-      printf(".\n");
-      
-    } else if (digestLen != 0) {
-      printf("CMS uses Apple Hash Agility v1.\n");
-    } else {
-      printf("CMS does not use Apple Hash Agility!\n");
-      return;
-    }
-
-    printf("AMFI will expect CD hash of ");
-    printDigestType(cmsDigestType);
-    printf(" code directory to be ");
-    for (CT_size_t i = 0; i < digestLen; i++) {
-      printf("%02x", digestData[i]);
-    }
-    printf(".\n");
+void print_verifier_result(const VerifierResult *result) {
+  if (result->error == VERIFIER_ERROR_NO_EVALUATOR) {
+    printf("Error: CoreTrust evaluator is not available!\n");
+    return;
+  }
+  if (result->error == VERIFIER_ERROR_EVALUATION_FAILED) {
+    printf("Error: CTEvaluateAMFICodeSignatureCMS returned 0x%x.\n", result->coreTrustResult);
+    return;
+  }
 
-   if (superblob) {
-    void *cdhashOut = malloc(CS_CDHASH_LEN);
-   csd_superblob_calculate_best_cdhash(superblob, cdhashOut);
-   
-   if (memcmp(cdhashOut, digestData, CS_CDHASH_LEN) == 0) {
-     printf("CD hash matches the expected hash.\n");
-   } else {
-     printf("CD hash does not match the expected hash.\n");
-   }
+  if (result->policyFlags == 0) {
+    printf("CoreTrust evaluation was successful, but there were no matching "
+           "policies found for the certificate.\n");
+    return;
+  }
 
-   free(cdhashOut);
-   }
+  printf("CoreTrust evaluation was successful!\n");
+  printPolicyInformation(result->policyFlags);
 
+  if (result->hashAgilityDigestType != 0) {
+    printf("CMS uses Apple Hash Agility V2, chosen hash type is ");
+    printDigestType(result->hashAgilityDigestType);
+    printf(".\n");
+  } else if (result->expectedCDHashLength != 0) {
+    printf("CMS uses Apple Hash Agility v1.\n");
   } else {
-    printf("Error: CTEvaluateAMFICodeSignatureCMS returned 0x%x.\n", result);
+    printf("CMS does not use Apple Hash Agility!\n");
+    return;
+  }
+
+  printf("AMFI will expect CD hash of ");
+  printDigestType(result->cmsDigestType);
+  printf(" code directory to be ");
+  for (size_t i = 0; i < result->expectedCDHashLength; i++) {
+    printf("%02x", result->expectedCDHash[i]);
+  }
+  printf(".\n");
+
+  if (result->hasComputedCDHash) {
+    if (result->cdhashMatches) {
+      printf("CD hash matches the expected hash.\n");
+    } else {
+      printf("CD hash does not match the expected hash.\n");
+    }
   }
 }
 
@@ -204,73 +215,680 @@ void* get_file_data(const char* filename, size_t *sizeOut) {
     return data;
 }
 
-int main(int argc, char *argv[]) {
- const char *inputPath = get_argument_value(argc, argv, "-i");
- if (!inputPath) {
+int run_worker_pool(PipelineConfig *config, unsigned workerCount, const char *timeoutMillis, bool printStats) {
+  WorkerPool *pool = worker_pool_init(config, workerCount);
+  if (!pool) {
+    printf("Error: failed to set up worker pool!\n");
+    return -1;
+  }
+  if (timeoutMillis) {
+    pool->timeoutNanos = strtoull(timeoutMillis, NULL, 0) * 1000000ULL;
+  }
+  int r = worker_pool_run_paths_from_file(pool, stdin);
+  if (r == 0 && printStats) {
+    worker_pool_print_stats(pool, stderr);
+  }
+  worker_pool_free(pool);
+  return r;
+}
+
+int run_pipeline(int argc, char *argv[]) {
+  PipelineConfig config;
+  pipeline_config_init_default(&config);
 
-    
-    void *inputCMS = get_argument_value(argc, argv, "-c");
-    void *inputCD = get_argument_value(argc, argv, "-C");
+  const char *threadCounts = get_argument_value(argc, argv, "-t");
+  if (threadCounts && pipeline_config_parse_thread_counts(&config, threadCounts) != 0) {
+    printf("Error: invalid thread counts, expected five comma separated numbers!\n");
+    return -1;
+  }
+  const char *queueDepth = get_argument_value(argc, argv, "-q");
+  if (queueDepth) {
+    config.queueDepth = strtoul(queueDepth, NULL, 0);
+    if (config.queueDepth == 0) {
+      printf("Error: invalid queue depth!\n");
+      return -1;
+    }
+  }
+  const char *reader = get_argument_value(argc, argv, "-R");
+  if (reader && pipeline_config_parse_reader(&config, reader) != 0) {
+    printf("Error: unsupported reader %s!\n", reader);
+    return -1;
+  }
+  const char *ioDepth = get_argument_value(argc, argv, "-D");
+  if (ioDepth) {
+    config.ioDepth = (unsigned)strtoul(ioDepth, NULL, 0);
+    if (config.ioDepth == 0) {
+      printf("Error: invalid I/O depth!\n");
+      return -1;
+    }
+  }
+  const char *maxBytes = get_argument_value(argc, argv, "-B");
+  if (maxBytes) {
+    config.budget.maxBytes = strtoull(maxBytes, NULL, 0);
+  }
+  const char *maxMillis = get_argument_value(argc, argv, "-T");
+  if (maxMillis) {
+    config.budget.maxNanos = strtoull(maxMillis, NULL, 0) * 1000000ULL;
+  }
+  config.retryDeferred = argument_exists(argc, argv, "-r");
+  config.audit = argument_exists(argc, argv, "-a");
+  config.prescreen = argument_exists(argc, argv, "-e");
+  const char *statsInterval = get_argument_value(argc, argv, "-S");
+  if (statsInterval) {
+    config.statsInterval = (unsigned)strtoul(statsInterval, NULL, 0);
+  }
+
+  TrustCacheSet *trustCaches = NULL;
+  if (load_trust_caches(argc, argv, &trustCaches) != 0) {
+    printf("Error: failed to load trust caches!\n");
+    return -1;
+  }
+  config.trustCaches = trustCaches;
+
+  const char *workerCount = get_argument_value(argc, argv, "-w");
+  if (workerCount) {
+    unsigned workers = (unsigned)strtoul(workerCount, NULL, 0);
+    if (workers == 0) {
+      printf("Error: invalid worker count!\n");
+      trust_cache_set_free(trustCaches);
+      return -1;
+    }
+    if (argument_exists(argc, argv, "--snapshot") || argument_exists(argc, argv, "--store") || argument_exists(argc, argv, "--trace") || config.retryDeferred) {
+      printf("Error: --snapshot, --store, --trace and -r are not supported with worker processes!\n");
+      trust_cache_set_free(trustCaches);
+      return -1;
+    }
+    int r = run_worker_pool(&config, workers, get_argument_value(argc, argv, "--worker-timeout"), argument_exists(argc, argv, "-s"));
+    trust_cache_set_free(trustCaches);
+    return r;
+  }
+
+  const char *tracePath = get_argument_value(argc, argv, "--trace");
+  if (tracePath && trace_start(tracePath, TRACE_DEFAULT_EVENTS_PER_THREAD) != 0) {
+    printf("Error: failed to start tracing!\n");
+    trust_cache_set_free(trustCaches);
+    return -1;
+  }
+
+  const char *snapshotPath = get_argument_value(argc, argv, "--snapshot");
+  if (snapshotPath) {
+    config.snapshot = snapshot_writer_init(snapshotPath);
+    if (!config.snapshot) {
+      printf("Error: failed to set up snapshot!\n");
+      trust_cache_set_free(trustCaches);
+      if (tracePath) trace_stop();
+      return -1;
+    }
+  }
+
+  const char *storePath = get_argument_value(argc, argv, "--store");
+  if (storePath) {
+    config.store = store_writer_init(storePath);
+    if (!config.store) {
+      printf("Error: failed to set up store!\n");
+      if (config.snapshot) snapshot_writer_free(config.snapshot);
+      trust_cache_set_free(trustCaches);
+      if (tracePath) trace_stop();
+      return -1;
+    }
+  }
+
+  Pipeline *pipeline = pipeline_init(&config);
+  if (!pipeline) {
+    printf("Error: failed to set up pipeline!\n");
+    if (config.snapshot) snapshot_writer_free(config.snapshot);
+    if (config.store) store_writer_free(config.store);
+    trust_cache_set_free(trustCaches);
+    if (tracePath) trace_stop();
+    return -1;
+  }
+  int r = pipeline_run_paths_from_file(pipeline, stdin);
+  if (r == 0 && argument_exists(argc, argv, "-s")) {
+    pipeline_print_stats(pipeline, stderr);
+  }
+  pipeline_free(pipeline);
+  if (config.snapshot) {
+    if (r == 0 && snapshot_writer_finish(config.snapshot) != 0) {
+      r = -1;
+    }
+    snapshot_writer_free(config.snapshot);
+  }
+  if (config.store) {
+    if (r == 0 && store_writer_finish(config.store) != 0) {
+      r = -1;
+    }
+    store_writer_free(config.store);
+  }
+  trust_cache_set_free(trustCaches);
+  if (tracePath && trace_stop() != 0) {
+    r = -1;
+  }
+  return r;
+}
+
+int run_diff(int argc, char *argv[]) {
+  if (argc < 4) {
+    print_usage(argv[0]);
+  }
+
+  Snapshot *oldSnapshot = snapshot_open(argv[2]);
+  if (!oldSnapshot) return -1;
+  Snapshot *newSnapshot = snapshot_open(argv[3]);
+  if (!newSnapshot) {
+    snapshot_free(oldSnapshot);
+    return -1;
+  }
+
+  SnapshotDiffStats stats;
+  int r = snapshot_diff(oldSnapshot, newSnapshot, stdout, &stats);
+  if (r == 0) {
+    fprintf(stderr, "%llu added, %llu removed, %llu changed, %llu unchanged\n",
+            (unsigned long long)stats.added, (unsigned long long)stats.removed,
+            (unsigned long long)stats.changed, (unsigned long long)stats.unchanged);
+  }
+  snapshot_free(oldSnapshot);
+  snapshot_free(newSnapshot);
+  return r;
+}
+
+void print_store_record(const StoreSegment *segment, const StoreRecord *record, void *context) {
+  store_record_print(segment, record, context);
+}
+
+int run_query(int argc, char *argv[]) {
+  if (argc < 3 || argv[2][0] == '-') {
+    print_usage(argv[0]);
+  }
+
+  StoreQuery query;
+  store_query_init(&query);
+  const char *cdhash = get_argument_value(argc, argv, "--cdhash");
+  if (cdhash && store_query_set_cdhash(&query, cdhash) != 0) {
+    printf("Error: invalid cdhash!\n");
+    return -1;
+  }
+  query.teamId = get_argument_value(argc, argv, "--team");
+  query.identifier = get_argument_value(argc, argv, "--identifier");
+  query.path = get_argument_value(argc, argv, "--path");
+  query.pathPrefix = get_argument_value(argc, argv, "--under");
+  const char *policyAll = get_argument_value(argc, argv, "--policy");
+  if (policyAll) {
+    query.policyAll = strtoull(policyAll, NULL, 0);
+  }
+  const char *policyNone = get_argument_value(argc, argv, "--no-policy");
+  if (policyNone) {
+    query.policyNone = strtoull(policyNone, NULL, 0);
+  }
+  const char *agility = get_argument_value(argc, argv, "--agility");
+  if (agility) {
+    query.hashAgilityVersion = (int)strtoul(agility, NULL, 0);
+  }
+  const char *excludedAgility = get_argument_value(argc, argv, "--no-agility");
+  if (excludedAgility) {
+    query.excludedHashAgilityVersion = (int)strtoul(excludedAgility, NULL, 0);
+  }
+  query.evaluatedOnly = argument_exists(argc, argv, "--evaluated");
+
+  uint64_t start = clock_now_ns();
+  Store *store = store_open(argv[2]);
+  if (!store) return -1;
+  StoreQueryStats stats;
+  int r = store_query(store, &query, print_store_record, stdout, &stats);
+  uint64_t nanos = clock_now_ns() - start;
+  if (r == 0 && argument_exists(argc, argv, "-s")) {
+    fprintf(stderr, "%llu matches, %llu candidates of %llu records in %llu segments, %.3f ms\n",
+            (unsigned long long)stats.matchCount, (unsigned long long)stats.candidateCount,
+            (unsigned long long)stats.recordCount, (unsigned long long)stats.segmentCount, nanos / 1e6);
+  }
+  store_free(store);
+  return r;
+}
+
+int run_closure(int argc, char *argv[]) {
+  if (argc < 3 || argv[2][0] == '-') {
+    print_usage(argv[0]);
+  }
+
+  unsigned threads = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+  const char *threadCount = get_argument_value(argc, argv, "-j");
+  if (threadCount) {
+    threads = (unsigned)strtoul(threadCount, NULL, 0);
+    if (threads == 0) {
+      printf("Error: invalid thread count!\n");
+      return -1;
+    }
+  }
+
+  TrustCacheSet *trustCaches = NULL;
+  if (load_trust_caches(argc, argv, &trustCaches) != 0) {
+    printf("Error: failed to load trust caches!\n");
+    return -1;
+  }
+
+  Closure *closure = closure_init(get_argument_value(argc, argv, "--root"), argv[2], threads);
+  if (!closure) {
+    trust_cache_set_free(trustCaches);
+    return -1;
+  }
+  closure->trustCaches = trustCaches;
+  int r = closure_run(closure);
+  if (r == 0) {
+    closure_print(closure, stdout);
+    if (argument_exists(argc, argv, "-s")) {
+      closure_print_stats(closure, stderr);
+    }
+  }
+  closure_free(closure);
+  trust_cache_set_free(trustCaches);
+  return r;
+}
+
+int run_bundle(int argc, char *argv[]) {
+  if (argc < 3 || argv[2][0] == '-') {
+    print_usage(argv[0]);
+  }
+
+  unsigned threads = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+  const char *threadCount = get_argument_value(argc, argv, "-j");
+  if (threadCount) {
+    threads = (unsigned)strtoul(threadCount, NULL, 0);
+    if (threads == 0) {
+      printf("Error: invalid thread count!\n");
+      return -1;
+    }
+  }
+
+  Bundle *bundle = bundle_init(argv[2], threads);
+  if (!bundle) return -1;
+  int r = bundle_verify(bundle);
+  if (r == 0) {
+    bundle_print(bundle, stdout);
+    if (argument_exists(argc, argv, "-s")) {
+      bundle_print_stats(bundle, stderr);
+    }
+    r = bundle_is_intact(bundle) ? 0 : 1;
+  }
+  bundle_free(bundle);
+  return r;
+}
+
+int run_sweep(int argc, char *argv[]) {
+  unsigned threads = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+  const char *threadCount = get_argument_value(argc, argv, "-j");
+  if (threadCount) {
+    threads = (unsigned)strtoul(threadCount, NULL, 0);
+    if (threads == 0) {
+      printf("Error: invalid thread count!\n");
+      return -1;
+    }
+  }
+
+  // The base pair comes from a binary or from separate CMS and code directory files, like the default mode
+  uint8_t *cms = NULL, *cd = NULL;
+  size_t cmsSize = 0, cdSize = 0;
+  const char *inputPath = get_argument_value(argc, argv, "-i");
+  if (inputPath) {
+    ScanItem *item = scan_item_init(inputPath);
+    if (!item) return -1;
+    scan_item_prefetch(item);
+    if (scan_item_parse(item) != 0) {
+      printf("Error: %s has no usable signature (%s)!\n", inputPath, scan_status_to_string(item->status));
+      scan_item_free(item);
+      return -1;
+    }
+    cms = item->cmsData;
+    cmsSize = item->cmsLen;
+    cd = item->codeDirectoryData;
+    cdSize = item->codeDirectoryLen;
+    item->cmsData = NULL;
+    item->codeDirectoryData = NULL;
+    scan_item_free(item);
+  }
+  else {
+    const char *inputCMS = get_argument_value(argc, argv, "-c");
+    const char *inputCD = get_argument_value(argc, argv, "-C");
     if (!inputCMS || !inputCD) {
       print_usage(argv[0]);
     }
-    size_t cmsSize, cdSize;
-    void *cms = get_file_data(inputCMS, &cmsSize);
-    void *cd = get_file_data(inputCD, &cdSize);
-  
-    evaluate_code_signature(cms, cmsSize, cd, cdSize, NULL);
+    cms = get_file_data(inputCMS, &cmsSize);
+    cd = get_file_data(inputCD, &cdSize);
+    if (!cms || !cd) {
+      free(cms);
+      free(cd);
+      return -1;
+    }
+  }
 
-    return 0;
+  Sweep *sweep = sweep_init(cms, cmsSize, cd, cdSize, threads);
+  free(cms);
+  free(cd);
+  if (!sweep) return -1;
+  sweep->changedOnly = argument_exists(argc, argv, "--changed");
+
+  int r = 0;
+  for (int i = 0; r == 0 && i + 1 < argc; i++) {
+    if (strcmp(argv[i], "-m")) continue;
+    r = sweep_add_spec(sweep, argv[++i]);
+  }
+  if (r == 0) {
+    r = sweep_run(sweep, stdout);
+  }
+  if (r == 0 && argument_exists(argc, argv, "-s")) {
+    sweep_print_stats(sweep, stderr);
+  }
+  sweep_free(sweep);
+  return r;
+}
+
+int run_pack(int argc, char *argv[]) {
+  if (argc < 3) {
+    print_usage(argv[0]);
+  }
+  unsigned threads = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+  const char *threadCount = get_argument_value(argc, argv, "-j");
+  if (threadCount) {
+    threads = (unsigned)strtoul(threadCount, NULL, 0);
+    if (threads == 0) {
+      printf("Error: invalid thread count!\n");
+      return -1;
+    }
+  }
+
+  PackWriter *writer = pack_writer_init(argv[2]);
+  if (!writer) return -1;
+  int r = pack_writer_add_paths_from_file(writer, stdin, threads);
+  if (r == 0) {
+    r = pack_writer_finish(writer);
+  }
+  if (r == 0 && argument_exists(argc, argv, "-s")) {
+    pack_writer_print_stats(writer, stderr);
+  }
+  pack_writer_free(writer);
+  return r;
+}
+
+int run_replay(int argc, char *argv[]) {
+  if (argc < 3) {
+    print_usage(argv[0]);
+  }
+  unsigned threads = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+  const char *threadCount = get_argument_value(argc, argv, "-j");
+  if (threadCount) {
+    threads = (unsigned)strtoul(threadCount, NULL, 0);
+    if (threads == 0) {
+      printf("Error: invalid thread count!\n");
+      return -1;
+    }
+  }
+  uint64_t rounds = 1;
+  const char *roundCount = get_argument_value(argc, argv, "-n");
+  if (roundCount) {
+    rounds = strtoull(roundCount, NULL, 0);
+    if (rounds == 0) {
+      printf("Error: invalid round count!\n");
+      return -1;
+    }
+  }
+
+  Pack *pack = pack_open(argv[2]);
+  if (!pack) return -1;
+  PackReplay *replay = pack_replay_init(pack, threads, rounds);
+  if (!replay) {
+    pack_free(pack);
+    return -1;
+  }
+  int r = pack_replay_run(replay, argument_exists(argc, argv, "--list") ? stdout : NULL);
+  if (r == 0 && argument_exists(argc, argv, "-s")) {
+    pack_replay_print_stats(replay, stderr);
+  }
+  pack_replay_free(replay);
+  pack_free(pack);
+  return r;
+}
+
+static Watch *gWatch = NULL;
+
+static void watch_signal_handler(int signalNumber) {
+  (void)signalNumber;
+  if (gWatch) watch_stop(gWatch);
+}
+
+int run_watch(int argc, char *argv[]) {
+  PipelineConfig config;
+  pipeline_config_init_default(&config);
+  unsigned threads = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+  const char *threadCount = get_argument_value(argc, argv, "-j");
+  if (threadCount) {
+    threads = (unsigned)strtoul(threadCount, NULL, 0);
+    if (threads == 0) {
+      printf("Error: invalid thread count!\n");
+      return -1;
+    }
+  }
+  const char *reader = get_argument_value(argc, argv, "-R");
+  if (reader && pipeline_config_parse_reader(&config, reader) != 0) {
+    printf("Error: unsupported reader %s!\n", reader);
+    return -1;
+  }
+  const char *maxBytes = get_argument_value(argc, argv, "-B");
+  if (maxBytes) {
+    config.budget.maxBytes = strtoull(maxBytes, NULL, 0);
+  }
+  const char *maxMillis = get_argument_value(argc, argv, "-T");
+  if (maxMillis) {
+    config.budget.maxNanos = strtoull(maxMillis, NULL, 0) * 1000000ULL;
+  }
+  config.audit = argument_exists(argc, argv, "-a");
+  config.prescreen = argument_exists(argc, argv, "-e");
+  const char *statsInterval = get_argument_value(argc, argv, "-S");
+  if (statsInterval) {
+    config.statsInterval = (unsigned)strtoul(statsInterval, NULL, 0);
+  }
+
+  TrustCacheSet *trustCaches = NULL;
+  if (load_trust_caches(argc, argv, &trustCaches) != 0) {
+    printf("Error: failed to load trust caches!\n");
+    return -1;
+  }
+  config.trustCaches = trustCaches;
+
+  Watch *watch = watch_init(&config, threads);
+  if (!watch) {
+    trust_cache_set_free(trustCaches);
+    return -1;
+  }
+  int r = 0;
+  // Roots come first, up to the first option
+  for (int i = 2; r == 0 && i < argc && argv[i][0] != '-'; i++) {
+    r = watch_add_root(watch, argv[i]);
+  }
+  const char *debounce = get_argument_value(argc, argv, "-d");
+  if (r == 0 && debounce) {
+    watch->debounceNanos = strtoull(debounce, NULL, 0) * 1000000ULL;
+  }
+  const char *pollInterval = get_argument_value(argc, argv, "--poll");
+  if (r == 0 && pollInterval) {
+    watch->pollNanos = strtoull(pollInterval, NULL, 0) * 1000000ULL;
+    if (watch->pollNanos == 0) {
+      printf("Error: invalid poll interval!\n");
+      r = -1;
+    }
+  }
+  const char *backend = get_argument_value(argc, argv, "-W");
+  if (r == 0 && backend && watch_parse_backend(watch, backend) != 0) {
+    printf("Error: unsupported watch backend %s!\n", backend);
+    r = -1;
+  }
+  watch->initialScan = argument_exists(argc, argv, "--initial");
+
+  if (r == 0) {
+    gWatch = watch;
+    signal(SIGINT, watch_signal_handler);
+    signal(SIGTERM, watch_signal_handler);
+    r = watch_run(watch);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    gWatch = NULL;
+  }
+  if (r == 0 && argument_exists(argc, argv, "-s")) {
+    watch_print_stats(watch, stderr);
+  }
+  watch_free(watch);
+  trust_cache_set_free(trustCaches);
+  return r;
+}
+
+int run_pages(int argc, char *argv[]) {
+  PageSampleConfig config;
+  page_sample_config_init(&config);
+  unsigned threads = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+  const char *threadCount = get_argument_value(argc, argv, "-j");
+  if (threadCount) {
+    threads = (unsigned)strtoul(threadCount, NULL, 0);
+    if (threads == 0) {
+      printf("Error: invalid thread count!\n");
+      return -1;
+    }
+  }
+  const char *randomPages = get_argument_value(argc, argv, "-k");
+  if (randomPages) {
+    config.randomPages = (uint32_t)strtoul(randomPages, NULL, 0);
+  }
+  const char *tamperPages = get_argument_value(argc, argv, "--tamper");
+  if (tamperPages) {
+    config.tamperPages = (uint32_t)strtoul(tamperPages, NULL, 0);
+    if (config.tamperPages == 0) {
+      printf("Error: invalid tamper size!\n");
+      return -1;
+    }
+  }
+  // Without a seed every run samples different pages, the seed is part of the statistics to reproduce a run
+  const char *seed = get_argument_value(argc, argv, "--seed");
+  config.seed = seed ? strtoull(seed, NULL, 0) : clock_now_ns() ^ ((uint64_t)getpid() << 32);
+  config.full = argument_exists(argc, argv, "--full");
+
+  PageSampler sampler;
+  page_sampler_init(&sampler, &config, stdout);
+  int i = 2;
+  for (; i < argc && argv[i][0] != '-'; i++) {
+    page_sampler_add_path(&sampler, argv[i]);
+  }
+  if (i == 2) {
+    page_sampler_run_paths_from_file(&sampler, stdin, threads);
+  }
+  if (argument_exists(argc, argv, "-s")) {
+    page_sampler_print_stats(&sampler, stderr);
+  }
+  return atomic_load(&sampler.statusCounts[PAGE_SAMPLE_TAMPERED]) ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+ if (argument_exists(argc, argv, "-h")) {
+    print_usage(argv[0]);
+ }
+
+ if (argc > 1 && !strcmp(argv[1], "diff")) {
+    return run_diff(argc, argv);
+ }
+
+ if (argc > 1 && !strcmp(argv[1], "query")) {
+    return run_query(argc, argv);
+ }
+
+ if (argc > 1 && !strcmp(argv[1], "closure")) {
+    return run_closure(argc, argv);
+ }
+
+ if (argc > 1 && !strcmp(argv[1], "bundle")) {
+    return run_bundle(argc, argv);
+ }
+
+ if (argc > 1 && !strcmp(argv[1], "sweep")) {
+    return run_sweep(argc, argv);
  }
 
- char *preferredSlice = extract_preferred_slice(inputPath);
- if (!preferredSlice) {
-       printf("Error: failed to extract preferred slice!\n");
-       return -1;
+ if (argc > 1 && !strcmp(argv[1], "pack")) {
+    return run_pack(argc, argv);
  }
 
- MachO *macho = macho_init_for_writing(preferredSlice);
- if (!macho) {
-   free(preferredSlice);
-   return -1;
+ if (argc > 1 && !strcmp(argv[1], "replay")) {
+    return run_replay(argc, argv);
  }
 
- CS_SuperBlob *superblob = macho_read_code_signature(macho);
- if (!superblob) {
-     printf("Error: no code signature found, please fake-sign the binary at minimum before running the bypass.\n");
-     free(preferredSlice);
-     return -1;
+ if (argc > 1 && !strcmp(argv[1], "watch")) {
+    return run_watch(argc, argv);
  }
 
- CS_DecodedSuperBlob *decodedSuperblob = csd_superblob_decode(superblob);
- CS_DecodedBlob *signatureBlob = csd_superblob_find_blob(decodedSuperblob, CSSLOT_SIGNATURESLOT, NULL);
- if (!signatureBlob) {
-     printf("Error: no signature blob found!\n");
-     free(preferredSlice);
-     return -1;
+ if (argc > 1 && !strcmp(argv[1], "pages")) {
+    return run_pages(argc, argv);
  }
 
- size_t sigBlobLen = csd_blob_get_size(signatureBlob) - 8;
- uint8_t *sigBlob = malloc(sigBlobLen);
- csd_blob_read(signatureBlob, 8, sigBlobLen, sigBlob);
+ if (argument_exists(argc, argv, "-p")) {
+    return run_pipeline(argc, argv);
+ }
+
+ const char *inputPath = get_argument_value(argc, argv, "-i");
+ if (!inputPath) {
+    const char *inputCMS = get_argument_value(argc, argv, "-c");
+    const char *inputCD = get_argument_value(argc, argv, "-C");
+    if (!inputCMS || !inputCD) {
+      print_usage(argv[0]);
+    }
+    size_t cmsSize = 0, cdSize = 0;
+    uint8_t *cms = get_file_data(inputCMS, &cmsSize);
+    uint8_t *cd = get_file_data(inputCD, &cdSize);
+    if (!cms || !cd) {
+      free(cms);
+      free(cd);
+      return -1;
+    }
 
- CS_DecodedBlob *codeDirectory = csd_superblob_find_blob(decodedSuperblob, CSSLOT_CODEDIRECTORY, NULL);
- if (!codeDirectory) {
-     printf("Error: no code directory found!\n");
-     free(preferredSlice);
-     return -1;
+    VerifierResult result;
+    verifier_evaluate_blobs(cms, cmsSize, cd, cdSize, 0, &result);
+    print_verifier_result(&result);
+    free(cms);
+    free(cd);
+    return 0;
  }
 
- size_t codeDirectoryBlobLen = csd_blob_get_size(codeDirectory);
- uint8_t *codeDirectoryBlob = malloc(codeDirectoryBlobLen);
- csd_blob_read(codeDirectory, 0, codeDirectoryBlobLen, codeDirectoryBlob);
+ VerifierImage image;
+ VerifierError error = verifier_image_open_path(&image, inputPath);
+ if (error != VERIFIER_OK) {
+    printf("Error: failed to open %s (%s)!\n", inputPath, verifier_error_to_string(error));
+    return -1;
+ }
 
-evaluate_code_signature(sigBlob, sigBlobLen, codeDirectoryBlob, codeDirectoryBlobLen, decodedSuperblob);
+ VerifierResult result;
+ error = verifier_evaluate_slice(&image, verifier_image_find_preferred_slice(&image), 0, &result);
+ verifier_image_close(&image);
+ switch (error) {
+    case VERIFIER_ERROR_NO_SLICE:
+    case VERIFIER_ERROR_NOT_MACHO:
+      printf("Error: failed to extract preferred slice!\n");
+      return -1;
+    case VERIFIER_ERROR_UNSUPPORTED_FILETYPE:
+      printf("Error: MachO is an object file or dSYM, please use a MachO executable or dynamic library!\n");
+      return -1;
+    case VERIFIER_ERROR_NO_SIGNATURE:
+      printf("Error: no code signature found, please fake-sign the binary at minimum before running the bypass.\n");
+      return -1;
+    case VERIFIER_ERROR_NO_CMS:
+      printf("Error: no signature blob found!\n");
+      break;
+    case VERIFIER_ERROR_NO_CODE_DIRECTORY:
+      printf("Error: no code directory found!\n");
+      return -1;
+    default:
+      print_verifier_result(&result);
+      break;
+ }
 
- csd_superblob_free(decodedSuperblob);
- free(preferredSlice);
- free(sigBlob);
- free(codeDirectoryBlob);
+ TrustCacheSet *trustCaches = NULL;
+ if (load_trust_caches(argc, argv, &trustCaches) == 0 && trustCaches) {
+    print_trust_cache_membership(trustCaches, &result);
+    trust_cache_set_free(trustCaches);
+ }
+ if (error == VERIFIER_ERROR_NO_CMS) return -1;
 
   return 0;
 }
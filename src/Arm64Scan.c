@@ -0,0 +1,322 @@
+#include "Arm64Scan.h"
+
+#include <string.h>
+
+#include <choma/arm64.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// How far arm64_scan_section_find_function_start walks back, and how many instructions past an adrp are
+// searched for the add completing it
+#define ARM64_SCAN_FUNCTION_SEARCH 0x2000
+#define ARM64_SCAN_ADRP_LOOKAHEAD 8
+
+typedef struct Arm64Pattern {
+    uint32_t class;
+    uint32_t mask;
+    uint32_t value;
+} Arm64Pattern;
+
+static const Arm64Pattern gArm64Patterns[] = {
+    { ARM64_CLASS_B_L,      0x7c000000, 0x14000000 },
+    { ARM64_CLASS_B_COND,   0xff000000, 0x54000000 },
+    { ARM64_CLASS_CB_N_Z,   0x7e000000, 0x34000000 },
+    { ARM64_CLASS_TB_N_Z,   0x7e000000, 0x36000000 },
+    { ARM64_CLASS_ADR_P,    0x1f000000, 0x10000000 },
+    { ARM64_CLASS_ADD_IMM,  0x7f800000, 0x11000000 },
+    { ARM64_CLASS_MOV_IMM,  0x1f800000, 0x12800000 },
+    { ARM64_CLASS_LDR_LIT,  0x3b000000, 0x18000000 },
+    { ARM64_CLASS_PROLOGUE, 0xffffffff, 0xd503237f }, // pacibsp
+    { ARM64_CLASS_PROLOGUE, 0xffc003e0, 0xa98003e0 }, // stp xN, xM, [sp, #imm]!
+    { ARM64_CLASS_PROLOGUE, 0xffc07fff, 0xa9007bfd }, // stp x29, x30, [sp, #imm]
+    { ARM64_CLASS_PROLOGUE, 0xff8003ff, 0xd10003ff }, // sub sp, sp, #imm
+    { ARM64_CLASS_RET,      0xfffffc1f, 0xd65f0000 }, // ret
+    { ARM64_CLASS_RET,      0xfffffbff, 0xd65f0bff }, // retaa, retab
+};
+
+#define ARM64_PATTERN_COUNT (sizeof(gArm64Patterns) / sizeof(gArm64Patterns[0]))
+
+// Lanes of insts[0, 16) matching (inst & mask) == value for any of the patterns
+static uint32_t arm64_scan_match_batch(const uint32_t *insts, const Arm64Pattern *patterns, size_t patternCount)
+{
+    uint32_t lanes = 0;
+#if defined(__x86_64__)
+    __m128i v[4];
+    for (int j = 0; j < 4; j++) {
+        v[j] = _mm_loadu_si128((const __m128i *)(insts + j * 4));
+    }
+    for (size_t p = 0; p < patternCount; p++) {
+        __m128i mask = _mm_set1_epi32((int)patterns[p].mask);
+        __m128i value = _mm_set1_epi32((int)patterns[p].value);
+        for (int j = 0; j < 4; j++) {
+            __m128i match = _mm_cmpeq_epi32(_mm_and_si128(v[j], mask), value);
+            lanes |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(match)) << (j * 4);
+        }
+    }
+#elif defined(__aarch64__)
+    static const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+    uint32x4_t bits = vld1q_u32(laneBits);
+    uint32x4_t v[4];
+    for (int j = 0; j < 4; j++) {
+        v[j] = vld1q_u32(insts + j * 4);
+    }
+    for (size_t p = 0; p < patternCount; p++) {
+        uint32x4_t mask = vdupq_n_u32(patterns[p].mask);
+        uint32x4_t value = vdupq_n_u32(patterns[p].value);
+        for (int j = 0; j < 4; j++) {
+            uint32x4_t match = vceqq_u32(vandq_u32(v[j], mask), value);
+            lanes |= vaddvq_u32(vandq_u32(match, bits)) << (j * 4);
+        }
+    }
+#else
+    for (size_t p = 0; p < patternCount; p++) {
+        for (int i = 0; i < ARM64_SCAN_BATCH; i++) {
+            if ((insts[i] & patterns[p].mask) == patterns[p].value) lanes |= 1u << i;
+        }
+    }
+#endif
+    return lanes;
+}
+
+static uint64_t arm64_scan_match(const uint32_t *insts, size_t count, const Arm64Pattern *patterns, size_t patternCount)
+{
+    uint64_t lanes = 0;
+    size_t i = 0;
+    for (; i + ARM64_SCAN_BATCH <= count; i += ARM64_SCAN_BATCH) {
+        lanes |= (uint64_t)arm64_scan_match_batch(insts + i, patterns, patternCount) << i;
+    }
+    if (i < count) {
+        // Pad the tail with an instruction matching no pattern (udf #0 is all zeroes, and no pattern matches 0)
+        uint32_t tail[ARM64_SCAN_BATCH] = { 0 };
+        memcpy(tail, insts + i, (count - i) * sizeof(uint32_t));
+        lanes |= (uint64_t)arm64_scan_match_batch(tail, patterns, patternCount) << i;
+    }
+    return lanes;
+}
+
+uint64_t arm64_scan_classify(const uint32_t *insts, size_t count, uint32_t classes)
+{
+    Arm64Pattern patterns[ARM64_PATTERN_COUNT];
+    size_t patternCount = 0;
+    for (size_t p = 0; p < ARM64_PATTERN_COUNT; p++) {
+        if (gArm64Patterns[p].class & classes) patterns[patternCount++] = gArm64Patterns[p];
+    }
+    if (!patternCount || !count) return 0;
+    return arm64_scan_match(insts, count > 64 ? 64 : count, patterns, patternCount);
+}
+
+uint32_t arm64_scan_get_class(uint32_t inst)
+{
+    for (size_t p = 0; p < ARM64_PATTERN_COUNT; p++) {
+        if ((inst & gArm64Patterns[p].mask) == gArm64Patterns[p].value) return gArm64Patterns[p].class;
+    }
+    return 0;
+}
+
+ssize_t arm64_scan_find_next(const uint32_t *insts, size_t count, uint32_t value, uint32_t mask)
+{
+    Arm64Pattern pattern = { 0, mask, value & mask };
+    for (size_t i = 0; i < count; i += 64) {
+        size_t batch = count - i < 64 ? count - i : 64;
+        if (pattern.value == 0) {
+            // Tail padding would match, check lanes one by one
+            for (size_t j = 0; j < batch; j++) {
+                if ((insts[i + j] & mask) == pattern.value) return i + j;
+            }
+            continue;
+        }
+        uint64_t lanes = arm64_scan_match(insts + i, batch, &pattern, 1);
+        if (lanes) return i + __builtin_ctzll(lanes);
+    }
+    return -1;
+}
+
+ssize_t arm64_scan_find_prev(const uint32_t *insts, size_t count, uint32_t value, uint32_t mask)
+{
+    Arm64Pattern pattern = { 0, mask, value & mask };
+    size_t end = count;
+    while (end) {
+        size_t batch = end < 64 ? end : 64;
+        size_t start = end - batch;
+        if (pattern.value == 0) {
+            for (size_t j = batch; j > 0; j--) {
+                if ((insts[start + j - 1] & mask) == pattern.value) return start + j - 1;
+            }
+        }
+        else {
+            uint64_t lanes = arm64_scan_match(insts + start, batch, &pattern, 1);
+            if (lanes) return start + 63 - __builtin_clzll(lanes);
+        }
+        end = start;
+    }
+    return -1;
+}
+
+// Instructions [index, index + count) of the section, straight from the mapping if there is one
+static const uint32_t *arm64_scan_load(SectionCache *cache, uint64_t index, size_t count, uint32_t *buffer)
+{
+    if (cache->direct) return (const uint32_t *)(cache->direct + index * sizeof(uint32_t));
+    if (section_cache_read_at_address(cache, cache->vmaddr + index * sizeof(uint32_t), buffer, count * sizeof(uint32_t)) != 0) return NULL;
+    return buffer;
+}
+
+static bool arm64_scan_get_index(SectionCache *cache, uint64_t vmaddr, uint64_t *indexOut)
+{
+    if (vmaddr < cache->vmaddr || (vmaddr - cache->vmaddr) % sizeof(uint32_t)) return false;
+    uint64_t index = (vmaddr - cache->vmaddr) / sizeof(uint32_t);
+    if (index >= cache->size / sizeof(uint32_t)) return false;
+    *indexOut = index;
+    return true;
+}
+
+uint64_t arm64_scan_section_find_next_inst(SectionCache *cache, uint64_t startAddr, uint32_t searchCount, uint32_t value, uint32_t mask)
+{
+    uint64_t index;
+    if (!arm64_scan_get_index(cache, startAddr, &index)) return 0;
+    uint64_t end = cache->size / sizeof(uint32_t);
+    if (searchCount && searchCount < end - index) end = index + searchCount;
+
+    uint32_t buffer[ARM64_SCAN_CHUNK];
+    while (index < end) {
+        size_t count = end - index < ARM64_SCAN_CHUNK ? end - index : ARM64_SCAN_CHUNK;
+        const uint32_t *insts = arm64_scan_load(cache, index, count, buffer);
+        if (!insts) return 0;
+        ssize_t found = arm64_scan_find_next(insts, count, value, mask);
+        if (found >= 0) return cache->vmaddr + (index + found) * sizeof(uint32_t);
+        index += count;
+    }
+    return 0;
+}
+
+uint64_t arm64_scan_section_find_prev_inst(SectionCache *cache, uint64_t startAddr, uint32_t searchCount, uint32_t value, uint32_t mask)
+{
+    uint64_t index;
+    if (!arm64_scan_get_index(cache, startAddr, &index)) return 0;
+    uint64_t end = index + 1;
+    uint64_t start = searchCount && searchCount < end ? end - searchCount : 0;
+
+    uint32_t buffer[ARM64_SCAN_CHUNK];
+    while (end > start) {
+        size_t count = end - start < ARM64_SCAN_CHUNK ? end - start : ARM64_SCAN_CHUNK;
+        const uint32_t *insts = arm64_scan_load(cache, end - count, count, buffer);
+        if (!insts) return 0;
+        ssize_t found = arm64_scan_find_prev(insts, count, value, mask);
+        if (found >= 0) return cache->vmaddr + (end - count + found) * sizeof(uint32_t);
+        end -= count;
+    }
+    return 0;
+}
+
+// The closest prologue instruction before midAddr, then back over the rest of the prologue
+// (pacibsp; sub sp, sp, #imm; stp ..., [sp, #imm]!; stp x29, x30, [sp, #imm] in any combination)
+uint64_t arm64_scan_section_find_function_start(SectionCache *cache, uint64_t midAddr)
+{
+    uint64_t index;
+    if (!arm64_scan_get_index(cache, midAddr, &index)) return 0;
+    uint64_t end = index + 1;
+    uint64_t limit = end > ARM64_SCAN_FUNCTION_SEARCH ? end - ARM64_SCAN_FUNCTION_SEARCH : 0;
+
+    uint32_t buffer[64];
+    while (end > limit) {
+        size_t count = end - limit < 64 ? end - limit : 64;
+        const uint32_t *insts = arm64_scan_load(cache, end - count, count, buffer);
+        if (!insts) return 0;
+        uint64_t lanes = arm64_scan_classify(insts, count, ARM64_CLASS_PROLOGUE);
+        if (lanes) {
+            uint64_t start = end - count + 63 - __builtin_clzll(lanes);
+            while (start > 0) {
+                uint32_t previous = section_cache_read32(cache, cache->vmaddr + (start - 1) * sizeof(uint32_t));
+                if (arm64_scan_get_class(previous) != ARM64_CLASS_PROLOGUE) break;
+                start--;
+            }
+            return cache->vmaddr + start * sizeof(uint32_t);
+        }
+        end -= count;
+    }
+    return 0;
+}
+
+// Full decode of a candidate lane, true if it references target
+static bool arm64_scan_references(SectionCache *cache, uint32_t inst, uint64_t vmaddr, uint64_t target, uint32_t class)
+{
+    uint64_t resolved = 0;
+    arm64_register reg;
+    switch (class) {
+        case ARM64_CLASS_B_L: {
+            bool isBl;
+            return arm64_dec_b_l(inst, vmaddr, &resolved, &isBl) == 0 && resolved == target;
+        }
+        case ARM64_CLASS_B_COND: {
+            arm64_cond cond;
+            bool isBc;
+            return arm64_dec_b_c_cond(inst, vmaddr, &resolved, &cond, &isBc) == 0 && resolved == target;
+        }
+        case ARM64_CLASS_CB_N_Z: {
+            bool isCbnz;
+            return arm64_dec_cb_n_z(inst, vmaddr, &isCbnz, &reg, &resolved) == 0 && resolved == target;
+        }
+        case ARM64_CLASS_TB_N_Z: {
+            bool isTbnz;
+            uint64_t bit;
+            return arm64_dec_tb_n_z(inst, vmaddr, &isTbnz, &reg, &resolved, &bit) == 0 && resolved == target;
+        }
+        case ARM64_CLASS_LDR_LIT:
+            return arm64_dec_ldr_lit(inst, vmaddr, &resolved, &reg) == 0 && resolved == target;
+        case ARM64_CLASS_ADR_P: {
+            bool isAdrp;
+            if (arm64_dec_adr_p(inst, vmaddr, &resolved, &reg, &isAdrp) != 0) return false;
+            if (!isAdrp) return resolved == target;
+            if (resolved != (target & ~0xfffULL)) return false;
+            // adrp only gets the page, the add after it completes the address
+            for (int i = 1; i <= ARM64_SCAN_ADRP_LOOKAHEAD; i++) {
+                uint64_t next = vmaddr + i * sizeof(uint32_t);
+                if (next - cache->vmaddr >= cache->size) break;
+                uint32_t addInst = section_cache_read32(cache, next);
+                if (arm64_scan_get_class(addInst) != ARM64_CLASS_ADD_IMM) continue;
+                arm64_register destination, source;
+                uint16_t imm;
+                if (arm64_dec_add_imm(addInst, &destination, &source, &imm) != 0) continue;
+                if (ARM64_REG_GET_NUM(source) != ARM64_REG_GET_NUM(reg)) continue;
+                return resolved + imm == target;
+            }
+            return false;
+        }
+        default:
+            return false;
+    }
+}
+
+size_t arm64_scan_section_find_xrefs(SectionCache *cache, uint64_t startAddr, uint64_t endAddr, uint64_t target, uint32_t classes, uint64_t *xrefsOut, size_t maxXrefs)
+{
+    uint64_t index;
+    if (!arm64_scan_get_index(cache, startAddr, &index)) return 0;
+    uint64_t end = cache->size / sizeof(uint32_t);
+    if (endAddr > startAddr && (endAddr - cache->vmaddr) / sizeof(uint32_t) < end) end = (endAddr - cache->vmaddr) / sizeof(uint32_t);
+    classes &= ARM64_CLASS_XREFS;
+
+    size_t found = 0;
+    uint32_t buffer[ARM64_SCAN_CHUNK];
+    while (index < end) {
+        size_t count = end - index < ARM64_SCAN_CHUNK ? end - index : ARM64_SCAN_CHUNK;
+        const uint32_t *insts = arm64_scan_load(cache, index, count, buffer);
+        if (!insts) break;
+        for (size_t i = 0; i < count; i += 64) {
+            size_t batch = count - i < 64 ? count - i : 64;
+            uint64_t lanes = arm64_scan_classify(insts + i, batch, classes);
+            while (lanes) {
+                size_t lane = i + __builtin_ctzll(lanes);
+                lanes &= lanes - 1;
+                uint64_t vmaddr = cache->vmaddr + (index + lane) * sizeof(uint32_t);
+                if (!arm64_scan_references(cache, insts[lane], vmaddr, target, arm64_scan_get_class(insts[lane]))) continue;
+                if (found < maxXrefs) xrefsOut[found] = vmaddr;
+                found++;
+            }
+        }
+        index += count;
+    }
+    return found;
+}
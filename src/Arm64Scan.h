@@ -0,0 +1,57 @@
+#ifndef ARM64_SCAN_H
+#define ARM64_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "SectionCache.h"
+
+// Batched arm64 instruction scanning
+// Instructions are classified 16 at a time by masking and comparing their opcode fields in vector registers
+// (SSE2 on x86_64, NEON on arm64, plain C elsewhere). Only the lanes that match a class reach ChOma's full
+// arm64_dec_* decoders, so linear scans over a text section mostly run at memory speed
+
+#define ARM64_SCAN_BATCH 16
+#define ARM64_SCAN_CHUNK 1024 // instructions read from the section at a time
+
+typedef enum {
+    ARM64_CLASS_B_L      = 1 << 0,  // b, bl
+    ARM64_CLASS_B_COND   = 1 << 1,  // b.cond, bc.cond
+    ARM64_CLASS_CB_N_Z   = 1 << 2,  // cbz, cbnz
+    ARM64_CLASS_TB_N_Z   = 1 << 3,  // tbz, tbnz
+    ARM64_CLASS_ADR_P    = 1 << 4,  // adr, adrp
+    ARM64_CLASS_ADD_IMM  = 1 << 5,  // add (immediate), 32 and 64-bit
+    ARM64_CLASS_MOV_IMM  = 1 << 6,  // movz, movn, movk
+    ARM64_CLASS_LDR_LIT  = 1 << 7,  // ldr (literal)
+    ARM64_CLASS_PROLOGUE = 1 << 8,  // pacibsp, stp x29, x30, [sp, ...], sub sp, sp, #imm
+    ARM64_CLASS_RET      = 1 << 9,  // ret, retaa, retab
+    ARM64_CLASS_COUNT_   = 10,
+} Arm64InstClass;
+
+#define ARM64_CLASS_BRANCHES (ARM64_CLASS_B_L | ARM64_CLASS_B_COND | ARM64_CLASS_CB_N_Z | ARM64_CLASS_TB_N_Z)
+#define ARM64_CLASS_XREFS (ARM64_CLASS_BRANCHES | ARM64_CLASS_ADR_P | ARM64_CLASS_LDR_LIT)
+
+// Bitmask of the lanes of insts[0, count) (count <= 64) whose instruction is in any of classes
+uint64_t arm64_scan_classify(const uint32_t *insts, size_t count, uint32_t classes);
+
+// Class of a single instruction, 0 if it is in none
+uint32_t arm64_scan_get_class(uint32_t inst);
+
+// Index of the first / last instruction with (inst & mask) == value, -1 if there is none
+ssize_t arm64_scan_find_next(const uint32_t *insts, size_t count, uint32_t value, uint32_t mask);
+ssize_t arm64_scan_find_prev(const uint32_t *insts, size_t count, uint32_t value, uint32_t mask);
+
+// Section level scans, same contract as pfsec_find_next_inst / pfsec_find_prev_inst / pfsec_find_function_start:
+// startAddr is included, searchCount 0 searches up to the section boundary, 0 if nothing was found
+uint64_t arm64_scan_section_find_next_inst(SectionCache *cache, uint64_t startAddr, uint32_t searchCount, uint32_t value, uint32_t mask);
+uint64_t arm64_scan_section_find_prev_inst(SectionCache *cache, uint64_t startAddr, uint32_t searchCount, uint32_t value, uint32_t mask);
+uint64_t arm64_scan_section_find_function_start(SectionCache *cache, uint64_t midAddr);
+
+// Addresses in [startAddr, endAddr) (endAddr 0 for the section end) referencing target through any of classes
+// (ARM64_CLASS_XREFS), adrp is matched together with the add that completes it
+// Returns the total count, at most maxXrefs are stored
+size_t arm64_scan_section_find_xrefs(SectionCache *cache, uint64_t startAddr, uint64_t endAddr, uint64_t target, uint32_t classes, uint64_t *xrefsOut, size_t maxXrefs);
+
+#endif // ARM64_SCAN_H
@@ -0,0 +1,273 @@
+#include "Audit.h"
+
+#include <string.h>
+
+#include <choma/MachOByteOrder.h>
+
+#include "CodeHash.h"
+#include "Der.h"
+#include "Plist.h"
+
+static const uint32_t gAuditBlobSlots[AUDIT_BLOB_COUNT] = {
+    [AUDIT_BLOB_ENTITLEMENTS] = CSSLOT_ENTITLEMENTS,
+    [AUDIT_BLOB_DER_ENTITLEMENTS] = CSSLOT_DER_ENTITLEMENTS,
+    [AUDIT_BLOB_REQUIREMENTS] = CSSLOT_REQUIREMENTS,
+    [AUDIT_BLOB_LAUNCH_CONSTRAINT_SELF] = CSSLOT_LAUNCH_CONSTRAINT_SELF,
+    [AUDIT_BLOB_LAUNCH_CONSTRAINT_PARENT] = CSSLOT_LAUNCH_CONSTRAINT_PARENT,
+    [AUDIT_BLOB_LAUNCH_CONSTRAINT_RESPONSIBLE] = CSSLOT_LAUNCH_CONSTRAINT_RESPONSIBLE,
+    [AUDIT_BLOB_LIBRARY_CONSTRAINT] = CSSLOT_LIBRARY_CONSTRAINT,
+};
+
+const char *audit_blob_kind_to_string(AuditBlobKind kind)
+{
+    switch (kind) {
+        case AUDIT_BLOB_ENTITLEMENTS:
+            return "ents";
+        case AUDIT_BLOB_DER_ENTITLEMENTS:
+            return "der-ents";
+        case AUDIT_BLOB_REQUIREMENTS:
+            return "reqs";
+        case AUDIT_BLOB_LAUNCH_CONSTRAINT_SELF:
+            return "lc-self";
+        case AUDIT_BLOB_LAUNCH_CONSTRAINT_PARENT:
+            return "lc-parent";
+        case AUDIT_BLOB_LAUNCH_CONSTRAINT_RESPONSIBLE:
+            return "lc-responsible";
+        case AUDIT_BLOB_LIBRARY_CONSTRAINT:
+            return "lib-constraint";
+        default:
+            return "unknown";
+    }
+}
+
+const char *audit_slot_state_to_string(AuditSlotState state)
+{
+    switch (state) {
+        case AUDIT_SLOT_UNBOUND:
+            return "unbound";
+        case AUDIT_SLOT_OK:
+            return "ok";
+        case AUDIT_SLOT_MISMATCH:
+            return "mismatch";
+        case AUDIT_SLOT_MISSING:
+            return "missing";
+        default:
+            return "unknown";
+    }
+}
+
+static bool audit_is_code_directory(uint32_t type)
+{
+    return type == CSSLOT_CODEDIRECTORY || (type >= CSSLOT_ALTERNATE_CODEDIRECTORIES && type < CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT);
+}
+
+// Requirements are a superblob of their own, only the requirement types are decoded
+static void audit_decode_requirements(AuditRecord *record, const uint8_t *blob, size_t size)
+{
+    if (size < sizeof(CS_SuperBlob)) return;
+    CS_SuperBlob header = *(const CS_SuperBlob *)blob;
+    SUPERBLOB_APPLY_BYTE_ORDER(&header, BIG_TO_HOST_APPLIER);
+    if (header.magic != CSMAGIC_REQUIREMENTS) return;
+    if (header.count > (size - sizeof(CS_SuperBlob)) / sizeof(CS_BlobIndex)) return;
+
+    record->requirementCount = header.count;
+    for (uint32_t i = 0; i < header.count; i++) {
+        CS_BlobIndex index = ((const CS_SuperBlob *)blob)->index[i];
+        BLOB_INDEX_APPLY_BYTE_ORDER(&index, BIG_TO_HOST_APPLIER);
+        if (index.type < 32 && index.offset < size) {
+            record->requirementTypes |= 1u << index.type;
+        }
+    }
+}
+
+AuditRecord *audit_record_create(CS_DecodedSuperBlob *superblob)
+{
+    AuditRecord *record = calloc(1, sizeof(AuditRecord));
+    if (!record) return NULL;
+
+    for (int kind = 0; kind < AUDIT_BLOB_COUNT; kind++) {
+        uint32_t slot = gAuditBlobSlots[kind];
+        AuditBlob *auditBlob = &record->blobs[kind];
+        CS_DecodedBlob *blob = csd_superblob_find_blob(superblob, slot, NULL);
+
+        // The special slot hash covers the whole blob, header included
+        size_t size = 0;
+        bool mustFree = false;
+        uint8_t *data = blob ? code_hash_copy_blob_data(blob, &size, &mustFree) : NULL;
+
+        bool bound = false, mismatch = false;
+        for (CS_DecodedBlob *codeDir = superblob->firstBlob; codeDir; codeDir = codeDir->next) {
+            if (!audit_is_code_directory(csd_blob_get_type(codeDir))) continue;
+            if (!data) {
+                bound = bound || code_directory_has_special_slot(codeDir, slot);
+                continue;
+            }
+            int match = code_directory_verify_special_slot(codeDir, slot, data, size);
+            if (match < 0) continue;
+            bound = true;
+            if (match == 0) mismatch = true;
+        }
+
+        if (!data) {
+            if (bound) {
+                auditBlob->state = AUDIT_SLOT_MISSING;
+            }
+            continue;
+        }
+
+        auditBlob->present = true;
+        auditBlob->state = mismatch ? AUDIT_SLOT_MISMATCH : (bound ? AUDIT_SLOT_OK : AUDIT_SLOT_UNBOUND);
+        if (kind == AUDIT_BLOB_REQUIREMENTS) {
+            audit_decode_requirements(record, data, size);
+        }
+        if (size > sizeof(CS_GenericBlob)) {
+            auditBlob->size = size - sizeof(CS_GenericBlob);
+            auditBlob->data = malloc(auditBlob->size);
+            if (auditBlob->data) {
+                memcpy(auditBlob->data, data + sizeof(CS_GenericBlob), auditBlob->size);
+            }
+            else {
+                auditBlob->size = 0;
+            }
+        }
+        if (mustFree) free(data);
+    }
+    return record;
+}
+
+static void audit_print_base64(const uint8_t *data, size_t size, FILE *output)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char chunk[4];
+    size_t i = 0;
+    for (; i + 3 <= size; i += 3) {
+        uint32_t v = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+        chunk[0] = alphabet[(v >> 18) & 0x3f];
+        chunk[1] = alphabet[(v >> 12) & 0x3f];
+        chunk[2] = alphabet[(v >> 6) & 0x3f];
+        chunk[3] = alphabet[v & 0x3f];
+        fwrite(chunk, 1, 4, output);
+    }
+    if (i < size) {
+        uint32_t v = (uint32_t)data[i] << 16;
+        if (i + 1 < size) v |= (uint32_t)data[i + 1] << 8;
+        chunk[0] = alphabet[(v >> 18) & 0x3f];
+        chunk[1] = alphabet[(v >> 12) & 0x3f];
+        chunk[2] = i + 1 < size ? alphabet[(v >> 6) & 0x3f] : '=';
+        chunk[3] = '=';
+        fwrite(chunk, 1, 4, output);
+    }
+}
+
+static void audit_print_requirement_types(uint32_t types, FILE *output)
+{
+    static const struct { uint32_t bit; const char *name; } names[] = {
+        { AUDIT_REQUIREMENT_HOST, "host" },
+        { AUDIT_REQUIREMENT_GUEST, "guest" },
+        { AUDIT_REQUIREMENT_DESIGNATED, "designated" },
+        { AUDIT_REQUIREMENT_LIBRARY, "library" },
+        { AUDIT_REQUIREMENT_PLUGIN, "plugin" },
+    };
+    bool first = true;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (!(types & names[i].bit)) continue;
+        fprintf(output, "%s%s", first ? "" : ",", names[i].name);
+        first = false;
+    }
+    if (first) fprintf(output, "none");
+}
+
+// Keys go into a comma separated list inside a tab separated record, bytes that would break either become '?'
+static void audit_print_key(const uint8_t *key, size_t size, bool first, FILE *output)
+{
+    if (!first) fputc(',', output);
+    for (size_t i = 0; i < size; i++) {
+        fputc(key[i] < 0x20 || key[i] == 0x7f || key[i] == ',' ? '?' : key[i], output);
+    }
+}
+
+// CoreEntitlements DER, used by DER entitlements and by launch / library constraints:
+// [APPLICATION 16] { INTEGER version, [CONTEXT 16] { SEQUENCE { UTF8String key, value }... } }
+// Prints the top-level keys if output is set, returns -1 if the blob is not in that form
+static int audit_walk_der_keys(const uint8_t *data, size_t size, FILE *output)
+{
+    DerItem outer, dict, item;
+    DerReader reader;
+    if (der_read_item(data, size, &outer) != 0 || !der_item_is(&outer, DER_CLASS_APPLICATION, true, 16)) return -1;
+    if (der_reader_init_children(&reader, &outer) != 0) return -1;
+    if (der_reader_expect(&reader, DER_CLASS_UNIVERSAL, false, DER_TAG_INTEGER, &item) != 0) return -1;
+    if (der_reader_expect(&reader, DER_CLASS_CONTEXT, true, 16, &dict) != 0) return -1;
+    if (der_reader_init_children(&reader, &dict) != 0) return -1;
+
+    bool first = true;
+    int r = 0;
+    while ((r = der_reader_next(&reader, &item)) == 1) {
+        DerReader pair;
+        DerItem key;
+        if (!der_item_is(&item, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE) || der_reader_init_children(&pair, &item) != 0) return -1;
+        if (der_reader_expect(&pair, DER_CLASS_UNIVERSAL, false, DER_TAG_UTF8_STRING, &key) != 0) return -1;
+        if (output) audit_print_key(key.content, key.contentSize, first, output);
+        first = false;
+    }
+    if (r < 0) return -1;
+    if (output && first) fprintf(output, "none");
+    return 0;
+}
+
+// XML entitlements are a plist dict
+static int audit_print_xml_keys(const uint8_t *data, size_t size, FILE *output)
+{
+    PlistNode *root = plist_parse_xml((const char *)data, size);
+    if (!root || root->type != PLIST_DICT) {
+        plist_free(root);
+        return -1;
+    }
+    for (size_t i = 0; i < root->childCount; i++) {
+        const char *key = root->children[i]->key;
+        audit_print_key((const uint8_t *)key, strlen(key), i == 0, output);
+    }
+    if (!root->childCount) fprintf(output, "none");
+    plist_free(root);
+    return 0;
+}
+
+// Entitlements and constraints are listed by their top-level keys, blobs that do not decode are printed as base64
+static void audit_print_blob_value(AuditBlobKind kind, const AuditBlob *blob, FILE *output)
+{
+    if (kind == AUDIT_BLOB_ENTITLEMENTS) {
+        if (audit_print_xml_keys(blob->data, blob->size, output) == 0) return;
+    }
+    else if (audit_walk_der_keys(blob->data, blob->size, NULL) == 0) {
+        audit_walk_der_keys(blob->data, blob->size, output);
+        return;
+    }
+    fprintf(output, "base64=");
+    audit_print_base64(blob->data, blob->size, output);
+}
+
+void audit_record_print(AuditRecord *record, FILE *output)
+{
+    for (int kind = 0; kind < AUDIT_BLOB_COUNT; kind++) {
+        AuditBlob *blob = &record->blobs[kind];
+        if (!blob->present && blob->state != AUDIT_SLOT_MISSING) continue;
+
+        fprintf(output, "\t%s=%s", audit_blob_kind_to_string(kind), audit_slot_state_to_string(blob->state));
+        if (!blob->present) continue;
+        fputc(':', output);
+        if (kind == AUDIT_BLOB_REQUIREMENTS) {
+            audit_print_requirement_types(record->requirementTypes, output);
+        }
+        else {
+            audit_print_blob_value(kind, blob, output);
+        }
+    }
+}
+
+void audit_record_free(AuditRecord *record)
+{
+    if (!record) return;
+    for (int kind = 0; kind < AUDIT_BLOB_COUNT; kind++) {
+        free(record->blobs[kind].data);
+    }
+    free(record);
+}
@@ -0,0 +1,63 @@
+#ifndef AUDIT_H
+#define AUDIT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <choma/CSBlob.h>
+
+// Signature audit: pulls the entitlements, requirements and launch constraints out of an already decoded superblob
+// and checks each against the special slot hashes of every code directory
+
+typedef enum {
+    AUDIT_SLOT_UNBOUND,  // blob present, no code directory binds a hash for it
+    AUDIT_SLOT_OK,       // every code directory that binds the slot matches
+    AUDIT_SLOT_MISMATCH, // at least one code directory disagrees
+    AUDIT_SLOT_MISSING,  // a code directory binds the slot, the blob is not there
+} AuditSlotState;
+
+typedef enum {
+    AUDIT_BLOB_ENTITLEMENTS = 0,
+    AUDIT_BLOB_DER_ENTITLEMENTS,
+    AUDIT_BLOB_REQUIREMENTS,
+    AUDIT_BLOB_LAUNCH_CONSTRAINT_SELF,
+    AUDIT_BLOB_LAUNCH_CONSTRAINT_PARENT,
+    AUDIT_BLOB_LAUNCH_CONSTRAINT_RESPONSIBLE,
+    AUDIT_BLOB_LIBRARY_CONSTRAINT,
+    AUDIT_BLOB_COUNT,
+} AuditBlobKind;
+
+// Requirement types inside the requirements blob
+#define AUDIT_REQUIREMENT_HOST (1 << 1)
+#define AUDIT_REQUIREMENT_GUEST (1 << 2)
+#define AUDIT_REQUIREMENT_DESIGNATED (1 << 3)
+#define AUDIT_REQUIREMENT_LIBRARY (1 << 4)
+#define AUDIT_REQUIREMENT_PLUGIN (1 << 5)
+
+typedef struct AuditBlob {
+    bool present;
+    AuditSlotState state;
+    uint8_t *data; // blob payload without the 8 byte magic / length header
+    size_t size;
+} AuditBlob;
+
+typedef struct AuditRecord {
+    AuditBlob blobs[AUDIT_BLOB_COUNT];
+    uint32_t requirementTypes; // AUDIT_REQUIREMENT_* bits
+    uint32_t requirementCount;
+} AuditRecord;
+
+const char *audit_blob_kind_to_string(AuditBlobKind kind);
+const char *audit_slot_state_to_string(AuditSlotState state);
+
+// Returns NULL only if allocation fails, a signature without any of the blobs yields an empty record
+AuditRecord *audit_record_create(CS_DecodedSuperBlob *superblob);
+
+// Appends tab separated key=state[:value] fields, requirements are listed by type, entitlements and constraints by
+// their top-level keys (base64=<payload> if they do not decode)
+void audit_record_print(AuditRecord *record, FILE *output);
+
+void audit_record_free(AuditRecord *record);
+
+#endif // AUDIT_H
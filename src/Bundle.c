@@ -0,0 +1,795 @@
+#include "Bundle.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Clock.h"
+#include "CodeHash.h"
+#include "Plist.h"
+#include "Scan.h"
+
+const char *bundle_result_kind_to_string(BundleResultKind kind)
+{
+    switch (kind) {
+        case BUNDLE_RESULT_MODIFIED:
+            return "modified";
+        case BUNDLE_RESULT_MISSING:
+            return "missing";
+        case BUNDLE_RESULT_EXTRA:
+            return "extra";
+        case BUNDLE_RESULT_NESTED_MISMATCH:
+            return "nested-mismatch";
+        case BUNDLE_RESULT_UNREADABLE:
+            return "unreadable";
+        default:
+            return "unknown";
+    }
+}
+
+static char *bundle_join_path(const char *directory, const char *name)
+{
+    if (!*directory) return strdup(name);
+    size_t directoryLength = strlen(directory);
+    size_t nameLength = strlen(name);
+    char *path = malloc(directoryLength + nameLength + 2);
+    if (!path) return NULL;
+    memcpy(path, directory, directoryLength);
+    path[directoryLength] = '/';
+    memcpy(path + directoryLength + 1, name, nameLength + 1);
+    return path;
+}
+
+static bool bundle_is_directory(const char *path)
+{
+    struct stat s;
+    return path && stat(path, &s) == 0 && S_ISDIR(s.st_mode);
+}
+
+static bool bundle_is_file(const char *path)
+{
+    struct stat s;
+    return path && stat(path, &s) == 0 && S_ISREG(s.st_mode);
+}
+
+// Small files only (plists), NULL if the file does not exist
+static uint8_t *bundle_read_file(const char *path, size_t *sizeOut)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat s;
+    if (fstat(fd, &s) != 0 || !S_ISREG(s.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    uint8_t *data = malloc(s.st_size ? s.st_size : 1);
+    size_t size = 0;
+    while (data && size < (size_t)s.st_size) {
+        ssize_t r = read(fd, data + size, s.st_size - size);
+        if (r <= 0) {
+            free(data);
+            data = NULL;
+            break;
+        }
+        size += r;
+    }
+    close(fd);
+    *sizeOut = size;
+    return data;
+}
+
+static int bundle_hash_file(Bundle *bundle, const char *path, HashAlgorithm algorithm, uint8_t *digestOut)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat s;
+    if (fstat(fd, &s) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (s.st_size == 0) {
+        close(fd);
+        hash_digest(algorithm, "", 0, digestOut);
+        atomic_fetch_add_explicit(&bundle->filesHashed, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    uint8_t *mapping = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return -1;
+    madvise(mapping, s.st_size, MADV_SEQUENTIAL);
+    hash_digest(algorithm, mapping, s.st_size, digestOut);
+    munmap(mapping, s.st_size);
+
+    atomic_fetch_add_explicit(&bundle->filesHashed, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bundle->bytesHashed, s.st_size, memory_order_relaxed);
+    return 0;
+}
+
+// Same rules as the audit: every code directory that binds the slot has to match
+static AuditSlotState bundle_verify_slot(CS_DecodedSuperBlob *superblob, uint32_t slot, const uint8_t *data, size_t size)
+{
+    bool bound = false, mismatch = false;
+    for (CS_DecodedBlob *codeDir = superblob->firstBlob; codeDir; codeDir = codeDir->next) {
+        uint32_t type = csd_blob_get_type(codeDir);
+        if (type != CSSLOT_CODEDIRECTORY && !(type >= CSSLOT_ALTERNATE_CODEDIRECTORIES && type < CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT)) continue;
+        if (!data) {
+            bound = bound || code_directory_has_special_slot(codeDir, slot);
+            continue;
+        }
+        int match = code_directory_verify_special_slot(codeDir, slot, data, size);
+        if (match < 0) continue;
+        bound = true;
+        if (match == 0) mismatch = true;
+    }
+    if (!data) return bound ? AUDIT_SLOT_MISSING : AUDIT_SLOT_UNBOUND;
+    return mismatch ? AUDIT_SLOT_MISMATCH : (bound ? AUDIT_SLOT_OK : AUDIT_SLOT_UNBOUND);
+}
+
+// Nested code is sealed by its cdhash, ad-hoc signed code included
+static bool bundle_calculate_cdhash(const char *path, uint8_t *cdhashOut)
+{
+    ScanItem *item = scan_item_init(path);
+    if (!item) return false;
+    scan_item_prefetch(item);
+    scan_item_parse(item);
+    bool found = item->superblob && code_signature_calculate_best_cdhash(item->superblob, cdhashOut) == 0;
+    scan_item_free(item);
+    return found;
+}
+
+static void bundle_add_result(Bundle *bundle, BundleResultKind kind, BundleSeal *seal, const char *path)
+{
+    char *fullPath = bundle_join_path(seal->name, path);
+    if (!fullPath) return;
+    pthread_mutex_lock(&bundle->lock);
+    if (bundle->resultCount == bundle->resultCapacity) {
+        size_t capacity = bundle->resultCapacity ? bundle->resultCapacity * 2 : 64;
+        BundleResult *results = realloc(bundle->results, capacity * sizeof(BundleResult));
+        if (!results) {
+            pthread_mutex_unlock(&bundle->lock);
+            free(fullPath);
+            return;
+        }
+        bundle->results = results;
+        bundle->resultCapacity = capacity;
+    }
+    bundle->results[bundle->resultCount++] = (BundleResult){ kind, fullPath };
+    pthread_mutex_unlock(&bundle->lock);
+}
+
+// .app bundles on macOS keep everything in Contents/ with the executable in MacOS/, versioned frameworks
+// in Versions/Current/, iOS apps and other shallow bundles at the top
+static int bundle_seal_locate(BundleSeal *seal, uint8_t **infoOut, size_t *infoSizeOut)
+{
+    const char *executableDirectory = "";
+    const char *infoName = "Info.plist";
+    char *contents = bundle_join_path(seal->path, "Contents");
+    char *versions = bundle_join_path(seal->path, "Versions/Current");
+    if (bundle_is_directory(contents)) {
+        seal->contentsPath = contents;
+        contents = NULL;
+        executableDirectory = "MacOS";
+    }
+    else if (bundle_is_directory(versions)) {
+        seal->contentsPath = versions;
+        versions = NULL;
+        infoName = "Resources/Info.plist";
+    }
+    else {
+        seal->contentsPath = strdup(seal->path);
+    }
+    free(contents);
+    free(versions);
+    if (!seal->contentsPath) return -1;
+
+    seal->infoName = strdup(infoName);
+    char *infoPath = bundle_join_path(seal->contentsPath, infoName);
+    if (!seal->infoName || !infoPath) {
+        free(infoPath);
+        return -1;
+    }
+    *infoOut = bundle_read_file(infoPath, infoSizeOut);
+    free(infoPath);
+    seal->hasInfoPlist = *infoOut != NULL;
+
+    // Binary Info.plists are not parsed, the executable is then named after the bundle
+    PlistNode *info = *infoOut ? plist_parse_xml((const char *)*infoOut, *infoSizeOut) : NULL;
+    const char *name = plist_dict_get_string(info, "CFBundleExecutable");
+    char *bundleName = NULL;
+    if (!name) {
+        const char *slash = strrchr(seal->path, '/');
+        bundleName = strdup(slash ? slash + 1 : seal->path);
+        if (!bundleName) {
+            plist_free(info);
+            return -1;
+        }
+        char *extension = strrchr(bundleName, '.');
+        if (extension && extension != bundleName) *extension = '\0';
+        name = bundleName;
+    }
+    seal->executableName = bundle_join_path(executableDirectory, name);
+    plist_free(info);
+    free(bundleName);
+    if (!seal->executableName) return -1;
+
+    char *executablePath = bundle_join_path(seal->contentsPath, seal->executableName);
+    bool found = bundle_is_file(executablePath);
+    free(executablePath);
+    if (found || !*executableDirectory) {
+        if (!found) {
+            free(seal->executableName);
+            seal->executableName = NULL;
+        }
+        return 0;
+    }
+
+    // Contents/MacOS with a single file in it is unambiguous even without a usable Info.plist
+    free(seal->executableName);
+    seal->executableName = NULL;
+    char *directoryPath = bundle_join_path(seal->contentsPath, executableDirectory);
+    DIR *directory = directoryPath ? opendir(directoryPath) : NULL;
+    free(directoryPath);
+    if (!directory) return 0;
+    char *onlyFile = NULL;
+    unsigned fileCount = 0;
+    struct dirent *entry = NULL;
+    while ((entry = readdir(directory))) {
+        if (entry->d_name[0] == '.') continue;
+        fileCount++;
+        if (!onlyFile) onlyFile = bundle_join_path(executableDirectory, entry->d_name);
+    }
+    closedir(directory);
+    if (fileCount == 1) {
+        seal->executableName = onlyFile;
+    }
+    else {
+        free(onlyFile);
+    }
+    return 0;
+}
+
+static void bundle_seal_read_signature(BundleSeal *seal, const uint8_t *resources, size_t resourcesSize, const uint8_t *info, size_t infoSize)
+{
+    if (!seal->executableName) return;
+    char *path = bundle_join_path(seal->contentsPath, seal->executableName);
+    ScanItem *item = path ? scan_item_init(path) : NULL;
+    free(path);
+    if (!item) return;
+
+    scan_item_prefetch(item);
+    scan_item_parse(item);
+    // Ad-hoc signatures end the parse stage early, the decoded superblob is still there
+    if (item->superblob) {
+        seal->isSigned = true;
+        seal->resourceState = bundle_verify_slot(item->superblob, CSSLOT_RESOURCEDIR, resources, resourcesSize);
+        seal->infoState = bundle_verify_slot(item->superblob, CSSLOT_INFOSLOT, info, infoSize);
+        seal->hasCDHash = code_signature_calculate_best_cdhash(item->superblob, seal->cdhash) == 0;
+    }
+    scan_item_free(item);
+}
+
+static void bundle_seal_load_rules(BundleSeal *seal, const PlistNode *rules)
+{
+    if (!rules || rules->type != PLIST_DICT || !rules->childCount) return;
+    seal->rules = calloc(rules->childCount, sizeof(BundleRule));
+    if (!seal->rules) return;
+
+    for (size_t i = 0; i < rules->childCount; i++) {
+        const PlistNode *value = rules->children[i];
+        BundleRule *rule = &seal->rules[seal->ruleCount];
+        memset(rule, 0, sizeof(BundleRule));
+        rule->weight = 1;
+        if (value->type == PLIST_BOOL) {
+            if (!value->boolean) continue;
+        }
+        else if (value->type == PLIST_DICT) {
+            PlistNode *weight = plist_dict_get(value, "weight");
+            if (weight && weight->type == PLIST_INTEGER) rule->weight = (double)weight->integer;
+            if (weight && weight->type == PLIST_REAL) rule->weight = strtod(weight->string, NULL);
+            rule->omit = plist_dict_get_bool(value, "omit", false);
+            rule->optional = plist_dict_get_bool(value, "optional", false);
+        }
+        else {
+            continue;
+        }
+        // Rules using syntax POSIX regexes do not have are skipped
+        if (regcomp(&rule->regex, value->key, REG_EXTENDED | REG_NOSUB) != 0) continue;
+        seal->ruleCount++;
+    }
+}
+
+// Highest weight rule wins, NULL if no rule matches
+static const BundleRule *bundle_seal_match_rule(BundleSeal *seal, const char *path)
+{
+    const BundleRule *best = NULL;
+    for (unsigned i = 0; i < seal->ruleCount; i++) {
+        const BundleRule *rule = &seal->rules[i];
+        if ((!best || rule->weight > best->weight) && regexec(&rule->regex, path, 0, NULL, 0) == 0) {
+            best = rule;
+        }
+    }
+    return best;
+}
+
+static BundleSeal *bundle_seal_load(Bundle *bundle, const char *path, const char *name, unsigned depth);
+
+static int bundle_append_entry(Bundle *bundle, BundleEntry *entry)
+{
+    if (bundle->entryCount == bundle->entryCapacity) {
+        size_t capacity = bundle->entryCapacity ? bundle->entryCapacity * 2 : 256;
+        BundleEntry *entries = realloc(bundle->entries, capacity * sizeof(BundleEntry));
+        if (!entries) return -1;
+        bundle->entries = entries;
+        bundle->entryCapacity = capacity;
+    }
+    bundle->entries[bundle->entryCount++] = *entry;
+    return 0;
+}
+
+// files2 values are dicts with hash2 (SHA-256) / hash (SHA-1), symlink or cdhash, legacy files values are bare SHA-1s
+static bool bundle_entry_decode(BundleEntry *entry, const PlistNode *value)
+{
+    const PlistNode *hash = NULL;
+    if (value->type == PLIST_DATA) {
+        hash = value;
+    }
+    else if (value->type == PLIST_DICT) {
+        entry->optional = plist_dict_get_bool(value, "optional", false);
+        const char *symlink = plist_dict_get_string(value, "symlink");
+        if (symlink) {
+            entry->type = BUNDLE_ENTRY_SYMLINK;
+            entry->symlink = strdup(symlink);
+            return entry->symlink != NULL;
+        }
+        PlistNode *cdhash = plist_dict_get(value, "cdhash");
+        if (cdhash && cdhash->type == PLIST_DATA && cdhash->dataSize == CS_CDHASH_LEN) {
+            entry->type = BUNDLE_ENTRY_NESTED;
+            memcpy(entry->digest, cdhash->data, CS_CDHASH_LEN);
+            return true;
+        }
+        PlistNode *hash2 = plist_dict_get(value, "hash2");
+        if (hash2 && hash2->type == PLIST_DATA && hash2->dataSize == hash_get_digest_size(HASH_ALGORITHM_SHA256)) {
+            entry->type = BUNDLE_ENTRY_HASH;
+            entry->algorithm = HASH_ALGORITHM_SHA256;
+            memcpy(entry->digest, hash2->data, hash2->dataSize);
+            return true;
+        }
+        hash = plist_dict_get(value, "hash");
+    }
+    if (!hash || hash->type != PLIST_DATA || hash->dataSize != hash_get_digest_size(HASH_ALGORITHM_SHA1)) return false;
+    entry->type = BUNDLE_ENTRY_HASH;
+    entry->algorithm = HASH_ALGORITHM_SHA1;
+    memcpy(entry->digest, hash->data, hash->dataSize);
+    return true;
+}
+
+static int bundle_compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// CodeResources keys are relative to the seal's contents, an absolute key or a .. component would point outside of it
+static bool bundle_is_contained_path(const char *path)
+{
+    if (path[0] == '/') return false;
+    for (const char *component = path; component; ) {
+        const char *slash = strchr(component, '/');
+        size_t length = slash ? (size_t)(slash - component) : strlen(component);
+        if (length == 2 && component[0] == '.' && component[1] == '.') return false;
+        component = slash ? slash + 1 : NULL;
+    }
+    return true;
+}
+
+static int bundle_seal_load_files(Bundle *bundle, BundleSeal *seal, const PlistNode *files)
+{
+    if (!files || files->type != PLIST_DICT || !files->childCount) return 0;
+    seal->sealedPaths = calloc(files->childCount, sizeof(char *));
+    if (!seal->sealedPaths) return -1;
+
+    for (size_t i = 0; i < files->childCount; i++) {
+        const PlistNode *value = files->children[i];
+        if (!bundle_is_contained_path(value->key)) {
+            seal->uncontainedCount++;
+            continue;
+        }
+        BundleEntry entry = { .seal = seal };
+        if (!bundle_entry_decode(&entry, value)) continue;
+        // Rules are loaded first, an optional rule (localizations) makes every file it matches optional
+        const BundleRule *rule = bundle_seal_match_rule(seal, value->key);
+        if (rule && rule->optional) entry.optional = true;
+        entry.path = strdup(value->key);
+        if (!entry.path) {
+            free(entry.symlink);
+            return -1;
+        }
+
+        if (entry.type == BUNDLE_ENTRY_NESTED) {
+            char *nestedPath = bundle_join_path(seal->contentsPath, entry.path);
+            if (bundle_is_directory(nestedPath)) {
+                char *nestedName = bundle_join_path(seal->name, entry.path);
+                entry.nested = nestedName ? bundle_seal_load(bundle, nestedPath, nestedName, seal->depth + 1) : NULL;
+                free(nestedName);
+            }
+            free(nestedPath);
+        }
+
+        seal->sealedPaths[seal->sealedCount++] = entry.path;
+        if (bundle_append_entry(bundle, &entry) != 0) {
+            seal->sealedCount--;
+            free(entry.path);
+            free(entry.symlink);
+            return -1;
+        }
+    }
+    qsort(seal->sealedPaths, seal->sealedCount, sizeof(char *), bundle_compare_strings);
+    return 0;
+}
+
+// Locates the executable, checks its special slots and loads CodeResources, nested seals included
+static int bundle_seal_read(Bundle *bundle, BundleSeal *seal)
+{
+    uint8_t *info = NULL;
+    size_t infoSize = 0;
+    if (bundle_seal_locate(seal, &info, &infoSize) != 0) {
+        free(info);
+        return -1;
+    }
+
+    size_t resourcesSize = 0;
+    char *resourcesPath = bundle_join_path(seal->contentsPath, "_CodeSignature/CodeResources");
+    uint8_t *resources = resourcesPath ? bundle_read_file(resourcesPath, &resourcesSize) : NULL;
+    seal->hasResources = resources != NULL;
+    bundle_seal_read_signature(seal, resources, resourcesSize, info, infoSize);
+    free(info);
+
+    int r = 0;
+    if (resources) {
+        PlistNode *root = plist_parse_xml((const char *)resources, resourcesSize);
+        if (root) {
+            PlistNode *rules = plist_dict_get(root, "rules2");
+            PlistNode *files = plist_dict_get(root, "files2");
+            bundle_seal_load_rules(seal, rules ? rules : plist_dict_get(root, "rules"));
+            r = bundle_seal_load_files(bundle, seal, files ? files : plist_dict_get(root, "files"));
+            plist_free(root);
+        }
+        else {
+            printf("Error: failed to parse %s!\n", resourcesPath);
+            r = -1;
+        }
+    }
+    free(resources);
+    free(resourcesPath);
+    return r;
+}
+
+// A seal that fails to load stays in bundle->seals (seals nested in it and their entries may already be there)
+// and is marked failed, which breaks the bundle
+static BundleSeal *bundle_seal_load(Bundle *bundle, const char *path, const char *name, unsigned depth)
+{
+    if (depth > BUNDLE_MAX_NESTING) return NULL;
+    BundleSeal **seals = realloc(bundle->seals, (bundle->sealCount + 1) * sizeof(BundleSeal *));
+    if (!seals) return NULL;
+    bundle->seals = seals;
+    BundleSeal *seal = calloc(1, sizeof(BundleSeal));
+    if (!seal) return NULL;
+    bundle->seals[bundle->sealCount++] = seal;
+    seal->path = strdup(path);
+    seal->name = strdup(name);
+    seal->depth = depth;
+    if (!seal->path || !seal->name || bundle_seal_read(bundle, seal) != 0) {
+        seal->failed = true;
+        return NULL;
+    }
+    return seal;
+}
+
+Bundle *bundle_init(const char *path, unsigned threadCount)
+{
+    char *bundlePath = strdup(path);
+    if (!bundlePath) return NULL;
+    size_t length = strlen(bundlePath);
+    while (length > 1 && bundlePath[length - 1] == '/') {
+        bundlePath[--length] = '\0';
+    }
+    if (!bundle_is_directory(bundlePath)) {
+        printf("Error: %s is not a bundle!\n", path);
+        free(bundlePath);
+        return NULL;
+    }
+
+    Bundle *bundle = calloc(1, sizeof(Bundle));
+    if (!bundle) {
+        free(bundlePath);
+        return NULL;
+    }
+    bundle->threadCount = threadCount ? threadCount : 1;
+    pthread_mutex_init(&bundle->lock, NULL);
+    atomic_init(&bundle->nextEntry, 0);
+    atomic_init(&bundle->bytesHashed, 0);
+    atomic_init(&bundle->filesHashed, 0);
+
+    BundleSeal *seal = bundle_seal_load(bundle, bundlePath, "", 0);
+    free(bundlePath);
+    if (!seal) {
+        bundle_free(bundle);
+        return NULL;
+    }
+    if (!seal->executableName) {
+        printf("Error: no main executable in %s!\n", path);
+        bundle_free(bundle);
+        return NULL;
+    }
+    return bundle;
+}
+
+static void bundle_check_entry(Bundle *bundle, BundleEntry *entry)
+{
+    BundleSeal *seal = entry->seal;
+    char *path = bundle_join_path(seal->contentsPath, entry->path);
+    if (!path) {
+        bundle_add_result(bundle, BUNDLE_RESULT_UNREADABLE, seal, entry->path);
+        return;
+    }
+
+    struct stat s;
+    if (lstat(path, &s) != 0) {
+        if (errno != ENOENT && errno != ENOTDIR) {
+            bundle_add_result(bundle, BUNDLE_RESULT_UNREADABLE, seal, entry->path);
+        }
+        else if (!entry->optional) {
+            bundle_add_result(bundle, BUNDLE_RESULT_MISSING, seal, entry->path);
+        }
+        free(path);
+        return;
+    }
+
+    switch (entry->type) {
+        case BUNDLE_ENTRY_SYMLINK: {
+            char target[PATH_MAX];
+            ssize_t length = S_ISLNK(s.st_mode) ? readlink(path, target, sizeof(target) - 1) : -1;
+            if (length >= 0) target[length] = '\0';
+            if (length < 0 || strcmp(target, entry->symlink)) {
+                bundle_add_result(bundle, BUNDLE_RESULT_MODIFIED, seal, entry->path);
+            }
+            break;
+        }
+        case BUNDLE_ENTRY_NESTED: {
+            uint8_t cdhash[CS_CDHASH_LEN];
+            bool found = false;
+            if (entry->nested) {
+                found = entry->nested->hasCDHash;
+                memcpy(cdhash, entry->nested->cdhash, CS_CDHASH_LEN);
+            }
+            else if (S_ISREG(s.st_mode)) {
+                found = bundle_calculate_cdhash(path, cdhash);
+            }
+            if (!found || memcmp(cdhash, entry->digest, CS_CDHASH_LEN)) {
+                bundle_add_result(bundle, BUNDLE_RESULT_NESTED_MISMATCH, seal, entry->path);
+            }
+            break;
+        }
+        case BUNDLE_ENTRY_HASH: {
+            // files2 seals symlinks as symlinks, a hash entry has to be a regular file
+            if (!S_ISREG(s.st_mode)) {
+                bundle_add_result(bundle, BUNDLE_RESULT_MODIFIED, seal, entry->path);
+                break;
+            }
+            uint8_t digest[HASH_MAX_DIGEST_SIZE];
+            if (bundle_hash_file(bundle, path, entry->algorithm, digest) != 0) {
+                bundle_add_result(bundle, BUNDLE_RESULT_UNREADABLE, seal, entry->path);
+            }
+            else if (memcmp(digest, entry->digest, hash_get_digest_size(entry->algorithm))) {
+                bundle_add_result(bundle, BUNDLE_RESULT_MODIFIED, seal, entry->path);
+            }
+            break;
+        }
+    }
+    free(path);
+}
+
+static void *bundle_worker(void *context)
+{
+    Bundle *bundle = context;
+    while (true) {
+        size_t index = atomic_fetch_add_explicit(&bundle->nextEntry, 1, memory_order_relaxed);
+        if (index >= bundle->entryCount) break;
+        bundle_check_entry(bundle, &bundle->entries[index]);
+    }
+    return NULL;
+}
+
+// Files no rule covers are not part of the seal
+static bool bundle_seal_covers(BundleSeal *seal, const char *path)
+{
+    const BundleRule *rule = bundle_seal_match_rule(seal, path);
+    return rule && !rule->omit;
+}
+
+static bool bundle_seal_is_sealed(BundleSeal *seal, const char *path)
+{
+    if (!seal->sealedCount) return false;
+    return bsearch(&path, seal->sealedPaths, seal->sealedCount, sizeof(char *), bundle_compare_strings) != NULL;
+}
+
+static void bundle_seal_find_extra(Bundle *bundle, BundleSeal *seal, const char *directoryName)
+{
+    char *directoryPath = bundle_join_path(seal->contentsPath, directoryName);
+    DIR *directory = directoryPath ? opendir(directoryPath) : NULL;
+    free(directoryPath);
+    if (!directory) return;
+
+    struct dirent *dirent = NULL;
+    while ((dirent = readdir(directory))) {
+        if (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, "..")) continue;
+        char *name = bundle_join_path(directoryName, dirent->d_name);
+        if (!name) break;
+
+        // The signature, Info.plist and the main executable are covered by the code directory, nested bundles by their own seal
+        bool skip = !strcmp(name, "_CodeSignature") || !strcmp(name, seal->infoName) ||
+                    (seal->executableName && !strcmp(name, seal->executableName)) ||
+                    bundle_seal_is_sealed(seal, name);
+        char *path = skip ? NULL : bundle_join_path(seal->contentsPath, name);
+        struct stat s;
+        if (path && lstat(path, &s) == 0) {
+            if (S_ISDIR(s.st_mode)) {
+                bundle_seal_find_extra(bundle, seal, name);
+            }
+            else if (bundle_seal_covers(seal, name)) {
+                bundle_add_result(bundle, BUNDLE_RESULT_EXTRA, seal, name);
+            }
+        }
+        free(path);
+        free(name);
+    }
+    closedir(directory);
+}
+
+int bundle_verify(Bundle *bundle)
+{
+    uint64_t start = clock_now_ns();
+    unsigned threadCount = bundle->threadCount;
+    if (threadCount > bundle->entryCount) threadCount = bundle->entryCount ? (unsigned)bundle->entryCount : 1;
+
+    pthread_t *threads = calloc(threadCount, sizeof(pthread_t));
+    if (!threads) return -1;
+    unsigned started = 0;
+    for (; started < threadCount; started++) {
+        if (pthread_create(&threads[started], NULL, bundle_worker, bundle) != 0) break;
+    }
+    if (started == 0) {
+        bundle_worker(bundle);
+    }
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    // Directory walks are cheap next to hashing and stay on this thread
+    for (size_t i = 0; i < bundle->sealCount; i++) {
+        BundleSeal *seal = bundle->seals[i];
+        if (seal->hasResources && !seal->failed) {
+            bundle_seal_find_extra(bundle, seal, "");
+        }
+    }
+    bundle->nanos = clock_now_ns() - start;
+    return 0;
+}
+
+static bool bundle_seal_is_intact(BundleSeal *seal)
+{
+    return !seal->failed && !seal->uncontainedCount && seal->isSigned && seal->resourceState == AUDIT_SLOT_OK &&
+           (seal->infoState == AUDIT_SLOT_OK || (!seal->hasInfoPlist && seal->infoState == AUDIT_SLOT_UNBOUND));
+}
+
+bool bundle_is_intact(Bundle *bundle)
+{
+    if (bundle->resultCount) return false;
+    for (size_t i = 0; i < bundle->sealCount; i++) {
+        if (!bundle_seal_is_intact(bundle->seals[i])) return false;
+    }
+    return true;
+}
+
+static int bundle_compare_results(const void *a, const void *b)
+{
+    const BundleResult *resultA = a, *resultB = b;
+    int r = strcmp(resultA->path, resultB->path);
+    if (r) return r;
+    return (int)resultA->kind - (int)resultB->kind;
+}
+
+void bundle_print(Bundle *bundle, FILE *output)
+{
+    if (bundle->resultCount) {
+        qsort(bundle->results, bundle->resultCount, sizeof(BundleResult), bundle_compare_results);
+    }
+    for (size_t i = 0; i < bundle->resultCount; i++) {
+        fprintf(output, "%s\t%s\n", bundle_result_kind_to_string(bundle->results[i].kind), bundle->results[i].path);
+    }
+
+    for (size_t i = 0; i < bundle->sealCount; i++) {
+        BundleSeal *seal = bundle->seals[i];
+        fprintf(output, "seal\t%s\t", seal->name[0] ? seal->name : ".");
+        if (seal->failed) {
+            fprintf(output, "failed\n");
+            continue;
+        }
+        if (!seal->isSigned) {
+            fprintf(output, "unsigned\n");
+            continue;
+        }
+        bool noResources = !seal->hasResources && seal->resourceState == AUDIT_SLOT_UNBOUND;
+        bool noInfo = !seal->hasInfoPlist && seal->infoState == AUDIT_SLOT_UNBOUND;
+        fprintf(output, "resources=%s\tinfo=%s\tcdhash=",
+                noResources ? "none" : audit_slot_state_to_string(seal->resourceState),
+                noInfo ? "none" : audit_slot_state_to_string(seal->infoState));
+        if (seal->hasCDHash) {
+            for (int j = 0; j < CS_CDHASH_LEN; j++) {
+                fprintf(output, "%02x", seal->cdhash[j]);
+            }
+        }
+        else {
+            fprintf(output, "none");
+        }
+        if (seal->uncontainedCount) {
+            fprintf(output, "\tuncontained=%u", seal->uncontainedCount);
+        }
+        fprintf(output, "\n");
+    }
+    fprintf(output, "bundle\t%s\n", bundle_is_intact(bundle) ? "intact" : "broken");
+}
+
+void bundle_print_stats(Bundle *bundle, FILE *output)
+{
+    uint64_t counts[BUNDLE_RESULT_UNREADABLE + 1] = { 0 };
+    for (size_t i = 0; i < bundle->resultCount; i++) {
+        counts[bundle->results[i].kind]++;
+    }
+    uint64_t bytes = atomic_load(&bundle->bytesHashed);
+    double seconds = bundle->nanos / 1e9;
+    fprintf(output, "bundle: %zu seals, %zu sealed entries, %llu files hashed (%.1f MiB in %.3f s, %.1f MiB/s on %u threads), results (",
+            bundle->sealCount, bundle->entryCount, (unsigned long long)atomic_load(&bundle->filesHashed),
+            bytes / 1048576.0, seconds, seconds > 0 ? bytes / 1048576.0 / seconds : 0, bundle->threadCount);
+    for (int i = 0; i <= BUNDLE_RESULT_UNREADABLE; i++) {
+        fprintf(output, "%s%s=%llu", i ? ", " : "", bundle_result_kind_to_string(i), (unsigned long long)counts[i]);
+    }
+    fprintf(output, ")\n");
+}
+
+void bundle_free(Bundle *bundle)
+{
+    for (size_t i = 0; i < bundle->sealCount; i++) {
+        BundleSeal *seal = bundle->seals[i];
+        for (unsigned j = 0; j < seal->ruleCount; j++) {
+            regfree(&seal->rules[j].regex);
+        }
+        free(seal->rules);
+        // The sealed paths are owned by the entries
+        free(seal->sealedPaths);
+        free(seal->path);
+        free(seal->name);
+        free(seal->contentsPath);
+        free(seal->executableName);
+        free(seal->infoName);
+        free(seal);
+    }
+    free(bundle->seals);
+    for (size_t i = 0; i < bundle->entryCount; i++) {
+        free(bundle->entries[i].path);
+        free(bundle->entries[i].symlink);
+    }
+    free(bundle->entries);
+    for (size_t i = 0; i < bundle->resultCount; i++) {
+        free(bundle->results[i].path);
+    }
+    free(bundle->results);
+    pthread_mutex_destroy(&bundle->lock);
+    free(bundle);
+}
@@ -0,0 +1,122 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <regex.h>
+
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+
+#include "Audit.h"
+#include "Hash.h"
+
+// Resource seal verification of a bundle (.app, .framework, ...) and every bundle nested in it
+// The main executable's code directories bind _CodeSignature/CodeResources, which in turn lists a hash,
+// symlink target or cdhash for every sealed file
+
+#define BUNDLE_MAX_NESTING 16
+
+typedef enum {
+    BUNDLE_RESULT_MODIFIED = 0,
+    BUNDLE_RESULT_MISSING,
+    BUNDLE_RESULT_EXTRA,           // not sealed but covered by a resource rule
+    BUNDLE_RESULT_NESTED_MISMATCH, // nested code whose cdhash is not the sealed one
+    BUNDLE_RESULT_UNREADABLE,
+} BundleResultKind;
+
+typedef struct BundleResult {
+    BundleResultKind kind;
+    char *path; // relative to the top-level bundle
+} BundleResult;
+
+typedef enum {
+    BUNDLE_ENTRY_HASH = 0,
+    BUNDLE_ENTRY_SYMLINK,
+    BUNDLE_ENTRY_NESTED,
+} BundleEntryType;
+
+typedef struct BundleRule {
+    regex_t regex;
+    double weight;
+    bool omit;
+    bool optional; // missing files matched by the rule are not reported
+} BundleRule;
+
+// One sealed bundle directory, the top-level one or a nested one
+typedef struct BundleSeal {
+    char *path;           // on disk
+    char *name;           // relative to the top-level bundle, empty for the top-level bundle
+    char *contentsPath;   // resource paths are relative to this
+    char *executableName; // relative to contentsPath, NULL if no main executable was found
+    char *infoName;       // relative to contentsPath
+    unsigned depth;
+    bool failed; // not completely loaded, never intact
+
+    bool isSigned;
+    bool hasResources;
+    bool hasInfoPlist;
+    AuditSlotState resourceState; // CodeResources against CSSLOT_RESOURCEDIR
+    AuditSlotState infoState;     // Info.plist against CSSLOT_INFOSLOT
+    bool hasCDHash;
+    uint8_t cdhash[CS_CDHASH_LEN];
+
+    BundleRule *rules;
+    unsigned ruleCount;
+    char **sealedPaths; // sorted, for finding extra files
+    size_t sealedCount;
+    unsigned uncontainedCount; // absolute keys or keys with .. components, never checked, never intact
+} BundleSeal;
+
+typedef struct BundleEntry {
+    BundleSeal *seal;
+    char *path; // relative to the seal's contentsPath
+    BundleEntryType type;
+    bool optional;
+    HashAlgorithm algorithm;
+    uint8_t digest[HASH_MAX_DIGEST_SIZE]; // sealed file hash or cdhash
+    char *symlink;
+    BundleSeal *nested; // set for nested bundles, NULL for nested Mach-Os
+} BundleEntry;
+
+typedef struct Bundle {
+    unsigned threadCount;
+
+    BundleSeal **seals;
+    size_t sealCount;
+    BundleEntry *entries;
+    size_t entryCount;
+    size_t entryCapacity;
+    atomic_size_t nextEntry;
+
+    pthread_mutex_t lock;
+    BundleResult *results;
+    size_t resultCount;
+    size_t resultCapacity;
+
+    atomic_uint_fast64_t bytesHashed;
+    atomic_uint_fast64_t filesHashed;
+    uint64_t nanos;
+} Bundle;
+
+// Reads the signature, CodeResources and rules of the bundle and every nested bundle, NULL on error
+Bundle *bundle_init(const char *path, unsigned threadCount);
+
+// Hash every sealed file over threadCount threads, then look for extra files
+int bundle_verify(Bundle *bundle);
+
+// Results sorted by path, followed by one seal line per bundle
+void bundle_print(Bundle *bundle, FILE *output);
+void bundle_print_stats(Bundle *bundle, FILE *output);
+
+// No results and every seal bound and matching
+bool bundle_is_intact(Bundle *bundle);
+
+const char *bundle_result_kind_to_string(BundleResultKind kind);
+
+void bundle_free(Bundle *bundle);
+
+#endif // BUNDLE_H
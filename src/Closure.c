@@ -0,0 +1,654 @@
+#include "Closure.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <choma/FAT.h>
+#include <choma/MachO.h>
+
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+#include "Fnv.h"
+
+#define CLOSURE_MAP_INITIAL_CAPACITY 256
+
+typedef struct ClosureStrings {
+    char **items;
+    bool *flags;
+    unsigned count;
+    unsigned capacity;
+} ClosureStrings;
+
+static int closure_strings_append(ClosureStrings *strings, const char *string, bool flag)
+{
+    if (strings->count == strings->capacity) {
+        unsigned capacity = strings->capacity ? strings->capacity * 2 : 16;
+        char **items = realloc(strings->items, capacity * sizeof(char *));
+        if (!items) return -1;
+        strings->items = items;
+        bool *flags = realloc(strings->flags, capacity * sizeof(bool));
+        if (!flags) return -1;
+        strings->flags = flags;
+        strings->capacity = capacity;
+    }
+    char *copy = strdup(string);
+    if (!copy) return -1;
+    strings->items[strings->count] = copy;
+    strings->flags[strings->count] = flag;
+    strings->count++;
+    return 0;
+}
+
+static void closure_strings_free(ClosureStrings *strings)
+{
+    for (unsigned i = 0; i < strings->count; i++) {
+        free(strings->items[i]);
+    }
+    free(strings->items);
+    free(strings->flags);
+}
+
+static uint64_t closure_hash_identity(dev_t device, ino_t inode)
+{
+    uint64_t hash = ((uint64_t)device * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)inode;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static ClosureMapEntry *closure_map_find(ClosureMap *map, uint64_t hash, const char *path, dev_t device, ino_t inode)
+{
+    if (!map->capacity) return NULL;
+    size_t mask = map->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        ClosureMapEntry *entry = &map->entries[i];
+        if (!entry->node) return entry;
+        if (entry->hash != hash) continue;
+        if (path ? (entry->path && !strcmp(entry->path, path)) : (entry->device == device && entry->inode == inode)) return entry;
+    }
+}
+
+static int closure_map_insert(ClosureMap *map, uint64_t hash, const char *path, dev_t device, ino_t inode, ClosureNode *node)
+{
+    // Keep the load factor at or below one half
+    if ((map->count + 1) * 2 > map->capacity) {
+        size_t capacity = map->capacity ? map->capacity * 2 : CLOSURE_MAP_INITIAL_CAPACITY;
+        ClosureMapEntry *entries = calloc(capacity, sizeof(ClosureMapEntry));
+        if (!entries) return -1;
+        ClosureMap grown = { entries, capacity, 0 };
+        for (size_t i = 0; i < map->capacity; i++) {
+            ClosureMapEntry *entry = &map->entries[i];
+            if (entry->node) *closure_map_find(&grown, entry->hash, entry->path, entry->device, entry->inode) = *entry;
+        }
+        grown.count = map->count;
+        free(map->entries);
+        *map = grown;
+    }
+    ClosureMapEntry *entry = closure_map_find(map, hash, path, device, inode);
+    if (!entry->node) map->count++;
+    entry->hash = hash;
+    entry->path = path;
+    entry->device = device;
+    entry->inode = inode;
+    entry->node = node;
+    return 0;
+}
+
+// Lexically collapse "//", "." and "..", symlinks are left alone since they may point outside the root
+static char *closure_normalize_path(const char *path)
+{
+    size_t length = strlen(path);
+    char *normalized = malloc(length + 2);
+    if (!normalized) return NULL;
+    bool absolute = path[0] == '/';
+    size_t out = 0;
+    if (absolute) normalized[out++] = '/';
+
+    const char *p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        const char *component = p;
+        while (*p && *p != '/') p++;
+        size_t componentLength = p - component;
+        if (componentLength == 0 || (componentLength == 1 && component[0] == '.')) continue;
+        if (componentLength == 2 && component[0] == '.' && component[1] == '.') {
+            size_t base = absolute ? 1 : 0;
+            if (out > base) {
+                while (out > base && normalized[out - 1] != '/') out--;
+                if (out > base) out--;
+                continue;
+            }
+            if (absolute) continue;
+        }
+        if (out > 0 && normalized[out - 1] != '/') normalized[out++] = '/';
+        memcpy(normalized + out, component, componentLength);
+        out += componentLength;
+    }
+    if (out == 0) normalized[out++] = absolute ? '/' : '.';
+    normalized[out] = '\0';
+    return normalized;
+}
+
+static char *closure_join_path(const char *directory, size_t directoryLength, const char *rest)
+{
+    size_t restLength = strlen(rest);
+    char *joined = malloc(directoryLength + restLength + 2);
+    if (!joined) return NULL;
+    memcpy(joined, directory, directoryLength);
+    joined[directoryLength] = '/';
+    memcpy(joined + directoryLength + 1, rest, restLength + 1);
+    char *normalized = closure_normalize_path(joined);
+    free(joined);
+    return normalized;
+}
+
+static size_t closure_dirname_length(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path) : 0;
+}
+
+static char *closure_host_path(Closure *closure, const char *path)
+{
+    size_t rootLength = strlen(closure->root);
+    size_t pathLength = strlen(path);
+    char *hostPath = malloc(rootLength + pathLength + 1);
+    if (!hostPath) return NULL;
+    memcpy(hostPath, closure->root, rootLength);
+    memcpy(hostPath + rootLength, path, pathLength + 1);
+    return hostPath;
+}
+
+static bool closure_stat(Closure *closure, const char *path, struct stat *statOut)
+{
+    char *hostPath = closure_host_path(closure, path);
+    if (!hostPath) return false;
+    bool found = stat(hostPath, statOut) == 0 && S_ISREG(statOut->st_mode);
+    free(hostPath);
+    return found;
+}
+
+// "@loader_path/x" or a bare "@loader_path" (which rpaths use), returns what follows the token
+static const char *closure_match_token(const char *path, const char *token)
+{
+    size_t length = strlen(token);
+    if (strncmp(path, token, length) != 0) return NULL;
+    if (path[length] == '/') return path + length + 1;
+    if (path[length] == '\0') return path + length;
+    return NULL;
+}
+
+// Expand @executable_path and @loader_path, the result is relative to the root
+static char *closure_expand_path(Closure *closure, const ClosureNode *loader, const char *path)
+{
+    const char *rest = NULL;
+    if ((rest = closure_match_token(path, "@executable_path"))) {
+        return closure_join_path(closure->executablePath, closure_dirname_length(closure->executablePath), rest);
+    }
+    if ((rest = closure_match_token(path, "@loader_path"))) {
+        return closure_join_path(loader->path, closure_dirname_length(loader->path), rest);
+    }
+    return closure_normalize_path(path);
+}
+
+// Resolve an install name like dyld does, falls back to the install name itself when nothing exists
+static char *closure_resolve(Closure *closure, const ClosureNode *loader, const char *installName, bool *foundOut, struct stat *statOut)
+{
+    *foundOut = false;
+    if (!strncmp(installName, "@rpath/", 7)) {
+        for (unsigned i = 0; i < loader->rpathCount; i++) {
+            char *candidate = closure_join_path(loader->rpaths[i], strlen(loader->rpaths[i]), installName + 7);
+            if (!candidate) return NULL;
+            if (closure_stat(closure, candidate, statOut)) {
+                *foundOut = true;
+                return candidate;
+            }
+            free(candidate);
+        }
+        return strdup(installName);
+    }
+
+    char *resolved = closure_expand_path(closure, loader, installName);
+    if (resolved) *foundOut = closure_stat(closure, resolved, statOut);
+    return resolved;
+}
+
+// Only the host's own shared cache can be asked, a system path missing under another root stays unresolved
+static bool closure_is_in_shared_cache(Closure *closure, const char *path)
+{
+    if (closure->root[0]) return false;
+    if (strncmp(path, "/usr/lib/", 9) && strncmp(path, "/System/Library/", 16)) return false;
+#ifdef __APPLE__
+    return _dyld_shared_cache_contains_path(path);
+#else
+    return false;
+#endif
+}
+
+static void closure_node_free(ClosureNode *node)
+{
+    if (node->item) scan_item_free(node->item);
+    for (unsigned i = 0; i < node->rpathCount; i++) {
+        free(node->rpaths[i]);
+    }
+    free(node->rpaths);
+    free(node->referencedAs);
+    free(node->path);
+    free(node);
+}
+
+static int closure_push_work(Closure *closure, ClosureNode *node)
+{
+    if (closure->workCount == closure->workCapacity) {
+        size_t capacity = closure->workCapacity ? closure->workCapacity * 2 : 64;
+        ClosureNode **work = realloc(closure->work, capacity * sizeof(ClosureNode *));
+        if (!work) return -1;
+        closure->work = work;
+        closure->workCapacity = capacity;
+    }
+    closure->work[closure->workCount++] = node;
+    closure->pending++;
+    pthread_cond_signal(&closure->cond);
+    return 0;
+}
+
+// Alias paths are owned by the closure, they are keys of the path map
+static int closure_add_alias_locked(Closure *closure, char *path)
+{
+    if (closure->aliasCount == closure->aliasCapacity) {
+        size_t capacity = closure->aliasCapacity ? closure->aliasCapacity * 2 : 16;
+        char **aliases = realloc(closure->aliases, capacity * sizeof(char *));
+        if (!aliases) return -1;
+        closure->aliases = aliases;
+        closure->aliasCapacity = capacity;
+    }
+    closure->aliases[closure->aliasCount++] = path;
+    return 0;
+}
+
+// Takes ownership of path, called with the lock held
+static int closure_add_node_locked(Closure *closure, ClosureNode *loader, char *path, const char *installName, bool weak, bool found, const struct stat *s)
+{
+    uint64_t pathHash = fnv_hash_string(path);
+    ClosureMapEntry *entry = closure_map_find(&closure->paths, pathHash, path, 0, 0);
+    ClosureNode *existing = entry ? entry->node : NULL;
+    uint64_t identityHash = 0;
+    if (!existing && found) {
+        // Same file under another path (symlinks, hard links), evaluate it only once
+        identityHash = closure_hash_identity(s->st_dev, s->st_ino);
+        entry = closure_map_find(&closure->identities, identityHash, NULL, s->st_dev, s->st_ino);
+        existing = entry ? entry->node : NULL;
+        if (existing) {
+            // The alias path becomes the key, so the next reference under it is found by the lookup above
+            if (closure_add_alias_locked(closure, path) != 0) {
+                free(path);
+                return -1;
+            }
+            if (closure_map_insert(&closure->paths, pathHash, path, 0, 0, existing) != 0) return -1;
+            if (!weak) existing->weak = false;
+            return 0;
+        }
+    }
+    if (existing) {
+        if (!weak) existing->weak = false;
+        free(path);
+        return 0;
+    }
+
+    ClosureNode *node = calloc(1, sizeof(ClosureNode));
+    if (!node) {
+        free(path);
+        return -1;
+    }
+    node->path = path;
+    node->referencedAs = installName ? strdup(installName) : NULL;
+    node->loader = loader;
+    node->depth = loader ? loader->depth + 1 : 0;
+    node->weak = weak;
+    if (found) {
+        node->state = CLOSURE_NODE_EVALUATED;
+    }
+    else if (closure_is_in_shared_cache(closure, path)) {
+        node->state = CLOSURE_NODE_SHARED_CACHE;
+        node->trust = CLOSURE_TRUST_PLATFORM;
+    }
+    else {
+        node->state = CLOSURE_NODE_MISSING;
+        node->trust = CLOSURE_TRUST_MISSING;
+    }
+
+    if (closure->nodeCount == closure->nodeCapacity) {
+        size_t capacity = closure->nodeCapacity ? closure->nodeCapacity * 2 : 64;
+        ClosureNode **nodes = realloc(closure->nodes, capacity * sizeof(ClosureNode *));
+        if (!nodes) {
+            closure_node_free(node);
+            return -1;
+        }
+        closure->nodes = nodes;
+        closure->nodeCapacity = capacity;
+    }
+    closure->nodes[closure->nodeCount++] = node;
+    if (closure_map_insert(&closure->paths, pathHash, node->path, 0, 0, node) != 0) return -1;
+    if (!found) return 0;
+    if (closure_map_insert(&closure->identities, identityHash, NULL, s->st_dev, s->st_ino, node) != 0) return -1;
+    return closure_push_work(closure, node);
+}
+
+static int closure_add_dependency(Closure *closure, ClosureNode *loader, const char *installName, bool weak)
+{
+    bool found = false;
+    struct stat s;
+    char *path = closure_resolve(closure, loader, installName, &found, &s);
+    if (!path) return -1;
+    pthread_mutex_lock(&closure->lock);
+    closure->edgeCount++;
+    int r = closure_add_node_locked(closure, loader, path, installName, weak, found, &s);
+    pthread_mutex_unlock(&closure->lock);
+    return r;
+}
+
+static ClosureTrust closure_trust_for_item(const ScanItem *item)
+{
+    if (!item) return CLOSURE_TRUST_FAILED;
+    bool inTrustCache = item->trustCacheChecked && item->trustCacheIndex >= 0;
+    switch (item->status) {
+        case SCAN_STATUS_OK:
+            if (inTrustCache || (item->policyFlags & (CORETRUST_POLICY_MAC_PLATFORM | CORETRUST_POLICY_MAC_PLATFORM_G2))) {
+                return CLOSURE_TRUST_PLATFORM;
+            }
+            return item->policyFlags ? CLOSURE_TRUST_THIRD_PARTY : CLOSURE_TRUST_NO_POLICY;
+        case SCAN_STATUS_NO_CMS:
+            return inTrustCache ? CLOSURE_TRUST_PLATFORM : CLOSURE_TRUST_AD_HOC;
+        case SCAN_STATUS_EVALUATION_FAILED:
+            // Ad-hoc signatures usually carry an empty CMS blob rather than none
+            if (item->cmsParsed && item->cmsParseResult == CMS_PARSE_EMPTY) {
+                return inTrustCache ? CLOSURE_TRUST_PLATFORM : CLOSURE_TRUST_AD_HOC;
+            }
+            return CLOSURE_TRUST_FAILED;
+        case SCAN_STATUS_NO_SIGNATURE:
+            return CLOSURE_TRUST_UNSIGNED;
+        default:
+            return CLOSURE_TRUST_FAILED;
+    }
+}
+
+static void closure_process_node(Closure *closure, ClosureNode *node)
+{
+    char *hostPath = closure_host_path(closure, node->path);
+    if (!hostPath) return;
+
+    ScanItem *item = scan_item_init(hostPath);
+    if (item) {
+        item->trustCaches = closure->trustCaches;
+        scan_item_prefetch(item);
+        scan_item_parse(item);
+        scan_item_evaluate(item);
+        scan_item_calculate_cdhash(item);
+        // Records show paths inside the root, like the rest of the closure
+        char *path = strdup(node->path);
+        if (path) {
+            free(item->path);
+            item->path = path;
+        }
+    }
+    node->item = item;
+    node->trust = closure_trust_for_item(item);
+
+    // The scan has released its slice by now, the load commands are read from a fresh one
+    LazyFat *fat = lazy_fat_init_from_path(hostPath);
+    free(hostPath);
+    LazyFatSlice *slice = fat ? scan_find_preferred_slice(fat) : NULL;
+    MachO *macho = slice ? lazy_fat_slice_get_macho(fat, slice) : NULL;
+    if (!macho) {
+        lazy_fat_free(fat);
+        return;
+    }
+
+    ClosureStrings rpaths = { 0 }, dependencies = { 0 };
+    ClosureStrings *rpathsOut = &rpaths, *dependenciesOut = &dependencies;
+    macho_enumerate_rpaths(macho, ^(const char *rpath, bool *stop) {
+        closure_strings_append(rpathsOut, rpath, false);
+    });
+    macho_enumerate_dependencies(macho, ^(const char *dylibPath, uint32_t cmd, struct dylib *dylib, bool *stop) {
+        if (cmd != LC_ID_DYLIB) {
+            closure_strings_append(dependenciesOut, dylibPath, cmd == LC_LOAD_WEAK_DYLIB);
+        }
+    });
+    lazy_fat_free(fat);
+
+    // Children only look at their loader's rpaths after being queued, which happens below
+    // Nodes are memoized by path, so a node reached through several loader chains inherits from the first one only
+    unsigned inherited = node->loader ? node->loader->rpathCount : 0;
+    node->rpaths = calloc(rpaths.count + inherited, sizeof(char *));
+    if (node->rpaths) {
+        for (unsigned i = 0; i < rpaths.count; i++) {
+            char *rpath = closure_expand_path(closure, node, rpaths.items[i]);
+            if (rpath) node->rpaths[node->rpathCount++] = rpath;
+        }
+        for (unsigned i = 0; i < inherited; i++) {
+            char *rpath = strdup(node->loader->rpaths[i]);
+            if (rpath) node->rpaths[node->rpathCount++] = rpath;
+        }
+    }
+
+    for (unsigned i = 0; i < dependencies.count; i++) {
+        if (closure_add_dependency(closure, node, dependencies.items[i], dependencies.flags[i]) != 0) {
+            fprintf(stderr, "Error: failed to add dependency %s of %s!\n", dependencies.items[i], node->path);
+        }
+    }
+    closure_strings_free(&rpaths);
+    closure_strings_free(&dependencies);
+}
+
+static void *closure_worker(void *arg)
+{
+    Closure *closure = arg;
+    pthread_mutex_lock(&closure->lock);
+    while (true) {
+        while (closure->workHead == closure->workCount && closure->pending > 0) {
+            pthread_cond_wait(&closure->cond, &closure->lock);
+        }
+        if (closure->workHead == closure->workCount) break;
+        // Oldest first, so the walk goes roughly breadth first
+        ClosureNode *node = closure->work[closure->workHead++];
+        pthread_mutex_unlock(&closure->lock);
+
+        closure_process_node(closure, node);
+
+        pthread_mutex_lock(&closure->lock);
+        if (--closure->pending == 0) {
+            pthread_cond_broadcast(&closure->cond);
+        }
+    }
+    pthread_mutex_unlock(&closure->lock);
+    return NULL;
+}
+
+Closure *closure_init(const char *root, const char *executablePath, unsigned threadCount)
+{
+    Closure *closure = calloc(1, sizeof(Closure));
+    if (!closure) return NULL;
+    // A trailing slash on the root would double up with the absolute paths appended to it
+    size_t rootLength = root ? strlen(root) : 0;
+    while (rootLength > 0 && root[rootLength - 1] == '/') rootLength--;
+    closure->root = strndup(root ? root : "", rootLength);
+    closure->executablePath = closure_normalize_path(executablePath);
+    closure->threadCount = threadCount ? threadCount : 1;
+    pthread_mutex_init(&closure->lock, NULL);
+    pthread_cond_init(&closure->cond, NULL);
+    if (!closure->root || !closure->executablePath) {
+        closure_free(closure);
+        return NULL;
+    }
+    return closure;
+}
+
+int closure_run(Closure *closure)
+{
+    struct stat s;
+    if (!closure_stat(closure, closure->executablePath, &s)) {
+        printf("Error: failed to open %s%s!\n", closure->root, closure->executablePath);
+        return -1;
+    }
+    char *path = strdup(closure->executablePath);
+    if (!path) return -1;
+    pthread_mutex_lock(&closure->lock);
+    int r = closure_add_node_locked(closure, NULL, path, NULL, false, true, &s);
+    pthread_mutex_unlock(&closure->lock);
+    if (r != 0) return -1;
+
+    pthread_t *threads = calloc(closure->threadCount, sizeof(pthread_t));
+    if (!threads) return -1;
+    unsigned started = 0;
+    for (; started < closure->threadCount; started++) {
+        if (pthread_create(&threads[started], NULL, closure_worker, closure) != 0) break;
+    }
+    if (started == 0) {
+        // Still finish the walk, just without fanning out
+        closure_worker(closure);
+    }
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return 0;
+}
+
+const char *closure_trust_to_string(ClosureTrust trust)
+{
+    switch (trust) {
+        case CLOSURE_TRUST_MISSING:
+            return "missing";
+        case CLOSURE_TRUST_FAILED:
+            return "failed";
+        case CLOSURE_TRUST_UNSIGNED:
+            return "unsigned";
+        case CLOSURE_TRUST_AD_HOC:
+            return "ad-hoc";
+        case CLOSURE_TRUST_NO_POLICY:
+            return "no-policy";
+        case CLOSURE_TRUST_THIRD_PARTY:
+            return "third-party";
+        case CLOSURE_TRUST_PLATFORM:
+            return "platform";
+    }
+    return "unknown";
+}
+
+static int closure_compare_nodes(const void *a, const void *b)
+{
+    const ClosureNode *nodeA = *(const ClosureNode **)a, *nodeB = *(const ClosureNode **)b;
+    if (nodeA->depth != nodeB->depth) return nodeA->depth < nodeB->depth ? -1 : 1;
+    return strcmp(nodeA->path, nodeB->path);
+}
+
+ClosureNode *closure_get_weakest_link(Closure *closure)
+{
+    ClosureNode *weakest = NULL;
+    for (size_t i = 0; i < closure->nodeCount; i++) {
+        ClosureNode *node = closure->nodes[i];
+        // dyld tolerates missing weak dependencies
+        if (node->state == CLOSURE_NODE_MISSING && node->weak) continue;
+        if (!weakest || node->trust < weakest->trust ||
+            (node->trust == weakest->trust && closure_compare_nodes(&node, &weakest) < 0)) {
+            weakest = node;
+        }
+    }
+    return weakest;
+}
+
+static void closure_print_node(ClosureNode *node, FILE *output)
+{
+    if (node->state == CLOSURE_NODE_EVALUATED && node->item) {
+        char *record = NULL;
+        size_t recordLength = 0;
+        FILE *stream = open_memstream(&record, &recordLength);
+        if (stream) {
+            scan_item_print(node->item, stream);
+            fclose(stream);
+            if (recordLength && record[recordLength - 1] == '\n') recordLength--;
+            fprintf(output, "%.*s", (int)recordLength, record);
+            free(record);
+        }
+    }
+    else {
+        const char *state = node->state == CLOSURE_NODE_SHARED_CACHE ? "shared-cache" : (node->weak ? "missing-weak" : "missing");
+        fprintf(output, "%s\t%s", node->path, state);
+    }
+    fprintf(output, "\ttrust=%s\tdepth=%u", closure_trust_to_string(node->trust), node->depth);
+    if (node->loader) {
+        fprintf(output, "\tloader=%s\tref=%s", node->loader->path, node->referencedAs);
+    }
+    fprintf(output, "\n");
+}
+
+void closure_print(Closure *closure, FILE *output)
+{
+    ClosureNode **sorted = malloc(closure->nodeCount * sizeof(ClosureNode *));
+    if (!sorted) return;
+    memcpy(sorted, closure->nodes, closure->nodeCount * sizeof(ClosureNode *));
+    qsort(sorted, closure->nodeCount, sizeof(ClosureNode *), closure_compare_nodes);
+    for (size_t i = 0; i < closure->nodeCount; i++) {
+        closure_print_node(sorted[i], output);
+    }
+    free(sorted);
+
+    ClosureNode *weakest = closure_get_weakest_link(closure);
+    if (!weakest) return;
+    fprintf(output, "weakest\t%s\t%s\tchain=", weakest->path, closure_trust_to_string(weakest->trust));
+    // Walk up to the executable, then print top down
+    unsigned chainLength = weakest->depth + 1;
+    ClosureNode **chain = calloc(chainLength, sizeof(ClosureNode *));
+    if (chain) {
+        unsigned i = chainLength;
+        for (ClosureNode *node = weakest; node && i > 0; node = node->loader) {
+            chain[--i] = node;
+        }
+        for (; i < chainLength; i++) {
+            fprintf(output, "%s%s", chain[i]->path, i + 1 < chainLength ? " -> " : "");
+        }
+        free(chain);
+    }
+    fprintf(output, "\n");
+}
+
+void closure_print_stats(Closure *closure, FILE *output)
+{
+    uint64_t counts[CLOSURE_TRUST_PLATFORM + 1] = { 0 };
+    uint64_t sharedCache = 0;
+    for (size_t i = 0; i < closure->nodeCount; i++) {
+        counts[closure->nodes[i]->trust]++;
+        if (closure->nodes[i]->state == CLOSURE_NODE_SHARED_CACHE) sharedCache++;
+    }
+    fprintf(output, "closure: %zu images (%llu in the shared cache), %llu load commands, %llu aliases, trust (",
+            closure->nodeCount, (unsigned long long)sharedCache, (unsigned long long)closure->edgeCount, (unsigned long long)closure->aliasCount);
+    for (int i = 0; i <= CLOSURE_TRUST_PLATFORM; i++) {
+        fprintf(output, "%s%s=%llu", i ? ", " : "", closure_trust_to_string(i), (unsigned long long)counts[i]);
+    }
+    fprintf(output, ")\n");
+}
+
+void closure_free(Closure *closure)
+{
+    if (!closure) return;
+    for (size_t i = 0; i < closure->nodeCount; i++) {
+        closure_node_free(closure->nodes[i]);
+    }
+    free(closure->nodes);
+    for (size_t i = 0; i < closure->aliasCount; i++) {
+        free(closure->aliases[i]);
+    }
+    free(closure->aliases);
+    free(closure->paths.entries);
+    free(closure->identities.entries);
+    free(closure->work);
+    free(closure->executablePath);
+    free(closure->root);
+    pthread_mutex_destroy(&closure->lock);
+    pthread_cond_destroy(&closure->cond);
+    free(closure);
+}
@@ -0,0 +1,103 @@
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "Scan.h"
+#include "TrustCache.h"
+
+// Load closure of an executable: every dylib reachable through its load commands is resolved the way dyld
+// would (@executable_path, @loader_path, @rpath) against a root filesystem and evaluated exactly once
+
+typedef enum {
+    CLOSURE_NODE_EVALUATED = 0,
+    CLOSURE_NODE_MISSING,      // not found on disk and not in the host's dyld shared cache
+    CLOSURE_NODE_SHARED_CACHE, // system library only present in the host's dyld shared cache, not evaluated
+} ClosureNodeState;
+
+// Ordered from weakest to strongest
+typedef enum {
+    CLOSURE_TRUST_MISSING = 0,
+    CLOSURE_TRUST_FAILED,      // not a Mach-O, malformed or rejected by CoreTrust
+    CLOSURE_TRUST_UNSIGNED,
+    CLOSURE_TRUST_AD_HOC,
+    CLOSURE_TRUST_NO_POLICY,   // valid CMS but no CoreTrust policy matched
+    CLOSURE_TRUST_THIRD_PARTY,
+    CLOSURE_TRUST_PLATFORM,    // platform policy, trust cache hit or shared cache
+} ClosureTrust;
+
+typedef struct ClosureNode {
+    char *path;         // inside the root, the unresolved install name for missing nodes
+    char *referencedAs; // install name as written by the first loader, NULL for the executable
+    struct ClosureNode *loader;
+    unsigned depth;
+    bool weak;          // only ever referenced by weak load commands so far
+    ClosureNodeState state;
+    ScanItem *item;
+    ClosureTrust trust;
+
+    // Effective rpaths, own LC_RPATHs first, then the ones inherited from the loader chain
+    char **rpaths;
+    unsigned rpathCount;
+} ClosureNode;
+
+typedef struct ClosureMapEntry {
+    uint64_t hash;
+    const char *path; // NULL for identity entries
+    dev_t device;
+    ino_t inode;
+    ClosureNode *node;
+} ClosureMapEntry;
+
+// Open addressing, keyed by resolved path or by file identity
+typedef struct ClosureMap {
+    ClosureMapEntry *entries;
+    size_t capacity;
+    size_t count;
+} ClosureMap;
+
+typedef struct Closure {
+    char *root; // prefix for every path, empty for the host filesystem
+    char *executablePath;
+    const TrustCacheSet *trustCaches; // optional
+    unsigned threadCount;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    ClosureNode **nodes;
+    size_t nodeCount;
+    size_t nodeCapacity;
+    ClosureMap paths;
+    ClosureMap identities;
+    ClosureNode **work; // FIFO, work[workHead..workCount) is still queued
+    size_t workHead;
+    size_t workCount;
+    size_t workCapacity;
+    size_t pending; // queued or being processed
+    uint64_t edgeCount;
+    char **aliases; // paths that resolved to an already known file
+    size_t aliasCount;
+    size_t aliasCapacity;
+} Closure;
+
+Closure *closure_init(const char *root, const char *executablePath, unsigned threadCount);
+
+// Evaluate the whole closure, fanning out over threadCount threads
+int closure_run(Closure *closure);
+
+// Every image sorted by depth and path, followed by the weakest link and how it is reached
+void closure_print(Closure *closure, FILE *output);
+void closure_print_stats(Closure *closure, FILE *output);
+
+// Weakest non-weak image of the closure, NULL if the closure is empty
+ClosureNode *closure_get_weakest_link(Closure *closure);
+
+const char *closure_trust_to_string(ClosureTrust trust);
+
+void closure_free(Closure *closure);
+
+#endif // CLOSURE_H
@@ -0,0 +1,297 @@
+#include "Cms.h"
+
+#include <string.h>
+
+#include "Der.h"
+#include "Fnv.h"
+
+static const uint8_t gOidSignedData[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x07, 0x02 };
+static const uint8_t gOidMessageDigest[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x09, 0x04 };
+static const uint8_t gOidSigningTime[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x09, 0x05 };
+static const uint8_t gOidAppleHashAgilityV1[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x63, 0x64, 0x09, 0x01 };
+static const uint8_t gOidAppleHashAgilityV2[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x63, 0x64, 0x09, 0x02 };
+static const uint8_t gOidSha1[] = { 0x2b, 0x0e, 0x03, 0x02, 0x1a };
+static const uint8_t gOidSha256[] = { 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01 };
+static const uint8_t gOidSha384[] = { 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x02 };
+static const uint8_t gOidSha512[] = { 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x03 };
+
+#define CMS_OID_EQUALS(item, oid) der_oid_equals(item, oid, sizeof(oid))
+
+const char *cms_parse_result_to_string(CmsParseResult result)
+{
+    switch (result) {
+        case CMS_PARSE_OK:
+            return "ok";
+        case CMS_PARSE_EMPTY:
+            return "empty";
+        case CMS_PARSE_MALFORMED:
+            return "malformed";
+        case CMS_PARSE_NO_SIGNER:
+            return "no-signer";
+        default:
+            return "unknown";
+    }
+}
+
+const char *cms_digest_algorithm_to_string(CmsDigestAlgorithm algorithm)
+{
+    switch (algorithm) {
+        case CMS_DIGEST_SHA1:
+            return "sha1";
+        case CMS_DIGEST_SHA256:
+            return "sha256";
+        case CMS_DIGEST_SHA384:
+            return "sha384";
+        case CMS_DIGEST_SHA512:
+            return "sha512";
+        default:
+            return "unknown";
+    }
+}
+
+static CmsDigestAlgorithm cms_digest_algorithm_from_oid(const DerItem *oid)
+{
+    if (CMS_OID_EQUALS(oid, gOidSha1)) return CMS_DIGEST_SHA1;
+    if (CMS_OID_EQUALS(oid, gOidSha256)) return CMS_DIGEST_SHA256;
+    if (CMS_OID_EQUALS(oid, gOidSha384)) return CMS_DIGEST_SHA384;
+    if (CMS_OID_EQUALS(oid, gOidSha512)) return CMS_DIGEST_SHA512;
+    return CMS_DIGEST_UNKNOWN;
+}
+
+// AlgorithmIdentifier ::= SEQUENCE { algorithm OID, parameters ANY OPTIONAL }
+static int cms_parse_algorithm_identifier(const DerItem *sequence, CmsDigestAlgorithm *algorithmOut)
+{
+    if (!der_item_is(sequence, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE)) return -1;
+    DerReader reader;
+    DerItem oid;
+    der_reader_init_children(&reader, sequence);
+    if (der_reader_expect(&reader, DER_CLASS_UNIVERSAL, false, DER_TAG_OID, &oid) != 0) return -1;
+    *algorithmOut = cms_digest_algorithm_from_oid(&oid);
+    return 0;
+}
+
+static void cms_slice_from_item(CmsSlice *slice, const DerItem *item, bool whole)
+{
+    slice->data = whole ? item->start : item->content;
+    slice->size = whole ? item->totalSize : item->contentSize;
+}
+
+static bool cms_slice_equals(const CmsSlice *a, const uint8_t *data, size_t size)
+{
+    return a->size == size && a->size && !memcmp(a->data, data, size);
+}
+
+// HashAgilityV2 ::= SET OF SEQUENCE { digestAlgorithm OID, digest OCTET STRING }, keep the strongest entry
+static int cms_parse_agility_v2(CmsInfo *info, const DerItem *values)
+{
+    DerReader setReader;
+    DerItem value;
+    der_reader_init_children(&setReader, values);
+    int r;
+    while ((r = der_reader_next(&setReader, &value)) == 1) {
+        if (!der_item_is(&value, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE)) return -1;
+        DerReader entryReader;
+        DerItem oid, digest;
+        der_reader_init_children(&entryReader, &value);
+        if (der_reader_expect(&entryReader, DER_CLASS_UNIVERSAL, false, DER_TAG_OID, &oid) != 0) return -1;
+        if (der_reader_expect(&entryReader, DER_CLASS_UNIVERSAL, false, DER_TAG_OCTET_STRING, &digest) != 0) return -1;
+
+        CmsDigestAlgorithm algorithm = cms_digest_algorithm_from_oid(&oid);
+        if (!info->hasAgilityV2 || algorithm > info->agilityV2Algorithm) {
+            info->hasAgilityV2 = true;
+            info->agilityV2Algorithm = algorithm;
+            cms_slice_from_item(&info->agilityV2Digest, &digest, false);
+        }
+    }
+    return r;
+}
+
+// Attribute ::= SEQUENCE { attrType OID, attrValues SET OF ANY }
+static int cms_parse_signed_attributes(CmsInfo *info, const DerItem *attributes)
+{
+    DerReader reader;
+    DerItem attribute;
+    der_reader_init_children(&reader, attributes);
+    int r;
+    while ((r = der_reader_next(&reader, &attribute)) == 1) {
+        if (!der_item_is(&attribute, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE)) return -1;
+        DerReader attributeReader;
+        DerItem type, values, first;
+        der_reader_init_children(&attributeReader, &attribute);
+        if (der_reader_expect(&attributeReader, DER_CLASS_UNIVERSAL, false, DER_TAG_OID, &type) != 0) return -1;
+        if (der_reader_expect(&attributeReader, DER_CLASS_UNIVERSAL, true, DER_TAG_SET, &values) != 0) return -1;
+
+        if (CMS_OID_EQUALS(&type, gOidAppleHashAgilityV2)) {
+            if (cms_parse_agility_v2(info, &values) < 0) return -1;
+            continue;
+        }
+
+        DerReader valueReader;
+        der_reader_init_children(&valueReader, &values);
+        if (der_reader_next(&valueReader, &first) != 1) continue;
+
+        if (CMS_OID_EQUALS(&type, gOidMessageDigest)) {
+            if (der_item_is(&first, DER_CLASS_UNIVERSAL, false, DER_TAG_OCTET_STRING)) {
+                cms_slice_from_item(&info->messageDigest, &first, false);
+            }
+        }
+        else if (CMS_OID_EQUALS(&type, gOidSigningTime)) {
+            info->hasSigningTime = der_parse_time(&first, &info->signingTime) == 0;
+        }
+        else if (CMS_OID_EQUALS(&type, gOidAppleHashAgilityV1)) {
+            if (der_item_is(&first, DER_CLASS_UNIVERSAL, false, DER_TAG_OCTET_STRING)) {
+                info->hasAgilityV1 = true;
+                cms_slice_from_item(&info->agilityV1, &first, false);
+            }
+        }
+    }
+    return r;
+}
+
+// SignerInfo ::= SEQUENCE { version, sid, digestAlgorithm, [0] signedAttrs OPTIONAL, signatureAlgorithm, signature, ... }
+static int cms_parse_signer_info(CmsInfo *info, const DerItem *signerInfo)
+{
+    if (!der_item_is(signerInfo, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE)) return -1;
+    DerReader reader;
+    DerItem item;
+    der_reader_init_children(&reader, signerInfo);
+    if (der_reader_expect(&reader, DER_CLASS_UNIVERSAL, false, DER_TAG_INTEGER, &item) != 0) return -1;
+
+    // sid: IssuerAndSerialNumber or [0] SubjectKeyIdentifier
+    if (der_reader_next(&reader, &item) != 1) return -1;
+    if (der_item_is(&item, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE)) {
+        DerReader sidReader;
+        DerItem issuer, serial;
+        der_reader_init_children(&sidReader, &item);
+        if (der_reader_expect(&sidReader, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE, &issuer) != 0) return -1;
+        if (der_reader_expect(&sidReader, DER_CLASS_UNIVERSAL, false, DER_TAG_INTEGER, &serial) != 0) return -1;
+        cms_slice_from_item(&info->signerIssuer, &issuer, true);
+        cms_slice_from_item(&info->signerSerial, &serial, false);
+    }
+    else if (item.tagClass == DER_CLASS_CONTEXT && item.tag == 0 && !item.constructed) {
+        cms_slice_from_item(&info->signerKeyIdentifier, &item, false);
+    }
+    else {
+        return -1;
+    }
+
+    if (der_reader_next(&reader, &item) != 1 || cms_parse_algorithm_identifier(&item, &info->digestAlgorithm) != 0) return -1;
+
+    if (der_reader_next(&reader, &item) != 1) return -1;
+    if (der_item_is(&item, DER_CLASS_CONTEXT, true, 0)) {
+        if (cms_parse_signed_attributes(info, &item) < 0) return -1;
+    }
+    return 0;
+}
+
+// Certificate ::= SEQUENCE { tbsCertificate SEQUENCE { [0] version OPTIONAL, serialNumber, signature, issuer, ... }, ... }
+static bool cms_certificate_matches_signer(const CmsInfo *info, const DerItem *certificate)
+{
+    if (!info->signerSerial.size) return false;
+    DerReader reader, tbsReader;
+    DerItem tbs, item, issuer;
+    if (der_reader_init_children(&reader, certificate) != 0) return false;
+    if (der_reader_expect(&reader, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE, &tbs) != 0) return false;
+    der_reader_init_children(&tbsReader, &tbs);
+    if (der_reader_next(&tbsReader, &item) != 1) return false;
+    if (der_item_is(&item, DER_CLASS_CONTEXT, true, 0) && der_reader_next(&tbsReader, &item) != 1) return false;
+    if (!der_item_is(&item, DER_CLASS_UNIVERSAL, false, DER_TAG_INTEGER)) return false;
+    if (!cms_slice_equals(&info->signerSerial, item.content, item.contentSize)) return false;
+
+    DerItem signature;
+    if (der_reader_next(&tbsReader, &signature) != 1) return false;
+    if (der_reader_expect(&tbsReader, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE, &issuer) != 0) return false;
+    return cms_slice_equals(&info->signerIssuer, issuer.start, issuer.totalSize);
+}
+
+static int cms_parse_certificates(CmsInfo *info, const DerItem *certificates, DerItem *firstOut, bool *hasFirst)
+{
+    DerReader reader;
+    DerItem certificate;
+    der_reader_init_children(&reader, certificates);
+    int r;
+    while ((r = der_reader_next(&reader, &certificate)) == 1) {
+        if (!der_item_is(&certificate, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE)) continue;
+        if (!*hasFirst) {
+            *firstOut = certificate;
+            *hasFirst = true;
+        }
+        info->certificateCount++;
+    }
+    return r;
+}
+
+CmsParseResult cms_parse(const uint8_t *data, size_t size, CmsInfo *infoOut)
+{
+    memset(infoOut, 0, sizeof(*infoOut));
+    if (!data || size == 0) return CMS_PARSE_EMPTY;
+
+    // ContentInfo ::= SEQUENCE { contentType OID, [0] EXPLICIT SignedData }
+    DerItem contentInfo, item, signedData;
+    DerReader reader;
+    if (der_read_item(data, size, &contentInfo) != 0) return CMS_PARSE_MALFORMED;
+    if (!der_item_is(&contentInfo, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE)) return CMS_PARSE_MALFORMED;
+    der_reader_init_children(&reader, &contentInfo);
+    if (der_reader_expect(&reader, DER_CLASS_UNIVERSAL, false, DER_TAG_OID, &item) != 0) return CMS_PARSE_MALFORMED;
+    if (!CMS_OID_EQUALS(&item, gOidSignedData)) return CMS_PARSE_MALFORMED;
+    if (der_reader_expect(&reader, DER_CLASS_CONTEXT, true, 0, &item) != 0) return CMS_PARSE_MALFORMED;
+    der_reader_init_children(&reader, &item);
+    if (der_reader_expect(&reader, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE, &signedData) != 0) return CMS_PARSE_MALFORMED;
+
+    // SignedData ::= SEQUENCE { version, digestAlgorithms SET, encapContentInfo SEQUENCE,
+    //                           [0] certificates OPTIONAL, [1] crls OPTIONAL, signerInfos SET }
+    der_reader_init_children(&reader, &signedData);
+    if (der_reader_expect(&reader, DER_CLASS_UNIVERSAL, false, DER_TAG_INTEGER, &item) != 0) return CMS_PARSE_MALFORMED;
+    if (der_reader_expect(&reader, DER_CLASS_UNIVERSAL, true, DER_TAG_SET, &item) != 0) return CMS_PARSE_MALFORMED;
+    if (der_reader_expect(&reader, DER_CLASS_UNIVERSAL, true, DER_TAG_SEQUENCE, &item) != 0) return CMS_PARSE_MALFORMED;
+
+    DerItem firstCertificate, certificates;
+    bool hasFirstCertificate = false;
+    if (der_reader_next(&reader, &item) != 1) return CMS_PARSE_MALFORMED;
+    if (der_item_is(&item, DER_CLASS_CONTEXT, true, 0)) {
+        certificates = item;
+        if (cms_parse_certificates(infoOut, &item, &firstCertificate, &hasFirstCertificate) < 0) return CMS_PARSE_MALFORMED;
+        if (der_reader_next(&reader, &item) != 1) return CMS_PARSE_MALFORMED;
+    }
+    if (der_item_is(&item, DER_CLASS_CONTEXT, true, 1)) {
+        if (der_reader_next(&reader, &item) != 1) return CMS_PARSE_MALFORMED;
+    }
+    if (!der_item_is(&item, DER_CLASS_UNIVERSAL, true, DER_TAG_SET)) return CMS_PARSE_MALFORMED;
+
+    DerReader signerReader;
+    DerItem signerInfo;
+    der_reader_init_children(&signerReader, &item);
+    int r;
+    while ((r = der_reader_next(&signerReader, &signerInfo)) == 1) {
+        if (infoOut->signerCount++ == 0 && cms_parse_signer_info(infoOut, &signerInfo) != 0) return CMS_PARSE_MALFORMED;
+    }
+    if (r < 0) return CMS_PARSE_MALFORMED;
+    if (infoOut->signerCount == 0) return CMS_PARSE_NO_SIGNER;
+
+    if (hasFirstCertificate) {
+        cms_slice_from_item(&infoOut->leafCertificate, &firstCertificate, true);
+        DerReader certificateReader;
+        DerItem certificate;
+        der_reader_init_children(&certificateReader, &certificates);
+        while (der_reader_next(&certificateReader, &certificate) == 1) {
+            if (cms_certificate_matches_signer(infoOut, &certificate)) {
+                cms_slice_from_item(&infoOut->leafCertificate, &certificate, true);
+                break;
+            }
+        }
+    }
+    return CMS_PARSE_OK;
+}
+
+uint64_t cms_info_get_signer_id(const CmsInfo *info)
+{
+    // FNV-1a over the issuer and serial (or key identifier), not cryptographic, only used for grouping
+    static const uint8_t separator = 0xff;
+    uint64_t hash = FNV_OFFSET_BASIS;
+    const CmsSlice *parts[] = { &info->signerIssuer, &info->signerSerial, &info->signerKeyIdentifier };
+    for (size_t p = 0; p < sizeof(parts) / sizeof(parts[0]); p++) {
+        hash = fnv_update(hash, parts[p]->data, parts[p]->size);
+        hash = fnv_update(hash, &separator, 1);
+    }
+    return hash;
+}
@@ -0,0 +1,63 @@
+#ifndef CMS_H
+#define CMS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// CMS SignedData parser for code signature blobs, built on the zero-copy Der reader
+// Nothing is allocated, all slices point into the buffer handed to cms_parse
+
+typedef enum {
+    CMS_DIGEST_UNKNOWN = 0,
+    CMS_DIGEST_SHA1,
+    CMS_DIGEST_SHA256,
+    CMS_DIGEST_SHA384,
+    CMS_DIGEST_SHA512,
+    CMS_DIGEST_COUNT,
+} CmsDigestAlgorithm;
+
+typedef enum {
+    CMS_PARSE_OK = 0,
+    CMS_PARSE_EMPTY,     // no bytes at all (ad-hoc signatures carry an empty CMS blob)
+    CMS_PARSE_MALFORMED, // not a well formed SignedData ContentInfo
+    CMS_PARSE_NO_SIGNER, // well formed but without any SignerInfo
+} CmsParseResult;
+
+typedef struct CmsSlice {
+    const uint8_t *data;
+    size_t size;
+} CmsSlice;
+
+typedef struct CmsInfo {
+    uint32_t certificateCount;
+    CmsSlice leafCertificate; // certificate matching the first signer, the first certificate if none matches
+
+    // First SignerInfo
+    uint32_t signerCount;
+    CmsDigestAlgorithm digestAlgorithm;
+    CmsSlice signerIssuer; // DER Name, empty when the signer is identified by subject key identifier
+    CmsSlice signerSerial;
+    CmsSlice signerKeyIdentifier;
+    CmsSlice messageDigest;
+
+    bool hasSigningTime;
+    int64_t signingTime; // seconds since the epoch
+
+    // Apple hash agility attributes
+    bool hasAgilityV1;
+    CmsSlice agilityV1; // plist with the cdhashes
+    bool hasAgilityV2;
+    CmsDigestAlgorithm agilityV2Algorithm; // strongest entry of the v2 attribute
+    CmsSlice agilityV2Digest;
+} CmsInfo;
+
+CmsParseResult cms_parse(const uint8_t *data, size_t size, CmsInfo *infoOut);
+
+const char *cms_parse_result_to_string(CmsParseResult result);
+const char *cms_digest_algorithm_to_string(CmsDigestAlgorithm algorithm);
+
+// Stable 64 bit identifier of the signer (issuer + serial, or key identifier) for grouping
+uint64_t cms_info_get_signer_id(const CmsInfo *info);
+
+#endif // CMS_H
@@ -0,0 +1,267 @@
+#include "CodeHash.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <choma/MachOByteOrder.h>
+
+// Page hashes are handed to hash_digest_many in batches of this many pages
+#define CODE_HASH_PAGE_BATCH 64
+
+int code_hash_type_get_algorithm(uint8_t hashType, HashAlgorithm *algorithmOut)
+{
+    switch (hashType) {
+        case CS_HASHTYPE_SHA160_160:
+            *algorithmOut = HASH_ALGORITHM_SHA1;
+            return 0;
+        case CS_HASHTYPE_SHA256_256:
+        case CS_HASHTYPE_SHA256_160:
+            *algorithmOut = HASH_ALGORITHM_SHA256;
+            return 0;
+        case CS_HASHTYPE_SHA384_384:
+            *algorithmOut = HASH_ALGORITHM_SHA384;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+uint8_t code_hash_type_get_size(uint8_t hashType)
+{
+    switch (hashType) {
+        case CS_HASHTYPE_SHA160_160:
+        case CS_HASHTYPE_SHA256_160:
+            return CS_CDHASH_LEN;
+        case CS_HASHTYPE_SHA256_256:
+            return 32;
+        case CS_HASHTYPE_SHA384_384:
+            return 48;
+        default:
+            return 0;
+    }
+}
+
+unsigned code_hash_type_get_rank(uint8_t hashType)
+{
+    switch (hashType) {
+        case CS_HASHTYPE_SHA160_160:
+            return 1;
+        case CS_HASHTYPE_SHA256_160:
+            return 2;
+        case CS_HASHTYPE_SHA256_256:
+            return 3;
+        case CS_HASHTYPE_SHA384_384:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+int code_hash_digest(uint8_t hashType, const void *data, size_t size, uint8_t *hashOut)
+{
+    HashAlgorithm algorithm;
+    if (code_hash_type_get_algorithm(hashType, &algorithm) != 0) return -1;
+    uint8_t digest[HASH_MAX_DIGEST_SIZE];
+    hash_digest(algorithm, data, size, digest);
+    memcpy(hashOut, digest, code_hash_type_get_size(hashType));
+    return 0;
+}
+
+uint8_t *code_hash_copy_blob_data(CS_DecodedBlob *blob, size_t *sizeOut, bool *mustFree)
+{
+    size_t size = csd_blob_get_size(blob);
+    *sizeOut = size;
+    *mustFree = false;
+
+    // Buffered streams can be hashed in place
+    uint8_t *raw = memory_stream_get_raw_pointer(blob->stream);
+    if (raw) return raw;
+
+    uint8_t *data = malloc(size ? size : 1);
+    if (!data) return NULL;
+    if (csd_blob_read(blob, 0, size, data) != 0) {
+        free(data);
+        return NULL;
+    }
+    *mustFree = true;
+    return data;
+}
+
+static int code_directory_read_header(CS_DecodedBlob *codeDirBlob, CS_CodeDirectory *codeDirOut)
+{
+    if (csd_blob_get_size(codeDirBlob) < sizeof(CS_CodeDirectory)) return -1;
+    if (csd_blob_read(codeDirBlob, 0, sizeof(CS_CodeDirectory), codeDirOut) != 0) return -1;
+    CODE_DIRECTORY_APPLY_BYTE_ORDER(codeDirOut, BIG_TO_HOST_APPLIER);
+    return 0;
+}
+
+int code_directory_calculate_cdhash(CS_DecodedBlob *codeDirBlob, uint8_t *cdhashOut, unsigned *rankOut)
+{
+    size_t size = 0;
+    bool mustFree = false;
+    uint8_t *data = code_hash_copy_blob_data(codeDirBlob, &size, &mustFree);
+    if (!data || size < sizeof(CS_CodeDirectory)) {
+        if (mustFree) free(data);
+        return -1;
+    }
+
+    uint8_t hashType = ((CS_CodeDirectory *)data)->hashType;
+    HashAlgorithm algorithm;
+    if (code_hash_type_get_algorithm(hashType, &algorithm) != 0) {
+        if (mustFree) free(data);
+        return -1;
+    }
+
+    // The cdhash is always the digest truncated to 20 bytes, whatever the slot size is
+    uint8_t digest[HASH_MAX_DIGEST_SIZE];
+    hash_digest(algorithm, data, size, digest);
+    memcpy(cdhashOut, digest, CS_CDHASH_LEN);
+    if (rankOut) *rankOut = code_hash_type_get_rank(hashType);
+
+    if (mustFree) free(data);
+    return 0;
+}
+
+int code_signature_calculate_best_cdhash(CS_DecodedSuperBlob *superblob, uint8_t *cdhashOut)
+{
+    unsigned bestRank = 0;
+    for (CS_DecodedBlob *blob = superblob->firstBlob; blob; blob = blob->next) {
+        uint32_t type = csd_blob_get_type(blob);
+        if (type != CSSLOT_CODEDIRECTORY && (type < CSSLOT_ALTERNATE_CODEDIRECTORIES || type >= CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT)) continue;
+
+        uint8_t cdhash[CS_CDHASH_LEN];
+        unsigned rank = 0;
+        if (code_directory_calculate_cdhash(blob, cdhash, &rank) != 0) continue;
+        if (rank > bestRank) {
+            bestRank = rank;
+            memcpy(cdhashOut, cdhash, CS_CDHASH_LEN);
+        }
+    }
+    return bestRank ? 0 : -1;
+}
+
+static uint64_t code_hash_read_big(const uint8_t *data, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value = value << 8 | data[i];
+    }
+    return value;
+}
+
+uint64_t code_directory_read_code_limit_64(const uint8_t *blob, uint64_t blobSize)
+{
+    if (blobSize < CODE_DIRECTORY_CODE_LIMIT_64_OFFSET + sizeof(uint64_t)) return 0;
+    if (code_hash_read_big(blob + offsetof(CS_CodeDirectory, version), sizeof(uint32_t)) < CODE_DIRECTORY_SUPPORTS_CODE_LIMIT_64) return 0;
+    return code_hash_read_big(blob + CODE_DIRECTORY_CODE_LIMIT_64_OFFSET, sizeof(uint64_t));
+}
+
+int code_directory_check_code_slots(const CS_CodeDirectory *codeDir, uint64_t codeLimit64, uint64_t blobSize, uint64_t sliceSize,
+                                    HashAlgorithm *algorithmOut, uint64_t *codeLimitOut)
+{
+    if (code_hash_type_get_algorithm(codeDir->hashType, algorithmOut) != 0) return -1;
+    if (codeDir->hashSize == 0 || codeDir->hashSize > hash_get_digest_size(*algorithmOut)) return -1;
+    if (codeDir->nCodeSlots == 0 || codeDir->pageSize == 0 || codeDir->pageSize > 31) return -1;
+    uint64_t codeLimit = codeLimit64 ? codeLimit64 : codeDir->codeLimit;
+    if (codeLimit > sliceSize) return -1;
+
+    uint64_t pageSize = 1ULL << codeDir->pageSize;
+    uint64_t slotsEnd = (uint64_t)codeDir->hashOffset + (uint64_t)codeDir->nCodeSlots * codeDir->hashSize;
+    if (slotsEnd > blobSize) return -1;
+    // The code limit has to end inside the last slot's page, the last page is the only short one
+    if ((uint64_t)(codeDir->nCodeSlots - 1) * pageSize >= codeLimit) return -1;
+    if (codeLimit > (uint64_t)codeDir->nCodeSlots * pageSize) return -1;
+    *codeLimitOut = codeLimit;
+    return 0;
+}
+
+int code_directory_verify_code_slots(CS_DecodedBlob *codeDirBlob, const uint8_t *code, size_t codeSize)
+{
+    CS_CodeDirectory codeDir;
+    if (code_directory_read_header(codeDirBlob, &codeDir) != 0) return -1;
+    if (codeDir.nCodeSlots == 0) return 0;
+
+    uint64_t blobSize = csd_blob_get_size(codeDirBlob);
+    uint8_t header[CODE_DIRECTORY_CODE_LIMIT_64_OFFSET + sizeof(uint64_t)];
+    uint64_t codeLimit64 = 0;
+    if (blobSize >= sizeof(header) && csd_blob_read(codeDirBlob, 0, sizeof(header), header) == 0) {
+        codeLimit64 = code_directory_read_code_limit_64(header, sizeof(header));
+    }
+    HashAlgorithm algorithm;
+    uint64_t codeLimit = 0;
+    if (code_directory_check_code_slots(&codeDir, codeLimit64, blobSize, codeSize, &algorithm, &codeLimit) != 0) return -1;
+    uint64_t pageSize = 1ULL << codeDir.pageSize;
+
+    size_t slotsSize = (size_t)codeDir.nCodeSlots * codeDir.hashSize;
+    uint8_t *expected = malloc(slotsSize);
+    if (!expected) return -1;
+    if (csd_blob_read(codeDirBlob, codeDir.hashOffset, slotsSize, expected) != 0) {
+        free(expected);
+        return -1;
+    }
+
+    size_t digestSize = hash_get_digest_size(algorithm);
+    uint8_t digests[CODE_HASH_PAGE_BATCH * HASH_MAX_DIGEST_SIZE];
+    const uint8_t *pages[CODE_HASH_PAGE_BATCH];
+    int mismatches = 0;
+
+    // Every page but the last is a full page, those go through the multi-buffer path
+    uint32_t fullPages = codeDir.nCodeSlots - 1;
+    for (uint32_t first = 0; first < fullPages; first += CODE_HASH_PAGE_BATCH) {
+        uint32_t count = fullPages - first < CODE_HASH_PAGE_BATCH ? fullPages - first : CODE_HASH_PAGE_BATCH;
+        for (uint32_t i = 0; i < count; i++) {
+            pages[i] = code + (uint64_t)(first + i) * pageSize;
+        }
+        hash_digest_many(algorithm, pages, pageSize, count, digests);
+        for (uint32_t i = 0; i < count; i++) {
+            if (memcmp(digests + i * digestSize, expected + (size_t)(first + i) * codeDir.hashSize, codeDir.hashSize) != 0) {
+                mismatches++;
+            }
+        }
+    }
+
+    uint64_t lastOffset = (uint64_t)fullPages * pageSize;
+    hash_digest(algorithm, code + lastOffset, codeLimit - lastOffset, digests);
+    if (memcmp(digests, expected + (size_t)fullPages * codeDir.hashSize, codeDir.hashSize) != 0) {
+        mismatches++;
+    }
+
+    free(expected);
+    return mismatches;
+}
+
+// Reads the hash bound to a special slot, returns -1 if the slot is out of range or all zeroes (nothing bound)
+static int code_directory_read_special_slot(CS_DecodedBlob *codeDirBlob, uint32_t slot, CS_CodeDirectory *codeDirOut, uint8_t *hashOut)
+{
+    if (code_directory_read_header(codeDirBlob, codeDirOut) != 0) return -1;
+    if (slot == 0 || slot > codeDirOut->nSpecialSlots) return -1;
+    if (codeDirOut->hashSize == 0 || codeDirOut->hashSize > HASH_MAX_DIGEST_SIZE) return -1;
+    if ((uint64_t)slot * codeDirOut->hashSize > codeDirOut->hashOffset) return -1;
+    if (csd_blob_read(codeDirBlob, codeDirOut->hashOffset - slot * codeDirOut->hashSize, codeDirOut->hashSize, hashOut) != 0) return -1;
+
+    static const uint8_t zero[HASH_MAX_DIGEST_SIZE];
+    if (!memcmp(hashOut, zero, codeDirOut->hashSize)) return -1;
+    return 0;
+}
+
+bool code_directory_has_special_slot(CS_DecodedBlob *codeDirBlob, uint32_t slot)
+{
+    CS_CodeDirectory codeDir;
+    uint8_t expected[HASH_MAX_DIGEST_SIZE];
+    return code_directory_read_special_slot(codeDirBlob, slot, &codeDir, expected) == 0;
+}
+
+int code_directory_verify_special_slot(CS_DecodedBlob *codeDirBlob, uint32_t slot, const void *data, size_t size)
+{
+    CS_CodeDirectory codeDir;
+    uint8_t expected[HASH_MAX_DIGEST_SIZE];
+    if (code_directory_read_special_slot(codeDirBlob, slot, &codeDir, expected) != 0) return -1;
+    // A slot wider than the digest would compare bytes the hash never wrote
+    HashAlgorithm algorithm;
+    if (code_hash_type_get_algorithm(codeDir.hashType, &algorithm) != 0) return -1;
+    if (codeDir.hashSize > hash_get_digest_size(algorithm)) return -1;
+
+    uint8_t actual[HASH_MAX_DIGEST_SIZE];
+    if (code_hash_digest(codeDir.hashType, data, size, actual) != 0) return -1;
+    return memcmp(actual, expected, codeDir.hashSize) == 0 ? 1 : 0;
+}
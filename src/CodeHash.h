@@ -0,0 +1,49 @@
+#ifndef CODE_HASH_H
+#define CODE_HASH_H
+
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+
+#include "Hash.h"
+
+// Code signing hashes (cdhashes, code and special slots) on top of the dispatched Hash backends
+
+// Map a CS_HASHTYPE_* to its algorithm and slot size, returns -1 for unknown types
+int code_hash_type_get_algorithm(uint8_t hashType, HashAlgorithm *algorithmOut);
+uint8_t code_hash_type_get_size(uint8_t hashType);
+// Same ranking the kernel uses to pick the best code directory, 0 for unknown types
+unsigned code_hash_type_get_rank(uint8_t hashType);
+
+// Hash data the way hashType specifies, truncating to the slot size
+int code_hash_digest(uint8_t hashType, const void *data, size_t size, uint8_t *hashOut);
+
+// Copy a blob out contiguously, *mustFree is set when the result has to be freed
+uint8_t *code_hash_copy_blob_data(CS_DecodedBlob *blob, size_t *sizeOut, bool *mustFree);
+
+int code_directory_calculate_cdhash(CS_DecodedBlob *codeDirBlob, uint8_t *cdhashOut, unsigned *rankOut);
+int code_signature_calculate_best_cdhash(CS_DecodedSuperBlob *superblob, uint8_t *cdhashOut);
+
+// Code directories from this version on carry codeLimit64 (after scatterOffset, teamOffset and spare3), used when non-zero
+#define CODE_DIRECTORY_SUPPORTS_CODE_LIMIT_64 0x20300
+#define CODE_DIRECTORY_CODE_LIMIT_64_OFFSET 56
+
+// codeLimit64 of a raw (big endian) code directory of blobSize bytes, 0 if its version or length does not have one
+uint64_t code_directory_read_code_limit_64(const uint8_t *blob, uint64_t blobSize);
+
+// Code slot layout checks shared by full and sampled page verification, codeDir in host byte order
+// Sets the hash algorithm and the effective code limit (codeLimit64 when set, codeLimit otherwise)
+// Returns -1 unless nCodeSlots slots of hashSize bytes fit the blob and describe the first code limit bytes of a sliceSize slice
+int code_directory_check_code_slots(const CS_CodeDirectory *codeDir, uint64_t codeLimit64, uint64_t blobSize, uint64_t sliceSize,
+                                    HashAlgorithm *algorithmOut, uint64_t *codeLimitOut);
+
+// Compare the code slots against code (the slice, starting at offset 0)
+// Returns the number of mismatching slots or -1 if the code directory is malformed or code is too short
+int code_directory_verify_code_slots(CS_DecodedBlob *codeDirBlob, const uint8_t *code, size_t codeSize);
+
+// True if the code directory binds a (non-zero) hash to the special slot
+bool code_directory_has_special_slot(CS_DecodedBlob *codeDirBlob, uint32_t slot);
+
+// Returns 1 if the special slot matches data, 0 if it does not and -1 if the slot is absent
+int code_directory_verify_special_slot(CS_DecodedBlob *codeDirBlob, uint32_t slot, const void *data, size_t size);
+
+#endif // CODE_HASH_H
@@ -0,0 +1,164 @@
+#include "Der.h"
+
+#include <string.h>
+
+static int der_read_item_depth(const uint8_t *data, size_t size, DerItem *itemOut, unsigned depth)
+{
+    if (depth > DER_MAX_DEPTH || size < 2) return -1;
+    const uint8_t *cur = data;
+    const uint8_t *end = data + size;
+
+    uint8_t identifier = *cur++;
+    itemOut->start = data;
+    itemOut->tagClass = identifier >> 6;
+    itemOut->constructed = (identifier & 0x20) != 0;
+    itemOut->tag = identifier & 0x1f;
+    if (itemOut->tag == 0x1f) {
+        // High tag number form, base 128 with at most 4 bytes
+        uint32_t tag = 0;
+        unsigned count = 0;
+        for (;;) {
+            if (cur >= end || count == 4) return -1;
+            uint8_t b = *cur++;
+            tag = (tag << 7) | (b & 0x7f);
+            count++;
+            if (!(b & 0x80)) break;
+        }
+        itemOut->tag = tag;
+    }
+
+    if (cur >= end) return -1;
+    uint8_t lengthByte = *cur++;
+    itemOut->indefinite = false;
+    if (lengthByte < 0x80) {
+        itemOut->contentSize = lengthByte;
+    }
+    else if (lengthByte == 0x80) {
+        // BER indefinite length, only valid for constructed encodings
+        if (!itemOut->constructed) return -1;
+        itemOut->indefinite = true;
+    }
+    else {
+        unsigned lengthSize = lengthByte & 0x7f;
+        if (lengthSize > sizeof(size_t) || lengthSize > (size_t)(end - cur)) return -1;
+        size_t length = 0;
+        for (unsigned i = 0; i < lengthSize; i++) {
+            length = (length << 8) | *cur++;
+        }
+        itemOut->contentSize = length;
+    }
+    itemOut->content = cur;
+
+    if (!itemOut->indefinite) {
+        if (itemOut->contentSize > (size_t)(end - cur)) return -1;
+        itemOut->totalSize = (size_t)(cur - data) + itemOut->contentSize;
+        return 0;
+    }
+
+    // Walk the children until the end-of-contents marker
+    const uint8_t *child = cur;
+    for (;;) {
+        if ((size_t)(end - child) < 2) return -1;
+        if (child[0] == 0 && child[1] == 0) break;
+        DerItem childItem;
+        if (der_read_item_depth(child, (size_t)(end - child), &childItem, depth + 1) != 0) return -1;
+        child += childItem.totalSize;
+    }
+    itemOut->contentSize = (size_t)(child - cur);
+    itemOut->totalSize = (size_t)(child + 2 - data);
+    return 0;
+}
+
+int der_read_item(const uint8_t *data, size_t size, DerItem *itemOut)
+{
+    return der_read_item_depth(data, size, itemOut, 0);
+}
+
+void der_reader_init(DerReader *reader, const uint8_t *data, size_t size)
+{
+    reader->cur = data;
+    reader->end = data + size;
+}
+
+int der_reader_init_children(DerReader *reader, const DerItem *item)
+{
+    if (!item->constructed) return -1;
+    der_reader_init(reader, item->content, item->contentSize);
+    return 0;
+}
+
+int der_reader_next(DerReader *reader, DerItem *itemOut)
+{
+    if (reader->cur >= reader->end) return 0;
+    if (der_read_item(reader->cur, (size_t)(reader->end - reader->cur), itemOut) != 0) return -1;
+    reader->cur += itemOut->totalSize;
+    return 1;
+}
+
+int der_reader_expect(DerReader *reader, uint8_t tagClass, bool constructed, uint32_t tag, DerItem *itemOut)
+{
+    if (der_reader_next(reader, itemOut) != 1) return -1;
+    return der_item_is(itemOut, tagClass, constructed, tag) ? 0 : -1;
+}
+
+bool der_oid_equals(const DerItem *item, const uint8_t *oid, size_t oidSize)
+{
+    return der_item_is(item, DER_CLASS_UNIVERSAL, false, DER_TAG_OID) &&
+           item->contentSize == oidSize && !memcmp(item->content, oid, oidSize);
+}
+
+static int der_parse_digits(const uint8_t *p, unsigned count, int *valueOut)
+{
+    int value = 0;
+    for (unsigned i = 0; i < count; i++) {
+        if (p[i] < '0' || p[i] > '9') return -1;
+        value = value * 10 + (p[i] - '0');
+    }
+    *valueOut = value;
+    return 0;
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date
+static int64_t der_days_from_civil(int64_t year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yearOfEra = (unsigned)(year - era * 400);
+    unsigned dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int64_t)dayOfEra - 719468;
+}
+
+int der_parse_time(const DerItem *item, int64_t *secondsOut)
+{
+    if (item->constructed || item->tagClass != DER_CLASS_UNIVERSAL) return -1;
+    const uint8_t *p = item->content;
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+
+    if (item->tag == DER_TAG_UTC_TIME) {
+        // YYMMDDHHMMSSZ, years before 50 are 20xx
+        if (item->contentSize != 13 || p[12] != 'Z') return -1;
+        if (der_parse_digits(p, 2, &year) != 0) return -1;
+        year += year < 50 ? 2000 : 1900;
+        p += 2;
+    }
+    else if (item->tag == DER_TAG_GENERALIZED_TIME) {
+        // YYYYMMDDHHMMSSZ
+        if (item->contentSize != 15 || p[14] != 'Z') return -1;
+        if (der_parse_digits(p, 4, &year) != 0) return -1;
+        p += 4;
+    }
+    else {
+        return -1;
+    }
+
+    if (der_parse_digits(p, 2, &month) != 0 || der_parse_digits(p + 2, 2, &day) != 0 ||
+        der_parse_digits(p + 4, 2, &hour) != 0 || der_parse_digits(p + 6, 2, &minute) != 0 ||
+        der_parse_digits(p + 8, 2, &second) != 0) {
+        return -1;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) return -1;
+
+    *secondsOut = der_days_from_civil(year, (unsigned)month, (unsigned)day) * 86400 + hour * 3600 + minute * 60 + second;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef DER_H
+#define DER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Zero-copy DER / BER reader, every item points back into the caller's buffer
+// All lengths are checked against the enclosing item, indefinite (BER) lengths are resolved by walking to the EOC
+
+#define DER_CLASS_UNIVERSAL 0
+#define DER_CLASS_APPLICATION 1
+#define DER_CLASS_CONTEXT 2
+#define DER_CLASS_PRIVATE 3
+
+#define DER_TAG_BOOLEAN 0x01
+#define DER_TAG_INTEGER 0x02
+#define DER_TAG_BIT_STRING 0x03
+#define DER_TAG_OCTET_STRING 0x04
+#define DER_TAG_NULL 0x05
+#define DER_TAG_OID 0x06
+#define DER_TAG_UTF8_STRING 0x0c
+#define DER_TAG_SEQUENCE 0x10
+#define DER_TAG_SET 0x11
+#define DER_TAG_UTC_TIME 0x17
+#define DER_TAG_GENERALIZED_TIME 0x18
+
+// Nesting limit for indefinite length items, keeps hostile input from recursing deeply
+#define DER_MAX_DEPTH 32
+
+typedef struct DerItem {
+    uint8_t tagClass;
+    bool constructed;
+    bool indefinite;
+    uint32_t tag;
+    const uint8_t *start;   // first byte of the identifier
+    const uint8_t *content;
+    size_t contentSize;     // excludes the EOC of indefinite items
+    size_t totalSize;       // identifier + length + content (+ EOC)
+} DerItem;
+
+typedef struct DerReader {
+    const uint8_t *cur;
+    const uint8_t *end;
+} DerReader;
+
+// Parse the item at the start of data, returns -1 if it is malformed or does not fit
+int der_read_item(const uint8_t *data, size_t size, DerItem *itemOut);
+
+void der_reader_init(DerReader *reader, const uint8_t *data, size_t size);
+// Iterate over the children of a constructed item
+int der_reader_init_children(DerReader *reader, const DerItem *item);
+// Returns 1 if an item was read, 0 at the end and -1 on malformed input
+int der_reader_next(DerReader *reader, DerItem *itemOut);
+// Like der_reader_next but the item must match, returns -1 otherwise
+int der_reader_expect(DerReader *reader, uint8_t tagClass, bool constructed, uint32_t tag, DerItem *itemOut);
+
+static inline bool der_item_is(const DerItem *item, uint8_t tagClass, bool constructed, uint32_t tag)
+{
+    return item->tagClass == tagClass && item->constructed == constructed && item->tag == tag;
+}
+
+bool der_oid_equals(const DerItem *item, const uint8_t *oid, size_t oidSize);
+
+// UTCTime / GeneralizedTime (Zulu only) to seconds since the epoch
+int der_parse_time(const DerItem *item, int64_t *secondsOut);
+
+#endif // DER_H
@@ -0,0 +1,65 @@
+#include "Evaluator.h"
+
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#if defined(__APPLE__)
+#include <TargetConditionals.h>
+#endif
+
+#if defined(__APPLE__) && TARGET_OS_IPHONE
+#define EVALUATOR_DEFAULT_PATH "/System/Library/PrivateFrameworks/MobileInBoxUpdate.framework/MobileInBoxUpdate"
+#elif defined(__APPLE__)
+#define EVALUATOR_DEFAULT_PATH "/System/Library/PrivateFrameworks/AuthKit.framework/Versions/A/AuthKit"
+#endif
+
+static pthread_once_t gEvaluatorOnce = PTHREAD_ONCE_INIT;
+static EvaluatorFunction gEvaluatorFunction = NULL;
+
+static void evaluator_load_once(void)
+{
+    const char *path = getenv(EVALUATOR_PATH_ENV);
+#ifdef EVALUATOR_DEFAULT_PATH
+    if (!path || !*path) path = EVALUATOR_DEFAULT_PATH;
+#endif
+    if (!path || !*path) {
+        fprintf(stderr, "Error: no CoreTrust evaluator on this platform, set %s to a library exporting %s!\n", EVALUATOR_PATH_ENV, EVALUATOR_SYMBOL);
+        return;
+    }
+
+    // The handle is never closed, the function stays in use until exit
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "Error: failed to load CoreTrust evaluator %s: %s!\n", path, dlerror());
+        return;
+    }
+    gEvaluatorFunction = (EvaluatorFunction)dlsym(handle, EVALUATOR_SYMBOL);
+    if (!gEvaluatorFunction) {
+        fprintf(stderr, "Error: %s does not export %s!\n", path, EVALUATOR_SYMBOL);
+        dlclose(handle);
+    }
+}
+
+int evaluator_load(void)
+{
+    pthread_once(&gEvaluatorOnce, evaluator_load_once);
+    return gEvaluatorFunction ? 0 : -1;
+}
+
+int evaluator_evaluate_amfi_cms(
+    const CT_uint8_t *cmsData, CT_size_t cmsLen,
+    const CT_uint8_t *detachedData, CT_size_t detachedDataLen,
+    CT_bool allow_test_hierarchy,
+    const CT_uint8_t **leafCert, CT_size_t *leafCertLen,
+    CoreTrustPolicyFlags *policyFlags,
+    CoreTrustDigestType *cmsDigestType,
+    CoreTrustDigestType *hashAgilityDigestType,
+    const CT_uint8_t **digestData, CT_size_t *digestLen,
+    CT_int *resultOut)
+{
+    if (evaluator_load() != 0) return -1;
+    *resultOut = gEvaluatorFunction(cmsData, cmsLen, detachedData, detachedDataLen, allow_test_hierarchy,
+                                    leafCert, leafCertLen, policyFlags, cmsDigestType, hashAgilityDigestType,
+                                    digestData, digestLen);
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include <stdbool.h>
+
+#include "CoreTrust.h"
+
+// CTEvaluateAMFICodeSignatureCMS is resolved with dlopen / dlsym the first time an evaluation is needed,
+// so modes that never evaluate do not pay for binding the framework that exports it
+// CORETRUST_CLI_EVALUATOR overrides the library, on Linux it has to point at a stand-in shared object
+
+#define EVALUATOR_PATH_ENV "CORETRUST_CLI_EVALUATOR"
+#define EVALUATOR_SYMBOL "CTEvaluateAMFICodeSignatureCMS"
+
+typedef CT_int (*EvaluatorFunction)(
+    const CT_uint8_t *cmsData, CT_size_t cmsLen,
+    const CT_uint8_t *detachedData, CT_size_t detachedDataLen,
+    CT_bool allow_test_hierarchy,
+    const CT_uint8_t **leafCert, CT_size_t *leafCertLen,
+    CoreTrustPolicyFlags *policyFlags,
+    CoreTrustDigestType *cmsDigestType,
+    CoreTrustDigestType *hashAgilityDigestType,
+    const CT_uint8_t **digestData, CT_size_t *digestLen);
+
+// Thread safe, the library is only loaded once and a failure is only reported once
+int evaluator_load(void);
+
+// Returns -1 if the evaluator could not be loaded, otherwise 0 with the CoreTrust result in resultOut
+int evaluator_evaluate_amfi_cms(
+    const CT_uint8_t *cmsData, CT_size_t cmsLen,
+    const CT_uint8_t *detachedData, CT_size_t detachedDataLen,
+    CT_bool allow_test_hierarchy,
+    const CT_uint8_t **leafCert, CT_size_t *leafCertLen,
+    CoreTrustPolicyFlags *policyFlags,
+    CoreTrustDigestType *cmsDigestType,
+    CoreTrustDigestType *hashAgilityDigestType,
+    const CT_uint8_t **digestData, CT_size_t *digestLen,
+    CT_int *resultOut);
+
+#endif // EVALUATOR_H
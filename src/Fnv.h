@@ -0,0 +1,36 @@
+#ifndef FNV_H
+#define FNV_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 64-bit FNV-1a, not cryptographic: path tables, grouping and seeding only
+// Snapshot files store these hashes, the constants must not change
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static inline uint64_t fnv_update(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static inline uint64_t fnv_hash(const void *data, size_t size)
+{
+    return fnv_update(FNV_OFFSET_BASIS, data, size);
+}
+
+static inline uint64_t fnv_hash_string(const char *string)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (const char *cur = string; *cur; cur++) {
+        hash = (hash ^ (uint8_t)*cur) * FNV_PRIME;
+    }
+    return hash;
+}
+
+#endif // FNV_H
@@ -0,0 +1,242 @@
+#include "Hash.h"
+#include "HashBackends.h"
+
+#include <string.h>
+#include <pthread.h>
+
+static const uint32_t gSha1InitialState[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+static const uint32_t gSha256InitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint64_t gSha384InitialState[8] = {
+    0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+    0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+};
+
+// Ordered by preference, the first supported entry of each algorithm wins
+static const HashBackend *const gHashBackends[] = {
+#if defined(__x86_64__)
+    &gHashBackendSha1ShaNi,
+    &gHashBackendSha256ShaNi,
+    &gHashBackendSha256Avx2,
+#endif
+#if defined(__aarch64__)
+    &gHashBackendSha1Armv8,
+    &gHashBackendSha256Armv8,
+#endif
+    &gHashBackendSha1Portable,
+    &gHashBackendSha256Portable,
+    &gHashBackendSha384Portable,
+};
+
+#define HASH_BACKEND_COUNT (sizeof(gHashBackends) / sizeof(gHashBackends[0]))
+
+static pthread_once_t gHashDispatchOnce = PTHREAD_ONCE_INIT;
+static const HashBackend *gHashSelected[HASH_ALGORITHM_COUNT];
+static const HashBackend *gHashSelectedMulti[HASH_ALGORITHM_COUNT];
+
+static void hash_dispatch_init(void)
+{
+    for (size_t i = 0; i < HASH_BACKEND_COUNT; i++) {
+        const HashBackend *backend = gHashBackends[i];
+        if (!backend->isSupported()) continue;
+        if (backend->compress && !gHashSelected[backend->algorithm]) {
+            gHashSelected[backend->algorithm] = backend;
+        }
+        if (backend->digestMany && !gHashSelectedMulti[backend->algorithm]) {
+            gHashSelectedMulti[backend->algorithm] = backend;
+        }
+    }
+
+    // Dedicated SHA instructions beat 8-lane vector code, multi-buffer only pays off over the portable fallback
+    for (int algorithm = 0; algorithm < HASH_ALGORITHM_COUNT; algorithm++) {
+        if (gHashSelected[algorithm] && strcmp(gHashSelected[algorithm]->name, "portable") != 0) {
+            gHashSelectedMulti[algorithm] = NULL;
+        }
+    }
+}
+
+size_t hash_get_digest_size(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+        case HASH_ALGORITHM_SHA1:
+            return 20;
+        case HASH_ALGORITHM_SHA256:
+            return 32;
+        case HASH_ALGORITHM_SHA384:
+            return 48;
+        default:
+            return 0;
+    }
+}
+
+size_t hash_get_block_size(HashAlgorithm algorithm)
+{
+    return algorithm == HASH_ALGORITHM_SHA384 ? 128 : 64;
+}
+
+const char *hash_algorithm_to_string(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+        case HASH_ALGORITHM_SHA1:
+            return "sha1";
+        case HASH_ALGORITHM_SHA256:
+            return "sha256";
+        case HASH_ALGORITHM_SHA384:
+            return "sha384";
+        default:
+            return "unknown";
+    }
+}
+
+const HashBackend *hash_get_backend(HashAlgorithm algorithm)
+{
+    if (algorithm >= HASH_ALGORITHM_COUNT) return NULL;
+    pthread_once(&gHashDispatchOnce, hash_dispatch_init);
+    return gHashSelected[algorithm];
+}
+
+const HashBackend *hash_get_multi_backend(HashAlgorithm algorithm)
+{
+    if (algorithm >= HASH_ALGORITHM_COUNT) return NULL;
+    pthread_once(&gHashDispatchOnce, hash_dispatch_init);
+    return gHashSelectedMulti[algorithm];
+}
+
+const HashBackend *const *hash_get_all_backends(size_t *countOut)
+{
+    if (countOut) *countOut = HASH_BACKEND_COUNT;
+    return gHashBackends;
+}
+
+int hash_set_backend(HashAlgorithm algorithm, const char *name)
+{
+    if (algorithm >= HASH_ALGORITHM_COUNT || !name) return -1;
+    pthread_once(&gHashDispatchOnce, hash_dispatch_init);
+
+    bool found = false;
+    for (size_t i = 0; i < HASH_BACKEND_COUNT; i++) {
+        const HashBackend *backend = gHashBackends[i];
+        if (backend->algorithm != algorithm || strcmp(backend->name, name) != 0) continue;
+        if (!backend->isSupported()) return -1;
+        if (backend->compress) gHashSelected[algorithm] = backend;
+        // Forcing a single-buffer backend also forces page hashing through it
+        gHashSelectedMulti[algorithm] = backend->digestMany ? backend : NULL;
+        found = true;
+    }
+    return found ? 0 : -1;
+}
+
+void hash_init(HashContext *context, HashAlgorithm algorithm)
+{
+    memset(context, 0, sizeof(*context));
+    context->algorithm = algorithm;
+    context->backend = hash_get_backend(algorithm);
+    switch (algorithm) {
+        case HASH_ALGORITHM_SHA1:
+            memcpy(context->state.words32, gSha1InitialState, sizeof(gSha1InitialState));
+            break;
+        case HASH_ALGORITHM_SHA256:
+            memcpy(context->state.words32, gSha256InitialState, sizeof(gSha256InitialState));
+            break;
+        case HASH_ALGORITHM_SHA384:
+            memcpy(context->state.words64, gSha384InitialState, sizeof(gSha384InitialState));
+            break;
+        default:
+            break;
+    }
+}
+
+void hash_update(HashContext *context, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    size_t blockSize = hash_get_block_size(context->algorithm);
+    context->length += size;
+
+    if (context->bufferLen) {
+        size_t toCopy = blockSize - context->bufferLen;
+        if (toCopy > size) toCopy = size;
+        memcpy(context->buffer + context->bufferLen, bytes, toCopy);
+        context->bufferLen += toCopy;
+        bytes += toCopy;
+        size -= toCopy;
+        if (context->bufferLen < blockSize) return;
+        context->backend->compress(&context->state, context->buffer, 1);
+        context->bufferLen = 0;
+    }
+
+    size_t blockCount = size / blockSize;
+    if (blockCount) {
+        context->backend->compress(&context->state, bytes, blockCount);
+        bytes += blockCount * blockSize;
+        size -= blockCount * blockSize;
+    }
+
+    if (size) {
+        memcpy(context->buffer, bytes, size);
+        context->bufferLen = size;
+    }
+}
+
+void hash_final(HashContext *context, uint8_t *digestOut)
+{
+    size_t blockSize = hash_get_block_size(context->algorithm);
+    // SHA-384 carries a 128 bit length, the top half is always zero here
+    size_t lengthSize = blockSize == 128 ? 16 : 8;
+    uint64_t bitLength = context->length * 8;
+
+    context->buffer[context->bufferLen++] = 0x80;
+    if (context->bufferLen > blockSize - lengthSize) {
+        memset(context->buffer + context->bufferLen, 0, blockSize - context->bufferLen);
+        context->backend->compress(&context->state, context->buffer, 1);
+        context->bufferLen = 0;
+    }
+    memset(context->buffer + context->bufferLen, 0, blockSize - context->bufferLen);
+    hash_store64_be(context->buffer + blockSize - 8, bitLength);
+    context->backend->compress(&context->state, context->buffer, 1);
+
+    size_t digestSize = hash_get_digest_size(context->algorithm);
+    if (context->algorithm == HASH_ALGORITHM_SHA384) {
+        for (size_t i = 0; i < digestSize / 8; i++) {
+            hash_store64_be(digestOut + i * 8, context->state.words64[i]);
+        }
+    }
+    else {
+        for (size_t i = 0; i < digestSize / 4; i++) {
+            hash_store32_be(digestOut + i * 4, context->state.words32[i]);
+        }
+    }
+    memset(context, 0, sizeof(*context));
+}
+
+void hash_digest(HashAlgorithm algorithm, const void *data, size_t size, uint8_t *digestOut)
+{
+    HashContext context;
+    hash_init(&context, algorithm);
+    hash_update(&context, data, size);
+    hash_final(&context, digestOut);
+}
+
+void hash_digest_many(HashAlgorithm algorithm, const uint8_t *const *inputs, size_t size, size_t count, uint8_t *digestsOut)
+{
+    size_t digestSize = hash_get_digest_size(algorithm);
+    const HashBackend *multi = hash_get_multi_backend(algorithm);
+    size_t done = 0;
+
+    if (multi && multi->lanes > 1) {
+        size_t batched = count - (count % multi->lanes);
+        if (batched) {
+            multi->digestMany(inputs, size, batched, digestsOut);
+            done = batched;
+        }
+    }
+
+    // Tail (or everything, without a multi-buffer backend) goes through the single-buffer path
+    for (; done < count; done++) {
+        hash_digest(algorithm, inputs[done], size, digestsOut + done * digestSize);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Hashing used on the hot path (cdhashes, page and special slot hashes)
+// Backends are picked once at startup from CPUID / HWCAP, hash_set_backend can override the choice
+
+typedef enum {
+    HASH_ALGORITHM_SHA1 = 0,
+    HASH_ALGORITHM_SHA256,
+    HASH_ALGORITHM_SHA384,
+    HASH_ALGORITHM_COUNT,
+} HashAlgorithm;
+
+#define HASH_MAX_DIGEST_SIZE 48
+#define HASH_MAX_BLOCK_SIZE 128
+
+typedef struct HashBackend {
+    const char *name;
+    HashAlgorithm algorithm;
+    bool (*isSupported)(void);
+    // Process blockCount full blocks
+    void (*compress)(void *state, const uint8_t *blocks, size_t blockCount);
+    // Optional: hash `count` equally sized messages at once, lanes is the preferred batch size
+    void (*digestMany)(const uint8_t *const *inputs, size_t size, size_t count, uint8_t *digestsOut);
+    unsigned lanes;
+} HashBackend;
+
+typedef struct HashContext {
+    const HashBackend *backend;
+    HashAlgorithm algorithm;
+    union {
+        uint32_t words32[8];
+        uint64_t words64[8];
+    } state;
+    uint64_t length;
+    uint8_t buffer[HASH_MAX_BLOCK_SIZE];
+    size_t bufferLen;
+} HashContext;
+
+size_t hash_get_digest_size(HashAlgorithm algorithm);
+size_t hash_get_block_size(HashAlgorithm algorithm);
+const char *hash_algorithm_to_string(HashAlgorithm algorithm);
+
+void hash_init(HashContext *context, HashAlgorithm algorithm);
+void hash_update(HashContext *context, const void *data, size_t size);
+void hash_final(HashContext *context, uint8_t *digestOut);
+
+// One-shot digest
+void hash_digest(HashAlgorithm algorithm, const void *data, size_t size, uint8_t *digestOut);
+
+// Digest `count` messages of `size` bytes each (e.g. code pages) into consecutive digests
+// Uses a multi-buffer backend when one is available
+void hash_digest_many(HashAlgorithm algorithm, const uint8_t *const *inputs, size_t size, size_t count, uint8_t *digestsOut);
+
+// Backend currently in use for an algorithm
+const HashBackend *hash_get_backend(HashAlgorithm algorithm);
+const HashBackend *hash_get_multi_backend(HashAlgorithm algorithm);
+
+// Enumerate every backend compiled in, supported or not
+const HashBackend *const *hash_get_all_backends(size_t *countOut);
+
+// Force a backend by name (e.g. "portable"), returns -1 if it is unknown or unsupported on this CPU
+int hash_set_backend(HashAlgorithm algorithm, const char *name);
+
+#endif // HASH_H
@@ -0,0 +1,128 @@
+#include "HashBackends.h"
+
+#if defined(__aarch64__)
+
+#include <arm_neon.h>
+
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+// ARMv8 Cryptography Extensions for SHA-1 / SHA-256
+
+#if defined(__clang__)
+#define HASH_ARM_CRYPTO_TARGET __attribute__((target("crypto")))
+#else
+#define HASH_ARM_CRYPTO_TARGET __attribute__((target("+crypto")))
+#endif
+
+static bool hash_arm64_has_sha1(void)
+{
+#if defined(__APPLE__)
+    // Every arm64 Apple SoC implements the SHA1 / SHA2 instructions
+    return true;
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+#else
+    return false;
+#endif
+}
+
+static bool hash_arm64_has_sha2(void)
+{
+#if defined(__APPLE__)
+    return true;
+#elif defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+    return false;
+#endif
+}
+
+HASH_ARM_CRYPTO_TARGET
+static inline uint32x4_t hash_arm64_load_be(const uint8_t *p)
+{
+    return vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p)));
+}
+
+HASH_ARM_CRYPTO_TARGET
+static void hash_sha1_compress_armv8(void *stateArg, const uint8_t *blocks, size_t blockCount)
+{
+    static const uint32_t roundConstants[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+    uint32_t *state = stateArg;
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32_t e0 = state[4];
+
+    for (size_t block = 0; block < blockCount; block++, blocks += 64) {
+        uint32x4_t abcdSave = abcd;
+        uint32_t e = e0;
+        uint32x4_t w[4];
+        for (int i = 0; i < 4; i++) w[i] = hash_arm64_load_be(blocks + i * 16);
+
+        for (int g = 0; g < 20; g++) {
+            if (g >= 4) {
+                w[g & 3] = vsha1su1q_u32(vsha1su0q_u32(w[g & 3], w[(g + 1) & 3], w[(g + 2) & 3]), w[(g + 3) & 3]);
+            }
+            uint32x4_t wk = vaddq_u32(w[g & 3], vdupq_n_u32(roundConstants[g / 5]));
+            uint32_t eNext = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+            if (g < 5) abcd = vsha1cq_u32(abcd, e, wk);
+            else if (g < 10 || g >= 15) abcd = vsha1pq_u32(abcd, e, wk);
+            else abcd = vsha1mq_u32(abcd, e, wk);
+            e = eNext;
+        }
+
+        abcd = vaddq_u32(abcd, abcdSave);
+        e0 += e;
+    }
+
+    vst1q_u32(state, abcd);
+    state[4] = e0;
+}
+
+HASH_ARM_CRYPTO_TARGET
+static void hash_sha256_compress_armv8(void *stateArg, const uint8_t *blocks, size_t blockCount)
+{
+    uint32_t *state = stateArg;
+    uint32x4_t state0 = vld1q_u32(&state[0]);
+    uint32x4_t state1 = vld1q_u32(&state[4]);
+
+    for (size_t block = 0; block < blockCount; block++, blocks += 64) {
+        uint32x4_t abcdSave = state0;
+        uint32x4_t efghSave = state1;
+        uint32x4_t w[4];
+        for (int i = 0; i < 4; i++) w[i] = hash_arm64_load_be(blocks + i * 16);
+
+        for (int i = 0; i < 16; i++) {
+            if (i >= 4) {
+                w[i & 3] = vsha256su1q_u32(vsha256su0q_u32(w[i & 3], w[(i + 1) & 3]), w[(i + 2) & 3], w[(i + 3) & 3]);
+            }
+            uint32x4_t wk = vaddq_u32(w[i & 3], vld1q_u32(&gHashSha256RoundConstants[i * 4]));
+            uint32x4_t tmp = state0;
+            state0 = vsha256hq_u32(state0, state1, wk);
+            state1 = vsha256h2q_u32(state1, tmp, wk);
+        }
+
+        state0 = vaddq_u32(state0, abcdSave);
+        state1 = vaddq_u32(state1, efghSave);
+    }
+
+    vst1q_u32(&state[0], state0);
+    vst1q_u32(&state[4], state1);
+}
+
+const HashBackend gHashBackendSha1Armv8 = {
+    .name = "armv8",
+    .algorithm = HASH_ALGORITHM_SHA1,
+    .isSupported = hash_arm64_has_sha1,
+    .compress = hash_sha1_compress_armv8,
+};
+
+const HashBackend gHashBackendSha256Armv8 = {
+    .name = "armv8",
+    .algorithm = HASH_ALGORITHM_SHA256,
+    .isSupported = hash_arm64_has_sha2,
+    .compress = hash_sha256_compress_armv8,
+};
+
+#endif // __aarch64__
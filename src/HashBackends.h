@@ -0,0 +1,52 @@
+#ifndef HASH_BACKENDS_H
+#define HASH_BACKENDS_H
+
+#include "Hash.h"
+
+// Backends known to Hash.c, not part of the public interface
+// Compress functions take the raw state (uint32_t[5 or 8] / uint64_t[8]) and whole blocks
+
+extern const HashBackend gHashBackendSha1Portable;
+extern const HashBackend gHashBackendSha256Portable;
+extern const HashBackend gHashBackendSha384Portable;
+
+#if defined(__x86_64__)
+extern const HashBackend gHashBackendSha1ShaNi;
+extern const HashBackend gHashBackendSha256ShaNi;
+extern const HashBackend gHashBackendSha256Avx2;
+#endif
+
+#if defined(__aarch64__)
+extern const HashBackend gHashBackendSha1Armv8;
+extern const HashBackend gHashBackendSha256Armv8;
+#endif
+
+void hash_sha1_compress_portable(void *state, const uint8_t *blocks, size_t blockCount);
+void hash_sha256_compress_portable(void *state, const uint8_t *blocks, size_t blockCount);
+void hash_sha512_compress_portable(void *state, const uint8_t *blocks, size_t blockCount);
+
+extern const uint32_t gHashSha256RoundConstants[64];
+extern const uint64_t gHashSha512RoundConstants[80];
+
+static inline uint32_t hash_load32_be(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t hash_load64_be(const uint8_t *p)
+{
+    return ((uint64_t)hash_load32_be(p) << 32) | hash_load32_be(p + 4);
+}
+
+static inline void hash_store32_be(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static inline void hash_store64_be(uint8_t *p, uint64_t v)
+{
+    hash_store32_be(p, (uint32_t)(v >> 32));
+    hash_store32_be(p + 4, (uint32_t)v);
+}
+
+#endif // HASH_BACKENDS_H
@@ -0,0 +1,232 @@
+#include "HashBackends.h"
+
+#if defined(__x86_64__)
+
+#include <string.h>
+#include <cpuid.h>
+#include <immintrin.h>
+
+// SHA extensions (Goldmont / Zen and later) for single streams,
+// 8-lane AVX2 SHA-256 for hashing many equally sized code pages at once
+
+static bool hash_x86_has_sha(void)
+{
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+    bool ssse3 = ecx & (1 << 9);
+    bool sse41 = ecx & (1 << 19);
+    if (!ssse3 || !sse41) return false;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+    return ebx & (1 << 29);
+}
+
+static bool hash_x86_has_avx2(void)
+{
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+    // OSXSAVE + AVX, then make sure the OS actually saves the YMM state
+    if ((ecx & (1 << 27)) == 0 || (ecx & (1 << 28)) == 0) return false;
+    uint32_t xcr0Low, xcr0High;
+    __asm__ volatile("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    if ((xcr0Low & 0x6) != 0x6) return false;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+    return ebx & (1 << 5);
+}
+
+#define SHA1_SHANI_GROUP(g, func) do { \
+    if ((g) < 4) { \
+        w[(g) & 3] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(blocks + (g) * 16)), mask); \
+    } \
+    __m128i x = (g) == 0 ? _mm_add_epi32(e, w[0]) : _mm_sha1nexte_epu32(e, w[(g) & 3]); \
+    e = abcd; \
+    if ((g) >= 3 && (g) <= 18) w[((g) + 1) & 3] = _mm_sha1msg2_epu32(w[((g) + 1) & 3], w[(g) & 3]); \
+    abcd = _mm_sha1rnds4_epu32(abcd, x, func); \
+    if ((g) >= 1 && (g) <= 16) w[((g) + 3) & 3] = _mm_sha1msg1_epu32(w[((g) + 3) & 3], w[(g) & 3]); \
+    if ((g) >= 2 && (g) <= 17) w[((g) + 2) & 3] = _mm_xor_si128(w[((g) + 2) & 3], w[(g) & 3]); \
+} while (0)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void hash_sha1_compress_shani(void *stateArg, const uint8_t *blocks, size_t blockCount)
+{
+    uint32_t *state = stateArg;
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+    __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+    for (size_t block = 0; block < blockCount; block++, blocks += 64) {
+        __m128i abcdSave = abcd;
+        __m128i e = e0;
+        __m128i w[4];
+
+        for (int g = 0; g < 5; g++) SHA1_SHANI_GROUP(g, 0);
+        for (int g = 5; g < 10; g++) SHA1_SHANI_GROUP(g, 1);
+        for (int g = 10; g < 15; g++) SHA1_SHANI_GROUP(g, 2);
+        for (int g = 15; g < 20; g++) SHA1_SHANI_GROUP(g, 3);
+
+        e0 = _mm_sha1nexte_epu32(e, e0);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+    }
+
+    _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void hash_sha256_compress_shani(void *stateArg, const uint8_t *blocks, size_t blockCount)
+{
+    uint32_t *state = stateArg;
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // Rearrange into the ABEF / CDGH layout the instructions expect
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for (size_t block = 0; block < blockCount; block++, blocks += 64) {
+        __m128i abefSave = state0;
+        __m128i cdghSave = state1;
+        __m128i w[4];
+
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(blocks + i * 16)), mask);
+            }
+            else {
+                __m128i t = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                t = _mm_add_epi32(t, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(t, w[(i + 3) & 3]);
+            }
+            __m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&gHashSha256RoundConstants[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        }
+
+        state0 = _mm_add_epi32(state0, abefSave);
+        state1 = _mm_add_epi32(state1, cdghSave);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+#define AVX2_LANES 8
+#define AVX2_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+__attribute__((target("avx2")))
+static inline __m256i hash_avx2_load_words(const uint8_t *const lanes[AVX2_LANES], size_t offset)
+{
+    return _mm256_setr_epi32((int)hash_load32_be(lanes[0] + offset), (int)hash_load32_be(lanes[1] + offset),
+                             (int)hash_load32_be(lanes[2] + offset), (int)hash_load32_be(lanes[3] + offset),
+                             (int)hash_load32_be(lanes[4] + offset), (int)hash_load32_be(lanes[5] + offset),
+                             (int)hash_load32_be(lanes[6] + offset), (int)hash_load32_be(lanes[7] + offset));
+}
+
+// One block for each of the 8 lanes, lanes[i] + offset points at that lane's block
+__attribute__((target("avx2")))
+static void hash_sha256_avx2_block(__m256i state[8], const uint8_t *const lanes[AVX2_LANES], size_t offset)
+{
+    __m256i w[16];
+    __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+    __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 64; i++) {
+        __m256i wi;
+        if (i < 16) {
+            wi = hash_avx2_load_words(lanes, offset + i * 4);
+        }
+        else {
+            __m256i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(w15, 7), AVX2_ROTR(w15, 18)), _mm256_srli_epi32(w15, 3));
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(w2, 17), AVX2_ROTR(w2, 19)), _mm256_srli_epi32(w2, 10));
+            wi = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i - 7) & 15], s1));
+        }
+        w[i & 15] = wi;
+
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(e, 6), AVX2_ROTR(e, 11)), AVX2_ROTR(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, s1), _mm256_add_epi32(ch, wi));
+        t1 = _mm256_add_epi32(t1, _mm256_set1_epi32((int)gHashSha256RoundConstants[i]));
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(a, 2), AVX2_ROTR(a, 13)), AVX2_ROTR(a, 22));
+        __m256i maj = _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+        __m256i t2 = _mm256_add_epi32(s0, maj);
+        h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+        d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+    }
+
+    state[0] = _mm256_add_epi32(state[0], a); state[1] = _mm256_add_epi32(state[1], b);
+    state[2] = _mm256_add_epi32(state[2], c); state[3] = _mm256_add_epi32(state[3], d);
+    state[4] = _mm256_add_epi32(state[4], e); state[5] = _mm256_add_epi32(state[5], f);
+    state[6] = _mm256_add_epi32(state[6], g); state[7] = _mm256_add_epi32(state[7], h);
+}
+
+__attribute__((target("avx2")))
+static void hash_sha256_digest_many_avx2(const uint8_t *const *inputs, size_t size, size_t count, uint8_t *digestsOut)
+{
+    static const uint32_t initialState[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    size_t fullBlocks = size / 64;
+    size_t tailSize = size % 64;
+    // The padding needs a second block when the tail leaves no room for the 0x80 byte + length
+    size_t tailBlocks = tailSize < 56 ? 1 : 2;
+    uint8_t tails[AVX2_LANES][128];
+
+    for (size_t base = 0; base + AVX2_LANES <= count; base += AVX2_LANES) {
+        __m256i state[8];
+        for (int i = 0; i < 8; i++) state[i] = _mm256_set1_epi32((int)initialState[i]);
+
+        const uint8_t *lanes[AVX2_LANES];
+        for (int lane = 0; lane < AVX2_LANES; lane++) lanes[lane] = inputs[base + lane];
+        for (size_t block = 0; block < fullBlocks; block++) {
+            hash_sha256_avx2_block(state, lanes, block * 64);
+        }
+
+        const uint8_t *tailLanes[AVX2_LANES];
+        for (int lane = 0; lane < AVX2_LANES; lane++) {
+            memset(tails[lane], 0, sizeof(tails[lane]));
+            memcpy(tails[lane], inputs[base + lane] + fullBlocks * 64, tailSize);
+            tails[lane][tailSize] = 0x80;
+            hash_store64_be(tails[lane] + tailBlocks * 64 - 8, (uint64_t)size * 8);
+            tailLanes[lane] = tails[lane];
+        }
+        for (size_t block = 0; block < tailBlocks; block++) {
+            hash_sha256_avx2_block(state, tailLanes, block * 64);
+        }
+
+        uint32_t words[8][AVX2_LANES];
+        for (int i = 0; i < 8; i++) _mm256_storeu_si256((__m256i *)words[i], state[i]);
+        for (int lane = 0; lane < AVX2_LANES; lane++) {
+            uint8_t *digest = digestsOut + (base + lane) * 32;
+            for (int i = 0; i < 8; i++) hash_store32_be(digest + i * 4, words[i][lane]);
+        }
+    }
+}
+
+const HashBackend gHashBackendSha1ShaNi = {
+    .name = "shani",
+    .algorithm = HASH_ALGORITHM_SHA1,
+    .isSupported = hash_x86_has_sha,
+    .compress = hash_sha1_compress_shani,
+};
+
+const HashBackend gHashBackendSha256ShaNi = {
+    .name = "shani",
+    .algorithm = HASH_ALGORITHM_SHA256,
+    .isSupported = hash_x86_has_sha,
+    .compress = hash_sha256_compress_shani,
+};
+
+const HashBackend gHashBackendSha256Avx2 = {
+    .name = "avx2",
+    .algorithm = HASH_ALGORITHM_SHA256,
+    .isSupported = hash_x86_has_avx2,
+    .digestMany = hash_sha256_digest_many_avx2,
+    .lanes = AVX2_LANES,
+};
+
+#endif // __x86_64__
@@ -0,0 +1,250 @@
+#include "LazyFat.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <choma/Host.h>
+#include <choma/FileStream.h>
+#include <choma/MachOByteOrder.h>
+
+static int lazy_fat_parse_arch_table(LazyFat *fat, uint32_t magic, size_t fileSize)
+{
+    struct fat_header header;
+    if (memory_stream_read(fat->stream, 0, sizeof(header), &header) != 0) return -1;
+    uint32_t archCount = BIG_TO_HOST(header.nfat_arch);
+    if (archCount == 0 || archCount > LAZY_FAT_MAX_SLICES) return -1;
+
+    size_t archSize = magic == FAT_MAGIC_64 ? sizeof(struct fat_arch_64) : sizeof(struct fat_arch);
+    uint8_t *table = malloc(archCount * archSize);
+    fat->slices = calloc(archCount, sizeof(LazyFatSlice));
+    if (!table || !fat->slices || memory_stream_read(fat->stream, sizeof(header), archCount * archSize, table) != 0) {
+        free(table);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < archCount; i++) {
+        struct fat_arch_64 arch;
+        if (magic == FAT_MAGIC_64) {
+            memcpy(&arch, table + i * archSize, sizeof(arch));
+            arch.offset = BIG_TO_HOST(arch.offset);
+            arch.size = BIG_TO_HOST(arch.size);
+        }
+        else {
+            struct fat_arch arch32;
+            memcpy(&arch32, table + i * archSize, sizeof(arch32));
+            arch.offset = BIG_TO_HOST(arch32.offset);
+            arch.size = BIG_TO_HOST(arch32.size);
+            arch.cputype = arch32.cputype;
+            arch.cpusubtype = arch32.cpusubtype;
+            arch.align = arch32.align;
+            arch.reserved = 0;
+        }
+        arch.cputype = BIG_TO_HOST(arch.cputype);
+        arch.cpusubtype = BIG_TO_HOST(arch.cpusubtype);
+        arch.align = BIG_TO_HOST(arch.align);
+        // Slices pointing outside of the file can never be loaded, drop them here
+        if (arch.offset >= fileSize || arch.size > fileSize - arch.offset) continue;
+        fat->slices[fat->sliceCount++].archDescriptor = arch;
+    }
+    free(table);
+    return fat->sliceCount ? 0 : -1;
+}
+
+static int lazy_fat_load_header(LazyFat *fat, LazyFatSlice *slice)
+{
+    if (slice->headerLoaded) return slice->headerValid ? 0 : -1;
+    slice->headerLoaded = true;
+
+    uint32_t magic = 0;
+    if (slice->archDescriptor.size < sizeof(struct mach_header)) return -1;
+    if (memory_stream_read(fat->stream, slice->archDescriptor.offset, sizeof(magic), &magic) != 0) return -1;
+    magic = LITTLE_TO_HOST(magic);
+    if (magic != MH_MAGIC && magic != MH_MAGIC_64) return -1;
+
+    size_t headerSize = magic == MH_MAGIC_64 ? sizeof(struct mach_header_64) : sizeof(struct mach_header);
+    if (slice->archDescriptor.size < headerSize) return -1;
+    memset(&slice->machHeader, 0, sizeof(slice->machHeader));
+    if (memory_stream_read(fat->stream, slice->archDescriptor.offset, headerSize, &slice->machHeader) != 0) return -1;
+    slice->machHeader.magic = magic;
+    slice->machHeader.cputype = LITTLE_TO_HOST(slice->machHeader.cputype);
+    slice->machHeader.cpusubtype = LITTLE_TO_HOST(slice->machHeader.cpusubtype);
+    slice->machHeader.filetype = LITTLE_TO_HOST(slice->machHeader.filetype);
+    slice->machHeader.ncmds = LITTLE_TO_HOST(slice->machHeader.ncmds);
+    slice->machHeader.sizeofcmds = LITTLE_TO_HOST(slice->machHeader.sizeofcmds);
+    slice->machHeader.flags = LITTLE_TO_HOST(slice->machHeader.flags);
+    slice->is64Bit = magic == MH_MAGIC_64;
+    slice->headerValid = true;
+    return 0;
+}
+
+LazyFat *lazy_fat_init_from_memory_stream(MemoryStream *stream)
+{
+    LazyFat *fat = calloc(1, sizeof(LazyFat));
+    if (!fat) {
+        memory_stream_free(stream);
+        return NULL;
+    }
+    fat->stream = stream;
+
+    size_t fileSize = memory_stream_get_size(stream);
+    uint32_t magic = 0;
+    if (fileSize < sizeof(struct fat_header) || memory_stream_read(stream, 0, sizeof(magic), &magic) != 0) goto fail;
+
+    if (BIG_TO_HOST(magic) == FAT_MAGIC || BIG_TO_HOST(magic) == FAT_MAGIC_64) {
+        fat->isFat = true;
+        if (lazy_fat_parse_arch_table(fat, BIG_TO_HOST(magic), fileSize) != 0) goto fail;
+    }
+    else {
+        // Thin Mach-O, the header has to be read anyway to describe the only slice
+        fat->slices = calloc(1, sizeof(LazyFatSlice));
+        if (!fat->slices) goto fail;
+        fat->sliceCount = 1;
+        fat->slices[0].archDescriptor.offset = 0;
+        fat->slices[0].archDescriptor.size = fileSize;
+        if (lazy_fat_load_header(fat, &fat->slices[0]) != 0) goto fail;
+        fat->slices[0].archDescriptor.cputype = fat->slices[0].machHeader.cputype;
+        fat->slices[0].archDescriptor.cpusubtype = fat->slices[0].machHeader.cpusubtype;
+    }
+    return fat;
+
+fail:
+    lazy_fat_free(fat);
+    return NULL;
+}
+
+LazyFat *lazy_fat_init_from_path(const char *path)
+{
+    MemoryStream *stream = file_stream_init_from_path(path, 0, FILE_STREAM_SIZE_AUTO, 0);
+    if (!stream) return NULL;
+    return lazy_fat_init_from_memory_stream(stream);
+}
+
+LazyFatSlice *lazy_fat_find_slice(LazyFat *fat, cpu_type_t cputype, cpu_subtype_t cpusubtype)
+{
+    for (uint32_t i = 0; i < fat->sliceCount; i++) {
+        LazyFatSlice *slice = &fat->slices[i];
+        if (slice->archDescriptor.cputype != cputype || slice->archDescriptor.cpusubtype != cpusubtype) continue;
+        if (lazy_fat_load_header(fat, slice) == 0) return slice;
+    }
+    return NULL;
+}
+
+LazyFatSlice *lazy_fat_find_preferred_slice(LazyFat *fat)
+{
+    cpu_type_t cputype;
+    cpu_subtype_t cpusubtype;
+    if (host_get_cpu_information(&cputype, &cpusubtype) != 0) return NULL;
+
+    LazyFatSlice *slice = NULL;
+    if (cputype == CPU_TYPE_ARM64) {
+        if (cpusubtype == CPU_SUBTYPE_ARM64E) {
+            // New ABI arm64e first, then the old one
+            slice = lazy_fat_find_slice(fat, cputype, CPU_SUBTYPE_ARM64E | CPU_SUBTYPE_ARM64E_ABI_V2);
+            if (!slice) {
+                slice = lazy_fat_find_slice(fat, cputype, CPU_SUBTYPE_ARM64E);
+            }
+        }
+        if (!slice) {
+            // The kernel prefers arm64v8 to plain arm64
+            slice = lazy_fat_find_slice(fat, cputype, CPU_SUBTYPE_ARM64_V8);
+            if (!slice) {
+                slice = lazy_fat_find_slice(fat, cputype, CPU_SUBTYPE_ARM64_ALL);
+            }
+        }
+    }
+    return slice;
+}
+
+int lazy_fat_slice_read_at_offset(LazyFat *fat, LazyFatSlice *slice, uint64_t offset, size_t size, void *outBuf)
+{
+    if (offset > slice->archDescriptor.size || size > slice->archDescriptor.size - offset) return -1;
+    return memory_stream_read(fat->stream, slice->archDescriptor.offset + offset, size, outBuf);
+}
+
+int lazy_fat_slice_find_code_signature_bounds(LazyFat *fat, LazyFatSlice *slice, uint32_t *offsetOut, uint32_t *sizeOut)
+{
+    if (lazy_fat_load_header(fat, slice) != 0) return -1;
+
+    uint64_t headerSize = slice->is64Bit ? sizeof(struct mach_header_64) : sizeof(struct mach_header);
+    uint32_t sizeofcmds = slice->machHeader.sizeofcmds;
+    if (sizeofcmds > slice->archDescriptor.size - headerSize) return -1;
+    uint8_t *commands = malloc(sizeofcmds ? sizeofcmds : 1);
+    if (!commands) return -1;
+    if (lazy_fat_slice_read_at_offset(fat, slice, headerSize, sizeofcmds, commands) != 0) {
+        free(commands);
+        return -1;
+    }
+
+    int r = -1;
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < slice->machHeader.ncmds && offset + sizeof(struct load_command) <= sizeofcmds; i++) {
+        struct load_command command;
+        memcpy(&command, commands + offset, sizeof(command));
+        command.cmd = LITTLE_TO_HOST(command.cmd);
+        command.cmdsize = LITTLE_TO_HOST(command.cmdsize);
+        if (command.cmdsize < sizeof(struct load_command) || offset + command.cmdsize > sizeofcmds) break;
+
+        if (command.cmd == LC_CODE_SIGNATURE && command.cmdsize >= sizeof(struct linkedit_data_command)) {
+            struct linkedit_data_command signatureCommand;
+            memcpy(&signatureCommand, commands + offset, sizeof(signatureCommand));
+            *offsetOut = LITTLE_TO_HOST(signatureCommand.dataoff);
+            *sizeOut = LITTLE_TO_HOST(signatureCommand.datasize);
+            r = 0;
+            break;
+        }
+        offset += command.cmdsize;
+    }
+    free(commands);
+    return r;
+}
+
+CS_SuperBlob *lazy_fat_slice_read_code_signature(LazyFat *fat, LazyFatSlice *slice)
+{
+    uint32_t offset = 0, size = 0;
+    if (lazy_fat_slice_find_code_signature_bounds(fat, slice, &offset, &size) != 0) return NULL;
+    if (size < sizeof(CS_SuperBlob)) return NULL;
+
+    CS_SuperBlob *superblob = malloc(size);
+    if (!superblob) return NULL;
+    if (lazy_fat_slice_read_at_offset(fat, slice, offset, size, superblob) != 0) {
+        free(superblob);
+        return NULL;
+    }
+    return superblob;
+}
+
+MemoryStream *lazy_fat_slice_get_stream(LazyFat *fat, LazyFatSlice *slice)
+{
+    MemoryStream *stream = memory_stream_softclone(fat->stream);
+    if (!stream) return NULL;
+    size_t fileSize = memory_stream_get_size(fat->stream);
+    uint64_t sliceEnd = slice->archDescriptor.offset + slice->archDescriptor.size;
+    if (memory_stream_trim(stream, slice->archDescriptor.offset, fileSize - sliceEnd) != 0) {
+        memory_stream_free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+MachO *lazy_fat_slice_get_macho(LazyFat *fat, LazyFatSlice *slice)
+{
+    if (slice->macho) return slice->macho;
+    if (lazy_fat_load_header(fat, slice) != 0) return NULL;
+
+    // macho_init takes over the stream and frees it on failure
+    MemoryStream *stream = lazy_fat_slice_get_stream(fat, slice);
+    if (!stream) return NULL;
+    slice->macho = macho_init(stream, slice->archDescriptor);
+    return slice->macho;
+}
+
+void lazy_fat_free(LazyFat *fat)
+{
+    if (!fat) return;
+    for (uint32_t i = 0; i < fat->sliceCount; i++) {
+        if (fat->slices[i].macho) macho_free(fat->slices[i].macho);
+    }
+    free(fat->slices);
+    if (fat->stream) memory_stream_free(fat->stream);
+    free(fat);
+}
@@ -0,0 +1,58 @@
+#ifndef LAZY_FAT_H
+#define LAZY_FAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <choma/FAT.h>
+#include <choma/MachO.h>
+#include <choma/CSBlob.h>
+
+// Universal binary view that only reads the fat_arch table up front
+// A slice's mach header is read the first time the slice is looked at, its ChOma MachO (segments, sections,
+// fileset entries) is only built when lazy_fat_slice_get_macho is called, so evaluating one slice of a
+// binary with many slices costs one table read and one header read instead of a full parse of every slice
+
+#define LAZY_FAT_MAX_SLICES 64
+
+typedef struct LazyFatSlice {
+    struct fat_arch_64 archDescriptor;
+    bool headerLoaded;
+    bool headerValid;
+    bool is64Bit;
+    struct mach_header_64 machHeader; // reserved is 0 for 32-bit slices
+    MachO *macho; // built on demand, owned by the slice
+} LazyFatSlice;
+
+typedef struct LazyFat {
+    MemoryStream *stream;
+    bool isFat; // false for a thin Mach-O, which is presented as a single slice
+    uint32_t sliceCount;
+    LazyFatSlice *slices;
+} LazyFat;
+
+// Takes ownership of the stream, NULL if it is neither a FAT nor a Mach-O file
+LazyFat *lazy_fat_init_from_memory_stream(MemoryStream *stream);
+LazyFat *lazy_fat_init_from_path(const char *path);
+
+// Match against the fat_arch table like the kernel does, the slice's header is read before it is returned
+LazyFatSlice *lazy_fat_find_slice(LazyFat *fat, cpu_type_t cputype, cpu_subtype_t cpusubtype);
+
+// Same order as ChOma's fat_find_preferred_slice: the slice the kernel would load on this host
+LazyFatSlice *lazy_fat_find_preferred_slice(LazyFat *fat);
+
+int lazy_fat_slice_read_at_offset(LazyFat *fat, LazyFatSlice *slice, uint64_t offset, size_t size, void *outBuf);
+
+// Walks the load commands straight from the stream, without building the MachO
+int lazy_fat_slice_find_code_signature_bounds(LazyFat *fat, LazyFatSlice *slice, uint32_t *offsetOut, uint32_t *sizeOut);
+CS_SuperBlob *lazy_fat_slice_read_code_signature(LazyFat *fat, LazyFatSlice *slice);
+
+// Soft clone of the file stream trimmed to the slice, the caller frees it
+MemoryStream *lazy_fat_slice_get_stream(LazyFat *fat, LazyFatSlice *slice);
+
+// Full ChOma MachO for the segment, symbol and load command APIs, built on first use and freed with the FAT
+MachO *lazy_fat_slice_get_macho(LazyFat *fat, LazyFatSlice *slice);
+
+void lazy_fat_free(LazyFat *fat);
+
+#endif // LAZY_FAT_H
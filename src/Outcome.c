@@ -0,0 +1,87 @@
+#include "Outcome.h"
+
+#include <stdlib.h>
+
+void outcome_table_add(OutcomeTable *table, CT_int result, CoreTrustPolicyFlags policyFlags, uint64_t count)
+{
+    for (unsigned i = 0; i < table->count; i++) {
+        if (table->outcomes[i].result == result && table->outcomes[i].policyFlags == policyFlags) {
+            table->outcomes[i].count += count;
+            return;
+        }
+    }
+    if (table->count == OUTCOME_TABLE_MAX_OUTCOMES) {
+        table->otherCount += count;
+        return;
+    }
+    table->outcomes[table->count++] = (Outcome){ result, policyFlags, count };
+}
+
+void outcome_table_merge(OutcomeTable *table, const OutcomeTable *other)
+{
+    for (unsigned i = 0; i < other->count; i++) {
+        outcome_table_add(table, other->outcomes[i].result, other->outcomes[i].policyFlags, other->outcomes[i].count);
+    }
+    table->otherCount += other->otherCount;
+}
+
+static int outcome_compare(const void *a, const void *b)
+{
+    const Outcome *outcomeA = a, *outcomeB = b;
+    if (outcomeA->count != outcomeB->count) return outcomeA->count > outcomeB->count ? -1 : 1;
+    return 0;
+}
+
+void outcome_table_print(OutcomeTable *table, FILE *output)
+{
+    qsort(table->outcomes, table->count, sizeof(Outcome), outcome_compare);
+    for (unsigned i = 0; i < table->count; i++) {
+        fprintf(output, "\tresult=0x%x policy=0x%llx: %llu\n", (unsigned)table->outcomes[i].result,
+                (unsigned long long)table->outcomes[i].policyFlags, (unsigned long long)table->outcomes[i].count);
+    }
+    if (table->otherCount) {
+        fprintf(output, "\tother: %llu\n", (unsigned long long)table->otherCount);
+    }
+}
+
+int outcome_buffer_init(OutcomeBuffer *buffer, FILE *output, pthread_mutex_t *lock)
+{
+    buffer->data = malloc(OUTCOME_OUTPUT_BUFFER_SIZE);
+    buffer->size = 0;
+    buffer->output = output;
+    buffer->lock = lock;
+    return buffer->data ? 0 : -1;
+}
+
+void outcome_buffer_flush(OutcomeBuffer *buffer)
+{
+    if (!buffer->size) return;
+    pthread_mutex_lock(buffer->lock);
+    fwrite(buffer->data, 1, buffer->size, buffer->output);
+    pthread_mutex_unlock(buffer->lock);
+    buffer->size = 0;
+}
+
+void outcome_buffer_printf(OutcomeBuffer *buffer, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer->data + buffer->size, OUTCOME_OUTPUT_BUFFER_SIZE - buffer->size, format, args);
+    va_end(args);
+    if (length > 0 && buffer->size + length >= OUTCOME_OUTPUT_BUFFER_SIZE) {
+        // Did not fit, flush and print it again into the empty buffer
+        outcome_buffer_flush(buffer);
+        va_start(args, format);
+        length = vsnprintf(buffer->data, OUTCOME_OUTPUT_BUFFER_SIZE, format, args);
+        va_end(args);
+        if (length >= OUTCOME_OUTPUT_BUFFER_SIZE) length = OUTCOME_OUTPUT_BUFFER_SIZE - 1;
+    }
+    if (length > 0) buffer->size += length;
+}
+
+void outcome_buffer_free(OutcomeBuffer *buffer)
+{
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+}
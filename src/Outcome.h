@@ -0,0 +1,48 @@
+#ifndef OUTCOME_H
+#define OUTCOME_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include "CoreTrust.h"
+
+// Shared by the evaluation loops that run many CoreTrust calls on worker threads (sweep, replay)
+// Every worker counts (result, policy flags) pairs in its own table and buffers its output lines,
+// the tables are merged once the workers are joined and the buffers are written under a shared lock
+
+#define OUTCOME_TABLE_MAX_OUTCOMES 64
+#define OUTCOME_OUTPUT_BUFFER_SIZE (64 * 1024)
+
+typedef struct Outcome {
+    CT_int result;
+    CoreTrustPolicyFlags policyFlags;
+    uint64_t count;
+} Outcome;
+
+typedef struct OutcomeTable {
+    Outcome outcomes[OUTCOME_TABLE_MAX_OUTCOMES];
+    unsigned count;
+    uint64_t otherCount; // evaluations whose outcome did not fit into the table
+} OutcomeTable;
+
+typedef struct OutcomeBuffer {
+    char *data;
+    size_t size;
+    FILE *output;
+    pthread_mutex_t *lock;
+} OutcomeBuffer;
+
+void outcome_table_add(OutcomeTable *table, CT_int result, CoreTrustPolicyFlags policyFlags, uint64_t count);
+void outcome_table_merge(OutcomeTable *table, const OutcomeTable *other);
+// One line per outcome, most frequent first
+void outcome_table_print(OutcomeTable *table, FILE *output);
+
+int outcome_buffer_init(OutcomeBuffer *buffer, FILE *output, pthread_mutex_t *lock);
+// Appends a line, flushing first if it does not fit (truncated if it is longer than the whole buffer)
+void outcome_buffer_printf(OutcomeBuffer *buffer, const char *format, ...);
+void outcome_buffer_flush(OutcomeBuffer *buffer);
+void outcome_buffer_free(OutcomeBuffer *buffer);
+
+#endif // OUTCOME_H
@@ -0,0 +1,470 @@
+#include "Pack.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Clock.h"
+#include "Hash.h"
+#include "Sort.h"
+#include "Evaluator.h"
+
+#define PACK_ALIGN(value, alignment) (((value) + (alignment) - 1) & ~((uint64_t)(alignment) - 1))
+
+PackWriter *pack_writer_init(const char *path)
+{
+    PackWriter *writer = calloc(1, sizeof(PackWriter));
+    if (!writer) return NULL;
+    pthread_mutex_init(&writer->lock, NULL);
+    writer->path = strdup(path);
+    writer->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (!writer->path || writer->fd < 0) {
+        printf("Error: failed to open %s for writing!\n", path);
+        if (writer->fd >= 0) close(writer->fd);
+        pthread_mutex_destroy(&writer->lock);
+        free(writer->path);
+        free(writer);
+        return NULL;
+    }
+    writer->dataEnd = PACK_ALIGN(sizeof(PackHeader), PACK_DATA_ALIGNMENT);
+    return writer;
+}
+
+static int pack_write_all(int fd, const void *data, size_t size, uint64_t offset)
+{
+    const uint8_t *cur = data;
+    while (size) {
+        ssize_t written = pwrite(fd, cur, size, offset);
+        if (written < 0) return -1;
+        cur += written;
+        offset += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static int pack_writer_grow_blobs(PackWriter *writer)
+{
+    uint64_t capacity = writer->blobCapacity ? writer->blobCapacity * 2 : 1024;
+    PackBlob *blobs = calloc(capacity, sizeof(PackBlob));
+    if (!blobs) return -1;
+    for (uint64_t i = 0; i < writer->blobCapacity; i++) {
+        PackBlob *blob = &writer->blobs[i];
+        if (!blob->offset) continue;
+        uint64_t slot;
+        memcpy(&slot, blob->digest, sizeof(slot));
+        for (slot &= capacity - 1; blobs[slot].offset; slot = (slot + 1) & (capacity - 1));
+        blobs[slot] = *blob;
+    }
+    free(writer->blobs);
+    writer->blobs = blobs;
+    writer->blobCapacity = capacity;
+    return 0;
+}
+
+// Offset of the blob in the pack, written now unless an identical one already is. Called with the lock held
+static int pack_writer_store_blob(PackWriter *writer, const uint8_t *data, size_t size, uint64_t *offsetOut)
+{
+    uint8_t digest[32];
+    hash_digest(HASH_ALGORITHM_SHA256, data, size, digest);
+    if ((writer->blobCount + 1) * 2 > writer->blobCapacity && pack_writer_grow_blobs(writer) != 0) return -1;
+
+    uint64_t slot;
+    memcpy(&slot, digest, sizeof(slot));
+    for (slot &= writer->blobCapacity - 1; writer->blobs[slot].offset; slot = (slot + 1) & (writer->blobCapacity - 1)) {
+        PackBlob *blob = &writer->blobs[slot];
+        if (blob->size == size && !memcmp(blob->digest, digest, sizeof(digest))) {
+            *offsetOut = blob->offset;
+            return 0;
+        }
+    }
+
+    uint64_t offset = PACK_ALIGN(writer->dataEnd, PACK_BLOB_ALIGNMENT);
+    if (pack_write_all(writer->fd, data, size, offset) != 0) {
+        printf("Error: failed to write to %s!\n", writer->path);
+        return -1;
+    }
+    PackBlob *blob = &writer->blobs[slot];
+    memcpy(blob->digest, digest, sizeof(digest));
+    blob->size = size;
+    blob->offset = offset;
+    writer->blobCount++;
+    writer->dataEnd = offset + size;
+    *offsetOut = offset;
+    return 0;
+}
+
+int pack_writer_add(PackWriter *writer, const char *path, cpu_type_t cputype, cpu_subtype_t cpusubtype,
+                    const uint8_t *cms, size_t cmsSize, const uint8_t *codeDirectory, size_t codeDirectorySize)
+{
+    size_t pathLength = strlen(path);
+    if (pathLength > UINT32_MAX || cmsSize > UINT32_MAX || codeDirectorySize > UINT32_MAX) return -1;
+
+    pthread_mutex_lock(&writer->lock);
+    int r = -1;
+    PackEntry entry = { 0 };
+    entry.cputype = cputype;
+    entry.cpusubtype = cpusubtype;
+    entry.cmsSize = (uint32_t)cmsSize;
+    entry.codeDirectorySize = (uint32_t)codeDirectorySize;
+    if (pack_writer_store_blob(writer, cms, cmsSize, &entry.cmsOffset) != 0) goto out;
+    if (pack_writer_store_blob(writer, codeDirectory, codeDirectorySize, &entry.codeDirectoryOffset) != 0) goto out;
+
+    if (writer->entryCount == writer->entryCapacity) {
+        uint64_t capacity = writer->entryCapacity ? writer->entryCapacity * 2 : 1024;
+        PackEntry *entries = realloc(writer->entries, capacity * sizeof(PackEntry));
+        if (!entries) goto out;
+        writer->entries = entries;
+        writer->entryCapacity = capacity;
+    }
+    if (writer->stringsSize + pathLength + 1 > writer->stringsCapacity) {
+        uint64_t capacity = writer->stringsCapacity ? writer->stringsCapacity : 64 * 1024;
+        while (writer->stringsSize + pathLength + 1 > capacity) capacity *= 2;
+        char *strings = realloc(writer->strings, capacity);
+        if (!strings) goto out;
+        writer->strings = strings;
+        writer->stringsCapacity = capacity;
+    }
+    entry.pathOffset = writer->stringsSize;
+    entry.pathLength = (uint32_t)pathLength;
+    memcpy(writer->strings + writer->stringsSize, path, pathLength + 1);
+    writer->stringsSize += pathLength + 1;
+    writer->entries[writer->entryCount++] = entry;
+    writer->blobBytes += cmsSize + codeDirectorySize;
+    r = 0;
+
+out:
+    pthread_mutex_unlock(&writer->lock);
+    return r;
+}
+
+typedef struct PackExtractContext {
+    PackWriter *writer;
+    FILE *input;
+    pthread_mutex_t inputLock;
+} PackExtractContext;
+
+static void *pack_extract_worker(void *arg)
+{
+    PackExtractContext *context = arg;
+    PackWriter *writer = context->writer;
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    while (true) {
+        pthread_mutex_lock(&context->inputLock);
+        ssize_t lineLen = getdelim(&line, &lineCapacity, '\0', context->input);
+        pthread_mutex_unlock(&context->inputLock);
+        if (lineLen <= 0) break;
+        // The last path may not be terminated, getdelim returns it without the delimiter
+        if (line[lineLen - 1] == '\0') lineLen--;
+        if (lineLen == 0) continue;
+
+        atomic_fetch_add_explicit(&writer->fileCount, 1, memory_order_relaxed);
+        ScanItem *item = scan_item_init(line);
+        bool packed = false;
+        if (item && scan_item_prefetch(item) == 0 && scan_item_parse(item) == 0 && item->cmsData && item->codeDirectoryData) {
+            packed = pack_writer_add(writer, item->path, item->cputype, item->cpusubtype, item->cmsData, item->cmsLen,
+                                     item->codeDirectoryData, item->codeDirectoryLen) == 0;
+        }
+        if (!packed) atomic_fetch_add_explicit(&writer->skippedCount, 1, memory_order_relaxed);
+        if (item) scan_item_free(item);
+    }
+    free(line);
+    return NULL;
+}
+
+int pack_writer_add_paths_from_file(PackWriter *writer, FILE *input, unsigned threadCount)
+{
+    PackExtractContext context = { .writer = writer, .input = input };
+    pthread_mutex_init(&context.inputLock, NULL);
+    pthread_t *threads = calloc(threadCount, sizeof(pthread_t));
+    unsigned started = 0;
+    if (threads) {
+        for (; started < threadCount; started++) {
+            if (pthread_create(&threads[started], NULL, pack_extract_worker, &context) != 0) break;
+        }
+    }
+    if (started == 0) {
+        pack_extract_worker(&context);
+    }
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&context.inputLock);
+    return 0;
+}
+
+// context is the writer's string table
+static int pack_entry_sort_compare(const void *a, const void *b, void *context)
+{
+    const PackEntry *entryA = a, *entryB = b;
+    const char *strings = context;
+    return strcmp(strings + entryA->pathOffset, strings + entryB->pathOffset);
+}
+
+int pack_writer_finish(PackWriter *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    if (sort_with_context(writer->entries, writer->entryCount, sizeof(PackEntry), pack_entry_sort_compare, writer->strings) != 0) {
+        printf("Error: failed to sort pack %s!\n", writer->path);
+        close(writer->fd);
+        writer->fd = -1;
+        pthread_mutex_unlock(&writer->lock);
+        return -1;
+    }
+
+    PackHeader header = { 0 };
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.entrySize = sizeof(PackEntry);
+    header.entryCount = writer->entryCount;
+    header.dataOffset = PACK_ALIGN(sizeof(PackHeader), PACK_DATA_ALIGNMENT);
+    header.dataSize = writer->dataEnd - header.dataOffset;
+    header.entriesOffset = PACK_ALIGN(writer->dataEnd, _Alignof(PackEntry));
+    header.stringsOffset = header.entriesOffset + writer->entryCount * sizeof(PackEntry);
+    header.stringsSize = writer->stringsSize;
+    header.blobCount = writer->blobCount;
+    header.blobBytes = writer->blobBytes;
+
+    int r = -1;
+    if (pack_write_all(writer->fd, writer->entries, writer->entryCount * sizeof(PackEntry), header.entriesOffset) == 0 &&
+        pack_write_all(writer->fd, writer->strings, writer->stringsSize, header.stringsOffset) == 0 &&
+        ftruncate(writer->fd, header.stringsOffset + header.stringsSize) == 0 &&
+        pack_write_all(writer->fd, &header, sizeof(header), 0) == 0) {
+        r = 0;
+    }
+    else {
+        printf("Error: failed to write pack %s!\n", writer->path);
+    }
+    if (close(writer->fd) != 0) r = -1;
+    writer->fd = -1;
+    pthread_mutex_unlock(&writer->lock);
+    return r;
+}
+
+void pack_writer_print_stats(PackWriter *writer, FILE *output)
+{
+    uint64_t stored = writer->dataEnd - PACK_ALIGN(sizeof(PackHeader), PACK_DATA_ALIGNMENT);
+    fprintf(output, "pack: %llu files, %llu packed, %llu skipped, %llu unique blobs, %llu of %llu blob bytes stored (%.1f%%)\n",
+            (unsigned long long)writer->fileCount, (unsigned long long)writer->entryCount, (unsigned long long)writer->skippedCount,
+            (unsigned long long)writer->blobCount, (unsigned long long)stored, (unsigned long long)writer->blobBytes,
+            writer->blobBytes ? 100.0 * stored / writer->blobBytes : 0.0);
+}
+
+void pack_writer_free(PackWriter *writer)
+{
+    if (writer->fd >= 0) close(writer->fd);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->blobs);
+    free(writer->entries);
+    free(writer->strings);
+    free(writer->path);
+    free(writer);
+}
+
+static bool pack_range_valid(const PackHeader *header, uint64_t offset, uint64_t size)
+{
+    return offset >= header->dataOffset && size <= header->dataSize && offset - header->dataOffset <= header->dataSize - size;
+}
+
+Pack *pack_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: failed to open %s!\n", path);
+        return NULL;
+    }
+    struct stat s;
+    if (fstat(fd, &s) != 0 || (uint64_t)s.st_size < sizeof(PackHeader)) {
+        printf("Error: %s is not a pack!\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("Error: failed to map %s!\n", path);
+        return NULL;
+    }
+
+    const PackHeader *header = mapping;
+    uint64_t size = s.st_size;
+    bool valid = !memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) &&
+                 header->version == PACK_VERSION &&
+                 header->entrySize == sizeof(PackEntry) &&
+                 header->dataOffset >= sizeof(PackHeader) && header->dataOffset <= size &&
+                 header->dataSize <= size - header->dataOffset &&
+                 header->entriesOffset <= size && header->entriesOffset % _Alignof(PackEntry) == 0 &&
+                 header->entryCount <= (size - header->entriesOffset) / sizeof(PackEntry) &&
+                 header->stringsOffset <= size && header->stringsSize <= size - header->stringsOffset;
+
+    // Check every entry now so the replay can use them blindly
+    const PackEntry *entries = valid ? (const PackEntry *)((uint8_t *)mapping + header->entriesOffset) : NULL;
+    for (uint64_t i = 0; valid && i < header->entryCount; i++) {
+        valid = pack_range_valid(header, entries[i].cmsOffset, entries[i].cmsSize) &&
+                pack_range_valid(header, entries[i].codeDirectoryOffset, entries[i].codeDirectorySize);
+    }
+    if (!valid) {
+        printf("Error: %s is not a supported pack!\n", path);
+        munmap(mapping, s.st_size);
+        return NULL;
+    }
+
+    Pack *pack = calloc(1, sizeof(Pack));
+    if (!pack) {
+        munmap(mapping, s.st_size);
+        return NULL;
+    }
+    pack->mapping = mapping;
+    pack->size = s.st_size;
+    pack->header = header;
+    pack->entries = entries;
+    pack->strings = (const char *)(pack->mapping + header->stringsOffset);
+    // The blobs are read over and over, fault them in up front rather than during the first round
+    madvise(pack->mapping + header->dataOffset, header->dataSize, MADV_WILLNEED);
+    return pack;
+}
+
+const char *pack_entry_get_path(const Pack *pack, const PackEntry *entry)
+{
+    uint64_t stringsSize = pack->header->stringsSize;
+    if (entry->pathOffset >= stringsSize || entry->pathLength >= stringsSize - entry->pathOffset) return NULL;
+    const char *path = pack->strings + entry->pathOffset;
+    return path[entry->pathLength] == '\0' ? path : NULL;
+}
+
+void pack_free(Pack *pack)
+{
+    munmap(pack->mapping, pack->size);
+    free(pack);
+}
+
+PackReplay *pack_replay_init(const Pack *pack, unsigned threadCount, uint64_t rounds)
+{
+    PackReplay *replay = calloc(1, sizeof(PackReplay));
+    if (!replay) return NULL;
+    pthread_mutex_init(&replay->lock, NULL);
+    replay->pack = pack;
+    replay->threadCount = threadCount ? threadCount : 1;
+    replay->rounds = rounds ? rounds : 1;
+    replay->evaluationCount = pack->header->entryCount * replay->rounds;
+    return replay;
+}
+
+typedef struct PackReplayWorker {
+    PackReplay *replay;
+    OutcomeTable outcomes;
+    OutcomeBuffer output; // only with a list output
+} PackReplayWorker;
+
+static void *pack_replay_worker(void *context)
+{
+    PackReplayWorker *worker = context;
+    PackReplay *replay = worker->replay;
+    const Pack *pack = replay->pack;
+    uint64_t entryCount = pack->header->entryCount;
+    while (true) {
+        uint64_t first = atomic_fetch_add_explicit(&replay->nextEvaluation, PACK_CHUNK_SIZE, memory_order_relaxed);
+        if (first >= replay->evaluationCount) break;
+        uint64_t last = first + PACK_CHUNK_SIZE < replay->evaluationCount ? first + PACK_CHUNK_SIZE : replay->evaluationCount;
+        for (uint64_t evaluation = first; evaluation < last; evaluation++) {
+            const PackEntry *entry = &pack->entries[evaluation % entryCount];
+            const CT_uint8_t *leafCert = NULL;
+            CT_size_t leafCertLen = 0;
+            CoreTrustPolicyFlags policyFlags = 0;
+            CoreTrustDigestType cmsDigestType = 0;
+            CoreTrustDigestType hashAgilityDigestType = 0;
+            const CT_uint8_t *digestData = NULL;
+            CT_size_t digestLen = 0;
+            CT_int result = 0;
+            if (evaluator_evaluate_amfi_cms(pack->mapping + entry->cmsOffset, entry->cmsSize,
+                                            pack->mapping + entry->codeDirectoryOffset, entry->codeDirectorySize, false,
+                                            &leafCert, &leafCertLen, &policyFlags, &cmsDigestType,
+                                            &hashAgilityDigestType, &digestData, &digestLen, &result) != 0) {
+                atomic_store(&replay->evaluatorMissing, true);
+                return NULL;
+            }
+            outcome_table_add(&worker->outcomes, result, policyFlags, 1);
+
+            if (worker->output.data && evaluation < entryCount) {
+                const char *path = pack_entry_get_path(pack, entry);
+                outcome_buffer_printf(&worker->output, "%s\t0x%x\t0x%llx\n", path ? path : "?", (unsigned)result,
+                                      (unsigned long long)policyFlags);
+            }
+        }
+    }
+    if (worker->output.data) outcome_buffer_flush(&worker->output);
+    return NULL;
+}
+
+int pack_replay_run(PackReplay *replay, FILE *listOutput)
+{
+    if (!replay->evaluationCount) {
+        printf("Error: pack has no entries!\n");
+        return -1;
+    }
+    if (evaluator_load() != 0) {
+        printf("Error: CoreTrust evaluator is not available!\n");
+        return -1;
+    }
+    replay->listOutput = listOutput;
+
+    uint64_t start = clock_now_ns();
+    unsigned threadCount = replay->threadCount;
+    if (threadCount > replay->evaluationCount) threadCount = (unsigned)replay->evaluationCount;
+    PackReplayWorker *workers = calloc(threadCount, sizeof(PackReplayWorker));
+    pthread_t *threads = calloc(threadCount, sizeof(pthread_t));
+    int r = workers && threads ? 0 : -1;
+    for (unsigned i = 0; r == 0 && i < threadCount; i++) {
+        workers[i].replay = replay;
+        if (listOutput && outcome_buffer_init(&workers[i].output, listOutput, &replay->lock) != 0) r = -1;
+    }
+
+    if (r == 0) {
+        unsigned started = 0;
+        for (; started < threadCount; started++) {
+            if (pthread_create(&threads[started], NULL, pack_replay_worker, &workers[started]) != 0) break;
+        }
+        if (started == 0) {
+            pack_replay_worker(&workers[0]);
+        }
+        for (unsigned i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        for (unsigned i = 0; i < threadCount; i++) {
+            outcome_table_merge(&replay->outcomes, &workers[i].outcomes);
+        }
+        if (atomic_load(&replay->evaluatorMissing)) {
+            printf("Error: CoreTrust evaluator is not available!\n");
+            r = -1;
+        }
+    }
+    replay->nanos = clock_now_ns() - start;
+
+    for (unsigned i = 0; workers && i < threadCount; i++) {
+        outcome_buffer_free(&workers[i].output);
+    }
+    free(workers);
+    free(threads);
+    if (listOutput) fflush(listOutput);
+    return r;
+}
+
+void pack_replay_print_stats(PackReplay *replay, FILE *output)
+{
+    const PackHeader *header = replay->pack->header;
+    double seconds = replay->nanos / 1e9;
+    fprintf(output, "replay: %llu entries (%llu unique blobs) x %llu rounds, %.3f s (%.0f evaluations/s on %u threads)\n",
+            (unsigned long long)header->entryCount, (unsigned long long)header->blobCount, (unsigned long long)replay->rounds,
+            seconds, seconds > 0 ? replay->evaluationCount / seconds : 0, replay->threadCount);
+    outcome_table_print(&replay->outcomes, output);
+}
+
+void pack_replay_free(PackReplay *replay)
+{
+    pthread_mutex_destroy(&replay->lock);
+    free(replay);
+}
@@ -0,0 +1,132 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "Scan.h"
+#include "Outcome.h"
+
+// Signature packs: the CMS and code directory blobs of a corpus in one file, for replaying evaluations
+// Blobs are stored once (identical CMS blobs of a corpus signed by the same certificate chain are shared) at
+// aligned offsets in a page aligned data region, followed by fixed size entries sorted by path and a string
+// table. A pack is mapped read-only and every entry is checked at open, so replaying it needs no syscalls,
+// copies or allocations per entry
+
+#define PACK_MAGIC "CTPACK01"
+#define PACK_VERSION 1
+#define PACK_BLOB_ALIGNMENT 16
+#define PACK_DATA_ALIGNMENT 0x4000
+
+#define PACK_CHUNK_SIZE 64
+
+typedef struct PackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entrySize;
+    uint64_t entryCount;
+    uint64_t entriesOffset;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t blobCount;  // unique blobs in the data region
+    uint64_t blobBytes;  // CMS and code directory bytes of all entries, before deduplication
+} PackHeader;
+
+typedef struct PackEntry {
+    uint64_t pathOffset;
+    uint32_t pathLength;
+    int32_t cputype;
+    int32_t cpusubtype;
+    uint32_t cmsSize;
+    uint64_t cmsOffset; // from the start of the file
+    uint64_t codeDirectoryOffset;
+    uint32_t codeDirectorySize;
+    uint32_t reserved;
+} PackEntry;
+
+_Static_assert(sizeof(PackEntry) == 48, "pack entries are part of the file format");
+
+typedef struct PackBlob {
+    uint8_t digest[32]; // SHA-256
+    uint64_t size;
+    uint64_t offset; // 0 marks an empty slot
+} PackBlob;
+
+typedef struct PackWriter {
+    pthread_mutex_t lock;
+    char *path;
+    int fd;
+    uint64_t dataEnd;
+
+    PackBlob *blobs; // open addressing on the digest
+    uint64_t blobCount;
+    uint64_t blobCapacity;
+    uint64_t blobBytes;
+
+    PackEntry *entries;
+    uint64_t entryCount;
+    uint64_t entryCapacity;
+    char *strings;
+    uint64_t stringsSize;
+    uint64_t stringsCapacity;
+
+    // Extraction
+    atomic_uint_fast64_t fileCount;
+    atomic_uint_fast64_t skippedCount;
+} PackWriter;
+
+typedef struct Pack {
+    uint8_t *mapping;
+    size_t size;
+    const PackHeader *header;
+    const PackEntry *entries;
+    const char *strings;
+} Pack;
+
+typedef struct PackReplay {
+    const Pack *pack;
+    unsigned threadCount;
+    uint64_t rounds;
+    uint64_t evaluationCount;
+    atomic_uint_fast64_t nextEvaluation;
+    _Atomic bool evaluatorMissing; // set by any worker whose evaluation call failed
+
+    pthread_mutex_t lock; // list output and merged outcomes
+    FILE *listOutput;
+    OutcomeTable outcomes;
+    uint64_t nanos;
+} PackReplay;
+
+PackWriter *pack_writer_init(const char *path);
+
+// Thread safe, blobs are written as they come in and deduplicated by digest
+int pack_writer_add(PackWriter *writer, const char *path, cpu_type_t cputype, cpu_subtype_t cpusubtype,
+                    const uint8_t *cms, size_t cmsSize, const uint8_t *codeDirectory, size_t codeDirectorySize);
+
+// Parse every NUL delimited path of input on threadCount threads and add the files that have both blobs
+int pack_writer_add_paths_from_file(PackWriter *writer, FILE *input, unsigned threadCount);
+
+// Sorts the entries by path and writes them, the string table and the header
+int pack_writer_finish(PackWriter *writer);
+void pack_writer_print_stats(PackWriter *writer, FILE *output);
+void pack_writer_free(PackWriter *writer);
+
+Pack *pack_open(const char *path);
+const char *pack_entry_get_path(const Pack *pack, const PackEntry *entry);
+void pack_free(Pack *pack);
+
+PackReplay *pack_replay_init(const Pack *pack, unsigned threadCount, uint64_t rounds);
+
+// Evaluate every entry rounds times, if listOutput is set the first round prints path, result and policy flags
+int pack_replay_run(PackReplay *replay, FILE *listOutput);
+
+void pack_replay_print_stats(PackReplay *replay, FILE *output);
+void pack_replay_free(PackReplay *replay);
+
+#endif // PACK_H
@@ -0,0 +1,498 @@
+#include "PageSample.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+#include <choma/MachOByteOrder.h>
+
+#include "Verifier.h"
+#include "CodeHash.h"
+#include "Hash.h"
+#include "Clock.h"
+#include "Fnv.h"
+
+// Sampled full pages are handed to hash_digest_many in batches of this many pages
+#define PAGE_SAMPLE_BATCH 64
+
+typedef struct PageSampleCodeDirectory {
+    const uint8_t *blob; // raw and big endian, inside the mapping
+    CS_CodeDirectory header; // host byte order
+    HashAlgorithm algorithm;
+    uint64_t pageSize;
+    uint64_t codeLimit; // codeLimit64 when set, codeLimit otherwise
+} PageSampleCodeDirectory;
+
+// Offsets inside the slice the fixed pages are taken from
+typedef struct PageSampleLayout {
+    uint32_t signatureOffset;
+    uint32_t signatureSize;
+    bool hasSignature;
+    bool hasEntry;
+    uint64_t entryOffset;
+    bool hasText;
+    uint64_t textOffset;
+} PageSampleLayout;
+
+static const char *gPageSampleStatusStrings[PAGE_SAMPLE_STATUS_COUNT] = {
+    [PAGE_SAMPLE_OK] = "ok",
+    [PAGE_SAMPLE_TAMPERED] = "tampered",
+    [PAGE_SAMPLE_OPEN_FAILED] = "open-failed",
+    [PAGE_SAMPLE_NOT_MACHO] = "not-macho",
+    [PAGE_SAMPLE_NO_SLICE] = "no-slice",
+    [PAGE_SAMPLE_NO_SIGNATURE] = "no-signature",
+    [PAGE_SAMPLE_NO_CODE_DIRECTORY] = "no-code-directory",
+    [PAGE_SAMPLE_MALFORMED] = "malformed",
+};
+
+const char *page_sample_status_to_string(PageSampleStatus status)
+{
+    return status < PAGE_SAMPLE_STATUS_COUNT ? gPageSampleStatusStrings[status] : "unknown";
+}
+
+void page_sample_config_init(PageSampleConfig *config)
+{
+    memset(config, 0, sizeof(PageSampleConfig));
+    config->randomPages = PAGE_SAMPLE_DEFAULT_RANDOM_PAGES;
+    config->tamperPages = 1;
+}
+
+double page_sample_detection_probability(uint64_t candidatePages, uint64_t randomPages, uint64_t tamperPages)
+{
+    if (!tamperPages || !randomPages || !candidatePages) return 0.0;
+    if (tamperPages >= candidatePages || randomPages > candidatePages - tamperPages) return 1.0;
+    // Hypergeometric: every drawn page misses the modified ones
+    double miss = 1.0;
+    for (uint64_t i = 0; i < randomPages; i++) {
+        miss *= (double)(candidatePages - tamperPages - i) / (double)(candidatePages - i);
+    }
+    return 1.0 - miss;
+}
+
+static uint32_t page_sample_read_big32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return BIG_TO_HOST(value);
+}
+
+static uint32_t page_sample_read_little32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return LITTLE_TO_HOST(value);
+}
+
+static uint64_t page_sample_read_little64(const uint8_t *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return LITTLE_TO_HOST(value);
+}
+
+static bool page_sample_range_valid(uint64_t size, uint64_t offset, uint64_t length)
+{
+    return offset <= size && length <= size - offset;
+}
+
+// Finds __TEXT,__text in a segment command, 32-bit and 64-bit commands only differ in their layouts
+static void page_sample_read_segment(const uint8_t *command, uint32_t cmdsize, bool is64Bit, PageSampleLayout *layout)
+{
+    size_t segmentSize = is64Bit ? sizeof(struct segment_command_64) : sizeof(struct segment_command);
+    size_t sectionSize = is64Bit ? sizeof(struct section_64) : sizeof(struct section);
+    if (cmdsize < segmentSize) return;
+    if (strncmp((const char *)command + offsetof(struct segment_command, segname), SEG_TEXT, sizeof(((struct segment_command *)0)->segname))) return;
+    uint32_t nsects = page_sample_read_little32(command + (is64Bit ? offsetof(struct segment_command_64, nsects) : offsetof(struct segment_command, nsects)));
+    for (uint32_t i = 0; i < nsects && segmentSize + (uint64_t)(i + 1) * sectionSize <= cmdsize; i++) {
+        const uint8_t *section = command + segmentSize + (uint64_t)i * sectionSize;
+        if (strncmp((const char *)section, SECT_TEXT, sizeof(((struct section *)0)->sectname))) continue;
+        layout->textOffset = page_sample_read_little32(section + (is64Bit ? offsetof(struct section_64, offset) : offsetof(struct section, offset)));
+        layout->hasText = true;
+        return;
+    }
+}
+
+static PageSampleStatus page_sample_read_layout(const uint8_t *slice, uint64_t sliceSize, PageSampleLayout *layout)
+{
+    if (sliceSize < sizeof(struct mach_header_64)) return PAGE_SAMPLE_NOT_MACHO;
+    uint32_t magic = page_sample_read_little32(slice);
+    if (magic != MH_MAGIC && magic != MH_MAGIC_64) return PAGE_SAMPLE_NOT_MACHO;
+    bool is64Bit = magic == MH_MAGIC_64;
+    uint64_t headerSize = is64Bit ? sizeof(struct mach_header_64) : sizeof(struct mach_header);
+    uint32_t ncmds = page_sample_read_little32(slice + offsetof(struct mach_header, ncmds));
+    uint32_t sizeofcmds = page_sample_read_little32(slice + offsetof(struct mach_header, sizeofcmds));
+    if (!page_sample_range_valid(sliceSize, headerSize, sizeofcmds)) return PAGE_SAMPLE_NOT_MACHO;
+
+    const uint8_t *commands = slice + headerSize;
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < ncmds && offset + sizeof(struct load_command) <= sizeofcmds; i++) {
+        const uint8_t *command = commands + offset;
+        uint32_t cmd = page_sample_read_little32(command + offsetof(struct load_command, cmd));
+        uint32_t cmdsize = page_sample_read_little32(command + offsetof(struct load_command, cmdsize));
+        if (cmdsize < sizeof(struct load_command) || offset + cmdsize > sizeofcmds) break;
+        if (cmd == LC_CODE_SIGNATURE && cmdsize >= sizeof(struct linkedit_data_command)) {
+            layout->signatureOffset = page_sample_read_little32(command + offsetof(struct linkedit_data_command, dataoff));
+            layout->signatureSize = page_sample_read_little32(command + offsetof(struct linkedit_data_command, datasize));
+            layout->hasSignature = true;
+        }
+        else if (cmd == LC_MAIN && cmdsize >= sizeof(struct entry_point_command)) {
+            layout->entryOffset = page_sample_read_little64(command + offsetof(struct entry_point_command, entryoff));
+            layout->hasEntry = true;
+        }
+        else if ((cmd == LC_SEGMENT_64 && is64Bit) || (cmd == LC_SEGMENT && !is64Bit)) {
+            page_sample_read_segment(command, cmdsize, is64Bit, layout);
+        }
+        offset += cmdsize;
+    }
+    return layout->hasSignature ? PAGE_SAMPLE_OK : PAGE_SAMPLE_NO_SIGNATURE;
+}
+
+// The code directory with the strongest hash type, the one the kernel validates pages against
+static PageSampleStatus page_sample_find_code_directory(const uint8_t *superblob, uint64_t size, PageSampleCodeDirectory *codeDirectoryOut)
+{
+    if (size < sizeof(CS_SuperBlob) || page_sample_read_big32(superblob) != CSMAGIC_EMBEDDED_SIGNATURE) return PAGE_SAMPLE_NO_SIGNATURE;
+    uint32_t length = page_sample_read_big32(superblob + offsetof(CS_SuperBlob, length));
+    if (length < size) size = length;
+    uint32_t count = page_sample_read_big32(superblob + offsetof(CS_SuperBlob, count));
+    if (!page_sample_range_valid(size, sizeof(CS_SuperBlob), (uint64_t)count * sizeof(CS_BlobIndex))) return PAGE_SAMPLE_NO_SIGNATURE;
+
+    unsigned bestRank = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *index = superblob + sizeof(CS_SuperBlob) + i * sizeof(CS_BlobIndex);
+        uint32_t type = page_sample_read_big32(index + offsetof(CS_BlobIndex, type));
+        uint32_t offset = page_sample_read_big32(index + offsetof(CS_BlobIndex, offset));
+        if (type != CSSLOT_CODEDIRECTORY && (type < CSSLOT_ALTERNATE_CODEDIRECTORIES || type >= CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT)) continue;
+        if (!page_sample_range_valid(size, offset, sizeof(CS_CodeDirectory))) continue;
+        const uint8_t *blob = superblob + offset;
+        uint32_t blobLength = page_sample_read_big32(blob + offsetof(CS_GenericBlob, length));
+        if (page_sample_read_big32(blob) != CSMAGIC_CODEDIRECTORY || blobLength < sizeof(CS_CodeDirectory) || !page_sample_range_valid(size, offset, blobLength)) continue;
+
+        unsigned rank = code_hash_type_get_rank(blob[offsetof(CS_CodeDirectory, hashType)]);
+        if (rank <= bestRank) continue;
+        bestRank = rank;
+        codeDirectoryOut->blob = blob;
+        memcpy(&codeDirectoryOut->header, blob, sizeof(CS_CodeDirectory));
+        CODE_DIRECTORY_APPLY_BYTE_ORDER(&codeDirectoryOut->header, BIG_TO_HOST_APPLIER);
+    }
+    return bestRank ? PAGE_SAMPLE_OK : PAGE_SAMPLE_NO_CODE_DIRECTORY;
+}
+
+// Same checks as code_directory_verify_code_slots, against the slice the code directory has to describe
+// An oversized last page is a malformed directory, not a mismatch
+static PageSampleStatus page_sample_validate_code_directory(PageSampleCodeDirectory *codeDirectory, uint64_t sliceSize)
+{
+    const CS_CodeDirectory *header = &codeDirectory->header;
+    uint64_t codeLimit64 = code_directory_read_code_limit_64(codeDirectory->blob, header->length);
+    if (code_directory_check_code_slots(header, codeLimit64, header->length, sliceSize, &codeDirectory->algorithm, &codeDirectory->codeLimit) != 0) {
+        return PAGE_SAMPLE_MALFORMED;
+    }
+    codeDirectory->pageSize = 1ULL << header->pageSize;
+    return PAGE_SAMPLE_OK;
+}
+
+// Hash the given code slots (sorted, NULL for all of them), returns the number of mismatching ones
+static uint32_t page_sample_check_slots(const PageSampleCodeDirectory *codeDirectory, const uint8_t *code, const uint32_t *slots, uint32_t slotCount)
+{
+    const CS_CodeDirectory *header = &codeDirectory->header;
+    const uint8_t *expected = codeDirectory->blob + header->hashOffset;
+    size_t digestSize = hash_get_digest_size(codeDirectory->algorithm);
+    uint32_t lastSlot = header->nCodeSlots - 1;
+    uint8_t digests[PAGE_SAMPLE_BATCH * HASH_MAX_DIGEST_SIZE];
+    const uint8_t *pages[PAGE_SAMPLE_BATCH];
+    uint32_t batchSlots[PAGE_SAMPLE_BATCH];
+    uint32_t batchCount = 0;
+    uint32_t mismatches = 0;
+
+    // Every page but the last is a full page, those go through the multi-buffer path
+    for (uint32_t i = 0; i <= slotCount; i++) {
+        bool flush = i == slotCount || batchCount == PAGE_SAMPLE_BATCH;
+        if (flush && batchCount) {
+            hash_digest_many(codeDirectory->algorithm, pages, codeDirectory->pageSize, batchCount, digests);
+            for (uint32_t j = 0; j < batchCount; j++) {
+                if (memcmp(digests + j * digestSize, expected + (size_t)batchSlots[j] * header->hashSize, header->hashSize) != 0) mismatches++;
+            }
+            batchCount = 0;
+        }
+        if (i == slotCount) break;
+
+        uint32_t slot = slots ? slots[i] : i;
+        if (slot == lastSlot) {
+            uint64_t lastOffset = (uint64_t)lastSlot * codeDirectory->pageSize;
+            hash_digest(codeDirectory->algorithm, code + lastOffset, codeDirectory->codeLimit - lastOffset, digests);
+            if (memcmp(digests, expected + (size_t)lastSlot * header->hashSize, header->hashSize) != 0) mismatches++;
+            continue;
+        }
+        pages[batchCount] = code + (uint64_t)slot * codeDirectory->pageSize;
+        batchSlots[batchCount++] = slot;
+    }
+    return mismatches;
+}
+
+static uint64_t page_sample_mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t page_sample_random(uint64_t *state)
+{
+    *state += 0x9e3779b97f4a7c15ULL;
+    return page_sample_mix(*state);
+}
+
+static int page_sample_compare_slots(const void *a, const void *b)
+{
+    uint32_t slotA = *(const uint32_t *)a, slotB = *(const uint32_t *)b;
+    return slotA == slotB ? 0 : (slotA < slotB ? -1 : 1);
+}
+
+// Fixed pages first, then randomPages distinct others drawn with Floyd's algorithm, sorted
+static uint32_t *page_sample_pick_slots(const PageSampleConfig *config, const char *path, uint32_t pageCount,
+                                        const uint32_t *fixed, uint32_t fixedCount, uint32_t *slotCountOut)
+{
+    uint64_t candidates = pageCount - fixedCount;
+    uint32_t randomPages = config->randomPages < candidates ? config->randomPages : (uint32_t)candidates;
+    uint32_t *slots = malloc(((size_t)fixedCount + randomPages) * sizeof(uint32_t));
+    if (!slots) return NULL;
+    memcpy(slots, fixed, fixedCount * sizeof(uint32_t));
+
+    uint64_t state = page_sample_mix(fnv_update(config->seed, path, strlen(path)));
+
+    uint32_t *drawn = slots + fixedCount;
+    uint32_t drawnCount = 0;
+    for (uint64_t j = candidates - randomPages; j < candidates; j++) {
+        uint32_t pick = (uint32_t)(page_sample_random(&state) % (j + 1));
+        for (uint32_t k = 0; k < drawnCount; k++) {
+            if (drawn[k] == pick) {
+                pick = (uint32_t)j;
+                break;
+            }
+        }
+        drawn[drawnCount++] = pick;
+    }
+    // Candidate indexes skip the fixed pages, which are sorted
+    for (uint32_t k = 0; k < drawnCount; k++) {
+        for (uint32_t f = 0; f < fixedCount; f++) {
+            if (fixed[f] <= drawn[k]) drawn[k]++;
+        }
+    }
+    *slotCountOut = fixedCount + drawnCount;
+    qsort(slots, *slotCountOut, sizeof(uint32_t), page_sample_compare_slots);
+    return slots;
+}
+
+static uint32_t page_sample_add_fixed(uint32_t *fixed, uint32_t fixedCount, uint32_t slot)
+{
+    for (uint32_t i = 0; i < fixedCount; i++) {
+        if (fixed[i] == slot) return fixedCount;
+    }
+    fixed[fixedCount++] = slot;
+    return fixedCount;
+}
+
+static PageSampleStatus page_sample_verify_slice(const uint8_t *slice, uint64_t sliceSize, const char *path, const PageSampleConfig *config,
+                                                 PageSampleResult *result)
+{
+    PageSampleLayout layout = { 0 };
+    PageSampleStatus status = page_sample_read_layout(slice, sliceSize, &layout);
+    if (status != PAGE_SAMPLE_OK) return status;
+    if (!page_sample_range_valid(sliceSize, layout.signatureOffset, layout.signatureSize)) return PAGE_SAMPLE_NO_SIGNATURE;
+
+    PageSampleCodeDirectory codeDirectory = { 0 };
+    status = page_sample_find_code_directory(slice + layout.signatureOffset, layout.signatureSize, &codeDirectory);
+    if (status != PAGE_SAMPLE_OK) return status;
+    status = page_sample_validate_code_directory(&codeDirectory, sliceSize);
+    if (status != PAGE_SAMPLE_OK) return status;
+
+    uint32_t pageCount = codeDirectory.header.nCodeSlots;
+    result->hashType = codeDirectory.header.hashType;
+    result->pageCount = pageCount;
+    if (config->full) {
+        result->sampledCount = pageCount;
+        result->mismatches = page_sample_check_slots(&codeDirectory, slice, NULL, pageCount);
+        result->hashedCount = pageCount;
+        result->detectionProbability = 1.0;
+        return result->mismatches ? PAGE_SAMPLE_TAMPERED : PAGE_SAMPLE_OK;
+    }
+
+    uint32_t fixed[PAGE_SAMPLE_MAX_FIXED_PAGES];
+    uint32_t fixedCount = 0;
+    fixedCount = page_sample_add_fixed(fixed, fixedCount, 0);
+    fixedCount = page_sample_add_fixed(fixed, fixedCount, pageCount - 1);
+    if (layout.hasEntry && layout.entryOffset < codeDirectory.codeLimit) {
+        fixedCount = page_sample_add_fixed(fixed, fixedCount, (uint32_t)(layout.entryOffset / codeDirectory.pageSize));
+    }
+    if (layout.hasText && layout.textOffset < codeDirectory.codeLimit) {
+        fixedCount = page_sample_add_fixed(fixed, fixedCount, (uint32_t)(layout.textOffset / codeDirectory.pageSize));
+    }
+    qsort(fixed, fixedCount, sizeof(uint32_t), page_sample_compare_slots);
+
+    uint32_t slotCount = 0;
+    uint32_t *slots = page_sample_pick_slots(config, path, pageCount, fixed, fixedCount, &slotCount);
+    if (!slots) return PAGE_SAMPLE_MALFORMED;
+    result->sampledCount = slotCount;
+    result->sampleMismatches = page_sample_check_slots(&codeDirectory, slice, slots, slotCount);
+    result->hashedCount = slotCount;
+    result->mismatches = result->sampleMismatches;
+    free(slots);
+    result->detectionProbability = slotCount == pageCount ? 1.0 :
+        page_sample_detection_probability(pageCount - fixedCount, slotCount - fixedCount, config->tamperPages);
+
+    // A sample of every page already counted every mismatch
+    if (result->sampleMismatches && slotCount < pageCount) {
+        result->escalated = true;
+        result->mismatches = page_sample_check_slots(&codeDirectory, slice, NULL, pageCount);
+        result->hashedCount += pageCount;
+    }
+    return result->mismatches ? PAGE_SAMPLE_TAMPERED : PAGE_SAMPLE_OK;
+}
+
+int page_sample_verify_path(const char *path, const PageSampleConfig *config, PageSampleResult *resultOut)
+{
+    memset(resultOut, 0, sizeof(PageSampleResult));
+    VerifierImage image;
+    VerifierError error = verifier_image_open_path(&image, path);
+    if (error != VERIFIER_OK) {
+        if (error == VERIFIER_ERROR_NOT_MACHO) resultOut->status = PAGE_SAMPLE_NOT_MACHO;
+        else if (error == VERIFIER_ERROR_NO_SLICE) resultOut->status = PAGE_SAMPLE_NO_SLICE;
+        else resultOut->status = PAGE_SAMPLE_OPEN_FAILED;
+        return -1;
+    }
+    const VerifierSlice *slice = verifier_image_find_preferred_slice(&image);
+    if (!slice && image.sliceCount) slice = &image.slices[0];
+    if (!slice) {
+        resultOut->status = PAGE_SAMPLE_NO_SLICE;
+        verifier_image_close(&image);
+        return -1;
+    }
+    resultOut->cputype = slice->cputype;
+    resultOut->cpusubtype = slice->cpusubtype;
+    resultOut->status = page_sample_verify_slice(image.data + slice->offset, slice->size, path, config, resultOut);
+    verifier_image_close(&image);
+    return resultOut->status == PAGE_SAMPLE_OK || resultOut->status == PAGE_SAMPLE_TAMPERED ? 0 : -1;
+}
+
+void page_sample_result_print(const char *path, const PageSampleResult *result, FILE *output)
+{
+    flockfile(output);
+    fprintf(output, "%s\t%s", path, page_sample_status_to_string(result->status));
+    if (result->status == PAGE_SAMPLE_OK || result->status == PAGE_SAMPLE_TAMPERED) {
+        HashAlgorithm algorithm = HASH_ALGORITHM_SHA256;
+        code_hash_type_get_algorithm(result->hashType, &algorithm);
+        fprintf(output, "\tslice=%d:%d\thash=%s\tpages=%u\tsampled=%u", result->cputype, result->cpusubtype & ~CPU_SUBTYPE_MASK,
+                hash_algorithm_to_string(algorithm), result->pageCount, result->sampledCount);
+        if (result->escalated) {
+            fprintf(output, "\tsample-mismatches=%u", result->sampleMismatches);
+        }
+        if (result->status == PAGE_SAMPLE_TAMPERED) {
+            fprintf(output, "\tmismatches=%u", result->mismatches);
+        }
+        fprintf(output, "\tdetect=%.2f%%", result->detectionProbability * 100.0);
+    }
+    fprintf(output, "\n");
+    funlockfile(output);
+}
+
+void page_sampler_init(PageSampler *sampler, const PageSampleConfig *config, FILE *output)
+{
+    memset(sampler, 0, sizeof(PageSampler));
+    sampler->config = *config;
+    sampler->output = output;
+    sampler->startTime = clock_now_ns();
+}
+
+void page_sampler_add_path(PageSampler *sampler, const char *path)
+{
+    PageSampleResult result;
+    page_sample_verify_path(path, &sampler->config, &result);
+    page_sample_result_print(path, &result, sampler->output);
+
+    atomic_fetch_add_explicit(&sampler->fileCount, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sampler->statusCounts[result.status], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sampler->pageCount, result.pageCount, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sampler->hashedCount, result.hashedCount, memory_order_relaxed);
+    if (result.escalated) atomic_fetch_add_explicit(&sampler->escalatedCount, 1, memory_order_relaxed);
+    if ((result.status == PAGE_SAMPLE_OK || result.status == PAGE_SAMPLE_TAMPERED) && !sampler->config.full) {
+        atomic_fetch_add_explicit(&sampler->sampledFileCount, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&sampler->detectionMicros, (uint64_t)(result.detectionProbability * 1e6), memory_order_relaxed);
+    }
+}
+
+typedef struct PageSamplerContext {
+    PageSampler *sampler;
+    FILE *input;
+    pthread_mutex_t inputLock;
+} PageSamplerContext;
+
+static void *page_sampler_worker(void *arg)
+{
+    PageSamplerContext *context = arg;
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    while (true) {
+        pthread_mutex_lock(&context->inputLock);
+        ssize_t lineLen = getdelim(&line, &lineCapacity, '\0', context->input);
+        pthread_mutex_unlock(&context->inputLock);
+        if (lineLen <= 0) break;
+        // The last path may not be terminated, getdelim returns it without the delimiter
+        if (line[lineLen - 1] == '\0') lineLen--;
+        if (lineLen == 0) continue;
+        page_sampler_add_path(context->sampler, line);
+    }
+    free(line);
+    return NULL;
+}
+
+int page_sampler_run_paths_from_file(PageSampler *sampler, FILE *input, unsigned threadCount)
+{
+    PageSamplerContext context = { .sampler = sampler, .input = input };
+    pthread_mutex_init(&context.inputLock, NULL);
+    pthread_t *threads = calloc(threadCount, sizeof(pthread_t));
+    unsigned started = 0;
+    if (threads) {
+        for (; started < threadCount; started++) {
+            if (pthread_create(&threads[started], NULL, page_sampler_worker, &context) != 0) break;
+        }
+    }
+    if (started == 0) {
+        page_sampler_worker(&context);
+    }
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&context.inputLock);
+    return 0;
+}
+
+void page_sampler_print_stats(PageSampler *sampler, FILE *output)
+{
+    if (!sampler->endTime) sampler->endTime = clock_now_ns();
+    uint64_t fileCount = atomic_load(&sampler->fileCount);
+    uint64_t ok = atomic_load(&sampler->statusCounts[PAGE_SAMPLE_OK]);
+    uint64_t tampered = atomic_load(&sampler->statusCounts[PAGE_SAMPLE_TAMPERED]);
+    uint64_t pageCount = atomic_load(&sampler->pageCount);
+    uint64_t hashedCount = atomic_load(&sampler->hashedCount);
+    uint64_t sampledFileCount = atomic_load(&sampler->sampledFileCount);
+
+    fprintf(output, "%llu files in %.2f s: %llu ok, %llu tampered, %llu not checked\n", (unsigned long long)fileCount,
+            (double)(sampler->endTime - sampler->startTime) / 1e9, (unsigned long long)ok, (unsigned long long)tampered,
+            (unsigned long long)(fileCount - ok - tampered));
+    for (int status = PAGE_SAMPLE_OPEN_FAILED; status < PAGE_SAMPLE_STATUS_COUNT; status++) {
+        uint64_t count = atomic_load(&sampler->statusCounts[status]);
+        if (count) fprintf(output, "  %s: %llu\n", page_sample_status_to_string(status), (unsigned long long)count);
+    }
+    fprintf(output, "hashed %llu pages for %llu code pages (%.1f%%), %llu files escalated to full verification\n",
+            (unsigned long long)hashedCount, (unsigned long long)pageCount, pageCount ? 100.0 * hashedCount / pageCount : 0.0,
+            (unsigned long long)atomic_load(&sampler->escalatedCount));
+    if (sampledFileCount) {
+        fprintf(output, "mean detection probability of a %u page modification: %.2f%% (seed %llu, %u random pages)\n",
+                sampler->config.tamperPages, (double)atomic_load(&sampler->detectionMicros) / (double)sampledFileCount / 1e4,
+                (unsigned long long)sampler->config.seed, sampler->config.randomPages);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef PAGE_SAMPLE_H
+#define PAGE_SAMPLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include <choma/FAT.h>
+
+// Sampled page hash verification for integrity triage across many binaries
+// Instead of hashing every code page of the preferred slice, only a seeded subset of its code slots is checked:
+// the first and last page, the pages holding the entry point and the start of __TEXT,__text, plus k pages
+// drawn at random. The file is mapped, so pages that are not sampled are never read. A mismatch in the sample
+// escalates to verifying every page. Each result carries the chance that the random pages alone catch a
+// modification of a given number of pages, the fixed pages only add to it
+
+#define PAGE_SAMPLE_DEFAULT_RANDOM_PAGES 16
+#define PAGE_SAMPLE_MAX_FIXED_PAGES 4
+
+typedef enum {
+    PAGE_SAMPLE_OK = 0,
+    PAGE_SAMPLE_TAMPERED, // at least one code page does not match its slot
+    PAGE_SAMPLE_OPEN_FAILED,
+    PAGE_SAMPLE_NOT_MACHO,
+    PAGE_SAMPLE_NO_SLICE,
+    PAGE_SAMPLE_NO_SIGNATURE,
+    PAGE_SAMPLE_NO_CODE_DIRECTORY,
+    PAGE_SAMPLE_MALFORMED, // code directory with an unknown hash type or slots that do not fit the slice
+    PAGE_SAMPLE_STATUS_COUNT,
+} PageSampleStatus;
+
+typedef struct PageSampleConfig {
+    uint32_t randomPages;
+    uint64_t seed; // mixed with the path, so every binary gets its own reproducible sample
+    uint32_t tamperPages; // modification size the detection probability is reported for
+    bool full; // verify every page, no sampling
+} PageSampleConfig;
+
+typedef struct PageSampleResult {
+    PageSampleStatus status;
+    cpu_type_t cputype;
+    cpu_subtype_t cpusubtype;
+    uint8_t hashType;
+    uint32_t pageCount;
+    uint32_t sampledCount;
+    uint32_t sampleMismatches;
+    bool escalated;
+    uint32_t mismatches; // of all pages once escalated, of the sample otherwise
+    uint64_t hashedCount; // pages hashed in total, including the escalation
+    double detectionProbability;
+} PageSampleResult;
+
+typedef struct PageSampler {
+    PageSampleConfig config;
+    FILE *output;
+
+    _Atomic uint64_t fileCount;
+    _Atomic uint64_t statusCounts[PAGE_SAMPLE_STATUS_COUNT];
+    _Atomic uint64_t pageCount;
+    _Atomic uint64_t hashedCount;
+    _Atomic uint64_t escalatedCount;
+    _Atomic uint64_t sampledFileCount; // checked files that were not fully verified, for the mean detection probability
+    _Atomic uint64_t detectionMicros; // sum of their detection probabilities in millionths
+    uint64_t startTime;
+    uint64_t endTime;
+} PageSampler;
+
+const char *page_sample_status_to_string(PageSampleStatus status);
+
+void page_sample_config_init(PageSampleConfig *config);
+
+// Chance that randomPages pages drawn without replacement from candidatePages include one of tamperPages given pages
+double page_sample_detection_probability(uint64_t candidatePages, uint64_t randomPages, uint64_t tamperPages);
+
+int page_sample_verify_path(const char *path, const PageSampleConfig *config, PageSampleResult *resultOut);
+
+// Tab separated, same layout as the scan output
+void page_sample_result_print(const char *path, const PageSampleResult *result, FILE *output);
+
+void page_sampler_init(PageSampler *sampler, const PageSampleConfig *config, FILE *output);
+// Thread safe, verifies path, prints its line and counts it
+void page_sampler_add_path(PageSampler *sampler, const char *path);
+// Verify every path of a NUL delimited list on threadCount threads
+int page_sampler_run_paths_from_file(PageSampler *sampler, FILE *input, unsigned threadCount);
+void page_sampler_print_stats(PageSampler *sampler, FILE *output);
+
+#endif // PAGE_SAMPLE_H
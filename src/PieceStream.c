@@ -0,0 +1,514 @@
+#include "PieceStream.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+static const uint8_t gPieceZeroes[PIECE_STREAM_ZERO_CHUNK_SIZE];
+
+static uint32_t piece_table_next_priority(PieceTable *table)
+{
+    table->randomState ^= table->randomState << 13;
+    table->randomState ^= table->randomState >> 7;
+    table->randomState ^= table->randomState << 17;
+    return (uint32_t)(table->randomState >> 32);
+}
+
+static uint64_t piece_get_length(const PieceNode *node)
+{
+    return node ? node->subtreeLength : 0;
+}
+
+static void piece_update(PieceNode *node)
+{
+    node->subtreeLength = piece_get_length(node->left) + node->length + piece_get_length(node->right);
+}
+
+static PieceNode *piece_node_create(PieceTable *table, PieceSource source, uint64_t offset, uint64_t length)
+{
+    PieceNode *node = calloc(1, sizeof(PieceNode));
+    if (!node) return NULL;
+    node->source = source;
+    node->offset = offset;
+    node->length = length;
+    node->subtreeLength = length;
+    node->priority = piece_table_next_priority(table);
+    return node;
+}
+
+static void piece_free_tree(PieceTable *table, PieceNode *node)
+{
+    if (!node) return;
+    piece_free_tree(table, node->left);
+    piece_free_tree(table, node->right);
+    table->pieceCount--;
+    free(node);
+}
+
+// Split into the first position bytes and the rest, a piece straddling position is cut in two with the
+// preallocated *spare (set to NULL when used). The tail keeps the priority of the piece it was cut from,
+// which is at least that of everything below it, so both halves stay valid treaps
+static void piece_split(PieceTable *table, PieceNode *node, uint64_t position, PieceNode **leftOut, PieceNode **rightOut, PieceNode **spare)
+{
+    if (!node) {
+        *leftOut = NULL;
+        *rightOut = NULL;
+        return;
+    }
+    uint64_t leftLength = piece_get_length(node->left);
+    if (position <= leftLength) {
+        piece_split(table, node->left, position, leftOut, &node->left, spare);
+        piece_update(node);
+        *rightOut = node;
+    }
+    else if (position >= leftLength + node->length) {
+        piece_split(table, node->right, position - leftLength - node->length, &node->right, rightOut, spare);
+        piece_update(node);
+        *leftOut = node;
+    }
+    else {
+        uint64_t cut = position - leftLength;
+        PieceNode *tail = *spare;
+        *spare = NULL;
+        tail->source = node->source;
+        tail->offset = node->source == PIECE_SOURCE_ZERO ? 0 : node->offset + cut;
+        tail->length = node->length - cut;
+        tail->priority = node->priority;
+        tail->left = NULL;
+        tail->right = node->right;
+        node->length = cut;
+        node->right = NULL;
+        piece_update(tail);
+        piece_update(node);
+        table->pieceCount++;
+        *leftOut = node;
+        *rightOut = tail;
+    }
+}
+
+static PieceNode *piece_merge(PieceNode *left, PieceNode *right)
+{
+    if (!left) return right;
+    if (!right) return left;
+    if (left->priority > right->priority) {
+        left->right = piece_merge(left->right, right);
+        piece_update(left);
+        return left;
+    }
+    right->left = piece_merge(left, right->left);
+    piece_update(right);
+    return right;
+}
+
+// Replace the bytes [position, position + deleteLength) of the table with node (may be NULL)
+static int piece_table_replace(PieceTable *table, uint64_t position, uint64_t deleteLength, PieceNode *node)
+{
+    PieceNode *spares[2] = { calloc(1, sizeof(PieceNode)), calloc(1, sizeof(PieceNode)) };
+    if (!spares[0] || !spares[1]) {
+        free(spares[0]);
+        free(spares[1]);
+        free(node);
+        return -1;
+    }
+
+    PieceNode *left = NULL, *middle = NULL, *deleted = NULL, *right = NULL;
+    piece_split(table, table->root, position, &left, &middle, &spares[0]);
+    piece_split(table, middle, deleteLength, &deleted, &right, spares[0] ? &spares[0] : &spares[1]);
+    piece_free_tree(table, deleted);
+    if (node) {
+        table->pieceCount++;
+        left = piece_merge(left, node);
+    }
+    table->root = piece_merge(left, right);
+    free(spares[0]);
+    free(spares[1]);
+    return 0;
+}
+
+static int piece_table_append_data(PieceTable *table, const void *data, size_t size, uint64_t *offsetOut)
+{
+    if (table->addedCapacity - table->addedSize < size) {
+        size_t capacity = table->addedCapacity ? table->addedCapacity : 4096;
+        while (capacity - table->addedSize < size) capacity *= 2;
+        uint8_t *added = realloc(table->added, capacity);
+        if (!added) return -1;
+        table->added = added;
+        table->addedCapacity = capacity;
+    }
+    memcpy(table->added + table->addedSize, data, size);
+    *offsetOut = table->addedSize;
+    table->addedSize += size;
+    return 0;
+}
+
+static int piece_table_insert(PieceTable *table, uint64_t position, uint64_t deleteLength, PieceSource source, const void *data, size_t size)
+{
+    if (!size) return piece_table_replace(table, position, deleteLength, NULL);
+    uint64_t offset = 0;
+    if (source == PIECE_SOURCE_ADDED && piece_table_append_data(table, data, size, &offset) != 0) return -1;
+    PieceNode *node = piece_node_create(table, source, offset, size);
+    if (!node) return -1;
+    return piece_table_replace(table, position, deleteLength, node);
+}
+
+static void piece_read(const PieceTable *table, const PieceNode *node, uint64_t offset, size_t size, uint8_t *outBuf)
+{
+    while (node && size) {
+        uint64_t leftLength = piece_get_length(node->left);
+        if (offset < leftLength) {
+            size_t count = leftLength - offset < size ? leftLength - offset : size;
+            piece_read(table, node->left, offset, count, outBuf);
+            outBuf += count;
+            offset += count;
+            size -= count;
+        }
+        if (size && offset < leftLength + node->length) {
+            uint64_t start = offset - leftLength;
+            size_t count = node->length - start < size ? node->length - start : size;
+            switch (node->source) {
+                case PIECE_SOURCE_ORIGINAL:
+                    memcpy(outBuf, table->original + node->offset + start, count);
+                    break;
+                case PIECE_SOURCE_ADDED:
+                    memcpy(outBuf, table->added + node->offset + start, count);
+                    break;
+                case PIECE_SOURCE_ZERO:
+                    memset(outBuf, 0, count);
+                    break;
+            }
+            outBuf += count;
+            offset += count;
+            size -= count;
+        }
+        // Continue in the right subtree without recursing
+        offset -= leftLength + node->length;
+        node = node->right;
+    }
+}
+
+static void piece_table_release(PieceTable *table)
+{
+    if (--table->refCount) return;
+    piece_free_tree(table, table->root);
+    if (table->originalMapped && table->originalSize) munmap((void *)table->original, table->originalSize);
+    if (table->ownsOriginal) free((void *)table->original);
+    free(table->added);
+    free(table);
+}
+
+static int piece_stream_read(MemoryStream *stream, uint64_t offset, size_t size, void *outBuf)
+{
+    PieceStreamContext *context = stream->context;
+    if (offset > context->size || size > context->size - offset) {
+        printf("Error: cannot read %zx bytes at %llx, maximum is %zx.\n", size, (unsigned long long)offset, context->size);
+        return -1;
+    }
+    piece_read(context->table, context->table->root, context->base + offset, size, outBuf);
+    return size;
+}
+
+static int piece_stream_write(MemoryStream *stream, uint64_t offset, size_t size, const void *inBuf)
+{
+    PieceStreamContext *context = stream->context;
+    if (offset > context->size) return -1;
+    // Writing past the end grows the stream by exactly the overhang
+    size_t overlap = context->size - offset < size ? context->size - offset : size;
+    if (overlap < size && !(stream->flags & MEMORY_STREAM_FLAG_AUTO_EXPAND)) {
+        printf("Error: cannot write %zx bytes at %llx, maximum is %zx.\n", size, (unsigned long long)offset, context->size);
+        return -1;
+    }
+    if (piece_table_insert(context->table, context->base + offset, overlap, PIECE_SOURCE_ADDED, inBuf, size) != 0) return -1;
+    context->size += size - overlap;
+    return size;
+}
+
+static int piece_stream_get_size(MemoryStream *stream, size_t *sizeOut)
+{
+    PieceStreamContext *context = stream->context;
+    *sizeOut = context->size;
+    return 0;
+}
+
+static int piece_stream_trim(MemoryStream *stream, size_t trimAtStart, size_t trimAtEnd)
+{
+    PieceStreamContext *context = stream->context;
+    if (trimAtStart > context->size || trimAtEnd > context->size - trimAtStart) return -1;
+    context->base += trimAtStart;
+    context->size -= trimAtStart + trimAtEnd;
+    return 0;
+}
+
+static int piece_stream_expand(MemoryStream *stream, size_t expandAtStart, size_t expandAtEnd)
+{
+    PieceStreamContext *context = stream->context;
+    if (piece_table_insert(context->table, context->base + context->size, 0, PIECE_SOURCE_ZERO, NULL, expandAtEnd) != 0) return -1;
+    context->size += expandAtEnd;
+    if (piece_table_insert(context->table, context->base, 0, PIECE_SOURCE_ZERO, NULL, expandAtStart) != 0) return -1;
+    context->size += expandAtStart;
+    return 0;
+}
+
+static MemoryStream *piece_stream_init_with_table(PieceTable *table, uint64_t base, size_t size)
+{
+    MemoryStream *stream = calloc(1, sizeof(MemoryStream));
+    PieceStreamContext *context = calloc(1, sizeof(PieceStreamContext));
+    if (!stream || !context) {
+        free(stream);
+        free(context);
+        return NULL;
+    }
+    table->refCount++;
+    context->table = table;
+    context->base = base;
+    context->size = size;
+
+    stream->context = context;
+    stream->flags = MEMORY_STREAM_FLAG_MUTABLE | MEMORY_STREAM_FLAG_AUTO_EXPAND;
+    stream->read = piece_stream_read;
+    stream->write = piece_stream_write;
+    stream->getSize = piece_stream_get_size;
+    stream->trim = piece_stream_trim;
+    stream->expand = piece_stream_expand;
+    stream->softclone = NULL;
+    stream->hardclone = NULL;
+    stream->free = NULL;
+    return stream;
+}
+
+static MemoryStream *piece_stream_softclone(MemoryStream *stream);
+static MemoryStream *piece_stream_hardclone(MemoryStream *stream);
+static void piece_stream_free(MemoryStream *stream);
+
+static MemoryStream *piece_stream_init_with_original(const uint8_t *original, size_t size, bool mapped, bool owned)
+{
+    PieceTable *table = calloc(1, sizeof(PieceTable));
+    if (!table) return NULL;
+    table->original = original;
+    table->originalSize = size;
+    table->originalMapped = mapped;
+    table->ownsOriginal = owned;
+    table->randomState = 0x9e3779b97f4a7c15ULL ^ (uint64_t)(uintptr_t)table;
+    if (size) {
+        table->root = piece_node_create(table, PIECE_SOURCE_ORIGINAL, 0, size);
+        if (!table->root) {
+            free(table);
+            return NULL;
+        }
+        table->pieceCount = 1;
+    }
+
+    MemoryStream *stream = piece_stream_init_with_table(table, 0, size);
+    if (!stream) {
+        table->refCount = 1;
+        piece_table_release(table);
+        return NULL;
+    }
+    stream->softclone = piece_stream_softclone;
+    stream->hardclone = piece_stream_hardclone;
+    stream->free = piece_stream_free;
+    return stream;
+}
+
+static MemoryStream *piece_stream_softclone(MemoryStream *stream)
+{
+    PieceStreamContext *context = stream->context;
+    MemoryStream *clone = piece_stream_init_with_table(context->table, context->base, context->size);
+    if (!clone) return NULL;
+    clone->softclone = piece_stream_softclone;
+    clone->hardclone = piece_stream_hardclone;
+    clone->free = piece_stream_free;
+    return clone;
+}
+
+// A hard clone gets its own table over a flat copy of the window
+static MemoryStream *piece_stream_hardclone(MemoryStream *stream)
+{
+    PieceStreamContext *context = stream->context;
+    uint8_t *copy = malloc(context->size ? context->size : 1);
+    if (!copy) return NULL;
+    piece_read(context->table, context->table->root, context->base, context->size, copy);
+    MemoryStream *clone = piece_stream_init_with_original(copy, context->size, false, true);
+    if (!clone) free(copy);
+    return clone;
+}
+
+static void piece_stream_free(MemoryStream *stream)
+{
+    PieceStreamContext *context = stream->context;
+    piece_table_release(context->table);
+    free(context);
+}
+
+MemoryStream *piece_stream_init_from_path(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: failed to open %s!\n", path);
+        return NULL;
+    }
+    struct stat s;
+    if (fstat(fd, &s) != 0) {
+        close(fd);
+        return NULL;
+    }
+    uint8_t *mapping = NULL;
+    if (s.st_size) {
+        mapping = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            printf("Error: failed to map %s!\n", path);
+            close(fd);
+            return NULL;
+        }
+    }
+    close(fd);
+    MemoryStream *stream = piece_stream_init_with_original(mapping, s.st_size, true, false);
+    if (!stream && mapping) munmap(mapping, s.st_size);
+    return stream;
+}
+
+MemoryStream *piece_stream_init_from_buffer_nocopy(const void *buffer, size_t bufferSize)
+{
+    return piece_stream_init_with_original(buffer, bufferSize, false, false);
+}
+
+int piece_stream_insert(MemoryStream *stream, uint64_t offset, size_t size, const void *inBuf)
+{
+    PieceStreamContext *context = stream->context;
+    if (offset > context->size) return -1;
+    if (piece_table_insert(context->table, context->base + offset, 0, PIECE_SOURCE_ADDED, inBuf, size) != 0) return -1;
+    context->size += size;
+    return 0;
+}
+
+int piece_stream_delete(MemoryStream *stream, uint64_t offset, size_t size)
+{
+    PieceStreamContext *context = stream->context;
+    if (offset > context->size || size > context->size - offset) return -1;
+    if (piece_table_replace(context->table, context->base + offset, size, NULL) != 0) return -1;
+    context->size -= size;
+    return 0;
+}
+
+size_t piece_stream_get_piece_count(MemoryStream *stream)
+{
+    PieceStreamContext *context = stream->context;
+    return context->table->pieceCount;
+}
+
+typedef struct PieceGather {
+    struct iovec *iov;
+    size_t count;
+    size_t capacity;
+} PieceGather;
+
+static int piece_gather_append(PieceGather *gather, const void *base, size_t length)
+{
+    if (gather->count == gather->capacity) {
+        size_t capacity = gather->capacity ? gather->capacity * 2 : 64;
+        struct iovec *iov = realloc(gather->iov, capacity * sizeof(struct iovec));
+        if (!iov) return -1;
+        gather->iov = iov;
+        gather->capacity = capacity;
+    }
+    gather->iov[gather->count++] = (struct iovec){ (void *)base, length };
+    return 0;
+}
+
+// Same walk as piece_read, collecting the spans instead of copying them
+static int piece_gather(const PieceTable *table, const PieceNode *node, uint64_t offset, size_t size, PieceGather *gather)
+{
+    while (node && size) {
+        uint64_t leftLength = piece_get_length(node->left);
+        if (offset < leftLength) {
+            size_t count = leftLength - offset < size ? leftLength - offset : size;
+            if (piece_gather(table, node->left, offset, count, gather) != 0) return -1;
+            offset += count;
+            size -= count;
+        }
+        if (size && offset < leftLength + node->length) {
+            uint64_t start = offset - leftLength;
+            size_t count = node->length - start < size ? node->length - start : size;
+            if (node->source == PIECE_SOURCE_ZERO) {
+                for (size_t done = 0; done < count; done += PIECE_STREAM_ZERO_CHUNK_SIZE) {
+                    size_t chunk = count - done < PIECE_STREAM_ZERO_CHUNK_SIZE ? count - done : PIECE_STREAM_ZERO_CHUNK_SIZE;
+                    if (piece_gather_append(gather, gPieceZeroes, chunk) != 0) return -1;
+                }
+            }
+            else {
+                const uint8_t *source = node->source == PIECE_SOURCE_ORIGINAL ? table->original : table->added;
+                if (piece_gather_append(gather, source + node->offset + start, count) != 0) return -1;
+            }
+            offset += count;
+            size -= count;
+        }
+        offset -= leftLength + node->length;
+        node = node->right;
+    }
+    return 0;
+}
+
+static int piece_pwritev_full(int fd, struct iovec *iov, size_t count)
+{
+    off_t offset = 0;
+    while (count) {
+        int batch = count < IOV_MAX ? (int)count : IOV_MAX;
+        ssize_t written = pwritev(fd, iov, batch, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        offset += written;
+        // Skip what was written, a short write leaves the current iovec partially done
+        while (count && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+int piece_stream_write_to_path(MemoryStream *stream, const char *path)
+{
+    PieceStreamContext *context = stream->context;
+    PieceGather gather = { 0 };
+    if (piece_gather(context->table, context->table->root, context->base, context->size, &gather) != 0) {
+        free(gather.iov);
+        return -1;
+    }
+
+    size_t pathLength = strlen(path);
+    char *tempPath = malloc(pathLength + sizeof(".XXXXXX"));
+    if (!tempPath) {
+        free(gather.iov);
+        return -1;
+    }
+    memcpy(tempPath, path, pathLength);
+    memcpy(tempPath + pathLength, ".XXXXXX", sizeof(".XXXXXX"));
+    int fd = mkstemp(tempPath);
+    if (fd < 0) {
+        printf("Error: failed to create %s!\n", tempPath);
+        free(tempPath);
+        free(gather.iov);
+        return -1;
+    }
+
+    // Keep the mode of the file being replaced, binaries have to stay executable
+    struct stat s;
+    fchmod(fd, stat(path, &s) == 0 ? (s.st_mode & 07777) : 0755);
+    int r = piece_pwritev_full(fd, gather.iov, gather.count);
+    if (close(fd) != 0) r = -1;
+    if (r == 0 && rename(tempPath, path) != 0) r = -1;
+    if (r != 0) {
+        printf("Error: failed to write %s!\n", path);
+        unlink(tempPath);
+    }
+    free(tempPath);
+    free(gather.iov);
+    return r;
+}
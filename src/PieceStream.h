@@ -0,0 +1,77 @@
+#ifndef PIECE_STREAM_H
+#define PIECE_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <choma/MemoryStream.h>
+
+// MemoryStream backed by a piece table: the stream is a sequence of pieces, each a span of the original
+// data (a read-only mapping of the file or a caller buffer), of an append-only buffer holding every byte
+// written since, or of zeroes. Pieces sit in a treap ordered by stream position, so inserting, deleting or
+// overwriting a range is O(log n) in the number of pieces and never moves untouched data
+//
+// ChOma's memory_stream_insert / memory_stream_delete are generic (expand, then shift the tail through
+// copy_data) and stay O(size) on any backend, use piece_stream_insert / piece_stream_delete for the fast path
+//
+// Soft clones share the table and see each other's writes, trimming only narrows a stream's window.
+// Structural edits (insert, delete, expand) shift the data under other clones' windows, like editing a
+// buffered stream under its clones would
+
+#define PIECE_STREAM_ZERO_CHUNK_SIZE (64 * 1024)
+
+typedef enum {
+    PIECE_SOURCE_ORIGINAL = 0,
+    PIECE_SOURCE_ADDED,
+    PIECE_SOURCE_ZERO,
+} PieceSource;
+
+typedef struct PieceNode {
+    struct PieceNode *left;
+    struct PieceNode *right;
+    uint64_t subtreeLength;
+    uint64_t offset; // into the source
+    uint64_t length;
+    uint32_t priority;
+    PieceSource source;
+} PieceNode;
+
+typedef struct PieceTable {
+    unsigned refCount;
+    PieceNode *root;
+    size_t pieceCount;
+    uint64_t randomState;
+
+    const uint8_t *original;
+    size_t originalSize;
+    bool originalMapped; // munmap on free
+    bool ownsOriginal;   // free on free
+
+    uint8_t *added;
+    size_t addedSize;
+    size_t addedCapacity;
+} PieceTable;
+
+typedef struct PieceStreamContext {
+    PieceTable *table;
+    uint64_t base; // window into the table
+    size_t size;
+} PieceStreamContext;
+
+// Maps the file read-only, nothing is written back until piece_stream_write_to_path
+MemoryStream *piece_stream_init_from_path(const char *path);
+
+// buffer has to stay valid for the lifetime of the stream and all of its clones
+MemoryStream *piece_stream_init_from_buffer_nocopy(const void *buffer, size_t bufferSize);
+
+// O(log n) edits relative to the stream's window, return 0 on success
+int piece_stream_insert(MemoryStream *stream, uint64_t offset, size_t size, const void *inBuf);
+int piece_stream_delete(MemoryStream *stream, uint64_t offset, size_t size);
+
+size_t piece_stream_get_piece_count(MemoryStream *stream);
+
+// Materialize the stream's window with gathered pwritev calls into a temporary file next to path,
+// then rename it over path (which may be the file the stream was created from)
+int piece_stream_write_to_path(MemoryStream *stream, const char *path);
+
+#endif // PIECE_STREAM_H
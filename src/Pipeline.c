@@ -0,0 +1,527 @@
+#include "Pipeline.h"
+
+#include <string.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <pthread/qos.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#include "Clock.h"
+#include "Trace.h"
+
+#define PIPELINE_DEFAULT_QUEUE_DEPTH 256
+#define PIPELINE_DEFAULT_IO_DEPTH 256
+#define PIPELINE_REAP_BATCH 64
+
+static const char *gStageNames[PIPELINE_STAGE_COUNT] = {
+    [PIPELINE_STAGE_PREFETCH] = "prefetch",
+    [PIPELINE_STAGE_PARSE] = "parse",
+    [PIPELINE_STAGE_EVALUATE] = "evaluate",
+    [PIPELINE_STAGE_CDHASH] = "cdhash",
+    [PIPELINE_STAGE_OUTPUT] = "output",
+};
+
+static int pipeline_defer_item(Pipeline *pipeline, ScanItem *item)
+{
+    pthread_mutex_lock(&pipeline->deferredLock);
+    if (pipeline->deferredCount == pipeline->deferredCapacity) {
+        size_t capacity = pipeline->deferredCapacity ? pipeline->deferredCapacity * 2 : 64;
+        ScanItem **deferred = realloc(pipeline->deferred, sizeof(ScanItem *) * capacity);
+        if (!deferred) {
+            pthread_mutex_unlock(&pipeline->deferredLock);
+            return -1;
+        }
+        pipeline->deferred = deferred;
+        pipeline->deferredCapacity = capacity;
+    }
+    pipeline->deferred[pipeline->deferredCount++] = item;
+    pthread_mutex_unlock(&pipeline->deferredLock);
+    return 0;
+}
+
+// Final destination of every record, including deferred ones
+static void pipeline_emit_item(Pipeline *pipeline, ScanItem *item)
+{
+    scan_item_print(item, pipeline->config.output);
+    if (pipeline->config.snapshot && snapshot_writer_add_item(pipeline->config.snapshot, item) != 0) {
+        fprintf(stderr, "Error: failed to add %s to the snapshot!\n", item->path);
+    }
+    if (pipeline->config.store && store_writer_add_item(pipeline->config.store, item) != 0) {
+        fprintf(stderr, "Error: failed to add %s to the store!\n", item->path);
+    }
+}
+
+static int pipeline_output_item(PipelineStage *stage, ScanItem *item)
+{
+    Pipeline *pipeline = stage->pipeline;
+    if (item->status == SCAN_STATUS_CMS_REJECTED) {
+        atomic_fetch_add_explicit(&pipeline->cmsRejected, 1, memory_order_relaxed);
+    }
+    else if (item->cmsParsed && item->cmsParseResult == CMS_PARSE_OK) {
+        atomic_fetch_add_explicit(&pipeline->cmsDigests[item->cmsDigestAlgorithm], 1, memory_order_relaxed);
+    }
+    if (item->trustCacheChecked) {
+        atomic_fetch_add_explicit(&pipeline->trustCacheChecked, 1, memory_order_relaxed);
+        if (item->trustCacheIndex >= 0) {
+            atomic_fetch_add_explicit(&pipeline->trustCacheHits, 1, memory_order_relaxed);
+        }
+    }
+    if (item->status == SCAN_STATUS_OVER_BUDGET) {
+        atomic_fetch_add_explicit(&pipeline->budgetHits[item->budgetHit], 1, memory_order_relaxed);
+        // The retry keeps maxBlobs, a blob count hit would only happen again
+        if (pipeline->config.retryDeferred && item->budgetHit != SCAN_BUDGET_BLOBS && pipeline_defer_item(pipeline, item) == 0) {
+            return 0;
+        }
+    }
+    pipeline_emit_item(pipeline, item);
+    if (item->traceStart) {
+        // Whole lifetime in the pipeline, queueing included, named after the file so slow ones are easy to find
+        trace_record("file", item->traceStart, clock_now_ns(), item->traceId, item->path);
+    }
+    scan_item_free(item);
+    return 0;
+}
+
+static int pipeline_process_item(PipelineStage *stage, ScanItem *item)
+{
+    switch (stage->type) {
+        case PIPELINE_STAGE_PREFETCH:
+            if (stage->pipeline->config.reader == PIPELINE_READER_MMAP) {
+                return scan_item_prefetch(item);
+            }
+            return scan_item_prefetch_regions(item);
+        case PIPELINE_STAGE_PARSE:
+            return scan_item_parse(item);
+        case PIPELINE_STAGE_EVALUATE:
+            return scan_item_evaluate(item);
+        case PIPELINE_STAGE_CDHASH:
+            return scan_item_calculate_cdhash(item);
+        case PIPELINE_STAGE_OUTPUT:
+            return pipeline_output_item(stage, item);
+        default:
+            return -1;
+    }
+}
+
+void pipeline_config_init_default(PipelineConfig *config)
+{
+    memset(config, 0, sizeof(PipelineConfig));
+
+    long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpuCount < 1) cpuCount = 1;
+
+    // I/O bound stages get more threads than there are CPUs so the disks stay busy
+    config->threadCounts[PIPELINE_STAGE_PREFETCH] = cpuCount * 2;
+    config->threadCounts[PIPELINE_STAGE_PARSE] = cpuCount;
+    config->threadCounts[PIPELINE_STAGE_EVALUATE] = cpuCount;
+    config->threadCounts[PIPELINE_STAGE_CDHASH] = cpuCount > 1 ? cpuCount / 2 : 1;
+    config->threadCounts[PIPELINE_STAGE_OUTPUT] = 1;
+    config->queueDepth = PIPELINE_DEFAULT_QUEUE_DEPTH;
+    config->budget.maxBlobs = SCAN_DEFAULT_MAX_BLOBS;
+    config->reader = PIPELINE_READER_MMAP;
+    config->ioDepth = PIPELINE_DEFAULT_IO_DEPTH;
+    config->output = stdout;
+}
+
+int pipeline_config_parse_reader(PipelineConfig *config, const char *string)
+{
+    if (!strcmp(string, "mmap")) {
+        config->reader = PIPELINE_READER_MMAP;
+    }
+    else if (!strcmp(string, "pread")) {
+        config->reader = PIPELINE_READER_PREAD;
+    }
+    else if (!strcmp(string, "uring")) {
+        if (!region_reader_is_supported()) return -1;
+        config->reader = PIPELINE_READER_URING;
+    }
+    else if (!strcmp(string, "auto")) {
+        config->reader = region_reader_is_supported() ? PIPELINE_READER_URING : PIPELINE_READER_PREAD;
+    }
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+int pipeline_config_parse_thread_counts(PipelineConfig *config, const char *string)
+{
+    unsigned counts[PIPELINE_STAGE_COUNT];
+    const char *cur = string;
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        char *end = NULL;
+        unsigned long value = strtoul(cur, &end, 10);
+        if (end == cur || value == 0 || value > 1024) return -1;
+        counts[i] = (unsigned)value;
+        if (i < PIPELINE_STAGE_COUNT - 1) {
+            if (*end != ',') return -1;
+            cur = end + 1;
+        }
+        else if (*end != '\0') {
+            return -1;
+        }
+    }
+    memcpy(config->threadCounts, counts, sizeof(counts));
+    return 0;
+}
+
+Pipeline *pipeline_init(const PipelineConfig *config)
+{
+    Pipeline *pipeline = calloc(1, sizeof(Pipeline));
+    if (!pipeline) return NULL;
+    pipeline->config = *config;
+    pthread_mutex_init(&pipeline->deferredLock, NULL);
+
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        PipelineStage *stage = &pipeline->stages[i];
+        stage->pipeline = pipeline;
+        stage->type = i;
+        stage->name = gStageNames[i];
+        stage->threadCount = config->threadCounts[i] ? config->threadCounts[i] : 1;
+        stage->input = bounded_queue_init(config->queueDepth);
+        stage->threads = calloc(stage->threadCount, sizeof(pthread_t));
+        if (!stage->input || !stage->threads) {
+            pipeline_free(pipeline);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < PIPELINE_STAGE_COUNT - 1; i++) {
+        pipeline->stages[i].output = pipeline->stages[i + 1].input;
+    }
+    return pipeline;
+}
+
+// Prefetch worker driving its own io_uring: keeps up to ioDepth files in flight instead of one per thread
+// Busy time only covers submitting and completing, the reads themselves overlap with everything else
+static void pipeline_prefetch_uring_worker(PipelineStage *stage, RegionReader *reader)
+{
+    unsigned maxActive = stage->pipeline->config.ioDepth ? stage->pipeline->config.ioDepth : 1;
+    RegionFetch *completed[PIPELINE_REAP_BATCH];
+    bool inputDone = false;
+
+    for (;;) {
+        while (!inputDone && region_reader_get_active_count(reader) < maxActive) {
+            ScanItem *item = NULL;
+            if (!bounded_queue_try_pop(stage->input, (void **)&item)) {
+                // Only block for new input when there is nothing left to reap
+                if (region_reader_get_active_count(reader) > 0) break;
+                item = bounded_queue_pop(stage->input);
+                if (!item) {
+                    inputDone = true;
+                    break;
+                }
+            }
+
+            uint64_t start = clock_now_ns();
+            RegionFetch *fetch = item->status == SCAN_STATUS_OK ? region_fetch_init(item->path, item) : NULL;
+            if (fetch && region_reader_submit(reader, fetch) != 0) {
+                region_fetch_free(fetch);
+                fetch = NULL;
+            }
+            if (!fetch) {
+                if (item->status == SCAN_STATUS_OK) item->status = SCAN_STATUS_OPEN_FAILED;
+                atomic_fetch_add_explicit(&stage->itemCount, 1, memory_order_relaxed);
+                bounded_queue_push(stage->output, item);
+            }
+            atomic_fetch_add_explicit(&stage->busyNanos, clock_now_ns() - start, memory_order_relaxed);
+        }
+
+        if (inputDone && region_reader_get_active_count(reader) == 0) break;
+
+        unsigned count = region_reader_reap(reader, completed, PIPELINE_REAP_BATCH, true);
+        uint64_t start = clock_now_ns();
+        for (unsigned i = 0; i < count; i++) {
+            ScanItem *item = completed[i]->context;
+            scan_item_set_regions(item, region_fetch_take_regions(completed[i]));
+            region_fetch_free(completed[i]);
+            atomic_fetch_add_explicit(&stage->itemCount, 1, memory_order_relaxed);
+            bounded_queue_push(stage->output, item);
+        }
+        atomic_fetch_add_explicit(&stage->busyNanos, clock_now_ns() - start, memory_order_relaxed);
+    }
+}
+
+static void *pipeline_stage_worker(void *arg)
+{
+    PipelineStage *stage = arg;
+    trace_set_thread_name(stage->name);
+
+    if (stage->type == PIPELINE_STAGE_PREFETCH && stage->pipeline->config.reader == PIPELINE_READER_URING) {
+        RegionReader *reader = region_reader_init(stage->pipeline->config.ioDepth);
+        if (reader) {
+            pipeline_prefetch_uring_worker(stage, reader);
+            region_reader_free(reader);
+            if (atomic_fetch_sub(&stage->liveThreads, 1) == 1) {
+                bounded_queue_close(stage->output);
+            }
+            return NULL;
+        }
+        // Ring setup can still fail (e.g. memlock limits), the generic loop below uses blocking preads then
+    }
+
+    ScanItem *item = NULL;
+    while ((item = bounded_queue_pop(stage->input))) {
+        uint64_t start = clock_now_ns();
+        // The output stage frees the item, it must not be touched afterwards
+        BoundedQueue *output = stage->output;
+        pipeline_process_item(stage, item);
+        atomic_fetch_add_explicit(&stage->busyNanos, clock_now_ns() - start, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stage->itemCount, 1, memory_order_relaxed);
+        if (output) bounded_queue_push(output, item);
+    }
+
+    // Last thread out closes the next queue so the downstream stage can drain and exit
+    if (atomic_fetch_sub(&stage->liveThreads, 1) == 1 && stage->output) {
+        bounded_queue_close(stage->output);
+    }
+    return NULL;
+}
+
+static void pipeline_lower_thread_priority(void)
+{
+#if defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+#elif defined(__linux__)
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+#endif
+}
+
+// Deferred files are retried one at a time so a pathological file only ever occupies this thread
+static void *pipeline_retry_thread(void *arg)
+{
+    Pipeline *pipeline = arg;
+    pipeline_lower_thread_priority();
+    trace_set_thread_name("retry");
+
+    // Structural checks stay, they protect the decoder rather than the schedule
+    ScanBudget budget = { .maxBlobs = pipeline->config.budget.maxBlobs };
+    for (size_t i = 0; i < pipeline->deferredCount; i++) {
+        ScanItem *deferred = pipeline->deferred[i];
+        ScanItem *item = scan_item_init(deferred->path);
+        if (item) {
+            item->budget = &budget;
+            item->traceId = deferred->traceId;
+            item->auditEnabled = deferred->auditEnabled;
+            item->prescreen = deferred->prescreen;
+            item->trustCaches = deferred->trustCaches;
+            if (pipeline->config.reader == PIPELINE_READER_MMAP) {
+                scan_item_prefetch(item);
+            }
+            else {
+                scan_item_prefetch_regions(item);
+            }
+            scan_item_parse(item);
+            scan_item_evaluate(item);
+            scan_item_calculate_cdhash(item);
+            pipeline_emit_item(pipeline, item);
+            scan_item_free(item);
+        }
+        else {
+            pipeline_emit_item(pipeline, deferred);
+        }
+        scan_item_free(deferred);
+        atomic_fetch_add_explicit(&pipeline->retriedCount, 1, memory_order_relaxed);
+    }
+    pipeline->deferredCount = 0;
+    return NULL;
+}
+
+typedef struct PipelineMonitor {
+    Pipeline *pipeline;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+} PipelineMonitor;
+
+static void *pipeline_monitor_thread(void *arg)
+{
+    PipelineMonitor *monitor = arg;
+    pthread_mutex_lock(&monitor->lock);
+    while (!monitor->done) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += monitor->pipeline->config.statsInterval;
+        pthread_cond_timedwait(&monitor->cond, &monitor->lock, &deadline);
+        if (!monitor->done) {
+            pipeline_print_stats(monitor->pipeline, stderr);
+        }
+    }
+    pthread_mutex_unlock(&monitor->lock);
+    return NULL;
+}
+
+int pipeline_run_paths_from_file(Pipeline *pipeline, FILE *input)
+{
+    pipeline->startTime = clock_now_ns();
+    pipeline->endTime = 0;
+
+    unsigned started[PIPELINE_STAGE_COUNT] = { 0 };
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        PipelineStage *stage = &pipeline->stages[i];
+        atomic_store(&stage->liveThreads, stage->threadCount);
+        for (; started[i] < stage->threadCount; started[i]++) {
+            if (pthread_create(&stage->threads[started[i]], NULL, pipeline_stage_worker, stage) != 0) break;
+        }
+        if (started[i] < stage->threadCount) {
+            fprintf(stderr, "Error: failed to create %s thread!\n", stage->name);
+            atomic_fetch_sub(&stage->liveThreads, stage->threadCount - started[i]);
+            // Nothing has been queued yet, closing every input lets the started threads drain out and exit
+            for (int j = 0; j < PIPELINE_STAGE_COUNT; j++) {
+                bounded_queue_close(pipeline->stages[j].input);
+            }
+            for (int j = 0; j <= i; j++) {
+                for (unsigned t = 0; t < started[j]; t++) {
+                    pthread_join(pipeline->stages[j].threads[t], NULL);
+                }
+            }
+            return -1;
+        }
+    }
+
+    PipelineMonitor monitor = { .pipeline = pipeline, .done = false };
+    pthread_t monitorThread;
+    bool hasMonitor = false;
+    if (pipeline->config.statsInterval) {
+        pthread_mutex_init(&monitor.lock, NULL);
+        pthread_cond_init(&monitor.cond, NULL);
+        hasMonitor = pthread_create(&monitorThread, NULL, pipeline_monitor_thread, &monitor) == 0;
+    }
+
+    BoundedQueue *firstQueue = pipeline->stages[0].input;
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLen = 0;
+    while ((lineLen = getdelim(&line, &lineCapacity, '\0', input)) > 0) {
+        // The last path may not be terminated, getdelim returns it without the delimiter
+        if (line[lineLen - 1] == '\0') lineLen--;
+        if (lineLen == 0) continue;
+
+        ScanItem *item = scan_item_init(line);
+        if (!item) {
+            fprintf(stderr, "Error: failed to allocate scan item!\n");
+            break;
+        }
+        item->budget = &pipeline->config.budget;
+        item->traceId = atomic_load_explicit(&pipeline->pathCount, memory_order_relaxed) + 1;
+        item->auditEnabled = pipeline->config.audit;
+        item->prescreen = pipeline->config.prescreen;
+        item->trustCaches = pipeline->config.trustCaches;
+        if (trace_is_enabled()) item->traceStart = clock_now_ns();
+        bounded_queue_push(firstQueue, item);
+        atomic_fetch_add_explicit(&pipeline->pathCount, 1, memory_order_relaxed);
+    }
+    free(line);
+    bounded_queue_close(firstQueue);
+
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        PipelineStage *stage = &pipeline->stages[i];
+        for (unsigned t = 0; t < stage->threadCount; t++) {
+            pthread_join(stage->threads[t], NULL);
+        }
+    }
+
+    if (pipeline->deferredCount) {
+        pthread_t retryThread;
+        if (pthread_create(&retryThread, NULL, pipeline_retry_thread, pipeline) == 0) {
+            pthread_join(retryThread, NULL);
+        }
+        else {
+            pipeline_retry_thread(pipeline);
+        }
+    }
+    pipeline->endTime = clock_now_ns();
+
+    if (hasMonitor) {
+        pthread_mutex_lock(&monitor.lock);
+        monitor.done = true;
+        pthread_cond_signal(&monitor.cond);
+        pthread_mutex_unlock(&monitor.lock);
+        pthread_join(monitorThread, NULL);
+        pthread_mutex_destroy(&monitor.lock);
+        pthread_cond_destroy(&monitor.cond);
+    }
+    return 0;
+}
+
+void pipeline_print_stats(Pipeline *pipeline, FILE *output)
+{
+    uint64_t end = pipeline->endTime ? pipeline->endTime : clock_now_ns();
+    double wallNanos = (double)(end - pipeline->startTime);
+    if (wallNanos <= 0) wallNanos = 1;
+
+    flockfile(output);
+    uint64_t pathCount = atomic_load(&pipeline->pathCount);
+    fprintf(output, "%llu paths in %.3fs (%.1f/s)\n", (unsigned long long)pathCount, wallNanos / 1e9, pathCount / (wallNanos / 1e9));
+    fprintf(output, "%-10s %7s %10s %6s %9s %9s %9s %12s %12s\n", "stage", "threads", "items", "util", "depth", "high", "avg", "push-stalls", "pop-stalls");
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        PipelineStage *stage = &pipeline->stages[i];
+        BoundedQueue *queue = stage->input;
+        uint64_t items = atomic_load_explicit(&stage->itemCount, memory_order_relaxed);
+        uint64_t busy = atomic_load_explicit(&stage->busyNanos, memory_order_relaxed);
+        uint64_t pushes = atomic_load_explicit(&queue->pushCount, memory_order_relaxed);
+        uint64_t depthSum = atomic_load_explicit(&queue->depthSum, memory_order_relaxed);
+
+        // Utilization near 100% with a full input queue marks the bottleneck
+        double utilization = 100.0 * (double)busy / (wallNanos * stage->threadCount);
+        fprintf(output, "%-10s %7u %10llu %5.1f%% %4zu/%-4zu %9zu %9.1f %12llu %12llu\n",
+            stage->name, stage->threadCount, (unsigned long long)items, utilization,
+            bounded_queue_get_depth(queue), bounded_queue_get_capacity(queue),
+            (size_t)atomic_load_explicit(&queue->highWater, memory_order_relaxed),
+            pushes ? (double)depthSum / pushes : 0.0,
+            (unsigned long long)atomic_load_explicit(&queue->pushStalls, memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&queue->popStalls, memory_order_relaxed));
+    }
+
+    uint64_t budgetHitTotal = 0;
+    for (int i = SCAN_BUDGET_NONE + 1; i < SCAN_BUDGET_COUNT; i++) {
+        budgetHitTotal += atomic_load_explicit(&pipeline->budgetHits[i], memory_order_relaxed);
+    }
+    if (budgetHitTotal) {
+        fprintf(output, "over budget: %llu (", (unsigned long long)budgetHitTotal);
+        for (int i = SCAN_BUDGET_NONE + 1; i < SCAN_BUDGET_COUNT; i++) {
+            fprintf(output, "%s%s=%llu", i > SCAN_BUDGET_NONE + 1 ? ", " : "", scan_budget_limit_to_string(i),
+                (unsigned long long)atomic_load_explicit(&pipeline->budgetHits[i], memory_order_relaxed));
+        }
+        fprintf(output, "), retried %llu\n", (unsigned long long)atomic_load_explicit(&pipeline->retriedCount, memory_order_relaxed));
+    }
+
+    uint64_t cmsRejected = atomic_load_explicit(&pipeline->cmsRejected, memory_order_relaxed);
+    uint64_t cmsParsed = 0;
+    for (int i = 0; i < CMS_DIGEST_COUNT; i++) {
+        cmsParsed += atomic_load_explicit(&pipeline->cmsDigests[i], memory_order_relaxed);
+    }
+    if (cmsRejected || cmsParsed) {
+        fprintf(output, "cms: rejected %llu, digests (", (unsigned long long)cmsRejected);
+        for (int i = 0; i < CMS_DIGEST_COUNT; i++) {
+            fprintf(output, "%s%s=%llu", i ? ", " : "", cms_digest_algorithm_to_string(i),
+                (unsigned long long)atomic_load_explicit(&pipeline->cmsDigests[i], memory_order_relaxed));
+        }
+        fprintf(output, ")\n");
+    }
+
+    uint64_t trustCacheChecked = atomic_load_explicit(&pipeline->trustCacheChecked, memory_order_relaxed);
+    if (trustCacheChecked) {
+        fprintf(output, "trust cache: %llu of %llu cdhashes found\n",
+                (unsigned long long)atomic_load_explicit(&pipeline->trustCacheHits, memory_order_relaxed),
+                (unsigned long long)trustCacheChecked);
+    }
+    funlockfile(output);
+}
+
+void pipeline_free(Pipeline *pipeline)
+{
+    for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+        PipelineStage *stage = &pipeline->stages[i];
+        if (stage->input) bounded_queue_free(stage->input);
+        free(stage->threads);
+    }
+    for (size_t i = 0; i < pipeline->deferredCount; i++) {
+        scan_item_free(pipeline->deferred[i]);
+    }
+    free(pipeline->deferred);
+    pthread_mutex_destroy(&pipeline->deferredLock);
+    free(pipeline);
+}
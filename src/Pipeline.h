@@ -0,0 +1,101 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "Queue.h"
+#include "Scan.h"
+#include "Snapshot.h"
+#include "Store.h"
+
+typedef enum {
+    PIPELINE_STAGE_PREFETCH = 0,
+    PIPELINE_STAGE_PARSE,
+    PIPELINE_STAGE_EVALUATE,
+    PIPELINE_STAGE_CDHASH,
+    PIPELINE_STAGE_OUTPUT,
+    PIPELINE_STAGE_COUNT,
+} PipelineStageType;
+
+typedef enum {
+    PIPELINE_READER_MMAP = 0, // Map the whole file and let the parse stage fault in what it needs
+    PIPELINE_READER_PREAD,    // Chained blocking reads of only the signature regions on the prefetch threads
+    PIPELINE_READER_URING,    // Same reads, kept in flight across many files with io_uring
+} PipelineReaderType;
+
+typedef struct PipelineConfig {
+    unsigned threadCounts[PIPELINE_STAGE_COUNT];
+    size_t queueDepth;
+    PipelineReaderType reader;
+    unsigned ioDepth; // Reads in flight per prefetch thread with PIPELINE_READER_URING
+    ScanBudget budget;
+    bool retryDeferred; // Re-run over budget files without limits on a low priority thread at the end
+    unsigned statsInterval; // Seconds between live stats reports, 0 to disable
+    bool audit; // Extract and verify entitlements, requirements and launch constraints
+    bool prescreen; // Skip CoreTrust for CMS blobs that do not parse or have no signer
+    const TrustCacheSet *trustCaches; // Optional, cdhashes are looked up in these trust caches
+    SnapshotWriter *snapshot; // Optional, every record is also added to the snapshot
+    StoreWriter *store; // Optional, every record is also added to a new segment of the results store
+    FILE *output;
+} PipelineConfig;
+
+typedef struct Pipeline Pipeline;
+
+typedef struct PipelineStage {
+    Pipeline *pipeline;
+    PipelineStageType type;
+    const char *name;
+
+    BoundedQueue *input;
+    BoundedQueue *output; // NULL for the last stage
+
+    unsigned threadCount;
+    pthread_t *threads;
+    _Atomic unsigned liveThreads;
+
+    _Atomic uint64_t itemCount;
+    _Atomic uint64_t busyNanos;
+} PipelineStage;
+
+struct Pipeline {
+    PipelineConfig config;
+    PipelineStage stages[PIPELINE_STAGE_COUNT];
+    uint64_t startTime;
+    uint64_t endTime;
+    _Atomic uint64_t pathCount; // written by the reader, read by the stats monitor
+
+    _Atomic uint64_t budgetHits[SCAN_BUDGET_COUNT];
+    _Atomic uint64_t cmsRejected;
+    _Atomic uint64_t cmsDigests[CMS_DIGEST_COUNT];
+    _Atomic uint64_t trustCacheChecked;
+    _Atomic uint64_t trustCacheHits;
+    pthread_mutex_t deferredLock;
+    ScanItem **deferred;
+    size_t deferredCount;
+    size_t deferredCapacity;
+    _Atomic uint64_t retriedCount;
+};
+
+void pipeline_config_init_default(PipelineConfig *config);
+
+// Parse a comma separated list of per-stage thread counts (prefetch,parse,evaluate,cdhash,output)
+int pipeline_config_parse_thread_counts(PipelineConfig *config, const char *string);
+
+// Parse a reader name (mmap, pread, uring or auto), auto picks io_uring if the system supports it
+int pipeline_config_parse_reader(PipelineConfig *config, const char *string);
+
+// Read NUL delimited paths (find -print0) from the input and push them through all stages
+// Blocks until every path has been printed
+int pipeline_run_paths_from_file(Pipeline *pipeline, FILE *input);
+
+Pipeline *pipeline_init(const PipelineConfig *config);
+
+// Per-stage input queue depth and thread utilization
+void pipeline_print_stats(Pipeline *pipeline, FILE *output);
+
+void pipeline_free(Pipeline *pipeline);
+
+#endif // PIPELINE_H
@@ -0,0 +1,334 @@
+#include "Plist.h"
+
+#include <string.h>
+
+typedef struct PlistParser {
+    const char *cur;
+    const char *end;
+} PlistParser;
+
+static void plist_skip_whitespace(PlistParser *parser)
+{
+    while (parser->cur < parser->end && (*parser->cur == ' ' || *parser->cur == '\t' || *parser->cur == '\r' || *parser->cur == '\n')) {
+        parser->cur++;
+    }
+}
+
+static bool plist_starts_with(PlistParser *parser, const char *prefix)
+{
+    size_t length = strlen(prefix);
+    return (size_t)(parser->end - parser->cur) >= length && !memcmp(parser->cur, prefix, length);
+}
+
+static int plist_skip_past(PlistParser *parser, const char *terminator)
+{
+    size_t length = strlen(terminator);
+    while ((size_t)(parser->end - parser->cur) >= length) {
+        if (!memcmp(parser->cur, terminator, length)) {
+            parser->cur += length;
+            return 0;
+        }
+        parser->cur++;
+    }
+    return -1;
+}
+
+// Skips whitespace, comments, the XML declaration and the doctype
+static int plist_skip_misc(PlistParser *parser)
+{
+    while (true) {
+        plist_skip_whitespace(parser);
+        if (plist_starts_with(parser, "<?")) {
+            if (plist_skip_past(parser, "?>") != 0) return -1;
+        }
+        else if (plist_starts_with(parser, "<!--")) {
+            if (plist_skip_past(parser, "-->") != 0) return -1;
+        }
+        else if (plist_starts_with(parser, "<!")) {
+            if (plist_skip_past(parser, ">") != 0) return -1;
+        }
+        else {
+            return 0;
+        }
+    }
+}
+
+// Reads "<name ...>" or "<name/>", attributes are skipped
+static int plist_read_tag(PlistParser *parser, char *nameOut, size_t nameSize, bool *closingOut, bool *emptyOut)
+{
+    if (plist_skip_misc(parser) != 0 || parser->cur >= parser->end || *parser->cur != '<') return -1;
+    parser->cur++;
+    *closingOut = parser->cur < parser->end && *parser->cur == '/';
+    if (*closingOut) parser->cur++;
+    size_t length = 0;
+    while (parser->cur < parser->end && *parser->cur != '>' && *parser->cur != '/' && *parser->cur != ' ') {
+        if (length + 1 < nameSize) nameOut[length++] = *parser->cur;
+        parser->cur++;
+    }
+    nameOut[length] = '\0';
+    const char *close = memchr(parser->cur, '>', parser->end - parser->cur);
+    if (!close) return -1;
+    *emptyOut = close > parser->cur && close[-1] == '/';
+    parser->cur = close + 1;
+    return 0;
+}
+
+static size_t plist_encode_utf8(uint32_t codepoint, char *out)
+{
+    if (codepoint < 0x80) {
+        out[0] = (char)codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800) {
+        out[0] = (char)(0xc0 | (codepoint >> 6));
+        out[1] = (char)(0x80 | (codepoint & 0x3f));
+        return 2;
+    }
+    if (codepoint < 0x10000) {
+        out[0] = (char)(0xe0 | (codepoint >> 12));
+        out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3f));
+        out[2] = (char)(0x80 | (codepoint & 0x3f));
+        return 3;
+    }
+    out[0] = (char)(0xf0 | (codepoint >> 18));
+    out[1] = (char)(0x80 | ((codepoint >> 12) & 0x3f));
+    out[2] = (char)(0x80 | ((codepoint >> 6) & 0x3f));
+    out[3] = (char)(0x80 | (codepoint & 0x3f));
+    return 4;
+}
+
+// Text up to the closing tag with entities decoded, the closing tag is consumed
+static char *plist_read_text(PlistParser *parser, const char *name)
+{
+    const char *start = parser->cur;
+    const char *close = memchr(start, '<', parser->end - start);
+    if (!close) return NULL;
+
+    // Decoded text is never longer than the raw text
+    char *text = malloc(close - start + 1);
+    if (!text) return NULL;
+    size_t length = 0;
+    for (const char *p = start; p < close;) {
+        if (*p != '&') {
+            text[length++] = *p++;
+            continue;
+        }
+        const char *semicolon = memchr(p, ';', close - p);
+        if (!semicolon) {
+            free(text);
+            return NULL;
+        }
+        size_t entityLength = semicolon - p - 1;
+        const char *entity = p + 1;
+        if (entityLength == 3 && !memcmp(entity, "amp", 3)) text[length++] = '&';
+        else if (entityLength == 2 && !memcmp(entity, "lt", 2)) text[length++] = '<';
+        else if (entityLength == 2 && !memcmp(entity, "gt", 2)) text[length++] = '>';
+        else if (entityLength == 4 && !memcmp(entity, "quot", 4)) text[length++] = '"';
+        else if (entityLength == 4 && !memcmp(entity, "apos", 4)) text[length++] = '\'';
+        else if (entityLength >= 2 && entity[0] == '#') {
+            uint32_t codepoint = (uint32_t)strtoul(entity[1] == 'x' ? entity + 2 : entity + 1, NULL, entity[1] == 'x' ? 16 : 10);
+            if (codepoint == 0 || codepoint > 0x10ffff) {
+                free(text);
+                return NULL;
+            }
+            length += plist_encode_utf8(codepoint, text + length);
+        }
+        else {
+            free(text);
+            return NULL;
+        }
+        p = semicolon + 1;
+    }
+    text[length] = '\0';
+
+    parser->cur = close;
+    char closeName[16];
+    bool closing = false, empty = false;
+    if (plist_read_tag(parser, closeName, sizeof(closeName), &closing, &empty) != 0 || !closing || strcmp(closeName, name)) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static int plist_base64_value(char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+// Whitespace inside <data> is common, anything else that is not base64 is an error
+static int plist_base64_decode(const char *text, uint8_t **dataOut, size_t *sizeOut)
+{
+    size_t textLength = strlen(text);
+    uint8_t *data = malloc(textLength / 4 * 3 + 3);
+    if (!data) return -1;
+    size_t size = 0;
+    uint32_t accumulator = 0;
+    int bits = 0;
+    for (const char *p = text; *p; p++) {
+        if (*p == '=') break;
+        if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') continue;
+        int value = plist_base64_value(*p);
+        if (value < 0) {
+            free(data);
+            return -1;
+        }
+        accumulator = (accumulator << 6) | (uint32_t)value;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            data[size++] = (uint8_t)(accumulator >> bits);
+        }
+    }
+    *dataOut = data;
+    *sizeOut = size;
+    return 0;
+}
+
+static int plist_append_child(PlistNode *parent, PlistNode *child)
+{
+    // Grow in powers of two, dicts in CodeResources can have tens of thousands of entries
+    if ((parent->childCount & (parent->childCount - 1)) == 0) {
+        size_t capacity = parent->childCount ? parent->childCount * 2 : 4;
+        PlistNode **children = realloc(parent->children, capacity * sizeof(PlistNode *));
+        if (!children) return -1;
+        parent->children = children;
+    }
+    parent->children[parent->childCount++] = child;
+    return 0;
+}
+
+static PlistNode *plist_parse_value(PlistParser *parser, unsigned depth);
+
+static PlistNode *plist_parse_container(PlistParser *parser, PlistNode *node, const char *name, unsigned depth)
+{
+    while (true) {
+        const char *save = parser->cur;
+        char tag[16];
+        bool closing = false, empty = false;
+        if (plist_read_tag(parser, tag, sizeof(tag), &closing, &empty) != 0) goto fail;
+        if (closing) {
+            if (strcmp(tag, name)) goto fail;
+            return node;
+        }
+
+        char *key = NULL;
+        if (node->type == PLIST_DICT) {
+            if (strcmp(tag, "key")) goto fail;
+            key = empty ? strdup("") : plist_read_text(parser, "key");
+            if (!key) goto fail;
+        }
+        else {
+            parser->cur = save;
+        }
+        PlistNode *child = plist_parse_value(parser, depth + 1);
+        if (!child) {
+            free(key);
+            goto fail;
+        }
+        child->key = key;
+        if (plist_append_child(node, child) != 0) {
+            plist_free(child);
+            goto fail;
+        }
+    }
+
+fail:
+    plist_free(node);
+    return NULL;
+}
+
+static PlistNode *plist_parse_value(PlistParser *parser, unsigned depth)
+{
+    if (depth > PLIST_MAX_DEPTH) return NULL;
+    char tag[16];
+    bool closing = false, empty = false;
+    if (plist_read_tag(parser, tag, sizeof(tag), &closing, &empty) != 0 || closing) return NULL;
+
+    PlistNode *node = calloc(1, sizeof(PlistNode));
+    if (!node) return NULL;
+    if (!strcmp(tag, "dict") || !strcmp(tag, "array")) {
+        node->type = tag[0] == 'd' ? PLIST_DICT : PLIST_ARRAY;
+        return empty ? node : plist_parse_container(parser, node, tag, depth);
+    }
+    if (!strcmp(tag, "true") || !strcmp(tag, "false")) {
+        node->type = PLIST_BOOL;
+        node->boolean = tag[0] == 't';
+        if (!empty) {
+            bool ok = plist_read_tag(parser, tag, sizeof(tag), &closing, &empty) == 0 && closing;
+            if (!ok) goto fail;
+        }
+        return node;
+    }
+
+    if (!strcmp(tag, "string")) node->type = PLIST_STRING;
+    else if (!strcmp(tag, "data")) node->type = PLIST_DATA;
+    else if (!strcmp(tag, "integer")) node->type = PLIST_INTEGER;
+    else if (!strcmp(tag, "real")) node->type = PLIST_REAL;
+    else if (!strcmp(tag, "date")) node->type = PLIST_DATE;
+    else goto fail;
+
+    node->string = empty ? strdup("") : plist_read_text(parser, tag);
+    if (!node->string) goto fail;
+    if (node->type == PLIST_DATA && plist_base64_decode(node->string, &node->data, &node->dataSize) != 0) goto fail;
+    if (node->type == PLIST_INTEGER) node->integer = strtoll(node->string, NULL, 0);
+    return node;
+
+fail:
+    plist_free(node);
+    return NULL;
+}
+
+PlistNode *plist_parse_xml(const char *xml, size_t size)
+{
+    PlistParser parser = { xml, xml + size };
+    char tag[16];
+    bool closing = false, empty = false;
+    if (plist_read_tag(&parser, tag, sizeof(tag), &closing, &empty) != 0 || closing || strcmp(tag, "plist") || empty) return NULL;
+    PlistNode *root = plist_parse_value(&parser, 0);
+    if (!root) return NULL;
+    if (plist_read_tag(&parser, tag, sizeof(tag), &closing, &empty) != 0 || !closing || strcmp(tag, "plist")) {
+        plist_free(root);
+        return NULL;
+    }
+    return root;
+}
+
+PlistNode *plist_dict_get(const PlistNode *dict, const char *key)
+{
+    if (!dict || dict->type != PLIST_DICT) return NULL;
+    for (size_t i = 0; i < dict->childCount; i++) {
+        if (!strcmp(dict->children[i]->key, key)) return dict->children[i];
+    }
+    return NULL;
+}
+
+const char *plist_dict_get_string(const PlistNode *dict, const char *key)
+{
+    PlistNode *node = plist_dict_get(dict, key);
+    return node && node->type == PLIST_STRING ? node->string : NULL;
+}
+
+bool plist_dict_get_bool(const PlistNode *dict, const char *key, bool defaultValue)
+{
+    PlistNode *node = plist_dict_get(dict, key);
+    return node && node->type == PLIST_BOOL ? node->boolean : defaultValue;
+}
+
+void plist_free(PlistNode *node)
+{
+    if (!node) return;
+    for (size_t i = 0; i < node->childCount; i++) {
+        plist_free(node->children[i]);
+    }
+    free(node->children);
+    free(node->key);
+    free(node->string);
+    free(node->data);
+    free(node);
+}
@@ -0,0 +1,46 @@
+#ifndef PLIST_H
+#define PLIST_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Minimal XML property list reader, enough for CodeResources and XML Info.plists
+// Binary plists are not supported
+
+#define PLIST_MAX_DEPTH 64
+
+typedef enum {
+    PLIST_DICT = 0,
+    PLIST_ARRAY,
+    PLIST_STRING,
+    PLIST_DATA,
+    PLIST_INTEGER,
+    PLIST_REAL,
+    PLIST_BOOL,
+    PLIST_DATE,
+} PlistType;
+
+typedef struct PlistNode {
+    PlistType type;
+    char *key;    // set for values inside a dict
+    char *string; // string, date, integer and real values as written
+    uint8_t *data;
+    size_t dataSize;
+    int64_t integer;
+    bool boolean;
+    struct PlistNode **children; // dict values (with their keys) or array elements, in file order
+    size_t childCount;
+} PlistNode;
+
+// Returns the root object or NULL if xml is not a well formed XML plist
+PlistNode *plist_parse_xml(const char *xml, size_t size);
+
+// Linear lookup, NULL if dict is not a dict or has no such key
+PlistNode *plist_dict_get(const PlistNode *dict, const char *key);
+const char *plist_dict_get_string(const PlistNode *dict, const char *key);
+bool plist_dict_get_bool(const PlistNode *dict, const char *key, bool defaultValue);
+
+void plist_free(PlistNode *node);
+
+#endif // PLIST_H
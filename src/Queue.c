@@ -0,0 +1,153 @@
+#include "Queue.h"
+
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+static void queue_backoff(unsigned *attempt)
+{
+    if (*attempt < 64) {
+#if defined(__aarch64__)
+        __asm__ volatile("yield");
+#elif defined(__x86_64__) || defined(__i386__)
+        __asm__ volatile("pause");
+#endif
+    }
+    else if (*attempt < 128) {
+        sched_yield();
+    }
+    else {
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 50000 };
+        nanosleep(&ts, NULL);
+    }
+    (*attempt)++;
+}
+
+BoundedQueue *bounded_queue_init(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+
+    BoundedQueue *queue = aligned_alloc(QUEUE_CACHELINE_SIZE, (sizeof(BoundedQueue) + QUEUE_CACHELINE_SIZE - 1) & ~(size_t)(QUEUE_CACHELINE_SIZE - 1));
+    if (!queue) return NULL;
+    memset(queue, 0, sizeof(BoundedQueue));
+
+    queue->cells = malloc(sizeof(QueueCell) * size);
+    if (!queue->cells) {
+        free(queue);
+        return NULL;
+    }
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
+        queue->cells[i].item = NULL;
+    }
+    queue->mask = size - 1;
+    return queue;
+}
+
+bool bounded_queue_try_push(BoundedQueue *queue, void *item)
+{
+    size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    for (;;) {
+        QueueCell *cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->item = item;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        }
+    }
+}
+
+bool bounded_queue_try_pop(BoundedQueue *queue, void **itemOut)
+{
+    size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    for (;;) {
+        QueueCell *cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                *itemOut = cell->item;
+                atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            return false;
+        }
+        else {
+            pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        }
+    }
+}
+
+int bounded_queue_push(BoundedQueue *queue, void *item)
+{
+    unsigned attempt = 0;
+    while (!bounded_queue_try_push(queue, item)) {
+        if (atomic_load_explicit(&queue->closed, memory_order_acquire)) return -1;
+        if (attempt == 0) atomic_fetch_add_explicit(&queue->pushStalls, 1, memory_order_relaxed);
+        queue_backoff(&attempt);
+    }
+
+    size_t depth = bounded_queue_get_depth(queue);
+    atomic_fetch_add_explicit(&queue->pushCount, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&queue->depthSum, depth, memory_order_relaxed);
+    size_t highWater = atomic_load_explicit(&queue->highWater, memory_order_relaxed);
+    while (depth > highWater && !atomic_compare_exchange_weak_explicit(&queue->highWater, &highWater, depth, memory_order_relaxed, memory_order_relaxed));
+    return 0;
+}
+
+void *bounded_queue_pop(BoundedQueue *queue)
+{
+    unsigned attempt = 0;
+    void *item = NULL;
+    while (!bounded_queue_try_pop(queue, &item)) {
+        if (atomic_load_explicit(&queue->closed, memory_order_acquire)) {
+            // Everything pushed before the close is visible now, drain once more
+            if (bounded_queue_try_pop(queue, &item)) return item;
+            return NULL;
+        }
+        if (attempt == 0) atomic_fetch_add_explicit(&queue->popStalls, 1, memory_order_relaxed);
+        queue_backoff(&attempt);
+    }
+    return item;
+}
+
+void bounded_queue_close(BoundedQueue *queue)
+{
+    atomic_store_explicit(&queue->closed, true, memory_order_release);
+}
+
+bool bounded_queue_is_closed(BoundedQueue *queue)
+{
+    return atomic_load_explicit(&queue->closed, memory_order_acquire);
+}
+
+size_t bounded_queue_get_capacity(BoundedQueue *queue)
+{
+    return queue->mask + 1;
+}
+
+size_t bounded_queue_get_depth(BoundedQueue *queue)
+{
+    size_t enqueuePos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    size_t dequeuePos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+}
+
+void bounded_queue_free(BoundedQueue *queue)
+{
+    free(queue->cells);
+    free(queue);
+}
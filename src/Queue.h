@@ -0,0 +1,56 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define QUEUE_CACHELINE_SIZE 64
+
+typedef struct QueueCell {
+    _Atomic size_t sequence;
+    void *item;
+} QueueCell;
+
+// Bounded multi-producer multi-consumer queue (Vyukov ring)
+// Pushing and popping is lock-free, the blocking variants only spin and back off
+// A full queue makes producers wait, which is what caps memory usage in a pipeline
+typedef struct BoundedQueue {
+    QueueCell *cells;
+    size_t mask;
+
+    _Alignas(QUEUE_CACHELINE_SIZE) _Atomic size_t enqueuePos;
+    _Alignas(QUEUE_CACHELINE_SIZE) _Atomic size_t dequeuePos;
+    _Alignas(QUEUE_CACHELINE_SIZE) _Atomic bool closed;
+
+    // Statistics, only updated by the blocking variants
+    _Atomic uint64_t pushCount;
+    _Atomic uint64_t pushStalls;
+    _Atomic uint64_t popStalls;
+    _Atomic uint64_t depthSum;
+    _Atomic size_t highWater;
+} BoundedQueue;
+
+// Capacity is rounded up to the next power of two
+BoundedQueue *bounded_queue_init(size_t capacity);
+
+// Non-blocking variants, return false if the queue is full / empty
+bool bounded_queue_try_push(BoundedQueue *queue, void *item);
+bool bounded_queue_try_pop(BoundedQueue *queue, void **itemOut);
+
+// Blocking variants
+// Push returns -1 if the queue has been closed, pop returns NULL once the queue is closed and drained
+int bounded_queue_push(BoundedQueue *queue, void *item);
+void *bounded_queue_pop(BoundedQueue *queue);
+
+// Mark the queue as closed, must only be called after all producers are done pushing
+void bounded_queue_close(BoundedQueue *queue);
+bool bounded_queue_is_closed(BoundedQueue *queue);
+
+size_t bounded_queue_get_capacity(BoundedQueue *queue);
+size_t bounded_queue_get_depth(BoundedQueue *queue);
+
+void bounded_queue_free(BoundedQueue *queue);
+
+#endif // QUEUE_H
@@ -0,0 +1,655 @@
+#include "RegionReader.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <mach-o/fat.h>
+#include <mach-o/loader.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+// Enough for the mach header and the load commands of nearly every binary
+#define REGION_HEADER_READ_SIZE 0x1000
+#define REGION_MAX_READ_SIZE (256 * 1024 * 1024)
+#define REGION_MAX_FAT_ARCHS 64
+
+static uint32_t region_load32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint32_t region_load32_be(const uint8_t *data)
+{
+    return __builtin_bswap32(region_load32(data));
+}
+
+static uint64_t region_load64_be(const uint8_t *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return __builtin_bswap64(value);
+}
+
+RegionSet *region_set_retain(RegionSet *regions)
+{
+    atomic_fetch_add_explicit(&regions->refCount, 1, memory_order_relaxed);
+    return regions;
+}
+
+void region_set_release(RegionSet *regions)
+{
+    if (atomic_fetch_sub_explicit(&regions->refCount, 1, memory_order_acq_rel) != 1) return;
+    for (uint32_t i = 0; i < regions->extentCount; i++) {
+        free(regions->extents[i].data);
+    }
+    free(regions->extents);
+    if (regions->fd >= 0) close(regions->fd);
+    free(regions);
+}
+
+static int region_set_add_extent(RegionSet *regions, uint64_t offset, size_t size, uint8_t *data)
+{
+    if (regions->extentCount == regions->extentCapacity) {
+        uint32_t capacity = regions->extentCapacity ? regions->extentCapacity * 2 : 4;
+        RegionExtent *extents = realloc(regions->extents, sizeof(RegionExtent) * capacity);
+        if (!extents) return -1;
+        regions->extents = extents;
+        regions->extentCapacity = capacity;
+    }
+    regions->extents[regions->extentCount++] = (RegionExtent){ .offset = offset, .size = size, .data = data };
+    return 0;
+}
+
+static int region_extent_compare(const void *a, const void *b)
+{
+    const RegionExtent *extentA = a, *extentB = b;
+    if (extentA->offset != extentB->offset) return extentA->offset < extentB->offset ? -1 : 1;
+    // Larger extent first so it is found first when two start at the same offset
+    if (extentA->size != extentB->size) return extentA->size > extentB->size ? -1 : 1;
+    return 0;
+}
+
+static const RegionExtent *region_set_find_extent(RegionSet *regions, uint64_t offset, size_t size)
+{
+    // A fetch produces a handful of extents per slice, a linear scan beats anything smarter
+    for (uint32_t i = 0; i < regions->extentCount; i++) {
+        const RegionExtent *extent = &regions->extents[i];
+        if (offset >= extent->offset && offset + size <= extent->offset + extent->size) {
+            return extent;
+        }
+    }
+    return NULL;
+}
+
+static ssize_t region_pread_full(int fd, void *buf, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t r = pread(fd, (uint8_t *)buf + done, size - done, offset + done);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (r == 0) break;
+        done += r;
+    }
+    return done;
+}
+
+static void region_fetch_queue_read(RegionFetch *fetch, RegionReadType type, uint64_t offset, uint64_t size, uint64_t sliceOffset, uint64_t sliceSize)
+{
+    RegionSet *regions = fetch->regions;
+    if (offset >= regions->fileSize) return;
+    if (size > regions->fileSize - offset) size = regions->fileSize - offset;
+    if (size == 0 || size > fetch->maxReadSize) return;
+
+    // Already covered by an earlier read (e.g. a thin binary whose load commands fit into the header read)
+    if (region_set_find_extent(regions, offset, size)) return;
+
+    RegionRead *read = calloc(1, sizeof(RegionRead));
+    if (!read) return;
+    read->iov.iov_base = malloc(size);
+    if (!read->iov.iov_base) {
+        free(read);
+        return;
+    }
+    read->iov.iov_len = size;
+    read->fetch = fetch;
+    read->type = type;
+    read->offset = offset;
+    read->size = size;
+    read->sliceOffset = sliceOffset;
+    read->sliceSize = sliceSize;
+    read->next = fetch->pending;
+    fetch->pending = read;
+}
+
+static void region_fetch_handle_slice(RegionFetch *fetch, uint64_t sliceOffset, uint64_t sliceSize, const uint8_t *data, size_t size)
+{
+    if (size < sizeof(struct mach_header)) return;
+
+    uint32_t magic = region_load32(data);
+    size_t headerSize = 0;
+    if (magic == MH_MAGIC_64) {
+        headerSize = sizeof(struct mach_header_64);
+    }
+    else if (magic == MH_MAGIC) {
+        headerSize = sizeof(struct mach_header);
+    }
+    else {
+        return;
+    }
+    if (size < headerSize) return;
+
+    uint32_t ncmds = region_load32(data + offsetof(struct mach_header, ncmds));
+    uint32_t sizeofcmds = region_load32(data + offsetof(struct mach_header, sizeofcmds));
+    uint64_t commandsEnd = headerSize + (uint64_t)sizeofcmds;
+    if (commandsEnd > sliceSize) return;
+    if (commandsEnd > size) {
+        // Load commands did not fit into the first read, fetch all of them and continue from there
+        region_fetch_queue_read(fetch, REGION_READ_LOAD_COMMANDS, sliceOffset, commandsEnd, sliceOffset, sliceSize);
+        return;
+    }
+
+    uint64_t offset = headerSize;
+    for (uint32_t i = 0; i < ncmds && offset + sizeof(struct load_command) <= commandsEnd; i++) {
+        uint32_t cmd = region_load32(data + offset);
+        uint32_t cmdsize = region_load32(data + offset + 4);
+        if (cmdsize < sizeof(struct load_command) || offset + cmdsize > commandsEnd) break;
+
+        if (cmd == LC_CODE_SIGNATURE && cmdsize >= sizeof(struct linkedit_data_command)) {
+            uint32_t dataoff = region_load32(data + offset + offsetof(struct linkedit_data_command, dataoff));
+            uint32_t datasize = region_load32(data + offset + offsetof(struct linkedit_data_command, datasize));
+            if ((uint64_t)dataoff + datasize <= sliceSize) {
+                region_fetch_queue_read(fetch, REGION_READ_SIGNATURE, sliceOffset + dataoff, datasize, sliceOffset, sliceSize);
+            }
+            break;
+        }
+        offset += cmdsize;
+    }
+}
+
+static void region_fetch_handle_header(RegionFetch *fetch, const uint8_t *data, size_t size)
+{
+    if (size < sizeof(uint32_t)) return;
+
+    uint32_t fatMagic = region_load32_be(data);
+    if (fatMagic != FAT_MAGIC && fatMagic != FAT_MAGIC_64) {
+        region_fetch_handle_slice(fetch, 0, fetch->regions->fileSize, data, size);
+        return;
+    }
+
+    if (size < sizeof(struct fat_header)) return;
+    uint32_t archCount = region_load32_be(data + offsetof(struct fat_header, nfat_arch));
+    if (archCount == 0 || archCount > REGION_MAX_FAT_ARCHS) return;
+
+    size_t archSize = fatMagic == FAT_MAGIC_64 ? sizeof(struct fat_arch_64) : sizeof(struct fat_arch);
+    size_t tableEnd = sizeof(struct fat_header) + archCount * archSize;
+    if (tableEnd > size) {
+        region_fetch_queue_read(fetch, REGION_READ_HEADER, 0, tableEnd, 0, 0);
+        return;
+    }
+
+    for (uint32_t i = 0; i < archCount; i++) {
+        const uint8_t *arch = data + sizeof(struct fat_header) + i * archSize;
+        uint64_t sliceOffset, sliceSize;
+        if (fatMagic == FAT_MAGIC_64) {
+            sliceOffset = region_load64_be(arch + offsetof(struct fat_arch_64, offset));
+            sliceSize = region_load64_be(arch + offsetof(struct fat_arch_64, size));
+        }
+        else {
+            sliceOffset = region_load32_be(arch + offsetof(struct fat_arch, offset));
+            sliceSize = region_load32_be(arch + offsetof(struct fat_arch, size));
+        }
+        if (sliceOffset >= fetch->regions->fileSize || sliceSize > fetch->regions->fileSize - sliceOffset) continue;
+        uint64_t readSize = sliceSize < REGION_HEADER_READ_SIZE ? sliceSize : REGION_HEADER_READ_SIZE;
+        region_fetch_queue_read(fetch, REGION_READ_SLICE_HEADER, sliceOffset, readSize, sliceOffset, sliceSize);
+    }
+}
+
+static void region_fetch_complete_read(RegionFetch *fetch, RegionRead *read, ssize_t result)
+{
+    if (result != (ssize_t)read->size || region_set_add_extent(fetch->regions, read->offset, read->size, read->iov.iov_base) != 0) {
+        // This branch of the chain ends here, the parse stage falls back to pread for whatever is missing
+        free(read->iov.iov_base);
+        free(read);
+        return;
+    }
+
+    const uint8_t *data = read->iov.iov_base;
+    switch (read->type) {
+        case REGION_READ_HEADER:
+            region_fetch_handle_header(fetch, data, read->size);
+            break;
+        case REGION_READ_SLICE_HEADER:
+        case REGION_READ_LOAD_COMMANDS:
+            region_fetch_handle_slice(fetch, read->sliceOffset, read->sliceSize, data, read->size);
+            break;
+        case REGION_READ_SIGNATURE:
+            break;
+    }
+    free(read);
+}
+
+RegionFetch *region_fetch_init(const char *path, void *context)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat s;
+    if (fstat(fd, &s) != 0 || !S_ISREG(s.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    RegionFetch *fetch = calloc(1, sizeof(RegionFetch));
+    RegionSet *regions = calloc(1, sizeof(RegionSet));
+    if (!fetch || !regions) {
+        free(fetch);
+        free(regions);
+        close(fd);
+        return NULL;
+    }
+    atomic_init(&regions->refCount, 1);
+    regions->fd = fd;
+    regions->fileSize = s.st_size;
+    fetch->regions = regions;
+    fetch->context = context;
+    fetch->maxReadSize = REGION_MAX_READ_SIZE;
+
+    region_fetch_queue_read(fetch, REGION_READ_HEADER, 0, REGION_HEADER_READ_SIZE, 0, 0);
+    return fetch;
+}
+
+int region_fetch_run_sync(RegionFetch *fetch)
+{
+    while (fetch->pending) {
+        RegionRead *read = fetch->pending;
+        fetch->pending = read->next;
+        ssize_t result = region_pread_full(fetch->regions->fd, read->iov.iov_base, read->size, read->offset);
+        region_fetch_complete_read(fetch, read, result);
+    }
+    return 0;
+}
+
+RegionSet *region_fetch_take_regions(RegionFetch *fetch)
+{
+    RegionSet *regions = fetch->regions;
+    fetch->regions = NULL;
+    if (regions && regions->extentCount > 1) {
+        qsort(regions->extents, regions->extentCount, sizeof(RegionExtent), region_extent_compare);
+    }
+    return regions;
+}
+
+void region_fetch_free(RegionFetch *fetch)
+{
+    while (fetch->pending) {
+        RegionRead *read = fetch->pending;
+        fetch->pending = read->next;
+        free(read->iov.iov_base);
+        free(read);
+    }
+    if (fetch->regions) region_set_release(fetch->regions);
+    free(fetch);
+}
+
+typedef struct SparseStreamContext {
+    RegionSet *regions;
+    uint64_t base;
+    size_t size;
+} SparseStreamContext;
+
+static int sparse_stream_read(MemoryStream *stream, uint64_t offset, size_t size, void *outBuf)
+{
+    SparseStreamContext *context = stream->context;
+    if (offset > context->size || size > context->size - offset) {
+        printf("Error: cannot read %zx bytes at %llx, maximum is %zx.\n", size, (unsigned long long)offset, context->size);
+        return -1;
+    }
+
+    uint64_t fileOffset = context->base + offset;
+    const RegionExtent *extent = region_set_find_extent(context->regions, fileOffset, size);
+    if (extent) {
+        memcpy(outBuf, extent->data + (fileOffset - extent->offset), size);
+        return size;
+    }
+
+    atomic_fetch_add_explicit(&context->regions->missCount, 1, memory_order_relaxed);
+    return region_pread_full(context->regions->fd, outBuf, size, fileOffset);
+}
+
+static int sparse_stream_get_size(MemoryStream *stream, size_t *sizeOut)
+{
+    SparseStreamContext *context = stream->context;
+    *sizeOut = context->size;
+    return 0;
+}
+
+static int sparse_stream_trim(MemoryStream *stream, size_t trimAtStart, size_t trimAtEnd)
+{
+    SparseStreamContext *context = stream->context;
+    if (trimAtStart > context->size || trimAtEnd > context->size - trimAtStart) return -1;
+    context->base += trimAtStart;
+    context->size -= trimAtStart + trimAtEnd;
+    return 0;
+}
+
+static void sparse_stream_free(MemoryStream *stream)
+{
+    SparseStreamContext *context = stream->context;
+    region_set_release(context->regions);
+    free(context);
+}
+
+static MemoryStream *sparse_stream_init_with_context(RegionSet *regions, uint64_t base, size_t size);
+
+static MemoryStream *sparse_stream_softclone(MemoryStream *stream)
+{
+    SparseStreamContext *context = stream->context;
+    return sparse_stream_init_with_context(context->regions, context->base, context->size);
+}
+
+static MemoryStream *sparse_stream_init_with_context(RegionSet *regions, uint64_t base, size_t size)
+{
+    MemoryStream *stream = calloc(1, sizeof(MemoryStream));
+    SparseStreamContext *context = calloc(1, sizeof(SparseStreamContext));
+    if (!stream || !context) {
+        free(stream);
+        free(context);
+        return NULL;
+    }
+    context->regions = region_set_retain(regions);
+    context->base = base;
+    context->size = size;
+
+    stream->context = context;
+    stream->read = sparse_stream_read;
+    stream->getSize = sparse_stream_get_size;
+    stream->trim = sparse_stream_trim;
+    stream->softclone = sparse_stream_softclone;
+    stream->free = sparse_stream_free;
+    return stream;
+}
+
+MemoryStream *sparse_stream_init(RegionSet *regions)
+{
+    return sparse_stream_init_with_context(regions, 0, regions->fileSize);
+}
+
+#ifdef __linux__
+
+struct RegionReader {
+    int ringFd;
+    unsigned entries;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    _Atomic unsigned *sqHead;
+    _Atomic unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    _Atomic unsigned *cqHead;
+    _Atomic unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+
+    unsigned inflightReads; // placed into the submission ring and not yet completed
+    unsigned unsubmittedReads; // placed into the submission ring but not yet consumed by the kernel
+    unsigned activeFetches;
+
+    RegionRead *backlogHead;
+    RegionRead *backlogTail;
+
+    RegionFetch **completed;
+    unsigned completedCount;
+    unsigned completedCapacity;
+};
+
+static int region_io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int region_io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+bool region_reader_is_supported(void)
+{
+    static _Atomic int supported = -1;
+    int value = atomic_load(&supported);
+    if (value == -1) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = region_io_uring_setup(1, &params);
+        value = fd >= 0;
+        if (fd >= 0) close(fd);
+        atomic_store(&supported, value);
+    }
+    return value;
+}
+
+RegionReader *region_reader_init(unsigned queueDepth)
+{
+    RegionReader *reader = calloc(1, sizeof(RegionReader));
+    if (!reader) return NULL;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    reader->ringFd = region_io_uring_setup(queueDepth ? queueDepth : 1, &params);
+    if (reader->ringFd < 0) {
+        free(reader);
+        return NULL;
+    }
+    reader->entries = params.sq_entries;
+
+    reader->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    reader->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap && reader->cqRingSize > reader->sqRingSize) {
+        reader->sqRingSize = reader->cqRingSize;
+    }
+
+    reader->sqRing = mmap(NULL, reader->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, reader->ringFd, IORING_OFF_SQ_RING);
+    if (reader->sqRing == MAP_FAILED) goto fail;
+    if (singleMmap) {
+        reader->cqRing = reader->sqRing;
+    }
+    else {
+        reader->cqRing = mmap(NULL, reader->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, reader->ringFd, IORING_OFF_CQ_RING);
+        if (reader->cqRing == MAP_FAILED) goto fail;
+    }
+    reader->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    reader->sqes = mmap(NULL, reader->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, reader->ringFd, IORING_OFF_SQES);
+    if (reader->sqes == MAP_FAILED) goto fail;
+
+    uint8_t *sq = reader->sqRing, *cq = reader->cqRing;
+    reader->sqHead = (_Atomic unsigned *)(sq + params.sq_off.head);
+    reader->sqTail = (_Atomic unsigned *)(sq + params.sq_off.tail);
+    reader->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    reader->sqArray = (unsigned *)(sq + params.sq_off.array);
+    reader->cqHead = (_Atomic unsigned *)(cq + params.cq_off.head);
+    reader->cqTail = (_Atomic unsigned *)(cq + params.cq_off.tail);
+    reader->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    reader->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return reader;
+
+fail:
+    region_reader_free(reader);
+    return NULL;
+}
+
+// Room for the fetch is reserved by region_reader_submit, so completing it cannot fail
+static void region_reader_complete_fetch(RegionReader *reader, RegionFetch *fetch)
+{
+    reader->completed[reader->completedCount++] = fetch;
+    reader->activeFetches--;
+}
+
+// Move reads queued by the fetch chain into the backlog, or finish the fetch if its chain ended
+static void region_reader_collect_pending(RegionReader *reader, RegionFetch *fetch)
+{
+    while (fetch->pending) {
+        RegionRead *read = fetch->pending;
+        fetch->pending = read->next;
+        read->next = NULL;
+        if (reader->backlogTail) {
+            reader->backlogTail->next = read;
+        }
+        else {
+            reader->backlogHead = read;
+        }
+        reader->backlogTail = read;
+        fetch->inflight++;
+    }
+    if (fetch->inflight == 0) {
+        region_reader_complete_fetch(reader, fetch);
+    }
+}
+
+int region_reader_submit(RegionReader *reader, RegionFetch *fetch)
+{
+    // Every active fetch ends up in the completed list, grow it before the fetch is accepted
+    if (reader->completedCount + reader->activeFetches + 1 > reader->completedCapacity) {
+        unsigned capacity = reader->completedCapacity ? reader->completedCapacity * 2 : 64;
+        RegionFetch **completed = realloc(reader->completed, sizeof(RegionFetch *) * capacity);
+        if (!completed) return -1;
+        reader->completed = completed;
+        reader->completedCapacity = capacity;
+    }
+    reader->activeFetches++;
+    region_reader_collect_pending(reader, fetch);
+    return 0;
+}
+
+unsigned region_reader_get_active_count(RegionReader *reader)
+{
+    return reader->activeFetches;
+}
+
+static unsigned region_reader_fill_submission_ring(RegionReader *reader)
+{
+    unsigned queued = 0;
+    unsigned tail = atomic_load_explicit(reader->sqTail, memory_order_relaxed);
+    while (reader->backlogHead && reader->inflightReads < reader->entries) {
+        RegionRead *read = reader->backlogHead;
+        reader->backlogHead = read->next;
+        if (!reader->backlogHead) reader->backlogTail = NULL;
+
+        unsigned index = tail & *reader->sqMask;
+        struct io_uring_sqe *sqe = &reader->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = read->fetch->regions->fd;
+        sqe->off = read->offset;
+        sqe->addr = (uint64_t)(uintptr_t)&read->iov;
+        sqe->len = 1;
+        sqe->user_data = (uint64_t)(uintptr_t)read;
+        reader->sqArray[index] = index;
+
+        tail++;
+        queued++;
+        reader->inflightReads++;
+    }
+    atomic_store_explicit(reader->sqTail, tail, memory_order_release);
+    return queued;
+}
+
+unsigned region_reader_reap(RegionReader *reader, RegionFetch **fetchesOut, unsigned maxFetches, bool wait)
+{
+    reader->unsubmittedReads += region_reader_fill_submission_ring(reader);
+
+    bool shouldWait = wait && reader->inflightReads > 0 && reader->completedCount == 0;
+    if (reader->unsubmittedReads || shouldWait) {
+        int r = region_io_uring_enter(reader->ringFd, reader->unsubmittedReads, shouldWait ? 1 : 0, shouldWait ? IORING_ENTER_GETEVENTS : 0);
+        if (r >= 0) {
+            reader->unsubmittedReads -= (unsigned)r < reader->unsubmittedReads ? (unsigned)r : reader->unsubmittedReads;
+        }
+        else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            fprintf(stderr, "Error: io_uring_enter failed (%s)!\n", strerror(errno));
+        }
+    }
+
+    unsigned head = atomic_load_explicit(reader->cqHead, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(reader->cqTail, memory_order_acquire);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &reader->cqes[head & *reader->cqMask];
+        RegionRead *read = (RegionRead *)(uintptr_t)cqe->user_data;
+        int result = cqe->res;
+        head++;
+
+        RegionFetch *fetch = read->fetch;
+        reader->inflightReads--;
+        fetch->inflight--;
+        region_fetch_complete_read(fetch, read, result);
+        region_reader_collect_pending(reader, fetch);
+    }
+    atomic_store_explicit(reader->cqHead, head, memory_order_release);
+
+    unsigned count = reader->completedCount < maxFetches ? reader->completedCount : maxFetches;
+    if (count == 0) return 0;
+    memcpy(fetchesOut, reader->completed, sizeof(RegionFetch *) * count);
+    memmove(reader->completed, reader->completed + count, sizeof(RegionFetch *) * (reader->completedCount - count));
+    reader->completedCount -= count;
+    return count;
+}
+
+void region_reader_free(RegionReader *reader)
+{
+    if (reader->sqes && reader->sqes != MAP_FAILED) munmap(reader->sqes, reader->sqesSize);
+    if (reader->cqRing && reader->cqRing != MAP_FAILED && reader->cqRing != reader->sqRing) munmap(reader->cqRing, reader->cqRingSize);
+    if (reader->sqRing && reader->sqRing != MAP_FAILED) munmap(reader->sqRing, reader->sqRingSize);
+    if (reader->ringFd >= 0) close(reader->ringFd);
+    free(reader->completed);
+    free(reader);
+}
+
+#else
+
+bool region_reader_is_supported(void)
+{
+    return false;
+}
+
+RegionReader *region_reader_init(unsigned queueDepth)
+{
+    return NULL;
+}
+
+int region_reader_submit(RegionReader *reader, RegionFetch *fetch)
+{
+    return -1;
+}
+
+unsigned region_reader_get_active_count(RegionReader *reader)
+{
+    return 0;
+}
+
+unsigned region_reader_reap(RegionReader *reader, RegionFetch **fetchesOut, unsigned maxFetches, bool wait)
+{
+    return 0;
+}
+
+void region_reader_free(RegionReader *reader)
+{
+}
+
+#endif // __linux__
@@ -0,0 +1,98 @@
+#ifndef REGION_READER_H
+#define REGION_READER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#include <choma/MemoryStream.h>
+
+// A byte range of a file that has been read into memory
+typedef struct RegionExtent {
+    uint64_t offset;
+    size_t size;
+    uint8_t *data;
+} RegionExtent;
+
+// Sparse view of a file: the regions that were read ahead plus the descriptor to fall back on
+// Shared between all streams created from it, freed when the last reference goes away
+typedef struct RegionSet {
+    _Atomic unsigned refCount;
+    int fd;
+    size_t fileSize;
+    RegionExtent *extents; // sorted by offset once the fetch is complete
+    uint32_t extentCount;
+    uint32_t extentCapacity;
+    _Atomic uint64_t missCount; // reads that were not covered by an extent
+} RegionSet;
+
+typedef enum {
+    REGION_READ_HEADER,
+    REGION_READ_SLICE_HEADER,
+    REGION_READ_LOAD_COMMANDS,
+    REGION_READ_SIGNATURE,
+} RegionReadType;
+
+typedef struct RegionFetch RegionFetch;
+
+typedef struct RegionRead {
+    struct RegionRead *next;
+    RegionFetch *fetch;
+    RegionReadType type;
+    uint64_t offset;
+    size_t size;
+    uint64_t sliceOffset;
+    uint64_t sliceSize;
+    struct iovec iov;
+} RegionRead;
+
+// Chained reads for a single file: header -> load commands -> LC_CODE_SIGNATURE bounds -> superblob
+struct RegionFetch {
+    RegionSet *regions;
+    RegionRead *pending;
+    unsigned inflight;
+    size_t maxReadSize;
+    void *context;
+};
+
+// Open the file and queue the header read
+RegionFetch *region_fetch_init(const char *path, void *context);
+
+// Perform every read of the chain with blocking pread, used where io_uring is unavailable
+int region_fetch_run_sync(RegionFetch *fetch);
+
+// Hand over the fetched regions (sorted), the fetch keeps no reference afterwards
+RegionSet *region_fetch_take_regions(RegionFetch *fetch);
+
+void region_fetch_free(RegionFetch *fetch);
+
+RegionSet *region_set_retain(RegionSet *regions);
+void region_set_release(RegionSet *regions);
+
+// MemoryStream backed by a RegionSet, reads outside of the fetched regions fall back to pread
+MemoryStream *sparse_stream_init(RegionSet *regions);
+
+// Asynchronous reader keeping many chained reads in flight across files
+typedef struct RegionReader RegionReader;
+
+// Whether an io_uring based reader can be created on this system
+bool region_reader_is_supported(void);
+
+// Returns NULL if io_uring is unavailable
+RegionReader *region_reader_init(unsigned queueDepth);
+
+// Returns -1 if the fetch could not be accepted, it is then still owned by the caller
+int region_reader_submit(RegionReader *reader, RegionFetch *fetch);
+
+// Number of files that still have reads queued or in flight
+unsigned region_reader_get_active_count(RegionReader *reader);
+
+// Submit queued reads and collect files whose chain is complete
+// If wait is set, blocks until at least one read completes
+unsigned region_reader_reap(RegionReader *reader, RegionFetch **fetchesOut, unsigned maxFetches, bool wait);
+
+void region_reader_free(RegionReader *reader);
+
+#endif // REGION_READER_H
@@ -0,0 +1,557 @@
+#include "Scan.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <TargetConditionals.h>
+
+#include <choma/Host.h>
+#include <choma/BufferedStream.h>
+#include <choma/MemoryStream.h>
+#include <choma/MachOByteOrder.h>
+
+#include "Clock.h"
+#include "CodeHash.h"
+#include "Trace.h"
+
+#define SCAN_PREFETCH_HEADER_SIZE 0x10000
+
+const char *scan_status_to_string(ScanStatus status)
+{
+    switch (status) {
+        case SCAN_STATUS_OK:
+            return "ok";
+        case SCAN_STATUS_OPEN_FAILED:
+            return "open-failed";
+        case SCAN_STATUS_NOT_MACHO:
+            return "not-macho";
+        case SCAN_STATUS_NO_SLICE:
+            return "no-slice";
+        case SCAN_STATUS_UNSUPPORTED_FILETYPE:
+            return "unsupported-filetype";
+        case SCAN_STATUS_NO_SIGNATURE:
+            return "no-signature";
+        case SCAN_STATUS_NO_CMS:
+            return "no-cms";
+        case SCAN_STATUS_NO_CODE_DIRECTORY:
+            return "no-code-directory";
+        case SCAN_STATUS_EVALUATION_FAILED:
+            return "evaluation-failed";
+        case SCAN_STATUS_OVER_BUDGET:
+            return "over-budget";
+        case SCAN_STATUS_CMS_REJECTED:
+            return "cms-rejected";
+        case SCAN_STATUS_CRASHED:
+            return "crashed";
+        case SCAN_STATUS_NO_EVALUATOR:
+            return "no-evaluator";
+    }
+    return "unknown";
+}
+
+const char *scan_budget_limit_to_string(ScanBudgetLimit limit)
+{
+    switch (limit) {
+        case SCAN_BUDGET_NONE:
+            return "none";
+        case SCAN_BUDGET_BYTES:
+            return "bytes";
+        case SCAN_BUDGET_BLOBS:
+            return "blobs";
+        case SCAN_BUDGET_SLOTS:
+            return "slots";
+        case SCAN_BUDGET_TIME:
+            return "time";
+        default:
+            return "unknown";
+    }
+}
+
+static bool scan_item_exceeds(ScanItem *item, ScanBudgetLimit limit)
+{
+    item->status = SCAN_STATUS_OVER_BUDGET;
+    item->budgetHit = limit;
+    return true;
+}
+
+static bool scan_item_over_bytes(ScanItem *item, uint64_t size)
+{
+    if (item->budget && item->budget->maxBytes && size > item->budget->maxBytes) {
+        return scan_item_exceeds(item, SCAN_BUDGET_BYTES);
+    }
+    return false;
+}
+
+// Time is charged per stage, so waiting in a queue does not count against a file
+static bool scan_item_over_time(ScanItem *item, uint64_t stageStart)
+{
+    if (!item->budget || !item->budget->maxNanos) return false;
+    if (item->budgetNanosUsed + (clock_now_ns() - stageStart) > item->budget->maxNanos) {
+        return scan_item_exceeds(item, SCAN_BUDGET_TIME);
+    }
+    return false;
+}
+
+static void scan_item_charge_time(ScanItem *item, uint64_t stageStart)
+{
+    item->budgetNanosUsed += clock_now_ns() - stageStart;
+}
+
+// ChOma trusts the blob count and offsets of the superblob, check them before decoding
+// so that a bogus count cannot make the decoder walk millions of entries past the buffer
+static bool scan_item_over_blobs(ScanItem *item, CS_SuperBlob *superblob, uint32_t superblobSize)
+{
+    uint32_t length = BIG_TO_HOST(superblob->length);
+    uint32_t count = BIG_TO_HOST(superblob->count);
+    if (length < sizeof(CS_SuperBlob) || length > superblobSize) {
+        return scan_item_exceeds(item, SCAN_BUDGET_BYTES);
+    }
+    uint32_t maxBlobs = item->budget && item->budget->maxBlobs ? item->budget->maxBlobs : UINT32_MAX;
+    if (count > (length - sizeof(CS_SuperBlob)) / sizeof(CS_BlobIndex) || count > maxBlobs) {
+        return scan_item_exceeds(item, SCAN_BUDGET_BLOBS);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t offset = BIG_TO_HOST(superblob->index[i].offset);
+        if (offset > length - sizeof(CS_GenericBlob)) {
+            return scan_item_exceeds(item, SCAN_BUDGET_BLOBS);
+        }
+        CS_GenericBlob *blob = (CS_GenericBlob *)((uint8_t *)superblob + offset);
+        if (BIG_TO_HOST(blob->length) > length - offset) {
+            return scan_item_exceeds(item, SCAN_BUDGET_BYTES);
+        }
+    }
+    return false;
+}
+
+static bool scan_item_over_slots(ScanItem *item)
+{
+    if (item->codeDirectoryLen < sizeof(CS_CodeDirectory)) {
+        return scan_item_exceeds(item, SCAN_BUDGET_SLOTS);
+    }
+    CS_CodeDirectory *codeDirectory = (CS_CodeDirectory *)item->codeDirectoryData;
+    uint64_t hashOffset = BIG_TO_HOST(codeDirectory->hashOffset);
+    uint64_t slotsSize = (uint64_t)BIG_TO_HOST(codeDirectory->nCodeSlots) * codeDirectory->hashSize;
+    uint64_t specialSlotsSize = (uint64_t)BIG_TO_HOST(codeDirectory->nSpecialSlots) * codeDirectory->hashSize;
+    if (hashOffset + slotsSize > item->codeDirectoryLen || specialSlotsSize > hashOffset) {
+        return scan_item_exceeds(item, SCAN_BUDGET_SLOTS);
+    }
+    return false;
+}
+
+LazyFatSlice *scan_find_preferred_slice(LazyFat *fat)
+{
+    LazyFatSlice *slice = lazy_fat_find_preferred_slice(fat);
+
+#if TARGET_OS_MAC && !TARGET_OS_IPHONE
+    if (!slice) {
+        // Check for arm64v8 first
+        slice = lazy_fat_find_slice(fat, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64_V8);
+        if (!slice) {
+            // If that fails, check for regular arm64
+            slice = lazy_fat_find_slice(fat, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64_ALL);
+            if (!slice) {
+                // If that fails, check for arm64e with ABI v2
+                slice = lazy_fat_find_slice(fat, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64E | CPU_SUBTYPE_ARM64E_ABI_V2);
+                if (!slice) {
+                    // If that fails, check for arm64e
+                    slice = lazy_fat_find_slice(fat, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64E);
+                }
+            }
+        }
+    }
+#endif // TARGET_OS_MAC && !TARGET_OS_IPHONE
+
+    return slice;
+}
+
+ScanItem *scan_item_init(const char *path)
+{
+    ScanItem *item = calloc(1, sizeof(ScanItem));
+    if (!item) return NULL;
+    item->path = strdup(path);
+    if (!item->path) {
+        free(item);
+        return NULL;
+    }
+    return item;
+}
+
+static void scan_item_release_mapping(ScanItem *item)
+{
+    if (item->mapping) {
+        munmap(item->mapping, item->fileSize);
+        item->mapping = NULL;
+    }
+}
+
+int scan_item_prefetch(ScanItem *item)
+{
+    if (item->status != SCAN_STATUS_OK) return -1;
+
+    int fd = open(item->path, O_RDONLY);
+    if (fd < 0) {
+        item->status = SCAN_STATUS_OPEN_FAILED;
+        return -1;
+    }
+
+    struct stat s;
+    if (fstat(fd, &s) != 0 || !S_ISREG(s.st_mode)) {
+        close(fd);
+        item->status = SCAN_STATUS_OPEN_FAILED;
+        return -1;
+    }
+    if (s.st_size < (off_t)sizeof(uint32_t)) {
+        close(fd);
+        item->status = SCAN_STATUS_NOT_MACHO;
+        return -1;
+    }
+
+    void *mapping = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        item->status = SCAN_STATUS_OPEN_FAILED;
+        return -1;
+    }
+    item->mapping = mapping;
+    item->fileSize = s.st_size;
+
+    // The headers and load commands are needed by the parse stage right away
+    // The code signature sits at the end and gets faulted in on demand
+    size_t adviseSize = item->fileSize < SCAN_PREFETCH_HEADER_SIZE ? item->fileSize : SCAN_PREFETCH_HEADER_SIZE;
+    madvise(item->mapping, adviseSize, MADV_WILLNEED);
+    return 0;
+}
+
+int scan_item_prefetch_regions(ScanItem *item)
+{
+    if (item->status != SCAN_STATUS_OK) return -1;
+
+    RegionFetch *fetch = region_fetch_init(item->path, item);
+    if (!fetch) {
+        item->status = SCAN_STATUS_OPEN_FAILED;
+        return -1;
+    }
+    region_fetch_run_sync(fetch);
+    scan_item_set_regions(item, region_fetch_take_regions(fetch));
+    region_fetch_free(fetch);
+    return item->status == SCAN_STATUS_OK ? 0 : -1;
+}
+
+void scan_item_set_regions(ScanItem *item, RegionSet *regions)
+{
+    if (!regions) {
+        item->status = SCAN_STATUS_OPEN_FAILED;
+        return;
+    }
+    item->regions = regions;
+    item->fileSize = regions->fileSize;
+    if (item->fileSize < sizeof(uint32_t)) {
+        item->status = SCAN_STATUS_NOT_MACHO;
+    }
+}
+
+static void scan_item_release_regions(ScanItem *item)
+{
+    if (item->regions) {
+        region_set_release(item->regions);
+        item->regions = NULL;
+    }
+}
+
+int scan_item_parse(ScanItem *item)
+{
+    if (item->status != SCAN_STATUS_OK) return -1;
+    uint64_t stageStart = clock_now_ns();
+
+    // The FAT takes ownership of the stream, the file data is released below once the blobs are copied out
+    // Only the fat_arch table is read here, the selected slice's header and load commands are read on demand
+    MemoryStream *stream = NULL;
+    if (item->regions) {
+        stream = sparse_stream_init(item->regions);
+    }
+    else {
+        stream = buffered_stream_init_from_buffer_nocopy(item->mapping, item->fileSize, 0);
+    }
+    if (!stream) {
+        item->status = SCAN_STATUS_OPEN_FAILED;
+        scan_item_release_mapping(item);
+        scan_item_release_regions(item);
+        return -1;
+    }
+
+    TRACE_SPAN_BEGIN(fatSpan);
+    LazyFat *fat = lazy_fat_init_from_memory_stream(stream);
+    TRACE_SPAN_END(fatSpan, "fat_init", item->traceId);
+    if (!fat) {
+        item->status = SCAN_STATUS_NOT_MACHO;
+        scan_item_release_mapping(item);
+        scan_item_release_regions(item);
+        return -1;
+    }
+
+    TRACE_SPAN_BEGIN(sliceSpan);
+    LazyFatSlice *slice = scan_find_preferred_slice(fat);
+    TRACE_SPAN_END(sliceSpan, "slice_selection", item->traceId);
+    if (!slice) {
+        item->status = SCAN_STATUS_NO_SLICE;
+        goto out;
+    }
+    item->cputype = slice->machHeader.cputype;
+    item->cpusubtype = slice->machHeader.cpusubtype;
+
+    if (slice->machHeader.filetype == MH_OBJECT || slice->machHeader.filetype == MH_DSYM) {
+        item->status = SCAN_STATUS_UNSUPPORTED_FILETYPE;
+        goto out;
+    }
+
+    uint32_t superblobOffset = 0, superblobSize = 0;
+    if (lazy_fat_slice_find_code_signature_bounds(fat, slice, &superblobOffset, &superblobSize) != 0) {
+        item->status = SCAN_STATUS_NO_SIGNATURE;
+        goto out;
+    }
+    if (scan_item_over_bytes(item, superblobSize)) goto out;
+
+    TRACE_SPAN_BEGIN(readSpan);
+    CS_SuperBlob *superblob = lazy_fat_slice_read_code_signature(fat, slice);
+    TRACE_SPAN_END(readSpan, "read_code_signature", item->traceId);
+    if (!superblob) {
+        item->status = SCAN_STATUS_NO_SIGNATURE;
+        goto out;
+    }
+    if (scan_item_over_blobs(item, superblob, superblobSize) || scan_item_over_time(item, stageStart)) {
+        free(superblob);
+        goto out;
+    }
+    TRACE_SPAN_BEGIN(decodeSpan);
+    item->superblob = csd_superblob_decode(superblob);
+    TRACE_SPAN_END(decodeSpan, "superblob_decode", item->traceId);
+    free(superblob);
+    if (!item->superblob) {
+        item->status = SCAN_STATUS_NO_SIGNATURE;
+        goto out;
+    }
+    if (item->auditEnabled) {
+        TRACE_SPAN_BEGIN(auditSpan);
+        item->audit = audit_record_create(item->superblob);
+        TRACE_SPAN_END(auditSpan, "audit", item->traceId);
+    }
+    if (item->trustCaches) {
+        TRACE_SPAN_BEGIN(trustCacheSpan);
+        if (code_signature_calculate_best_cdhash(item->superblob, item->cdhash) == 0) {
+            item->hasCDHash = true;
+            item->trustCacheChecked = true;
+            item->trustCacheIndex = trust_cache_set_lookup(item->trustCaches, item->cdhash);
+        }
+        TRACE_SPAN_END(trustCacheSpan, "trust_cache", item->traceId);
+    }
+
+    CS_DecodedBlob *signatureBlob = csd_superblob_find_blob(item->superblob, CSSLOT_SIGNATURESLOT, NULL);
+    if (!signatureBlob || csd_blob_get_size(signatureBlob) < 8) {
+        item->status = SCAN_STATUS_NO_CMS;
+        goto out;
+    }
+    item->cmsLen = csd_blob_get_size(signatureBlob) - 8;
+    if (scan_item_over_bytes(item, item->cmsLen)) goto out;
+    item->cmsData = malloc(item->cmsLen);
+    if (!item->cmsData || csd_blob_read(signatureBlob, 8, item->cmsLen, item->cmsData) != 0) {
+        item->status = SCAN_STATUS_NO_CMS;
+        goto out;
+    }
+
+    // Only the summary is kept, the parsed slices point into cmsData which the cdhash stage releases
+    TRACE_SPAN_BEGIN(cmsSpan);
+    CmsInfo cmsInfo;
+    item->cmsParseResult = cms_parse(item->cmsData, item->cmsLen, &cmsInfo);
+    item->cmsParsed = true;
+    TRACE_SPAN_END(cmsSpan, "cms_parse", item->traceId);
+    if (item->cmsParseResult == CMS_PARSE_OK) {
+        item->cmsSignerId = cms_info_get_signer_id(&cmsInfo);
+        item->cmsCertificateCount = cmsInfo.certificateCount;
+        item->cmsDigestAlgorithm = cmsInfo.digestAlgorithm;
+        item->cmsHasSigningTime = cmsInfo.hasSigningTime;
+        item->cmsSigningTime = cmsInfo.signingTime;
+    }
+    else if (item->prescreen) {
+        item->status = SCAN_STATUS_CMS_REJECTED;
+        goto out;
+    }
+
+    CS_DecodedBlob *codeDirectory = csd_superblob_find_blob(item->superblob, CSSLOT_CODEDIRECTORY, NULL);
+    if (!codeDirectory) {
+        item->status = SCAN_STATUS_NO_CODE_DIRECTORY;
+        goto out;
+    }
+    item->identifier = csd_code_directory_copy_identifier(codeDirectory, NULL);
+    item->teamId = csd_code_directory_copy_team_id(codeDirectory, NULL);
+    item->codeDirectoryLen = csd_blob_get_size(codeDirectory);
+    if (scan_item_over_bytes(item, item->codeDirectoryLen)) goto out;
+    item->codeDirectoryData = malloc(item->codeDirectoryLen);
+    if (!item->codeDirectoryData || csd_blob_read(codeDirectory, 0, item->codeDirectoryLen, item->codeDirectoryData) != 0) {
+        item->status = SCAN_STATUS_NO_CODE_DIRECTORY;
+        goto out;
+    }
+    if (scan_item_over_slots(item)) goto out;
+    scan_item_over_time(item, stageStart);
+
+out:
+    scan_item_charge_time(item, stageStart);
+    lazy_fat_free(fat);
+    scan_item_release_mapping(item);
+    scan_item_release_regions(item);
+    return item->status == SCAN_STATUS_OK ? 0 : -1;
+}
+
+int scan_item_evaluate(ScanItem *item)
+{
+    if (item->status != SCAN_STATUS_OK) return -1;
+
+    const CT_uint8_t *leafCert = NULL;
+    CT_size_t leafCertLen = 0;
+    const CT_uint8_t *digestData = NULL;
+    CT_size_t digestLen = 0;
+
+    TRACE_SPAN_BEGIN(ctSpan);
+    int loaded = evaluator_evaluate_amfi_cms(
+        item->cmsData, item->cmsLen, item->codeDirectoryData, item->codeDirectoryLen, false,
+        &leafCert, &leafCertLen, &item->policyFlags, &item->cmsDigestType,
+        &item->hashAgilityDigestType, &digestData, &digestLen, &item->ctResult);
+    TRACE_SPAN_END(ctSpan, "coretrust", item->traceId);
+
+    if (loaded != 0) {
+        item->status = SCAN_STATUS_NO_EVALUATOR;
+        return -1;
+    }
+
+    if (item->ctResult != 0) {
+        item->status = SCAN_STATUS_EVALUATION_FAILED;
+        return -1;
+    }
+
+    // digestData points into the CMS blob, copy it out so the CMS can be released
+    if (item->hashAgilityDigestType != 0) {
+        item->hashAgilityVersion = 2;
+    }
+    else if (digestLen != 0) {
+        item->hashAgilityVersion = 1;
+    }
+    if (digestData && digestLen) {
+        item->expectedCDHashLen = digestLen < SCAN_MAX_DIGEST_LEN ? digestLen : SCAN_MAX_DIGEST_LEN;
+        memcpy(item->expectedCDHash, digestData, item->expectedCDHashLen);
+    }
+    return 0;
+}
+
+int scan_item_calculate_cdhash(ScanItem *item)
+{
+    if (item->status != SCAN_STATUS_OK) return -1;
+    uint64_t stageStart = clock_now_ns();
+
+    // Every code directory gets hashed to find the best one
+    uint64_t codeDirectoriesSize = 0;
+    for (CS_DecodedBlob *blob = item->superblob->firstBlob; blob; blob = blob->next) {
+        uint32_t type = csd_blob_get_type(blob);
+        if (type == CSSLOT_CODEDIRECTORY || (type >= CSSLOT_ALTERNATE_CODEDIRECTORIES && type < CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT)) {
+            codeDirectoriesSize += csd_blob_get_size(blob);
+        }
+    }
+    if (scan_item_over_bytes(item, codeDirectoriesSize) || scan_item_over_time(item, stageStart)) {
+        scan_item_charge_time(item, stageStart);
+        return -1;
+    }
+
+    // Already taken by the parse stage when trust caches are loaded
+    int cdhashResult = 0;
+    if (!item->hasCDHash) {
+        TRACE_SPAN_BEGIN(cdhashSpan);
+        cdhashResult = code_signature_calculate_best_cdhash(item->superblob, item->cdhash);
+        TRACE_SPAN_END(cdhashSpan, "cdhash", item->traceId);
+    }
+    if (cdhashResult == 0) {
+        item->hasCDHash = true;
+        // Hash Agility v1 and v2 both hand out the expected cdhash, same comparison as the single file mode
+        item->cdhashMatches = item->expectedCDHashLen >= CS_CDHASH_LEN &&
+                              !memcmp(item->cdhash, item->expectedCDHash, CS_CDHASH_LEN);
+    }
+
+    // Nothing after this stage needs the signature anymore
+    csd_superblob_free(item->superblob);
+    item->superblob = NULL;
+    free(item->cmsData);
+    item->cmsData = NULL;
+    free(item->codeDirectoryData);
+    item->codeDirectoryData = NULL;
+
+    scan_item_charge_time(item, stageStart);
+    return 0;
+}
+
+void scan_item_print(ScanItem *item, FILE *output)
+{
+    TRACE_SPAN_BEGIN(outputSpan);
+    flockfile(output);
+    fprintf(output, "%s\t%s", item->path, scan_status_to_string(item->status));
+    if (item->status == SCAN_STATUS_OVER_BUDGET) {
+        fprintf(output, "\tlimit=%s", scan_budget_limit_to_string(item->budgetHit));
+    }
+    if (item->cmsParsed && (item->status == SCAN_STATUS_OK || item->status == SCAN_STATUS_EVALUATION_FAILED || item->status == SCAN_STATUS_CMS_REJECTED)) {
+        fprintf(output, "\tcms=%s", cms_parse_result_to_string(item->cmsParseResult));
+        if (item->cmsParseResult == CMS_PARSE_OK) {
+            fprintf(output, "\tsigner=%016llx\tcerts=%u\tcms-digest=%s", (unsigned long long)item->cmsSignerId,
+                    item->cmsCertificateCount, cms_digest_algorithm_to_string(item->cmsDigestAlgorithm));
+            if (item->cmsHasSigningTime) {
+                fprintf(output, "\tsigning-time=%lld", (long long)item->cmsSigningTime);
+            }
+        }
+    }
+    if (item->status == SCAN_STATUS_OK || item->status == SCAN_STATUS_EVALUATION_FAILED) {
+        fprintf(output, "\tct=0x%x", item->ctResult);
+    }
+    if (item->trustCacheChecked) {
+        if (item->status != SCAN_STATUS_OK) {
+            fprintf(output, "\tcdhash=");
+            for (size_t i = 0; i < CS_CDHASH_LEN; i++) {
+                fprintf(output, "%02x", item->cdhash[i]);
+            }
+        }
+        const char *trustCache = trust_cache_set_get_path(item->trustCaches, item->trustCacheIndex);
+        fprintf(output, "\ttc=%s", trustCache ? trustCache : "none");
+    }
+    if (item->status == SCAN_STATUS_OK) {
+        fprintf(output, "\tpolicy=0x%llx\tdigest=%s\tagility=", (unsigned long long)item->policyFlags, digestTypeToString(item->cmsDigestType));
+        if (item->hashAgilityVersion) {
+            fprintf(output, "v%u", item->hashAgilityVersion);
+        }
+        else {
+            fprintf(output, "none");
+        }
+        if (item->hasCDHash) {
+            fprintf(output, "\tcdhash=");
+            for (size_t i = 0; i < CS_CDHASH_LEN; i++) {
+                fprintf(output, "%02x", item->cdhash[i]);
+            }
+            fprintf(output, "\tmatch=%s", item->expectedCDHashLen >= CS_CDHASH_LEN ? (item->cdhashMatches ? "yes" : "no") : "n/a");
+        }
+    }
+    if (item->audit) {
+        audit_record_print(item->audit, output);
+    }
+    fprintf(output, "\n");
+    funlockfile(output);
+    TRACE_SPAN_END(outputSpan, "output", item->traceId);
+}
+
+void scan_item_free(ScanItem *item)
+{
+    scan_item_release_mapping(item);
+    scan_item_release_regions(item);
+    if (item->superblob) csd_superblob_free(item->superblob);
+    free(item->cmsData);
+    free(item->codeDirectoryData);
+    free(item->teamId);
+    free(item->identifier);
+    audit_record_free(item->audit);
+    free(item->path);
+    free(item);
+}
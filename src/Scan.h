@@ -0,0 +1,152 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <choma/FAT.h>
+#include <choma/MachO.h>
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+
+#include "CoreTrust.h"
+#include "Evaluator.h"
+#include "RegionReader.h"
+#include "LazyFat.h"
+#include "Audit.h"
+#include "Cms.h"
+#include "TrustCache.h"
+
+#define SCAN_MAX_DIGEST_LEN 64
+
+typedef enum {
+    SCAN_STATUS_OK = 0,
+    SCAN_STATUS_OPEN_FAILED,
+    SCAN_STATUS_NOT_MACHO,
+    SCAN_STATUS_NO_SLICE,
+    SCAN_STATUS_UNSUPPORTED_FILETYPE,
+    SCAN_STATUS_NO_SIGNATURE,
+    SCAN_STATUS_NO_CMS,
+    SCAN_STATUS_NO_CODE_DIRECTORY,
+    SCAN_STATUS_EVALUATION_FAILED,
+    SCAN_STATUS_OVER_BUDGET,
+    SCAN_STATUS_CMS_REJECTED, // pre-screen found no usable signer, CoreTrust was not called
+    SCAN_STATUS_CRASHED, // the worker process scanning the file died (worker pool only)
+    SCAN_STATUS_NO_EVALUATOR, // CTEvaluateAMFICodeSignatureCMS could not be loaded
+} ScanStatus;
+
+typedef enum {
+    SCAN_BUDGET_NONE = 0,
+    SCAN_BUDGET_BYTES,  // Signature, CMS or code directories larger than maxBytes
+    SCAN_BUDGET_BLOBS,  // Superblob claiming more than maxBlobs blobs
+    SCAN_BUDGET_SLOTS,  // Code directory with more code slots than it has room for
+    SCAN_BUDGET_TIME,   // Parse and hash stages took longer than maxNanos
+    SCAN_BUDGET_COUNT,
+} ScanBudgetLimit;
+
+// Per-file limits enforced in the parse and hash stages, 0 means unlimited
+typedef struct ScanBudget {
+    uint64_t maxNanos;
+    size_t maxBytes;
+    uint32_t maxBlobs;
+} ScanBudget;
+
+#define SCAN_DEFAULT_MAX_BLOBS 256
+
+// State of a single file as it moves through the scan stages
+// Every stage only fills in its own fields and is a no-op once status is no longer SCAN_STATUS_OK
+typedef struct ScanItem {
+    char *path;
+    ScanStatus status;
+
+    const ScanBudget *budget; // optional
+    ScanBudgetLimit budgetHit;
+    uint64_t budgetNanosUsed;
+
+    // Tracing, traceId ties the spans of one file together
+    uint64_t traceId;
+    uint64_t traceStart;
+
+    // Prefetch, either the whole file is mapped or only the signature regions were read
+    uint8_t *mapping;
+    size_t fileSize;
+    RegionSet *regions;
+
+    // Parse
+    cpu_type_t cputype;
+    cpu_subtype_t cpusubtype;
+    CS_DecodedSuperBlob *superblob;
+    uint8_t *cmsData;
+    size_t cmsLen;
+    uint8_t *codeDirectoryData;
+    size_t codeDirectoryLen;
+    char *teamId; // of the primary code directory, NULL if it has none
+    char *identifier;
+
+    // Evaluate
+    CT_int ctResult;
+    CoreTrustPolicyFlags policyFlags;
+    CoreTrustDigestType cmsDigestType;
+    CoreTrustDigestType hashAgilityDigestType;
+    uint8_t hashAgilityVersion;
+    uint8_t expectedCDHash[SCAN_MAX_DIGEST_LEN];
+    size_t expectedCDHashLen;
+
+    // CD hash
+    bool hasCDHash;
+    bool cdhashMatches;
+    uint8_t cdhash[CS_CDHASH_LEN];
+
+    // CMS pre-screen, parsed straight from cmsData before evaluation
+    bool prescreen; // reject empty / malformed / signerless CMS blobs without calling CoreTrust
+    bool cmsParsed;
+    CmsParseResult cmsParseResult;
+    uint64_t cmsSignerId;
+    uint32_t cmsCertificateCount;
+    CmsDigestAlgorithm cmsDigestAlgorithm;
+    bool cmsHasSigningTime;
+    int64_t cmsSigningTime;
+
+    // Trust cache membership, the cdhash is taken in the parse stage so ad-hoc signed binaries get a verdict too
+    const TrustCacheSet *trustCaches; // optional
+    bool trustCacheChecked;
+    int trustCacheIndex; // -1 if no trust cache contains the cdhash
+
+    // Audit, filled by the parse stage while the decoded superblob is at hand
+    bool auditEnabled;
+    AuditRecord *audit;
+} ScanItem;
+
+const char *scan_status_to_string(ScanStatus status);
+const char *scan_budget_limit_to_string(ScanBudgetLimit limit);
+
+// Pick the slice to evaluate, mirrors what the kernel would load with an arm64 fallback on macOS
+LazyFatSlice *scan_find_preferred_slice(LazyFat *fat);
+
+ScanItem *scan_item_init(const char *path);
+
+// Map the file and hint the kernel to start reading the headers
+int scan_item_prefetch(ScanItem *item);
+
+// Read only the headers, load commands and code signature with chained blocking preads
+int scan_item_prefetch_regions(ScanItem *item);
+
+// Take over regions fetched by an asynchronous RegionReader, NULL marks the file as unreadable
+void scan_item_set_regions(ScanItem *item, RegionSet *regions);
+
+// Select the slice and extract the CMS and code directory blobs
+int scan_item_parse(ScanItem *item);
+
+// Run CTEvaluateAMFICodeSignatureCMS on the extracted blobs, loads the evaluator on first use
+int scan_item_evaluate(ScanItem *item);
+
+// Calculate the best CD hash and compare it against the one CoreTrust returned
+int scan_item_calculate_cdhash(ScanItem *item);
+
+// Print a single tab separated result line
+void scan_item_print(ScanItem *item, FILE *output);
+
+void scan_item_free(ScanItem *item);
+
+#endif // SCAN_H
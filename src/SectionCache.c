@@ -0,0 +1,214 @@
+#include "SectionCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <choma/MemoryStream.h>
+
+SectionCache *section_cache_init(PFSection *section, size_t maxBytes)
+{
+    SectionCache *cache = calloc(1, sizeof(SectionCache));
+    if (!cache) return NULL;
+    cache->macho = section->macho;
+    cache->fileoff = section->fileoff;
+    cache->vmaddr = section->vmaddr;
+    cache->size = section->size;
+    cache->head = SECTION_CACHE_NO_SLOT;
+    cache->tail = SECTION_CACHE_NO_SLOT;
+
+    // Memory backed streams need no cache, the section is read in place
+    MemoryStream *stream = macho_get_stream(section->macho);
+    uint8_t *raw = memory_stream_get_raw_pointer(stream);
+    size_t streamSize = memory_stream_get_size(stream);
+    if (raw && streamSize != MEMORY_STREAM_SIZE_INVALID && section->fileoff <= streamSize && section->size <= streamSize - section->fileoff) {
+        cache->direct = raw + section->fileoff;
+        return cache;
+    }
+
+    cache->pageCount = (section->size + SECTION_CACHE_PAGE_SIZE - 1) / SECTION_CACHE_PAGE_SIZE;
+    uint64_t maxSlots = maxBytes / SECTION_CACHE_PAGE_SIZE;
+    if (maxSlots == 0) maxSlots = 1;
+    if (maxSlots > cache->pageCount) maxSlots = cache->pageCount ? cache->pageCount : 1;
+    cache->maxSlots = (uint32_t)maxSlots;
+
+    cache->pageSlots = malloc((cache->pageCount ? cache->pageCount : 1) * sizeof(uint32_t));
+    cache->slots = calloc(cache->maxSlots, sizeof(SectionCacheSlot));
+    if (!cache->pageSlots || !cache->slots) {
+        section_cache_free(cache);
+        return NULL;
+    }
+    for (uint64_t i = 0; i < cache->pageCount; i++) {
+        cache->pageSlots[i] = SECTION_CACHE_NO_SLOT;
+    }
+    return cache;
+}
+
+static void section_cache_unlink(SectionCache *cache, uint32_t index)
+{
+    SectionCacheSlot *slot = &cache->slots[index];
+    if (slot->prev != SECTION_CACHE_NO_SLOT) cache->slots[slot->prev].next = slot->next;
+    else cache->head = slot->next;
+    if (slot->next != SECTION_CACHE_NO_SLOT) cache->slots[slot->next].prev = slot->prev;
+    else cache->tail = slot->prev;
+}
+
+static void section_cache_push_front(SectionCache *cache, uint32_t index)
+{
+    SectionCacheSlot *slot = &cache->slots[index];
+    slot->prev = SECTION_CACHE_NO_SLOT;
+    slot->next = cache->head;
+    if (cache->head != SECTION_CACHE_NO_SLOT) cache->slots[cache->head].prev = index;
+    cache->head = index;
+    if (cache->tail == SECTION_CACHE_NO_SLOT) cache->tail = index;
+}
+
+static void section_cache_push_back(SectionCache *cache, uint32_t index)
+{
+    SectionCacheSlot *slot = &cache->slots[index];
+    slot->prev = cache->tail;
+    slot->next = SECTION_CACHE_NO_SLOT;
+    if (cache->tail != SECTION_CACHE_NO_SLOT) cache->slots[cache->tail].next = index;
+    cache->tail = index;
+    if (cache->head == SECTION_CACHE_NO_SLOT) cache->head = index;
+}
+
+static const uint8_t *section_cache_get_page(SectionCache *cache, uint64_t page)
+{
+    uint32_t index = cache->pageSlots[page];
+    if (index != SECTION_CACHE_NO_SLOT) {
+        cache->hits++;
+        if (cache->head != index) {
+            section_cache_unlink(cache, index);
+            section_cache_push_front(cache, index);
+        }
+        return cache->slots[index].data;
+    }
+
+    cache->misses++;
+    if (cache->slotCount < cache->maxSlots) {
+        index = cache->slotCount;
+        cache->slots[index].data = malloc(SECTION_CACHE_PAGE_SIZE);
+        if (!cache->slots[index].data) return NULL;
+        cache->slotCount++;
+    }
+    else {
+        index = cache->tail;
+        section_cache_unlink(cache, index);
+        uint64_t evicted = cache->slots[index].page;
+        if (evicted < cache->pageCount && cache->pageSlots[evicted] == index) {
+            cache->pageSlots[evicted] = SECTION_CACHE_NO_SLOT;
+            cache->evictions++;
+        }
+    }
+
+    SectionCacheSlot *slot = &cache->slots[index];
+    uint64_t offset = page * SECTION_CACHE_PAGE_SIZE;
+    uint64_t size = cache->size - offset < SECTION_CACHE_PAGE_SIZE ? cache->size - offset : SECTION_CACHE_PAGE_SIZE;
+    if (macho_read_at_offset(cache->macho, cache->fileoff + offset, size, slot->data) != 0) {
+        // The slot stays empty at the LRU end so it is recycled first
+        slot->page = UINT64_MAX;
+        section_cache_push_back(cache, index);
+        return NULL;
+    }
+    slot->page = page;
+    cache->pageSlots[page] = index;
+    section_cache_push_front(cache, index);
+    return slot->data;
+}
+
+int section_cache_read_at_address(SectionCache *cache, uint64_t vmaddr, void *outBuf, size_t size)
+{
+    if (vmaddr < cache->vmaddr) return -1;
+    uint64_t offset = vmaddr - cache->vmaddr;
+    if (offset > cache->size || size > cache->size - offset) return -1;
+
+    if (cache->direct) {
+        memcpy(outBuf, cache->direct + offset, size);
+        return 0;
+    }
+
+    uint8_t *out = outBuf;
+    while (size) {
+        uint64_t page = offset / SECTION_CACHE_PAGE_SIZE;
+        uint64_t pageOffset = offset % SECTION_CACHE_PAGE_SIZE;
+        size_t count = SECTION_CACHE_PAGE_SIZE - pageOffset < size ? SECTION_CACHE_PAGE_SIZE - pageOffset : size;
+        const uint8_t *data = section_cache_get_page(cache, page);
+        if (!data) return -1;
+        memcpy(out, data + pageOffset, count);
+        out += count;
+        offset += count;
+        size -= count;
+    }
+    return 0;
+}
+
+uint32_t section_cache_read32(SectionCache *cache, uint64_t vmaddr)
+{
+    uint32_t value = 0;
+    if (section_cache_read_at_address(cache, vmaddr, &value, sizeof(value)) != 0) return 0;
+    return value;
+}
+
+uint64_t section_cache_read64(SectionCache *cache, uint64_t vmaddr)
+{
+    uint64_t value = 0;
+    if (section_cache_read_at_address(cache, vmaddr, &value, sizeof(value)) != 0) return 0;
+    return value;
+}
+
+int section_cache_read_string(SectionCache *cache, uint64_t vmaddr, char **outString)
+{
+    if (vmaddr < cache->vmaddr || vmaddr - cache->vmaddr >= cache->size) return -1;
+    uint64_t start = vmaddr - cache->vmaddr;
+
+    // Find the terminator a page at a time, then copy the whole string in one read
+    uint64_t offset = start;
+    while (offset < cache->size) {
+        uint64_t pageOffset = offset % SECTION_CACHE_PAGE_SIZE;
+        size_t count = SECTION_CACHE_PAGE_SIZE - pageOffset;
+        if (count > cache->size - offset) count = cache->size - offset;
+        const uint8_t *data = cache->direct ? cache->direct + offset : section_cache_get_page(cache, offset / SECTION_CACHE_PAGE_SIZE);
+        if (!data) return -1;
+        if (!cache->direct) data += pageOffset;
+        const uint8_t *terminator = memchr(data, 0, count);
+        if (terminator) {
+            size_t length = (offset - start) + (terminator - data);
+            char *string = malloc(length + 1);
+            if (!string) return -1;
+            if (section_cache_read_at_address(cache, vmaddr, string, length + 1) != 0) {
+                free(string);
+                return -1;
+            }
+            *outString = string;
+            return 0;
+        }
+        offset += count;
+    }
+    return -1;
+}
+
+void section_cache_print_stats(SectionCache *cache, FILE *output)
+{
+    if (cache->direct) {
+        fprintf(output, "Section cache: direct, %llu bytes mapped\n", (unsigned long long)cache->size);
+        return;
+    }
+    uint64_t lookups = cache->hits + cache->misses;
+    fprintf(output, "Section cache: %llu hits, %llu misses (%.1f%% hit rate), %llu evictions, %u/%u pages resident (%llu KiB)\n",
+            (unsigned long long)cache->hits, (unsigned long long)cache->misses, lookups ? 100.0 * cache->hits / lookups : 0.0,
+            (unsigned long long)cache->evictions, cache->slotCount, cache->maxSlots,
+            (unsigned long long)cache->slotCount * SECTION_CACHE_PAGE_SIZE / 1024);
+}
+
+void section_cache_free(SectionCache *cache)
+{
+    if (!cache) return;
+    if (cache->slots) {
+        for (uint32_t i = 0; i < cache->slotCount; i++) {
+            free(cache->slots[i].data);
+        }
+    }
+    free(cache->slots);
+    free(cache->pageSlots);
+    free(cache);
+}
@@ -0,0 +1,70 @@
+#ifndef SECTION_CACHE_H
+#define SECTION_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <choma/MachO.h>
+#include <choma/PatchFinder.h>
+
+// Page granular read cache for a PFSection
+// pfsec_set_cached either copies the whole section or leaves every pfsec_read32 / pfsec_read64 /
+// pfsec_read_string as a stream read, this sits in between: the section is read a page at a time and at most
+// maxBytes of pages are kept, least recently used first out. If the MachO's stream is backed by memory
+// (getRawPtr) nothing is copied at all and reads go straight to the mapping
+//
+// Not thread safe, like PFSection itself
+
+#define SECTION_CACHE_PAGE_SIZE 0x4000
+#define SECTION_CACHE_DEFAULT_MAX_BYTES (16 * 1024 * 1024)
+
+#define SECTION_CACHE_NO_SLOT UINT32_MAX
+
+typedef struct SectionCacheSlot {
+    uint64_t page;
+    uint32_t prev; // towards the most recently used slot
+    uint32_t next;
+    uint8_t *data;
+} SectionCacheSlot;
+
+typedef struct SectionCache {
+    MachO *macho;
+    uint64_t fileoff;
+    uint64_t vmaddr;
+    uint64_t size;
+
+    const uint8_t *direct; // section start inside a memory backed stream, NULL if pages are cached
+
+    uint64_t pageCount;
+    uint32_t *pageSlots; // page -> slot, SECTION_CACHE_NO_SLOT if not resident
+    SectionCacheSlot *slots;
+    uint32_t slotCount;
+    uint32_t maxSlots;
+    uint32_t head; // most recently used
+    uint32_t tail; // evicted next
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} SectionCache;
+
+// Uses the section's MachO, file offset, address and size, the section has to outlive the cache
+// maxBytes is rounded down to whole pages, at least one page is always kept
+SectionCache *section_cache_init(PFSection *section, size_t maxBytes);
+
+int section_cache_read_at_address(SectionCache *cache, uint64_t vmaddr, void *outBuf, size_t size);
+
+// 0 if the address is outside of the section, like pfsec_read32 / pfsec_read64
+uint32_t section_cache_read32(SectionCache *cache, uint64_t vmaddr);
+uint64_t section_cache_read64(SectionCache *cache, uint64_t vmaddr);
+
+// NUL terminated string at vmaddr, allocated, -1 if it runs past the end of the section
+int section_cache_read_string(SectionCache *cache, uint64_t vmaddr, char **outString);
+
+// Hits, misses, evictions and resident bytes, for tuning maxBytes
+void section_cache_print_stats(SectionCache *cache, FILE *output);
+
+void section_cache_free(SectionCache *cache);
+
+#endif // SECTION_CACHE_H
@@ -0,0 +1,318 @@
+#include "Snapshot.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Fnv.h"
+#include "Sort.h"
+
+SnapshotWriter *snapshot_writer_init(const char *path)
+{
+    SnapshotWriter *writer = calloc(1, sizeof(SnapshotWriter));
+    if (!writer) return NULL;
+    writer->path = strdup(path);
+    if (!writer->path) {
+        free(writer);
+        return NULL;
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    return writer;
+}
+
+int snapshot_writer_add_item(SnapshotWriter *writer, const ScanItem *item)
+{
+    size_t pathLength = strlen(item->path);
+    if (pathLength > UINT32_MAX) return -1;
+
+    SnapshotRecord record = { 0 };
+    record.pathHash = fnv_hash(item->path, pathLength);
+    record.pathLength = (uint32_t)pathLength;
+    record.status = item->status;
+    record.cputype = item->cputype;
+    record.cpusubtype = item->cpusubtype;
+    record.policyFlags = item->policyFlags;
+    record.signerId = item->cmsSignerId;
+    record.ctResult = (uint32_t)item->ctResult;
+    record.cmsDigestType = item->cmsDigestType;
+    record.hashAgilityDigestType = item->hashAgilityDigestType;
+    record.hashAgilityVersion = item->hashAgilityVersion;
+    record.hasCDHash = item->hasCDHash;
+    record.cmsDigestAlgorithm = (uint8_t)item->cmsDigestAlgorithm;
+    if (item->hasCDHash) memcpy(record.cdhash, item->cdhash, sizeof(record.cdhash));
+
+    pthread_mutex_lock(&writer->lock);
+    if (writer->recordCount == writer->recordCapacity) {
+        uint64_t capacity = writer->recordCapacity ? writer->recordCapacity * 2 : 4096;
+        SnapshotRecord *records = realloc(writer->records, capacity * sizeof(SnapshotRecord));
+        if (!records) {
+            pthread_mutex_unlock(&writer->lock);
+            return -1;
+        }
+        writer->records = records;
+        writer->recordCapacity = capacity;
+    }
+    if (writer->stringsSize + pathLength + 1 > writer->stringsCapacity) {
+        uint64_t capacity = writer->stringsCapacity ? writer->stringsCapacity : 64 * 1024;
+        while (writer->stringsSize + pathLength + 1 > capacity) capacity *= 2;
+        char *strings = realloc(writer->strings, capacity);
+        if (!strings) {
+            pthread_mutex_unlock(&writer->lock);
+            return -1;
+        }
+        writer->strings = strings;
+        writer->stringsCapacity = capacity;
+    }
+    record.pathOffset = writer->stringsSize;
+    memcpy(writer->strings + writer->stringsSize, item->path, pathLength + 1);
+    writer->stringsSize += pathLength + 1;
+    writer->records[writer->recordCount++] = record;
+    pthread_mutex_unlock(&writer->lock);
+    return 0;
+}
+
+static int snapshot_compare_paths(uint64_t hashA, const char *pathA, uint32_t lengthA, uint64_t hashB, const char *pathB, uint32_t lengthB)
+{
+    if (hashA != hashB) return hashA < hashB ? -1 : 1;
+    uint32_t length = lengthA < lengthB ? lengthA : lengthB;
+    int r = memcmp(pathA, pathB, length);
+    if (r) return r;
+    return lengthA == lengthB ? 0 : (lengthA < lengthB ? -1 : 1);
+}
+
+// context is the writer's string table
+static int snapshot_record_sort_compare(const void *a, const void *b, void *context)
+{
+    const SnapshotRecord *recordA = a, *recordB = b;
+    const char *strings = context;
+    return snapshot_compare_paths(recordA->pathHash, strings + recordA->pathOffset, recordA->pathLength,
+                                  recordB->pathHash, strings + recordB->pathOffset, recordB->pathLength);
+}
+
+static int snapshot_write_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *cur = data;
+    while (size) {
+        ssize_t written = write(fd, cur, size);
+        if (written < 0) return -1;
+        cur += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int snapshot_writer_finish(SnapshotWriter *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    if (sort_with_context(writer->records, writer->recordCount, sizeof(SnapshotRecord), snapshot_record_sort_compare, writer->strings) != 0) {
+        printf("Error: failed to sort snapshot %s!\n", writer->path);
+        pthread_mutex_unlock(&writer->lock);
+        return -1;
+    }
+
+    SnapshotHeader header = { 0 };
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.recordSize = sizeof(SnapshotRecord);
+    header.recordCount = writer->recordCount;
+    header.recordsOffset = sizeof(SnapshotHeader);
+    header.stringsOffset = header.recordsOffset + writer->recordCount * sizeof(SnapshotRecord);
+    header.stringsSize = writer->stringsSize;
+
+    int r = -1;
+    int fd = open(writer->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error: failed to open %s for writing!\n", writer->path);
+    }
+    else {
+        if (snapshot_write_all(fd, &header, sizeof(header)) == 0 &&
+            snapshot_write_all(fd, writer->records, writer->recordCount * sizeof(SnapshotRecord)) == 0 &&
+            snapshot_write_all(fd, writer->strings, writer->stringsSize) == 0) {
+            r = 0;
+        }
+        else {
+            printf("Error: failed to write snapshot %s!\n", writer->path);
+        }
+        if (close(fd) != 0) r = -1;
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return r;
+}
+
+void snapshot_writer_free(SnapshotWriter *writer)
+{
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->records);
+    free(writer->strings);
+    free(writer->path);
+    free(writer);
+}
+
+Snapshot *snapshot_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: failed to open %s!\n", path);
+        return NULL;
+    }
+    struct stat s;
+    if (fstat(fd, &s) != 0 || (uint64_t)s.st_size < sizeof(SnapshotHeader)) {
+        printf("Error: %s is not a snapshot!\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("Error: failed to map %s!\n", path);
+        return NULL;
+    }
+
+    const SnapshotHeader *header = mapping;
+    uint64_t size = s.st_size;
+    bool valid = !memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) &&
+                 header->version == SNAPSHOT_VERSION &&
+                 header->recordSize == sizeof(SnapshotRecord) &&
+                 header->recordsOffset >= sizeof(SnapshotHeader) && header->recordsOffset <= size &&
+                 header->recordsOffset % _Alignof(SnapshotRecord) == 0 &&
+                 header->recordCount <= (size - header->recordsOffset) / sizeof(SnapshotRecord) &&
+                 header->stringsOffset <= size && header->stringsSize <= size - header->stringsOffset;
+    if (!valid) {
+        printf("Error: %s is not a supported snapshot!\n", path);
+        munmap(mapping, s.st_size);
+        return NULL;
+    }
+
+    Snapshot *snapshot = calloc(1, sizeof(Snapshot));
+    if (!snapshot) {
+        munmap(mapping, s.st_size);
+        return NULL;
+    }
+    snapshot->mapping = mapping;
+    snapshot->size = s.st_size;
+    snapshot->header = header;
+    snapshot->records = (const SnapshotRecord *)(snapshot->mapping + header->recordsOffset);
+    snapshot->strings = (const char *)(snapshot->mapping + header->stringsOffset);
+    madvise(snapshot->mapping, snapshot->size, MADV_SEQUENTIAL);
+    return snapshot;
+}
+
+const char *snapshot_record_get_path(const Snapshot *snapshot, const SnapshotRecord *record)
+{
+    uint64_t stringsSize = snapshot->header->stringsSize;
+    if (record->pathOffset >= stringsSize || record->pathLength >= stringsSize - record->pathOffset) return NULL;
+    const char *path = snapshot->strings + record->pathOffset;
+    return path[record->pathLength] == '\0' ? path : NULL;
+}
+
+void snapshot_free(Snapshot *snapshot)
+{
+    munmap(snapshot->mapping, snapshot->size);
+    free(snapshot);
+}
+
+static void snapshot_print_cdhash(const SnapshotRecord *record, FILE *output)
+{
+    if (!record->hasCDHash) {
+        fprintf(output, "none");
+        return;
+    }
+    for (size_t i = 0; i < sizeof(record->cdhash); i++) {
+        fprintf(output, "%02x", record->cdhash[i]);
+    }
+}
+
+static void snapshot_print_change(const char *path, const SnapshotRecord *oldRecord, const SnapshotRecord *newRecord, FILE *output)
+{
+    fprintf(output, "changed\t%s", path);
+    if (oldRecord->status != newRecord->status) {
+        fprintf(output, "\tstatus=%s->%s", scan_status_to_string(oldRecord->status), scan_status_to_string(newRecord->status));
+    }
+    if (oldRecord->cputype != newRecord->cputype || oldRecord->cpusubtype != newRecord->cpusubtype) {
+        fprintf(output, "\tslice=%d:%d->%d:%d", oldRecord->cputype, oldRecord->cpusubtype & ~CPU_SUBTYPE_MASK,
+                newRecord->cputype, newRecord->cpusubtype & ~CPU_SUBTYPE_MASK);
+    }
+    if (oldRecord->hasCDHash != newRecord->hasCDHash || memcmp(oldRecord->cdhash, newRecord->cdhash, sizeof(oldRecord->cdhash))) {
+        fprintf(output, "\tcdhash=");
+        snapshot_print_cdhash(oldRecord, output);
+        fprintf(output, "->");
+        snapshot_print_cdhash(newRecord, output);
+    }
+    if (oldRecord->signerId != newRecord->signerId) {
+        fprintf(output, "\tsigner=%016llx->%016llx", (unsigned long long)oldRecord->signerId, (unsigned long long)newRecord->signerId);
+    }
+    if (oldRecord->policyFlags != newRecord->policyFlags) {
+        fprintf(output, "\tpolicy=0x%llx->0x%llx", (unsigned long long)oldRecord->policyFlags, (unsigned long long)newRecord->policyFlags);
+    }
+    if (oldRecord->ctResult != newRecord->ctResult) {
+        fprintf(output, "\tct=0x%x->0x%x", oldRecord->ctResult, newRecord->ctResult);
+    }
+    if (oldRecord->cmsDigestType != newRecord->cmsDigestType) {
+        fprintf(output, "\tdigest=%s->%s", digestTypeToString(oldRecord->cmsDigestType), digestTypeToString(newRecord->cmsDigestType));
+    }
+    if (oldRecord->hashAgilityVersion != newRecord->hashAgilityVersion || oldRecord->hashAgilityDigestType != newRecord->hashAgilityDigestType) {
+        fprintf(output, "\tagility=v%u:%s->v%u:%s", oldRecord->hashAgilityVersion, digestTypeToString(oldRecord->hashAgilityDigestType),
+                newRecord->hashAgilityVersion, digestTypeToString(newRecord->hashAgilityDigestType));
+    }
+    fprintf(output, "\n");
+}
+
+static bool snapshot_records_equal(const SnapshotRecord *a, const SnapshotRecord *b)
+{
+    return a->status == b->status && a->cputype == b->cputype && a->cpusubtype == b->cpusubtype &&
+           a->policyFlags == b->policyFlags && a->signerId == b->signerId && a->ctResult == b->ctResult &&
+           a->cmsDigestType == b->cmsDigestType && a->hashAgilityDigestType == b->hashAgilityDigestType &&
+           a->hashAgilityVersion == b->hashAgilityVersion && a->hasCDHash == b->hasCDHash &&
+           !memcmp(a->cdhash, b->cdhash, sizeof(a->cdhash));
+}
+
+int snapshot_diff(const Snapshot *oldSnapshot, const Snapshot *newSnapshot, FILE *output, SnapshotDiffStats *statsOut)
+{
+    SnapshotDiffStats stats = { 0 };
+    uint64_t oldCount = oldSnapshot->header->recordCount;
+    uint64_t newCount = newSnapshot->header->recordCount;
+    uint64_t i = 0, j = 0;
+
+    while (i < oldCount || j < newCount) {
+        const SnapshotRecord *oldRecord = i < oldCount ? &oldSnapshot->records[i] : NULL;
+        const SnapshotRecord *newRecord = j < newCount ? &newSnapshot->records[j] : NULL;
+        const char *oldPath = oldRecord ? snapshot_record_get_path(oldSnapshot, oldRecord) : NULL;
+        const char *newPath = newRecord ? snapshot_record_get_path(newSnapshot, newRecord) : NULL;
+        if ((oldRecord && !oldPath) || (newRecord && !newPath)) {
+            printf("Error: snapshot has a record with an invalid path!\n");
+            return -1;
+        }
+
+        int order = 0;
+        if (!oldRecord) order = 1;
+        else if (!newRecord) order = -1;
+        else order = snapshot_compare_paths(oldRecord->pathHash, oldPath, oldRecord->pathLength, newRecord->pathHash, newPath, newRecord->pathLength);
+
+        if (order < 0) {
+            fprintf(output, "removed\t%s\n", oldPath);
+            stats.removed++;
+            i++;
+        }
+        else if (order > 0) {
+            fprintf(output, "added\t%s\t%s\n", newPath, scan_status_to_string(newRecord->status));
+            stats.added++;
+            j++;
+        }
+        else {
+            if (snapshot_records_equal(oldRecord, newRecord)) {
+                stats.unchanged++;
+            }
+            else {
+                snapshot_print_change(newPath, oldRecord, newRecord, output);
+                stats.changed++;
+            }
+            i++;
+            j++;
+        }
+    }
+
+    if (statsOut) *statsOut = stats;
+    return 0;
+}
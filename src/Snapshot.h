@@ -0,0 +1,91 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "Scan.h"
+
+// Binary scan snapshots: fixed size records sorted by path, followed by a string table with the paths
+// Snapshots are mapped read-only, two of them are compared with a single merge join
+
+#define SNAPSHOT_MAGIC "CTSNAP01"
+#define SNAPSHOT_VERSION 1
+
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t recordCount;
+    uint64_t recordsOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+} SnapshotHeader;
+
+typedef struct SnapshotRecord {
+    uint64_t pathHash; // sort key, ties are broken by the path itself
+    uint64_t pathOffset;
+    uint32_t pathLength;
+    uint32_t status; // ScanStatus
+    int32_t cputype;
+    int32_t cpusubtype;
+    uint64_t policyFlags;
+    uint64_t signerId;
+    uint32_t ctResult;
+    uint32_t cmsDigestType;
+    uint32_t hashAgilityDigestType;
+    uint8_t hashAgilityVersion;
+    uint8_t hasCDHash;
+    uint8_t cmsDigestAlgorithm;
+    uint8_t reserved;
+    uint8_t cdhash[20];
+    uint8_t padding[4];
+} SnapshotRecord;
+
+_Static_assert(sizeof(SnapshotRecord) == 88, "snapshot records are part of the file format");
+
+typedef struct SnapshotWriter {
+    pthread_mutex_t lock;
+    char *path;
+    SnapshotRecord *records;
+    uint64_t recordCount;
+    uint64_t recordCapacity;
+    char *strings;
+    uint64_t stringsSize;
+    uint64_t stringsCapacity;
+} SnapshotWriter;
+
+typedef struct Snapshot {
+    uint8_t *mapping;
+    size_t size;
+    const SnapshotHeader *header;
+    const SnapshotRecord *records;
+    const char *strings;
+} Snapshot;
+
+// Records are collected in memory and written sorted by snapshot_writer_finish
+SnapshotWriter *snapshot_writer_init(const char *path);
+// Thread safe, may be called from several output threads
+int snapshot_writer_add_item(SnapshotWriter *writer, const ScanItem *item);
+int snapshot_writer_finish(SnapshotWriter *writer);
+void snapshot_writer_free(SnapshotWriter *writer);
+
+Snapshot *snapshot_open(const char *path);
+// Returns NULL if the record's path is out of the string table's bounds
+const char *snapshot_record_get_path(const Snapshot *snapshot, const SnapshotRecord *record);
+void snapshot_free(Snapshot *snapshot);
+
+typedef struct SnapshotDiffStats {
+    uint64_t added;
+    uint64_t removed;
+    uint64_t changed;
+    uint64_t unchanged;
+} SnapshotDiffStats;
+
+// Merge join of two snapshots, prints one line per added, removed or changed path
+int snapshot_diff(const Snapshot *oldSnapshot, const Snapshot *newSnapshot, FILE *output, SnapshotDiffStats *statsOut);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,68 @@
+#include "Sort.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Runs this short are insertion sorted before merging
+#define SORT_RUN_LENGTH 16
+
+// temporary has room for one element
+static void sort_insertion(uint8_t *base, size_t count, size_t size, SortCompare compare, void *context, uint8_t *temporary)
+{
+    for (size_t i = 1; i < count; i++) {
+        uint8_t *element = base + i * size;
+        size_t j = i;
+        while (j > 0 && compare(base + (j - 1) * size, element, context) > 0) j--;
+        if (j == i) continue;
+        memcpy(temporary, element, size);
+        memmove(base + (j + 1) * size, base + j * size, (i - j) * size);
+        memcpy(base + j * size, temporary, size);
+    }
+}
+
+// Merges the sorted ranges [0, middle) and [middle, count) of source into destination, ties taken from the left
+static void sort_merge(const uint8_t *source, uint8_t *destination, size_t middle, size_t count, size_t size, SortCompare compare, void *context)
+{
+    size_t left = 0, right = middle;
+    while (left < middle && right < count) {
+        if (compare(source + right * size, source + left * size, context) < 0) {
+            memcpy(destination, source + right++ * size, size);
+        }
+        else {
+            memcpy(destination, source + left++ * size, size);
+        }
+        destination += size;
+    }
+    memcpy(destination, source + left * size, (middle - left) * size);
+    destination += (middle - left) * size;
+    memcpy(destination, source + right * size, (count - right) * size);
+}
+
+int sort_with_context(void *base, size_t count, size_t size, SortCompare compare, void *context)
+{
+    if (count < 2 || size == 0) return 0;
+    uint8_t *buffer = malloc(count > SORT_RUN_LENGTH ? count * size : size);
+    if (!buffer) return -1;
+
+    for (size_t start = 0; start < count; start += SORT_RUN_LENGTH) {
+        size_t length = count - start < SORT_RUN_LENGTH ? count - start : SORT_RUN_LENGTH;
+        sort_insertion((uint8_t *)base + start * size, length, size, compare, context, buffer);
+    }
+
+    // Bottom-up passes alternate between base and the buffer
+    uint8_t *source = base, *destination = buffer;
+    for (size_t width = SORT_RUN_LENGTH; width < count; width *= 2) {
+        for (size_t start = 0; start < count; start += 2 * width) {
+            size_t middle = count - start < width ? count - start : width;
+            size_t length = count - start < 2 * width ? count - start : 2 * width;
+            sort_merge(source + start * size, destination + start * size, middle, length, size, compare, context);
+        }
+        uint8_t *swap = source;
+        source = destination;
+        destination = swap;
+    }
+    if (source != base) memcpy(base, source, count * size);
+    free(buffer);
+    return 0;
+}
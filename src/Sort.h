@@ -0,0 +1,13 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stddef.h>
+
+// qsort has no context argument everywhere and qsort_r takes it in a different position on glibc and the BSDs,
+// this is a stable merge sort that passes it through instead of a global
+typedef int (*SortCompare)(const void *a, const void *b, void *context);
+
+// Sorts count elements of size bytes, -1 if the merge buffer could not be allocated (base is left unchanged)
+int sort_with_context(void *base, size_t count, size_t size, SortCompare compare, void *context);
+
+#endif // SORT_H
@@ -0,0 +1,629 @@
+#include "Store.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Sort.h"
+
+static char *store_join_path(const char *directory, const char *name)
+{
+    size_t directoryLength = strlen(directory);
+    size_t nameLength = strlen(name);
+    char *path = malloc(directoryLength + nameLength + 2);
+    if (!path) return NULL;
+    memcpy(path, directory, directoryLength);
+    path[directoryLength] = '/';
+    memcpy(path + directoryLength + 1, name, nameLength + 1);
+    return path;
+}
+
+StoreWriter *store_writer_init(const char *directory)
+{
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        printf("Error: failed to create store %s!\n", directory);
+        return NULL;
+    }
+    StoreWriter *writer = calloc(1, sizeof(StoreWriter));
+    if (!writer) return NULL;
+    writer->directory = strdup(directory);
+    if (!writer->directory) {
+        free(writer);
+        return NULL;
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    return writer;
+}
+
+// Called with the writer lock held
+static int store_writer_append_string(StoreWriter *writer, const char *string, size_t length, uint64_t *offsetOut)
+{
+    if (writer->stringsSize + length + 1 > writer->stringsCapacity) {
+        uint64_t capacity = writer->stringsCapacity ? writer->stringsCapacity : 64 * 1024;
+        while (writer->stringsSize + length + 1 > capacity) capacity *= 2;
+        char *strings = realloc(writer->strings, capacity);
+        if (!strings) return -1;
+        writer->strings = strings;
+        writer->stringsCapacity = capacity;
+    }
+    *offsetOut = writer->stringsSize;
+    memcpy(writer->strings + writer->stringsSize, string, length);
+    writer->strings[writer->stringsSize + length] = '\0';
+    writer->stringsSize += length + 1;
+    return 0;
+}
+
+int store_writer_add_item(StoreWriter *writer, const ScanItem *item)
+{
+    size_t pathLength = strlen(item->path);
+    size_t teamIdLength = item->teamId ? strlen(item->teamId) : 0;
+    size_t identifierLength = item->identifier ? strlen(item->identifier) : 0;
+    if (pathLength > UINT32_MAX || teamIdLength > UINT32_MAX || identifierLength > UINT32_MAX) return -1;
+
+    StoreRecord record = { 0 };
+    record.pathLength = (uint32_t)pathLength;
+    record.teamIdLength = (uint32_t)teamIdLength;
+    record.identifierLength = (uint32_t)identifierLength;
+    record.status = item->status;
+    record.cputype = item->cputype;
+    record.cpusubtype = item->cpusubtype;
+    record.policyFlags = item->policyFlags;
+    record.signerId = item->cmsSignerId;
+    record.ctResult = (uint32_t)item->ctResult;
+    record.cmsDigestType = item->cmsDigestType;
+    record.hashAgilityDigestType = item->hashAgilityDigestType;
+    record.hashAgilityVersion = item->hashAgilityVersion;
+    record.hasCDHash = item->hasCDHash;
+    record.cdhashMatches = item->cdhashMatches;
+    if (item->hasCDHash) memcpy(record.cdhash, item->cdhash, sizeof(record.cdhash));
+
+    pthread_mutex_lock(&writer->lock);
+    if (writer->recordCount == UINT32_MAX) {
+        pthread_mutex_unlock(&writer->lock);
+        return -1;
+    }
+    if (writer->recordCount == writer->recordCapacity) {
+        uint64_t capacity = writer->recordCapacity ? writer->recordCapacity * 2 : 4096;
+        StoreRecord *records = realloc(writer->records, capacity * sizeof(StoreRecord));
+        if (!records) {
+            pthread_mutex_unlock(&writer->lock);
+            return -1;
+        }
+        writer->records = records;
+        writer->recordCapacity = capacity;
+    }
+    if (store_writer_append_string(writer, item->path, pathLength, &record.pathOffset) != 0 ||
+        (teamIdLength && store_writer_append_string(writer, item->teamId, teamIdLength, &record.teamIdOffset) != 0) ||
+        (identifierLength && store_writer_append_string(writer, item->identifier, identifierLength, &record.identifierOffset) != 0)) {
+        pthread_mutex_unlock(&writer->lock);
+        return -1;
+    }
+    writer->records[writer->recordCount++] = record;
+    pthread_mutex_unlock(&writer->lock);
+    return 0;
+}
+
+static const char *store_get_string(const char *strings, uint64_t stringsSize, uint64_t offset, uint32_t length)
+{
+    if (offset >= stringsSize || length >= stringsSize - offset) return NULL;
+    const char *string = strings + offset;
+    return string[length] == '\0' ? string : NULL;
+}
+
+// Returns false if the record has no key for the index or the key is out of the string table's bounds
+static bool store_get_key(const char *strings, uint64_t stringsSize, const StoreRecord *record, StoreIndexType type,
+                          const uint8_t **keyOut, uint32_t *lengthOut)
+{
+    const char *string = NULL;
+    switch (type) {
+        case STORE_INDEX_CDHASH:
+            if (!record->hasCDHash) return false;
+            *keyOut = record->cdhash;
+            *lengthOut = sizeof(record->cdhash);
+            return true;
+        case STORE_INDEX_TEAM_ID:
+            if (!record->teamIdLength) return false;
+            string = store_get_string(strings, stringsSize, record->teamIdOffset, record->teamIdLength);
+            *lengthOut = record->teamIdLength;
+            break;
+        case STORE_INDEX_IDENTIFIER:
+            if (!record->identifierLength) return false;
+            string = store_get_string(strings, stringsSize, record->identifierOffset, record->identifierLength);
+            *lengthOut = record->identifierLength;
+            break;
+        case STORE_INDEX_PATH:
+            string = store_get_string(strings, stringsSize, record->pathOffset, record->pathLength);
+            *lengthOut = record->pathLength;
+            break;
+        default:
+            return false;
+    }
+    *keyOut = (const uint8_t *)string;
+    return string != NULL;
+}
+
+// Byte order, so every key with a given prefix is in one contiguous range of the index
+static int store_compare_keys(const uint8_t *keyA, uint32_t lengthA, const uint8_t *keyB, uint32_t lengthB)
+{
+    uint32_t length = lengthA < lengthB ? lengthA : lengthB;
+    int r = memcmp(keyA, keyB, length);
+    if (r) return r;
+    return lengthA == lengthB ? 0 : (lengthA < lengthB ? -1 : 1);
+}
+
+typedef struct StoreSortContext {
+    const StoreWriter *writer;
+    StoreIndexType index;
+} StoreSortContext;
+
+// The sort is stable and indexes are filled in ingest order, equal keys stay in it
+static int store_index_sort_compare(const void *a, const void *b, void *context)
+{
+    const StoreSortContext *sortContext = context;
+    const StoreWriter *writer = sortContext->writer;
+    uint32_t recordA = *(const uint32_t *)a, recordB = *(const uint32_t *)b;
+    const uint8_t *keyA = NULL, *keyB = NULL;
+    uint32_t lengthA = 0, lengthB = 0;
+    store_get_key(writer->strings, writer->stringsSize, &writer->records[recordA], sortContext->index, &keyA, &lengthA);
+    store_get_key(writer->strings, writer->stringsSize, &writer->records[recordB], sortContext->index, &keyB, &lengthB);
+    return store_compare_keys(keyA, lengthA, keyB, lengthB);
+}
+
+static int store_write_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *cur = data;
+    while (size) {
+        ssize_t written = write(fd, cur, size);
+        if (written < 0) return -1;
+        cur += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int store_writer_finish(StoreWriter *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    if (writer->recordCount == 0) {
+        pthread_mutex_unlock(&writer->lock);
+        return 0;
+    }
+
+    uint32_t *indexes[STORE_INDEX_COUNT] = { NULL };
+    uint64_t indexCounts[STORE_INDEX_COUNT] = { 0 };
+    int r = -1;
+    int fd = -1;
+    char *temporaryPath = NULL, *segmentPath = NULL;
+
+    for (int type = 0; type < STORE_INDEX_COUNT; type++) {
+        indexes[type] = malloc(writer->recordCount * sizeof(uint32_t));
+        if (!indexes[type]) break;
+        for (uint64_t i = 0; i < writer->recordCount; i++) {
+            const uint8_t *key = NULL;
+            uint32_t length = 0;
+            if (store_get_key(writer->strings, writer->stringsSize, &writer->records[i], type, &key, &length)) {
+                indexes[type][indexCounts[type]++] = (uint32_t)i;
+            }
+        }
+        StoreSortContext context = { writer, type };
+        if (sort_with_context(indexes[type], indexCounts[type], sizeof(uint32_t), store_index_sort_compare, &context) != 0) goto out;
+    }
+    for (int type = 0; type < STORE_INDEX_COUNT; type++) {
+        if (!indexes[type]) goto out;
+    }
+
+    StoreSegmentHeader header = { 0 };
+    memcpy(header.magic, STORE_SEGMENT_MAGIC, sizeof(header.magic));
+    header.version = STORE_SEGMENT_VERSION;
+    header.recordSize = sizeof(StoreRecord);
+    header.createdTime = (uint64_t)time(NULL);
+    header.recordCount = writer->recordCount;
+    header.recordsOffset = sizeof(StoreSegmentHeader);
+    uint64_t offset = header.recordsOffset + writer->recordCount * sizeof(StoreRecord);
+    for (int type = 0; type < STORE_INDEX_COUNT; type++) {
+        header.indexOffsets[type] = offset;
+        header.indexCounts[type] = indexCounts[type];
+        offset += indexCounts[type] * sizeof(uint32_t);
+    }
+    header.stringsOffset = offset;
+    header.stringsSize = writer->stringsSize;
+
+    // Segment names sort in ingest order
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    unsigned long long stamp = (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+    char name[64];
+    snprintf(name, sizeof(name), ".%020llu-%d.tmp", stamp, (int)getpid());
+    temporaryPath = store_join_path(writer->directory, name);
+    snprintf(name, sizeof(name), "%020llu-%d%s", stamp, (int)getpid(), STORE_SEGMENT_SUFFIX);
+    segmentPath = store_join_path(writer->directory, name);
+    if (!temporaryPath || !segmentPath) goto out;
+
+    fd = open(temporaryPath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        printf("Error: failed to open %s for writing!\n", temporaryPath);
+        goto out;
+    }
+    bool written = store_write_all(fd, &header, sizeof(header)) == 0 &&
+                   store_write_all(fd, writer->records, writer->recordCount * sizeof(StoreRecord)) == 0;
+    for (int type = 0; type < STORE_INDEX_COUNT && written; type++) {
+        written = store_write_all(fd, indexes[type], indexCounts[type] * sizeof(uint32_t)) == 0;
+    }
+    written = written && store_write_all(fd, writer->strings, writer->stringsSize) == 0 && fsync(fd) == 0;
+    if (close(fd) != 0) written = false;
+    fd = -1;
+    if (!written || rename(temporaryPath, segmentPath) != 0) {
+        printf("Error: failed to write store segment %s!\n", segmentPath);
+        unlink(temporaryPath);
+        goto out;
+    }
+    r = 0;
+
+out:
+    for (int type = 0; type < STORE_INDEX_COUNT; type++) {
+        free(indexes[type]);
+    }
+    free(temporaryPath);
+    free(segmentPath);
+    pthread_mutex_unlock(&writer->lock);
+    return r;
+}
+
+void store_writer_free(StoreWriter *writer)
+{
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->records);
+    free(writer->strings);
+    free(writer->directory);
+    free(writer);
+}
+
+static int store_segment_open(StoreSegment *segment, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: failed to open %s!\n", path);
+        return -1;
+    }
+    struct stat s;
+    if (fstat(fd, &s) != 0 || (uint64_t)s.st_size < sizeof(StoreSegmentHeader)) {
+        printf("Error: %s is not a store segment!\n", path);
+        close(fd);
+        return -1;
+    }
+    void *mapping = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("Error: failed to map %s!\n", path);
+        return -1;
+    }
+
+    const StoreSegmentHeader *header = mapping;
+    uint64_t size = s.st_size;
+    bool valid = !memcmp(header->magic, STORE_SEGMENT_MAGIC, sizeof(header->magic)) &&
+                 header->version == STORE_SEGMENT_VERSION &&
+                 header->recordSize == sizeof(StoreRecord) &&
+                 header->recordsOffset >= sizeof(StoreSegmentHeader) && header->recordsOffset <= size &&
+                 header->recordsOffset % _Alignof(StoreRecord) == 0 &&
+                 header->recordCount <= UINT32_MAX &&
+                 header->recordCount <= (size - header->recordsOffset) / sizeof(StoreRecord) &&
+                 header->stringsOffset <= size && header->stringsSize <= size - header->stringsOffset;
+    for (int type = 0; type < STORE_INDEX_COUNT && valid; type++) {
+        valid = header->indexOffsets[type] <= size && header->indexOffsets[type] % sizeof(uint32_t) == 0 &&
+                header->indexCounts[type] <= header->recordCount &&
+                header->indexCounts[type] <= (size - header->indexOffsets[type]) / sizeof(uint32_t);
+    }
+    if (!valid) {
+        printf("Error: %s is not a supported store segment!\n", path);
+        munmap(mapping, s.st_size);
+        return -1;
+    }
+
+    segment->path = strdup(path);
+    if (!segment->path) {
+        munmap(mapping, s.st_size);
+        return -1;
+    }
+    segment->mapping = mapping;
+    segment->size = s.st_size;
+    segment->header = header;
+    segment->records = (const StoreRecord *)(segment->mapping + header->recordsOffset);
+    segment->strings = (const char *)(segment->mapping + header->stringsOffset);
+    for (int type = 0; type < STORE_INDEX_COUNT; type++) {
+        segment->indexes[type] = (const uint32_t *)(segment->mapping + header->indexOffsets[type]);
+    }
+    return 0;
+}
+
+static int store_segment_name_compare(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+Store *store_open(const char *directory)
+{
+    DIR *dir = opendir(directory);
+    if (!dir) {
+        printf("Error: failed to open store %s!\n", directory);
+        return NULL;
+    }
+
+    char **names = NULL;
+    uint64_t nameCount = 0, nameCapacity = 0;
+    size_t suffixLength = strlen(STORE_SEGMENT_SUFFIX);
+    struct dirent *entry = NULL;
+    bool failed = false;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        // Segments still being written start with a dot
+        if (entry->d_name[0] == '.' || length <= suffixLength || strcmp(entry->d_name + length - suffixLength, STORE_SEGMENT_SUFFIX)) continue;
+        if (nameCount == nameCapacity) {
+            uint64_t capacity = nameCapacity ? nameCapacity * 2 : 64;
+            char **newNames = realloc(names, capacity * sizeof(char *));
+            if (!newNames) {
+                failed = true;
+                break;
+            }
+            names = newNames;
+            nameCapacity = capacity;
+        }
+        names[nameCount] = strdup(entry->d_name);
+        if (!names[nameCount]) {
+            failed = true;
+            break;
+        }
+        nameCount++;
+    }
+    closedir(dir);
+
+    Store *store = NULL;
+    if (!failed) {
+        qsort(names, nameCount, sizeof(char *), store_segment_name_compare);
+        store = calloc(1, sizeof(Store));
+        if (store && nameCount) {
+            store->segments = calloc(nameCount, sizeof(StoreSegment));
+            if (!store->segments) failed = true;
+        }
+        else if (!store) {
+            failed = true;
+        }
+    }
+    for (uint64_t i = 0; i < nameCount && !failed; i++) {
+        char *path = store_join_path(directory, names[i]);
+        if (!path) {
+            failed = true;
+            break;
+        }
+        if (store_segment_open(&store->segments[store->segmentCount], path) != 0) {
+            failed = true;
+        }
+        else {
+            store->recordCount += store->segments[store->segmentCount].header->recordCount;
+            store->segmentCount++;
+        }
+        free(path);
+    }
+    for (uint64_t i = 0; i < nameCount; i++) {
+        free(names[i]);
+    }
+    free(names);
+
+    if (failed && store) {
+        store_free(store);
+        store = NULL;
+    }
+    return store;
+}
+
+void store_free(Store *store)
+{
+    for (uint64_t i = 0; i < store->segmentCount; i++) {
+        munmap(store->segments[i].mapping, store->segments[i].size);
+        free(store->segments[i].path);
+    }
+    free(store->segments);
+    free(store);
+}
+
+void store_query_init(StoreQuery *query)
+{
+    memset(query, 0, sizeof(StoreQuery));
+    query->hashAgilityVersion = -1;
+    query->excludedHashAgilityVersion = -1;
+}
+
+static int store_hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+int store_query_set_cdhash(StoreQuery *query, const char *hex)
+{
+    if (strlen(hex) != sizeof(query->cdhash) * 2) return -1;
+    for (size_t i = 0; i < sizeof(query->cdhash); i++) {
+        int high = store_hex_digit(hex[i * 2]), low = store_hex_digit(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) return -1;
+        query->cdhash[i] = (uint8_t)(high << 4 | low);
+    }
+    query->hasCDHash = true;
+    return 0;
+}
+
+const char *store_record_get_path(const StoreSegment *segment, const StoreRecord *record)
+{
+    return store_get_string(segment->strings, segment->header->stringsSize, record->pathOffset, record->pathLength);
+}
+
+const char *store_record_get_team_id(const StoreSegment *segment, const StoreRecord *record)
+{
+    if (!record->teamIdLength) return "";
+    return store_get_string(segment->strings, segment->header->stringsSize, record->teamIdOffset, record->teamIdLength);
+}
+
+const char *store_record_get_identifier(const StoreSegment *segment, const StoreRecord *record)
+{
+    if (!record->identifierLength) return "";
+    return store_get_string(segment->strings, segment->header->stringsSize, record->identifierOffset, record->identifierLength);
+}
+
+static bool store_record_key_equals(const StoreSegment *segment, const StoreRecord *record, StoreIndexType type, const char *key)
+{
+    const uint8_t *recordKey = NULL;
+    uint32_t recordKeyLength = 0;
+    if (!store_get_key(segment->strings, segment->header->stringsSize, record, type, &recordKey, &recordKeyLength)) return false;
+    return recordKeyLength == strlen(key) && !memcmp(recordKey, key, recordKeyLength);
+}
+
+static bool store_record_matches(const StoreSegment *segment, const StoreRecord *record, const StoreQuery *query)
+{
+    if ((record->policyFlags & query->policyAll) != query->policyAll) return false;
+    if (record->policyFlags & query->policyNone) return false;
+    if (query->hashAgilityVersion >= 0 && record->hashAgilityVersion != query->hashAgilityVersion) return false;
+    if (query->excludedHashAgilityVersion >= 0 && record->hashAgilityVersion == query->excludedHashAgilityVersion) return false;
+    if (query->evaluatedOnly && record->status != SCAN_STATUS_OK && record->status != SCAN_STATUS_EVALUATION_FAILED) return false;
+    if (query->hasCDHash && (!record->hasCDHash || memcmp(record->cdhash, query->cdhash, sizeof(record->cdhash)))) return false;
+    if (query->teamId && !store_record_key_equals(segment, record, STORE_INDEX_TEAM_ID, query->teamId)) return false;
+    if (query->identifier && !store_record_key_equals(segment, record, STORE_INDEX_IDENTIFIER, query->identifier)) return false;
+    if (query->path && !store_record_key_equals(segment, record, STORE_INDEX_PATH, query->path)) return false;
+    if (query->pathPrefix) {
+        const char *path = store_record_get_path(segment, record);
+        if (!path || strncmp(path, query->pathPrefix, strlen(query->pathPrefix))) return false;
+    }
+    return true;
+}
+
+// First position in the index whose key is not below key, -1 if the index references an invalid record
+static int64_t store_index_lower_bound(const StoreSegment *segment, StoreIndexType type, const uint8_t *key, uint32_t keyLength)
+{
+    const uint32_t *index = segment->indexes[type];
+    uint64_t low = 0, high = segment->header->indexCounts[type];
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (index[middle] >= segment->header->recordCount) return -1;
+        const uint8_t *middleKey = NULL;
+        uint32_t middleKeyLength = 0;
+        if (!store_get_key(segment->strings, segment->header->stringsSize, &segment->records[index[middle]], type, &middleKey, &middleKeyLength)) return -1;
+        if (store_compare_keys(middleKey, middleKeyLength, key, keyLength) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return (int64_t)low;
+}
+
+static int store_query_segment(const StoreSegment *segment, const StoreQuery *query, StoreQueryCallback callback, void *context, StoreQueryStats *stats)
+{
+    // Most selective key first, the prefix only narrows the range of the path index
+    StoreIndexType type = STORE_INDEX_COUNT;
+    const uint8_t *key = NULL;
+    uint32_t keyLength = 0;
+    if (query->hasCDHash) {
+        type = STORE_INDEX_CDHASH;
+        key = query->cdhash;
+        keyLength = sizeof(query->cdhash);
+    }
+    else if (query->path || query->identifier || query->teamId || query->pathPrefix) {
+        const char *string = query->path ? query->path : (query->identifier ? query->identifier : (query->teamId ? query->teamId : query->pathPrefix));
+        type = query->path ? STORE_INDEX_PATH : (query->identifier ? STORE_INDEX_IDENTIFIER : (query->teamId ? STORE_INDEX_TEAM_ID : STORE_INDEX_PATH));
+        key = (const uint8_t *)string;
+        size_t length = strlen(string);
+        if (length > UINT32_MAX) return 0;
+        keyLength = (uint32_t)length;
+    }
+
+    if (type == STORE_INDEX_COUNT) {
+        for (uint64_t i = 0; i < segment->header->recordCount; i++) {
+            stats->candidateCount++;
+            if (store_record_matches(segment, &segment->records[i], query)) {
+                stats->matchCount++;
+                callback(segment, &segment->records[i], context);
+            }
+        }
+        return 0;
+    }
+
+    int64_t start = store_index_lower_bound(segment, type, key, keyLength);
+    if (start < 0) {
+        printf("Error: %s has a corrupt index!\n", segment->path);
+        return -1;
+    }
+    const uint32_t *index = segment->indexes[type];
+    for (uint64_t i = (uint64_t)start; i < segment->header->indexCounts[type]; i++) {
+        if (index[i] >= segment->header->recordCount) {
+            printf("Error: %s has a corrupt index!\n", segment->path);
+            return -1;
+        }
+        const StoreRecord *record = &segment->records[index[i]];
+        const uint8_t *recordKey = NULL;
+        uint32_t recordKeyLength = 0;
+        if (!store_get_key(segment->strings, segment->header->stringsSize, record, type, &recordKey, &recordKeyLength)) {
+            printf("Error: %s has a corrupt index!\n", segment->path);
+            return -1;
+        }
+        // Exact keys end at the first larger key, a prefix at the first key that does not start with it
+        if (recordKeyLength < keyLength || memcmp(recordKey, key, keyLength)) break;
+        bool prefixOnly = type == STORE_INDEX_PATH && !query->path;
+        if (!prefixOnly && recordKeyLength != keyLength) break;
+        stats->candidateCount++;
+        if (store_record_matches(segment, record, query)) {
+            stats->matchCount++;
+            callback(segment, record, context);
+        }
+    }
+    return 0;
+}
+
+int store_query(const Store *store, const StoreQuery *query, StoreQueryCallback callback, void *context, StoreQueryStats *statsOut)
+{
+    StoreQueryStats stats = { 0 };
+    stats.segmentCount = store->segmentCount;
+    stats.recordCount = store->recordCount;
+    int r = 0;
+    for (uint64_t i = 0; i < store->segmentCount && r == 0; i++) {
+        r = store_query_segment(&store->segments[i], query, callback, context, &stats);
+    }
+    if (statsOut) *statsOut = stats;
+    return r;
+}
+
+void store_record_print(const StoreSegment *segment, const StoreRecord *record, FILE *output)
+{
+    const char *path = store_record_get_path(segment, record);
+    const char *teamId = store_record_get_team_id(segment, record);
+    const char *identifier = store_record_get_identifier(segment, record);
+    fprintf(output, "%s\t%s\tslice=%d:%d", path ? path : "?", scan_status_to_string(record->status),
+            record->cputype, record->cpusubtype & ~CPU_SUBTYPE_MASK);
+    fprintf(output, "\tteam=%s\tidentifier=%s", teamId && teamId[0] ? teamId : "none", identifier && identifier[0] ? identifier : "none");
+    if (record->status == SCAN_STATUS_OK || record->status == SCAN_STATUS_EVALUATION_FAILED) {
+        fprintf(output, "\tct=0x%x", record->ctResult);
+    }
+    if (record->status == SCAN_STATUS_OK) {
+        fprintf(output, "\tpolicy=0x%llx\tdigest=%s\tagility=", (unsigned long long)record->policyFlags, digestTypeToString(record->cmsDigestType));
+        if (record->hashAgilityVersion) {
+            fprintf(output, "v%u", record->hashAgilityVersion);
+        }
+        else {
+            fprintf(output, "none");
+        }
+    }
+    if (record->hasCDHash) {
+        fprintf(output, "\tcdhash=");
+        for (size_t i = 0; i < sizeof(record->cdhash); i++) {
+            fprintf(output, "%02x", record->cdhash[i]);
+        }
+        if (record->status == SCAN_STATUS_OK) {
+            fprintf(output, "\tmatch=%s", record->hashAgilityVersion ? (record->cdhashMatches ? "yes" : "no") : "n/a");
+        }
+    }
+    fprintf(output, "\tingested=%llu\n", (unsigned long long)segment->header->createdTime);
+}
@@ -0,0 +1,145 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "Scan.h"
+
+// Append-only results store: a directory of immutable segments, one per ingest run, that is never rewritten
+// A segment holds fixed size records, a string table with the paths, team IDs and signing identifiers, and one
+// sorted index of record numbers per key (cdhash, team ID, identifier, path). Queries map every segment and
+// binary search the most selective index, policy flag and hash agility filters are checked on the candidates
+// or, without an indexed key, on a sequential pass over the records
+
+#define STORE_SEGMENT_MAGIC "CTSTOR01"
+#define STORE_SEGMENT_VERSION 1
+#define STORE_SEGMENT_SUFFIX ".ctseg"
+
+typedef enum {
+    STORE_INDEX_CDHASH = 0,
+    STORE_INDEX_TEAM_ID,
+    STORE_INDEX_IDENTIFIER,
+    STORE_INDEX_PATH,
+    STORE_INDEX_COUNT,
+} StoreIndexType;
+
+typedef struct StoreSegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t createdTime; // wall clock seconds of the ingest run
+    uint64_t recordCount;
+    uint64_t recordsOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    // Record numbers (uint32_t) sorted by key, records without the key are left out
+    uint64_t indexOffsets[STORE_INDEX_COUNT];
+    uint64_t indexCounts[STORE_INDEX_COUNT];
+} StoreSegmentHeader;
+
+typedef struct StoreRecord {
+    uint64_t pathOffset;
+    uint64_t teamIdOffset;
+    uint64_t identifierOffset;
+    uint32_t pathLength;
+    uint32_t teamIdLength; // 0 if the code directory has no team ID
+    uint32_t identifierLength;
+    uint32_t status; // ScanStatus
+    int32_t cputype;
+    int32_t cpusubtype;
+    uint64_t policyFlags;
+    uint64_t signerId;
+    uint32_t ctResult;
+    uint32_t cmsDigestType;
+    uint32_t hashAgilityDigestType;
+    uint8_t hashAgilityVersion;
+    uint8_t hasCDHash;
+    uint8_t cdhashMatches;
+    uint8_t reserved;
+    uint8_t cdhash[20];
+    uint8_t padding[4];
+} StoreRecord;
+
+_Static_assert(sizeof(StoreRecord) == 104, "store records are part of the file format");
+
+typedef struct StoreWriter {
+    pthread_mutex_t lock;
+    char *directory;
+    StoreRecord *records;
+    uint64_t recordCount;
+    uint64_t recordCapacity;
+    char *strings;
+    uint64_t stringsSize;
+    uint64_t stringsCapacity;
+} StoreWriter;
+
+typedef struct StoreSegment {
+    char *path;
+    uint8_t *mapping;
+    size_t size;
+    const StoreSegmentHeader *header;
+    const StoreRecord *records;
+    const char *strings;
+    const uint32_t *indexes[STORE_INDEX_COUNT];
+} StoreSegment;
+
+typedef struct Store {
+    StoreSegment *segments; // oldest first
+    uint64_t segmentCount;
+    uint64_t recordCount;
+} Store;
+
+// All set filters have to match, a query without filters matches every record
+typedef struct StoreQuery {
+    bool hasCDHash;
+    uint8_t cdhash[20];
+    const char *teamId;
+    const char *identifier;
+    const char *path;
+    const char *pathPrefix;
+    uint64_t policyAll;  // every one of these policy flags is set
+    uint64_t policyNone; // none of these policy flags is set
+    int hashAgilityVersion; // -1 for any, 0 for none
+    int excludedHashAgilityVersion; // -1 to exclude nothing
+    bool evaluatedOnly; // only records CoreTrust returned a verdict for
+} StoreQuery;
+
+typedef struct StoreQueryStats {
+    uint64_t segmentCount;
+    uint64_t recordCount;
+    uint64_t candidateCount; // records the filters were checked on
+    uint64_t matchCount;
+} StoreQueryStats;
+
+typedef void (*StoreQueryCallback)(const StoreSegment *segment, const StoreRecord *record, void *context);
+
+// Creates the directory if needed, records are collected in memory and written as a new segment by store_writer_finish
+StoreWriter *store_writer_init(const char *directory);
+// Thread safe, may be called from several output threads
+int store_writer_add_item(StoreWriter *writer, const ScanItem *item);
+// Writes the segment under a temporary name and renames it into place, readers never see a partial segment
+int store_writer_finish(StoreWriter *writer);
+void store_writer_free(StoreWriter *writer);
+
+Store *store_open(const char *directory);
+void store_free(Store *store);
+
+void store_query_init(StoreQuery *query);
+// Parse a 40 character hex cdhash into the query
+int store_query_set_cdhash(StoreQuery *query, const char *hex);
+// Calls callback for every matching record, oldest segment first
+int store_query(const Store *store, const StoreQuery *query, StoreQueryCallback callback, void *context, StoreQueryStats *statsOut);
+
+// Return NULL if the string is out of the string table's bounds, "" for a missing team ID
+const char *store_record_get_path(const StoreSegment *segment, const StoreRecord *record);
+const char *store_record_get_team_id(const StoreSegment *segment, const StoreRecord *record);
+const char *store_record_get_identifier(const StoreSegment *segment, const StoreRecord *record);
+
+// Tab separated, same field names as the scan output
+void store_record_print(const StoreSegment *segment, const StoreRecord *record, FILE *output);
+
+#endif // STORE_H
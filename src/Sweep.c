@@ -0,0 +1,490 @@
+#include "Sweep.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Clock.h"
+#include "Evaluator.h"
+
+typedef struct SweepField {
+    const char *name;
+    uint32_t offset;
+    uint8_t width;
+    uint32_t minVersion;
+} SweepField;
+
+// Offsets into CS_CodeDirectory, fields of later versions are only there when the version says so
+static const SweepField gSweepFields[] = {
+    { "version", 8, 4, 0 },
+    { "flags", 12, 4, 0 },
+    { "hashSize", 36, 1, 0 },
+    { "hashType", 37, 1, 0 },
+    { "platform", 38, 1, 0 },
+    { "pageSize", 39, 1, 0 },
+    { "execSegFlags", 80, 8, 0x20400 },
+};
+
+#define SWEEP_CD_TEAM_OFFSET_FIELD 48
+#define SWEEP_CD_TEAM_MIN_VERSION 0x20200
+
+// Per-thread state, the buffers are copies of the base that every mutation restores after evaluation
+typedef struct SweepWorker {
+    Sweep *sweep;
+    uint8_t *cms;
+    uint8_t *codeDirectory;
+    OutcomeBuffer output;
+    OutcomeTable outcomes;
+    uint64_t changedCount;
+} SweepWorker;
+
+static uint64_t sweep_read_be(const uint8_t *data, uint8_t width)
+{
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < width; i++) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+static void sweep_write_be(uint8_t *data, uint8_t width, uint64_t value)
+{
+    for (uint8_t i = 0; i < width; i++) {
+        data[width - 1 - i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+Sweep *sweep_init(const uint8_t *cms, size_t cmsSize, const uint8_t *codeDirectory, size_t codeDirectorySize, unsigned threadCount)
+{
+    Sweep *sweep = calloc(1, sizeof(Sweep));
+    if (!sweep) return NULL;
+    pthread_mutex_init(&sweep->lock, NULL);
+    sweep->cms = malloc(cmsSize ? cmsSize : 1);
+    sweep->codeDirectory = malloc(codeDirectorySize ? codeDirectorySize : 1);
+    if (!sweep->cms || !sweep->codeDirectory) {
+        sweep_free(sweep);
+        return NULL;
+    }
+    memcpy(sweep->cms, cms, cmsSize);
+    memcpy(sweep->codeDirectory, codeDirectory, codeDirectorySize);
+    sweep->cmsSize = cmsSize;
+    sweep->codeDirectorySize = codeDirectorySize;
+    sweep->threadCount = threadCount ? threadCount : 1;
+    atomic_init(&sweep->nextVariant, 0);
+    return sweep;
+}
+
+static int sweep_parse_number(const char *text, uint64_t *valueOut)
+{
+    char *end = NULL;
+    *valueOut = strtoull(text, &end, 0);
+    return end != text && *end == '\0' ? 0 : -1;
+}
+
+// "a", "a-b" or "a-b/step", * covers 0..limit-1
+static int sweep_parse_range(const char *text, uint64_t limit, SweepRange *rangeOut)
+{
+    if (!strcmp(text, "*")) {
+        if (!limit) return -1;
+        *rangeOut = (SweepRange){ 0, limit - 1, 1 };
+        return 0;
+    }
+    char buffer[128];
+    if (strlen(text) >= sizeof(buffer)) return -1;
+    strcpy(buffer, text);
+    uint64_t step = 1;
+    char *slash = strchr(buffer, '/');
+    if (slash) {
+        *slash = '\0';
+        if (sweep_parse_number(slash + 1, &step) != 0 || step == 0) return -1;
+    }
+    // A leading '-' can not be a range separator
+    char *dash = strchr(buffer + 1, '-');
+    uint64_t start = 0, end = 0;
+    if (dash) {
+        *dash = '\0';
+        if (sweep_parse_number(buffer, &start) != 0 || sweep_parse_number(dash + 1, &end) != 0) return -1;
+    }
+    else {
+        if (sweep_parse_number(buffer, &start) != 0) return -1;
+        end = start;
+    }
+    if (end < start) return -1;
+    // End on the last value the step actually reaches
+    *rangeOut = (SweepRange){ start, start + (end - start) / step * step, step };
+    return 0;
+}
+
+static int sweep_term_parse_values(SweepTerm *term, char *values, uint64_t limit, uint64_t maxValue)
+{
+    for (char *saveptr = NULL, *item = strtok_r(values, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        SweepRange range;
+        if (sweep_parse_range(item, limit, &range) != 0) {
+            printf("Error: invalid value %s in %s!\n", item, term->name);
+            return -1;
+        }
+        if (range.end > maxValue) {
+            printf("Error: %s is out of range for %s!\n", item, term->name);
+            return -1;
+        }
+        SweepRange *ranges = realloc(term->ranges, (term->rangeCount + 1) * sizeof(SweepRange));
+        if (!ranges) return -1;
+        term->ranges = ranges;
+        term->ranges[term->rangeCount++] = range;
+        term->variantCount += (range.end - range.start) / range.step + 1;
+    }
+    if (term->mutation == SWEEP_MUTATION_BITFLIP) term->variantCount *= 8;
+    return term->variantCount ? 0 : -1;
+}
+
+static int sweep_term_parse_team_ids(Sweep *sweep, SweepTerm *term, char *values)
+{
+    if (sweep->codeDirectorySize < SWEEP_CD_TEAM_OFFSET_FIELD + 4 ||
+        sweep_read_be(sweep->codeDirectory + 8, 4) < SWEEP_CD_TEAM_MIN_VERSION) {
+        printf("Error: the code directory has no team ID field!\n");
+        return -1;
+    }
+    uint32_t teamOffset = (uint32_t)sweep_read_be(sweep->codeDirectory + SWEEP_CD_TEAM_OFFSET_FIELD, 4);
+    if (!teamOffset || teamOffset >= sweep->codeDirectorySize) {
+        printf("Error: the code directory has no team ID!\n");
+        return -1;
+    }
+    const uint8_t *team = sweep->codeDirectory + teamOffset;
+    const uint8_t *terminator = memchr(team, 0, sweep->codeDirectorySize - teamOffset);
+    if (!terminator) {
+        printf("Error: the team ID of the code directory is not terminated!\n");
+        return -1;
+    }
+    term->offset = teamOffset;
+    term->width = (uint8_t)(terminator - team > 255 ? 255 : terminator - team);
+
+    for (char *saveptr = NULL, *item = strtok_r(values, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        // Overwritten in place, every offset after the team ID stays valid
+        if (strlen(item) > term->width) {
+            printf("Error: team ID %s is longer than the original!\n", item);
+            return -1;
+        }
+        char **teamIds = realloc(term->teamIds, (term->variantCount + 1) * sizeof(char *));
+        if (!teamIds) return -1;
+        term->teamIds = teamIds;
+        term->teamIds[term->variantCount] = strdup(item);
+        if (!term->teamIds[term->variantCount]) return -1;
+        term->variantCount++;
+    }
+    return term->variantCount ? 0 : -1;
+}
+
+static int sweep_term_parse(Sweep *sweep, SweepTerm *term, char *text)
+{
+    char *equals = strchr(text, '=');
+    if (!equals) {
+        printf("Error: missing values in %s!\n", text);
+        return -1;
+    }
+    *equals = '\0';
+    char *values = equals + 1;
+    term->name = strdup(text);
+    if (!term->name) return -1;
+
+    char *mutation = NULL;
+    if (!strncmp(text, "cms.", 4)) {
+        term->target = SWEEP_TARGET_CMS;
+        mutation = text + 4;
+    }
+    else if (!strncmp(text, "cd.", 3)) {
+        term->target = SWEEP_TARGET_CD;
+        mutation = text + 3;
+    }
+    else {
+        printf("Error: unknown target in %s!\n", text);
+        return -1;
+    }
+    size_t size = term->target == SWEEP_TARGET_CMS ? sweep->cmsSize : sweep->codeDirectorySize;
+
+    if (!strcmp(mutation, "flip") || !strcmp(mutation, "bitflip")) {
+        term->mutation = mutation[0] == 'f' ? SWEEP_MUTATION_FLIP : SWEEP_MUTATION_BITFLIP;
+        return size ? sweep_term_parse_values(term, values, size, size - 1) : -1;
+    }
+    if (!strcmp(mutation, "truncate")) {
+        term->mutation = SWEEP_MUTATION_TRUNCATE;
+        return sweep_term_parse_values(term, values, size, size);
+    }
+    if (!strncmp(mutation, "byte@", 5)) {
+        uint64_t offset = 0;
+        if (sweep_parse_number(mutation + 5, &offset) != 0 || offset >= size) {
+            printf("Error: invalid offset in %s!\n", text);
+            return -1;
+        }
+        term->mutation = SWEEP_MUTATION_FIELD;
+        term->offset = (uint32_t)offset;
+        term->width = 1;
+        return sweep_term_parse_values(term, values, 256, 0xff);
+    }
+    if (term->target == SWEEP_TARGET_CD && !strcmp(mutation, "team")) {
+        term->mutation = SWEEP_MUTATION_TEAM_ID;
+        return sweep_term_parse_team_ids(sweep, term, values);
+    }
+    if (term->target == SWEEP_TARGET_CD) {
+        for (size_t i = 0; i < sizeof(gSweepFields) / sizeof(gSweepFields[0]); i++) {
+            const SweepField *field = &gSweepFields[i];
+            if (strcmp(mutation, field->name)) continue;
+            if (field->offset + field->width > size ||
+                (field->minVersion && sweep_read_be(sweep->codeDirectory + 8, 4) < field->minVersion)) {
+                printf("Error: the code directory has no %s field!\n", field->name);
+                return -1;
+            }
+            term->mutation = SWEEP_MUTATION_FIELD;
+            term->offset = field->offset;
+            term->width = field->width;
+            uint64_t maxValue = field->width == 8 ? UINT64_MAX : (1ULL << (8 * field->width)) - 1;
+            return sweep_term_parse_values(term, values, 0, maxValue);
+        }
+    }
+    printf("Error: unknown mutation %s!\n", text);
+    return -1;
+}
+
+static void sweep_term_free(SweepTerm *term)
+{
+    free(term->name);
+    free(term->ranges);
+    if (term->teamIds) {
+        for (uint64_t i = 0; i < term->variantCount; i++) {
+            free(term->teamIds[i]);
+        }
+        free(term->teamIds);
+    }
+}
+
+int sweep_add_spec(Sweep *sweep, const char *spec)
+{
+    char *copy = strdup(spec);
+    if (!copy) return -1;
+    int r = 0;
+    for (char *saveptr = NULL, *text = strtok_r(copy, ";", &saveptr); text; text = strtok_r(NULL, ";", &saveptr)) {
+        SweepTerm term = { 0 };
+        if (sweep_term_parse(sweep, &term, text) != 0) {
+            sweep_term_free(&term);
+            r = -1;
+            break;
+        }
+        SweepTerm *terms = realloc(sweep->terms, (sweep->termCount + 1) * sizeof(SweepTerm));
+        if (!terms) {
+            sweep_term_free(&term);
+            r = -1;
+            break;
+        }
+        term.firstVariant = sweep->variantCount;
+        sweep->terms = terms;
+        sweep->terms[sweep->termCount++] = term;
+        sweep->variantCount += term.variantCount;
+    }
+    free(copy);
+    return r;
+}
+
+static uint64_t sweep_term_get_value(const SweepTerm *term, uint64_t index)
+{
+    for (unsigned i = 0; i < term->rangeCount; i++) {
+        const SweepRange *range = &term->ranges[i];
+        uint64_t count = (range->end - range->start) / range->step + 1;
+        if (index < count) return range->start + index * range->step;
+        index -= count;
+    }
+    return 0;
+}
+
+static const SweepTerm *sweep_find_term(const Sweep *sweep, uint64_t variant)
+{
+    unsigned low = 0, high = sweep->termCount - 1;
+    while (low < high) {
+        unsigned middle = (low + high + 1) / 2;
+        if (sweep->terms[middle].firstVariant <= variant) low = middle;
+        else high = middle - 1;
+    }
+    return &sweep->terms[low];
+}
+
+static int sweep_evaluate(const uint8_t *cms, size_t cmsSize, const uint8_t *codeDirectory, size_t codeDirectorySize,
+                          CT_int *resultOut, CoreTrustPolicyFlags *policyFlagsOut)
+{
+    const CT_uint8_t *leafCert = NULL;
+    CT_size_t leafCertLen = 0;
+    CoreTrustDigestType cmsDigestType = 0;
+    CoreTrustDigestType hashAgilityDigestType = 0;
+    const CT_uint8_t *digestData = NULL;
+    CT_size_t digestLen = 0;
+    *policyFlagsOut = 0;
+    return evaluator_evaluate_amfi_cms(cms, cmsSize, codeDirectory, codeDirectorySize, false,
+                                       &leafCert, &leafCertLen, policyFlagsOut, &cmsDigestType,
+                                       &hashAgilityDigestType, &digestData, &digestLen, resultOut);
+}
+
+static void sweep_worker_run_variant(SweepWorker *worker, uint64_t variant)
+{
+    Sweep *sweep = worker->sweep;
+    const SweepTerm *term = sweep_find_term(sweep, variant);
+    uint64_t index = variant - term->firstVariant;
+
+    bool isCMS = term->target == SWEEP_TARGET_CMS;
+    uint8_t *buffer = isCMS ? worker->cms : worker->codeDirectory;
+    const uint8_t *base = isCMS ? sweep->cms : sweep->codeDirectory;
+    size_t cmsSize = sweep->cmsSize;
+    size_t codeDirectorySize = sweep->codeDirectorySize;
+
+    uint64_t value = 0;
+    uint32_t offset = term->offset;
+    uint8_t width = 1;
+    switch (term->mutation) {
+        case SWEEP_MUTATION_FIELD:
+            value = sweep_term_get_value(term, index);
+            width = term->width;
+            sweep_write_be(buffer + offset, width, value);
+            break;
+        case SWEEP_MUTATION_TEAM_ID:
+            width = term->width;
+            memset(buffer + offset, 0, width);
+            memcpy(buffer + offset, term->teamIds[index], strlen(term->teamIds[index]));
+            break;
+        case SWEEP_MUTATION_FLIP:
+            value = sweep_term_get_value(term, index);
+            offset = (uint32_t)value;
+            buffer[offset] ^= 0xff;
+            break;
+        case SWEEP_MUTATION_BITFLIP:
+            value = sweep_term_get_value(term, index / 8);
+            offset = (uint32_t)value;
+            buffer[offset] ^= (uint8_t)(1 << (index % 8));
+            break;
+        case SWEEP_MUTATION_TRUNCATE:
+            value = sweep_term_get_value(term, index);
+            if (isCMS) cmsSize = value;
+            else codeDirectorySize = value;
+            width = 0;
+            break;
+    }
+
+    CT_int result = 0;
+    CoreTrustPolicyFlags policyFlags = 0;
+    sweep_evaluate(worker->cms, cmsSize, worker->codeDirectory, codeDirectorySize, &result, &policyFlags);
+    // Restore the base for the next variant
+    if (width) memcpy(buffer + offset, base + offset, width);
+
+    outcome_table_add(&worker->outcomes, result, policyFlags, 1);
+    bool changed = result != sweep->baseResult || policyFlags != sweep->basePolicyFlags;
+    if (changed) worker->changedCount++;
+    if (sweep->changedOnly && !changed) return;
+
+    if (term->mutation == SWEEP_MUTATION_TEAM_ID) {
+        outcome_buffer_printf(&worker->output, "%llu\t%s\t%.255s\t0x%x\t0x%llx\n", (unsigned long long)variant, term->name,
+                              term->teamIds[index], (unsigned)result, (unsigned long long)policyFlags);
+    }
+    else if (term->mutation == SWEEP_MUTATION_BITFLIP) {
+        outcome_buffer_printf(&worker->output, "%llu\t%s\t0x%llx.%u\t0x%x\t0x%llx\n", (unsigned long long)variant, term->name,
+                              (unsigned long long)value, (unsigned)(index % 8), (unsigned)result, (unsigned long long)policyFlags);
+    }
+    else {
+        outcome_buffer_printf(&worker->output, "%llu\t%s\t0x%llx\t0x%x\t0x%llx\n", (unsigned long long)variant, term->name,
+                              (unsigned long long)value, (unsigned)result, (unsigned long long)policyFlags);
+    }
+}
+
+static void *sweep_worker(void *context)
+{
+    SweepWorker *worker = context;
+    Sweep *sweep = worker->sweep;
+    while (true) {
+        uint64_t first = atomic_fetch_add_explicit(&sweep->nextVariant, SWEEP_CHUNK_SIZE, memory_order_relaxed);
+        if (first >= sweep->variantCount) break;
+        uint64_t last = first + SWEEP_CHUNK_SIZE < sweep->variantCount ? first + SWEEP_CHUNK_SIZE : sweep->variantCount;
+        for (uint64_t variant = first; variant < last; variant++) {
+            sweep_worker_run_variant(worker, variant);
+        }
+    }
+    outcome_buffer_flush(&worker->output);
+    return NULL;
+}
+
+int sweep_run(Sweep *sweep, FILE *output)
+{
+    if (!sweep->variantCount) {
+        printf("Error: no mutations to sweep!\n");
+        return -1;
+    }
+    if (sweep_evaluate(sweep->cms, sweep->cmsSize, sweep->codeDirectory, sweep->codeDirectorySize,
+                       &sweep->baseResult, &sweep->basePolicyFlags) != 0) {
+        printf("Error: CoreTrust evaluator is not available!\n");
+        return -1;
+    }
+    sweep->output = output;
+    fprintf(output, "base\t-\t-\t0x%x\t0x%llx\n", (unsigned)sweep->baseResult, (unsigned long long)sweep->basePolicyFlags);
+
+    uint64_t start = clock_now_ns();
+    unsigned threadCount = sweep->threadCount;
+    if (threadCount > sweep->variantCount) threadCount = (unsigned)sweep->variantCount;
+    SweepWorker *workers = calloc(threadCount, sizeof(SweepWorker));
+    pthread_t *threads = calloc(threadCount, sizeof(pthread_t));
+    int r = workers && threads ? 0 : -1;
+    unsigned prepared = 0;
+    for (; r == 0 && prepared < threadCount; prepared++) {
+        SweepWorker *worker = &workers[prepared];
+        worker->sweep = sweep;
+        worker->cms = malloc(sweep->cmsSize ? sweep->cmsSize : 1);
+        worker->codeDirectory = malloc(sweep->codeDirectorySize ? sweep->codeDirectorySize : 1);
+        if (!worker->cms || !worker->codeDirectory || outcome_buffer_init(&worker->output, output, &sweep->lock) != 0) {
+            prepared++;
+            r = -1;
+            break;
+        }
+        memcpy(worker->cms, sweep->cms, sweep->cmsSize);
+        memcpy(worker->codeDirectory, sweep->codeDirectory, sweep->codeDirectorySize);
+    }
+
+    if (r == 0) {
+        unsigned started = 0;
+        for (; started < threadCount; started++) {
+            if (pthread_create(&threads[started], NULL, sweep_worker, &workers[started]) != 0) break;
+        }
+        if (started == 0) {
+            sweep_worker(&workers[0]);
+        }
+        for (unsigned i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        for (unsigned i = 0; i < threadCount; i++) {
+            outcome_table_merge(&sweep->outcomes, &workers[i].outcomes);
+            sweep->changedCount += workers[i].changedCount;
+        }
+    }
+    sweep->nanos = clock_now_ns() - start;
+
+    for (unsigned i = 0; i < prepared; i++) {
+        free(workers[i].cms);
+        free(workers[i].codeDirectory);
+        outcome_buffer_free(&workers[i].output);
+    }
+    free(workers);
+    free(threads);
+    fflush(output);
+    return r;
+}
+
+void sweep_print_stats(Sweep *sweep, FILE *output)
+{
+    double seconds = sweep->nanos / 1e9;
+    fprintf(output, "sweep: %llu variants in %u terms, %.3f s (%.0f variants/s on %u threads), %llu changed the outcome\n",
+            (unsigned long long)sweep->variantCount, sweep->termCount, seconds,
+            seconds > 0 ? sweep->variantCount / seconds : 0, sweep->threadCount, (unsigned long long)sweep->changedCount);
+    outcome_table_print(&sweep->outcomes, output);
+}
+
+void sweep_free(Sweep *sweep)
+{
+    for (unsigned i = 0; i < sweep->termCount; i++) {
+        sweep_term_free(&sweep->terms[i]);
+    }
+    free(sweep->terms);
+    free(sweep->cms);
+    free(sweep->codeDirectory);
+    pthread_mutex_destroy(&sweep->lock);
+    free(sweep);
+}
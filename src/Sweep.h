@@ -0,0 +1,96 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "CoreTrust.h"
+#include "Outcome.h"
+
+// Mutation sweep: evaluates variants of a base (CMS, code directory) pair, each variant applies a single
+// mutation to the base so the result can be attributed to it
+//
+// A spec is a ';' separated list of terms, <target>.<mutation>=<values>
+//   cd.<field>=<values>        flags, version, hashSize, hashType, platform, pageSize or execSegFlags
+//   cd.team=<id>[,<id>...]     team ID, overwritten in place (no longer than the original)
+//   <target>.byte@<offset>=<values>  where target is cms or cd
+//   <target>.flip=<positions>        xor one byte with 0xff
+//   <target>.bitflip=<positions>     flip every bit of the byte, 8 variants per position
+//   <target>.truncate=<lengths>
+// Values are comma separated numbers or ranges (a-b or a-b/step), * is every position of the buffer
+
+#define SWEEP_CHUNK_SIZE 64
+
+typedef enum {
+    SWEEP_TARGET_CMS = 0,
+    SWEEP_TARGET_CD,
+} SweepTarget;
+
+typedef enum {
+    SWEEP_MUTATION_FIELD = 0, // big endian field of the code directory, also byte@
+    SWEEP_MUTATION_TEAM_ID,
+    SWEEP_MUTATION_FLIP,
+    SWEEP_MUTATION_BITFLIP,
+    SWEEP_MUTATION_TRUNCATE,
+} SweepMutation;
+
+typedef struct SweepRange {
+    uint64_t start;
+    uint64_t end; // inclusive
+    uint64_t step;
+} SweepRange;
+
+typedef struct SweepTerm {
+    char *name; // as written in the spec, printed with every variant
+    SweepTarget target;
+    SweepMutation mutation;
+    uint32_t offset;
+    uint8_t width;
+    SweepRange *ranges;
+    unsigned rangeCount;
+    char **teamIds;
+    uint64_t variantCount;
+    uint64_t firstVariant; // index of the term's first variant in the whole sweep
+} SweepTerm;
+
+typedef struct Sweep {
+    uint8_t *cms;
+    size_t cmsSize;
+    uint8_t *codeDirectory;
+    size_t codeDirectorySize;
+    unsigned threadCount;
+    bool changedOnly; // only print variants whose outcome differs from the base
+
+    SweepTerm *terms;
+    unsigned termCount;
+    uint64_t variantCount;
+    atomic_uint_fast64_t nextVariant;
+
+    CT_int baseResult;
+    CoreTrustPolicyFlags basePolicyFlags;
+
+    pthread_mutex_t lock; // output and merged outcomes
+    FILE *output;
+    OutcomeTable outcomes;
+    uint64_t changedCount;
+    uint64_t nanos;
+} Sweep;
+
+// The base buffers are copied
+Sweep *sweep_init(const uint8_t *cms, size_t cmsSize, const uint8_t *codeDirectory, size_t codeDirectorySize, unsigned threadCount);
+
+// Parse and append the terms of a spec, -1 on a malformed spec or out of range values
+int sweep_add_spec(Sweep *sweep, const char *spec);
+
+// Evaluate the base and then every variant, printing one tab separated line per variant:
+// index, term, value, CoreTrust result, policy flags
+int sweep_run(Sweep *sweep, FILE *output);
+
+void sweep_print_stats(Sweep *sweep, FILE *output);
+
+void sweep_free(Sweep *sweep);
+
+#endif // SWEEP_H
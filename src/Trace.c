@@ -0,0 +1,199 @@
+#include "Trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct TraceEvent {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+    uint64_t id;
+    char *detail;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;
+    unsigned tid;
+    const char *threadName;
+    TraceEvent *events;
+    size_t capacity;
+    uint64_t written; // total ever recorded, events[written % capacity] is the next slot
+} TraceBuffer;
+
+_Atomic bool gTraceEnabled = false;
+
+static pthread_mutex_t gTraceLock = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer *gTraceBuffers = NULL;
+static char *gTracePath = NULL;
+static size_t gTraceEventsPerThread = 0;
+static uint64_t gTraceStartTime = 0;
+static unsigned gTraceNextTid = 1;
+// Bumped on every start so buffers from an earlier session are never reused
+static _Atomic uint64_t gTraceGeneration = 0;
+
+static __thread TraceBuffer *tTraceBuffer = NULL;
+static __thread uint64_t tTraceGeneration = 0;
+
+static TraceBuffer *trace_get_thread_buffer(void)
+{
+    uint64_t generation = atomic_load_explicit(&gTraceGeneration, memory_order_acquire);
+    if (tTraceBuffer && tTraceGeneration == generation) return tTraceBuffer;
+
+    TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+    if (!buffer) return NULL;
+    pthread_mutex_lock(&gTraceLock);
+    buffer->capacity = gTraceEventsPerThread;
+    buffer->events = calloc(buffer->capacity, sizeof(TraceEvent));
+    if (!buffer->events) {
+        pthread_mutex_unlock(&gTraceLock);
+        free(buffer);
+        return NULL;
+    }
+    buffer->tid = gTraceNextTid++;
+    buffer->next = gTraceBuffers;
+    gTraceBuffers = buffer;
+    pthread_mutex_unlock(&gTraceLock);
+
+    tTraceBuffer = buffer;
+    tTraceGeneration = generation;
+    return buffer;
+}
+
+int trace_start(const char *path, size_t eventsPerThread)
+{
+    pthread_mutex_lock(&gTraceLock);
+    if (gTracePath) {
+        pthread_mutex_unlock(&gTraceLock);
+        return -1;
+    }
+    gTracePath = strdup(path);
+    if (!gTracePath) {
+        pthread_mutex_unlock(&gTraceLock);
+        return -1;
+    }
+    gTraceEventsPerThread = eventsPerThread ? eventsPerThread : TRACE_DEFAULT_EVENTS_PER_THREAD;
+    gTraceStartTime = clock_now_ns();
+    gTraceNextTid = 1;
+    atomic_fetch_add_explicit(&gTraceGeneration, 1, memory_order_release);
+    atomic_store_explicit(&gTraceEnabled, true, memory_order_release);
+    pthread_mutex_unlock(&gTraceLock);
+    return 0;
+}
+
+void trace_set_thread_name(const char *name)
+{
+    if (!trace_is_enabled()) return;
+    TraceBuffer *buffer = trace_get_thread_buffer();
+    if (buffer) buffer->threadName = name;
+}
+
+void trace_record(const char *name, uint64_t start, uint64_t end, uint64_t id, const char *detail)
+{
+    if (!trace_is_enabled()) return;
+    TraceBuffer *buffer = trace_get_thread_buffer();
+    if (!buffer) return;
+
+    TraceEvent *event = &buffer->events[buffer->written % buffer->capacity];
+    free(event->detail);
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    event->id = id;
+    event->detail = detail ? strdup(detail) : NULL;
+    buffer->written++;
+}
+
+static void trace_write_json_string(FILE *f, const char *string)
+{
+    fputc('"', f);
+    for (const unsigned char *c = (const unsigned char *)string; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', f);
+            fputc(*c, f);
+        }
+        else if (*c < 0x20) {
+            fprintf(f, "\\u%04x", *c);
+        }
+        else {
+            fputc(*c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static double trace_timestamp(uint64_t nanos)
+{
+    return nanos >= gTraceStartTime ? (double)(nanos - gTraceStartTime) / 1000.0 : 0.0;
+}
+
+int trace_stop(void)
+{
+    pthread_mutex_lock(&gTraceLock);
+    if (!gTracePath) {
+        pthread_mutex_unlock(&gTraceLock);
+        return -1;
+    }
+    // Writers are expected to be joined already, disabling first keeps late spans out of the buffers
+    atomic_store_explicit(&gTraceEnabled, false, memory_order_release);
+
+    FILE *f = fopen(gTracePath, "w");
+    if (!f) {
+        printf("Error: failed to open %s for writing!\n", gTracePath);
+    }
+
+    uint64_t dropped = 0;
+    bool first = true;
+    if (f) fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    TraceBuffer *buffer = gTraceBuffers;
+    while (buffer) {
+        uint64_t count = buffer->written < buffer->capacity ? buffer->written : buffer->capacity;
+        dropped += buffer->written - count;
+        if (f && buffer->threadName) {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", buffer->tid);
+            trace_write_json_string(f, buffer->threadName);
+            fprintf(f, "}}");
+            first = false;
+        }
+        for (uint64_t i = buffer->written - count; i < buffer->written; i++) {
+            TraceEvent *event = &buffer->events[i % buffer->capacity];
+            if (f) {
+                fprintf(f, "%s{\"name\":", first ? "" : ",\n");
+                trace_write_json_string(f, event->name);
+                fprintf(f, ",\"cat\":\"scan\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"id\":%llu",
+                        buffer->tid, trace_timestamp(event->start), (double)(event->end - event->start) / 1000.0, (unsigned long long)event->id);
+                if (event->detail) {
+                    fprintf(f, ",\"path\":");
+                    trace_write_json_string(f, event->detail);
+                }
+                fprintf(f, "}}");
+                first = false;
+            }
+        }
+        for (size_t i = 0; i < buffer->capacity; i++) {
+            free(buffer->events[i].detail);
+        }
+        TraceBuffer *next = buffer->next;
+        free(buffer->events);
+        free(buffer);
+        buffer = next;
+    }
+
+    int r = 0;
+    if (f) {
+        fprintf(f, "\n],\"otherData\":{\"droppedEvents\":%llu}}\n", (unsigned long long)dropped);
+        if (fclose(f) != 0) r = -1;
+    }
+    else {
+        r = -1;
+    }
+    if (dropped) {
+        fprintf(stderr, "Warning: %llu trace events were overwritten, only the most recent spans of each thread were kept\n", (unsigned long long)dropped);
+    }
+
+    gTraceBuffers = NULL;
+    free(gTracePath);
+    gTracePath = NULL;
+    pthread_mutex_unlock(&gTraceLock);
+    return r;
+}
@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "Clock.h"
+
+// Span tracing written out as Chrome trace-event JSON (loads in Perfetto / chrome://tracing)
+// Every thread records into its own ring buffer, nothing is shared on the hot path
+// While tracing is off a span costs one relaxed load and a predictable branch,
+// building with -DTRACE_DISABLED removes the spans altogether
+
+#define TRACE_DEFAULT_EVENTS_PER_THREAD (64 * 1024)
+
+extern _Atomic bool gTraceEnabled;
+
+static inline bool trace_is_enabled(void)
+{
+    return atomic_load_explicit(&gTraceEnabled, memory_order_relaxed);
+}
+
+// Start recording, the file is written by trace_stop
+// Once a thread's ring is full its oldest spans are overwritten
+int trace_start(const char *path, size_t eventsPerThread);
+// Stop recording and write out every thread's spans, returns -1 if the file could not be written
+int trace_stop(void);
+
+// Name the calling thread in the trace (e.g. its pipeline stage)
+void trace_set_thread_name(const char *name);
+
+// name must be a string literal (or otherwise outlive the trace), detail is copied
+void trace_record(const char *name, uint64_t start, uint64_t end, uint64_t id, const char *detail);
+
+#if defined(TRACE_DISABLED)
+#define TRACE_SPAN_BEGIN(span) const uint64_t span = 0; (void)span
+#define TRACE_SPAN_END(span, name, id) do { } while (0)
+#else
+#define TRACE_SPAN_BEGIN(span) uint64_t span = trace_is_enabled() ? clock_now_ns() : 0
+#define TRACE_SPAN_END(span, name, id) do { \
+    if (__builtin_expect(span != 0, 0)) trace_record(name, span, clock_now_ns(), id, NULL); \
+} while (0)
+#endif
+
+#endif // TRACE_H
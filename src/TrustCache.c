@@ -0,0 +1,302 @@
+#include "TrustCache.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint32_t gTrustCacheEntryStrides[] = { 20, 22, 24 };
+
+static inline uint64_t trust_cache_load_be64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t trust_cache_load_be32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint32_t trust_cache_load_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// A cdhash as three big endian words, so lexicographic order is integer order
+typedef struct TrustCacheKey {
+    uint64_t hi;
+    uint64_t mid;
+    uint32_t lo;
+} TrustCacheKey;
+
+static inline TrustCacheKey trust_cache_key_load(const uint8_t *cdhash)
+{
+    TrustCacheKey key = {
+        trust_cache_load_be64(cdhash),
+        trust_cache_load_be64(cdhash + 8),
+        trust_cache_load_be32(cdhash + 16),
+    };
+    return key;
+}
+
+// entry <= key, evaluated without branches so the search loop compiles to conditional moves
+static inline bool trust_cache_entry_le(const uint8_t *entry, const TrustCacheKey *key)
+{
+    TrustCacheKey e = trust_cache_key_load(entry);
+    return (e.hi < key->hi) | ((e.hi == key->hi) & ((e.mid < key->mid) | ((e.mid == key->mid) & (e.lo <= key->lo))));
+}
+
+bool trust_cache_contains(const TrustCache *cache, const uint8_t *cdhash)
+{
+    uint64_t n = cache->entryCount;
+    if (n == 0) return false;
+
+    size_t stride = cache->entryStride;
+    TrustCacheKey key = trust_cache_key_load(cdhash);
+    const uint8_t *base = cache->entries;
+    while (n > 1) {
+        uint64_t half = n / 2;
+        // Both possible midpoints of the next step
+        __builtin_prefetch(base + (half / 2) * stride);
+        __builtin_prefetch(base + (half + half / 2) * stride);
+        const uint8_t *mid = base + half * stride;
+        base = trust_cache_entry_le(mid, &key) ? mid : base;
+        n -= half;
+    }
+    return memcmp(base, cdhash, TRUST_CACHE_CDHASH_LEN) == 0;
+}
+
+static int trust_cache_compare_cdhash(const void *a, const void *b)
+{
+    return memcmp(a, b, TRUST_CACHE_CDHASH_LEN);
+}
+
+static bool trust_cache_is_sorted(const TrustCache *cache)
+{
+    for (uint64_t i = 1; i < cache->entryCount; i++) {
+        const uint8_t *entry = cache->entries + i * cache->entryStride;
+        if (memcmp(entry - cache->entryStride, entry, TRUST_CACHE_CDHASH_LEN) > 0) return false;
+    }
+    return true;
+}
+
+// Unsorted lists (e.g. concatenated raw cdhashes) are copied out and sorted once
+static int trust_cache_sort(TrustCache *cache)
+{
+    cache->sortedCopy = malloc(cache->entryCount * TRUST_CACHE_CDHASH_LEN);
+    if (!cache->sortedCopy) return -1;
+    for (uint64_t i = 0; i < cache->entryCount; i++) {
+        memcpy(cache->sortedCopy + i * TRUST_CACHE_CDHASH_LEN, cache->entries + i * cache->entryStride, TRUST_CACHE_CDHASH_LEN);
+    }
+    qsort(cache->sortedCopy, cache->entryCount, TRUST_CACHE_CDHASH_LEN, trust_cache_compare_cdhash);
+    cache->entries = cache->sortedCopy;
+    cache->entryStride = TRUST_CACHE_CDHASH_LEN;
+    return 0;
+}
+
+static void trust_cache_free(TrustCache *cache)
+{
+    if (!cache) return;
+    if (cache->mapping) munmap(cache->mapping, cache->mappingSize);
+    free(cache->sortedCopy);
+    free(cache->path);
+    free(cache);
+}
+
+static TrustCache *trust_cache_init_from_path(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: failed to open %s!\n", path);
+        return NULL;
+    }
+    struct stat s;
+    if (fstat(fd, &s) != 0 || s.st_size == 0) {
+        printf("Error: %s is not a trust cache!\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("Error: failed to map %s!\n", path);
+        return NULL;
+    }
+    // Every entry is visited by the sort check anyway
+    madvise(mapping, s.st_size, MADV_WILLNEED);
+
+    TrustCache *cache = calloc(1, sizeof(TrustCache));
+    if (!cache) {
+        munmap(mapping, s.st_size);
+        return NULL;
+    }
+    cache->mapping = mapping;
+    cache->mappingSize = s.st_size;
+    cache->path = strdup(path);
+    if (!cache->path) {
+        trust_cache_free(cache);
+        return NULL;
+    }
+
+    // Prefer the header interpretation, a raw list only matches if no header size works out
+    uint64_t size = s.st_size;
+    if (size >= sizeof(TrustCacheHeader)) {
+        uint32_t version = trust_cache_load_le32(cache->mapping);
+        uint64_t entryCount = trust_cache_load_le32(cache->mapping + offsetof(TrustCacheHeader, entryCount));
+        if (version < sizeof(gTrustCacheEntryStrides) / sizeof(gTrustCacheEntryStrides[0]) &&
+            sizeof(TrustCacheHeader) + entryCount * gTrustCacheEntryStrides[version] == size) {
+            cache->version = (int)version;
+            cache->entryStride = gTrustCacheEntryStrides[version];
+            cache->entryCount = entryCount;
+            cache->entries = cache->mapping + sizeof(TrustCacheHeader);
+        }
+    }
+    if (!cache->entries) {
+        if (size % TRUST_CACHE_CDHASH_LEN != 0) {
+            printf("Error: %s is not a trust cache (image4 wrapped trust caches need to be unwrapped first)!\n", path);
+            trust_cache_free(cache);
+            return NULL;
+        }
+        cache->version = -1;
+        cache->entryStride = TRUST_CACHE_CDHASH_LEN;
+        cache->entryCount = size / TRUST_CACHE_CDHASH_LEN;
+        cache->entries = cache->mapping;
+    }
+
+    if (!trust_cache_is_sorted(cache) && trust_cache_sort(cache) != 0) {
+        trust_cache_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+TrustCacheSet *trust_cache_set_init(void)
+{
+    return calloc(1, sizeof(TrustCacheSet));
+}
+
+static void trust_cache_bloom_reset(TrustCacheBloom *bloom)
+{
+    free(bloom->blocks);
+    bloom->blocks = NULL;
+    bloom->blockCount = 0;
+}
+
+int trust_cache_set_add_file(TrustCacheSet *set, const char *path)
+{
+    TrustCache *cache = trust_cache_init_from_path(path);
+    if (!cache) return -1;
+    TrustCache **caches = realloc(set->caches, (set->count + 1) * sizeof(TrustCache *));
+    if (!caches) {
+        trust_cache_free(cache);
+        return -1;
+    }
+    set->caches = caches;
+    set->caches[set->count++] = cache;
+    trust_cache_bloom_reset(&set->bloom);
+    return 0;
+}
+
+uint64_t trust_cache_set_get_entry_count(const TrustCacheSet *set)
+{
+    uint64_t count = 0;
+    for (unsigned i = 0; i < set->count; i++) {
+        count += set->caches[i]->entryCount;
+    }
+    return count;
+}
+
+// cdhashes are truncated SHA digests, their bytes are used as the hash directly:
+// bytes 0-7 select the block, bytes 8-13 one bit in each of the block's eight words
+static inline const uint64_t *trust_cache_bloom_block(const TrustCacheBloom *bloom, const uint8_t *cdhash, uint64_t *bitsOut)
+{
+    uint64_t h1, h2;
+    memcpy(&h1, cdhash, sizeof(h1));
+    memcpy(&h2, cdhash + 8, sizeof(h2));
+    *bitsOut = h2;
+    uint64_t index = ((h1 >> 32) * bloom->blockCount) >> 32;
+    return bloom->blocks + index * TRUST_CACHE_BLOOM_BLOCK_WORDS;
+}
+
+static inline bool trust_cache_bloom_may_contain(const TrustCacheBloom *bloom, const uint8_t *cdhash)
+{
+    uint64_t bits;
+    const uint64_t *block = trust_cache_bloom_block(bloom, cdhash, &bits);
+    uint64_t missing = 0;
+    for (int i = 0; i < TRUST_CACHE_BLOOM_BLOCK_WORDS; i++) {
+        missing |= ~block[i] & (1ULL << ((bits >> (i * 6)) & 63));
+    }
+    return missing == 0;
+}
+
+int trust_cache_set_build_filter(TrustCacheSet *set, unsigned bitsPerEntry)
+{
+    trust_cache_bloom_reset(&set->bloom);
+    uint64_t entryCount = trust_cache_set_get_entry_count(set);
+    if (entryCount == 0 || bitsPerEntry == 0) return 0;
+
+    uint64_t blockBits = TRUST_CACHE_BLOOM_BLOCK_WORDS * 64;
+    uint64_t blockCount = (entryCount * bitsPerEntry + blockBits - 1) / blockBits;
+    if (blockCount > UINT32_MAX) {
+        printf("Error: trust cache filter too large!\n");
+        return -1;
+    }
+    uint64_t *blocks = NULL;
+    if (posix_memalign((void **)&blocks, 64, blockCount * TRUST_CACHE_BLOOM_BLOCK_WORDS * sizeof(uint64_t)) != 0) {
+        return -1;
+    }
+    memset(blocks, 0, blockCount * TRUST_CACHE_BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    set->bloom.blocks = blocks;
+    set->bloom.blockCount = blockCount;
+
+    for (unsigned c = 0; c < set->count; c++) {
+        const TrustCache *cache = set->caches[c];
+        for (uint64_t i = 0; i < cache->entryCount; i++) {
+            const uint8_t *cdhash = cache->entries + i * cache->entryStride;
+            uint64_t bits;
+            uint64_t *block = (uint64_t *)trust_cache_bloom_block(&set->bloom, cdhash, &bits);
+            for (int w = 0; w < TRUST_CACHE_BLOOM_BLOCK_WORDS; w++) {
+                block[w] |= 1ULL << ((bits >> (w * 6)) & 63);
+            }
+        }
+    }
+    return 0;
+}
+
+int trust_cache_set_lookup(const TrustCacheSet *set, const uint8_t *cdhash)
+{
+    if (set->bloom.blockCount && !trust_cache_bloom_may_contain(&set->bloom, cdhash)) return -1;
+    for (unsigned i = 0; i < set->count; i++) {
+        if (trust_cache_contains(set->caches[i], cdhash)) return (int)i;
+    }
+    return -1;
+}
+
+const char *trust_cache_set_get_path(const TrustCacheSet *set, int index)
+{
+    if (index < 0 || (unsigned)index >= set->count) return NULL;
+    return set->caches[index]->path;
+}
+
+void trust_cache_set_free(TrustCacheSet *set)
+{
+    if (!set) return;
+    for (unsigned i = 0; i < set->count; i++) {
+        trust_cache_free(set->caches[i]);
+    }
+    free(set->caches);
+    trust_cache_bloom_reset(&set->bloom);
+    free(set);
+}
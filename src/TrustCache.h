@@ -0,0 +1,66 @@
+#ifndef TRUST_CACHE_H
+#define TRUST_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Static trust cache membership for computed cdhashes
+// Trust caches are mapped read-only and searched in place, an optional blocked Bloom filter
+// in front of all of them rejects most absent cdhashes with a single cache line read
+
+#define TRUST_CACHE_CDHASH_LEN 20
+#define TRUST_CACHE_DEFAULT_BLOOM_BITS 16 // bits per entry, ~0.1% false positives
+#define TRUST_CACHE_BLOOM_BLOCK_WORDS 8   // one 64 byte cache line per block
+
+// Payload layout of an (unwrapped) Apple trust cache, entries follow the header
+typedef struct TrustCacheHeader {
+    uint32_t version;
+    uint8_t uuid[16];
+    uint32_t entryCount;
+} TrustCacheHeader;
+
+typedef struct TrustCache {
+    char *path;
+    uint8_t *mapping;
+    size_t mappingSize;
+    const uint8_t *entries; // points into mapping, or into a sorted copy if the file was not sorted
+    uint8_t *sortedCopy;
+    uint64_t entryCount;
+    uint32_t entryStride; // 20 (v0 / raw), 22 (v1) or 24 (v2)
+    int version;          // -1 for a raw list of cdhashes without a header
+} TrustCache;
+
+typedef struct TrustCacheBloom {
+    uint64_t *blocks;
+    uint64_t blockCount;
+} TrustCacheBloom;
+
+typedef struct TrustCacheSet {
+    TrustCache **caches;
+    unsigned count;
+    TrustCacheBloom bloom; // blockCount is 0 when no filter was built
+} TrustCacheSet;
+
+TrustCacheSet *trust_cache_set_init(void);
+
+// Map a trust cache payload (v0, v1 or v2) or a raw list of 20 byte cdhashes
+// Invalidates a previously built filter
+int trust_cache_set_add_file(TrustCacheSet *set, const char *path);
+
+// Build the Bloom filter over the entries of all loaded trust caches
+int trust_cache_set_build_filter(TrustCacheSet *set, unsigned bitsPerEntry);
+
+uint64_t trust_cache_set_get_entry_count(const TrustCacheSet *set);
+
+// Index of the first trust cache containing cdhash, -1 if none does
+// Read-only, safe to call from any number of threads
+int trust_cache_set_lookup(const TrustCacheSet *set, const uint8_t *cdhash);
+bool trust_cache_contains(const TrustCache *cache, const uint8_t *cdhash);
+
+const char *trust_cache_set_get_path(const TrustCacheSet *set, int index);
+
+void trust_cache_set_free(TrustCacheSet *set);
+
+#endif // TRUST_CACHE_H
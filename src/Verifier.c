@@ -0,0 +1,326 @@
+#include "Verifier.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__APPLE__)
+#include <TargetConditionals.h>
+#endif
+
+#include <choma/Host.h>
+#include <choma/CSBlob.h>
+#include <choma/MachOByteOrder.h>
+
+#include "Evaluator.h"
+#include "CodeHash.h"
+
+static uint32_t verifier_read_big32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return BIG_TO_HOST(value);
+}
+
+static uint32_t verifier_read_little32(const uint8_t *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return LITTLE_TO_HOST(value);
+}
+
+static bool verifier_range_valid(uint64_t size, uint64_t offset, uint64_t length)
+{
+    return offset <= size && length <= size - offset;
+}
+
+VerifierError verifier_image_open_buffer(VerifierImage *image, const void *data, size_t size)
+{
+    if (!image || (!data && size)) return VERIFIER_ERROR_INVALID_ARGUMENT;
+    memset(image, 0, sizeof(*image));
+    image->data = data;
+    image->size = size;
+    if (size < sizeof(uint32_t)) return VERIFIER_ERROR_NOT_MACHO;
+
+    uint32_t magic = verifier_read_big32(image->data);
+    if (magic == FAT_MAGIC || magic == FAT_MAGIC_64) {
+        if (size < sizeof(struct fat_header)) return VERIFIER_ERROR_NOT_MACHO;
+        image->isFat = true;
+        uint32_t archCount = verifier_read_big32(image->data + offsetof(struct fat_header, nfat_arch));
+        size_t archSize = magic == FAT_MAGIC_64 ? sizeof(struct fat_arch_64) : sizeof(struct fat_arch);
+        if (archCount == 0 || archCount > VERIFIER_MAX_SLICES ||
+            !verifier_range_valid(size, sizeof(struct fat_header), archCount * archSize)) {
+            return VERIFIER_ERROR_NOT_MACHO;
+        }
+        for (uint32_t i = 0; i < archCount; i++) {
+            const uint8_t *arch = image->data + sizeof(struct fat_header) + i * archSize;
+            VerifierSlice slice;
+            slice.cputype = (cpu_type_t)verifier_read_big32(arch + offsetof(struct fat_arch, cputype));
+            slice.cpusubtype = (cpu_subtype_t)verifier_read_big32(arch + offsetof(struct fat_arch, cpusubtype));
+            if (magic == FAT_MAGIC_64) {
+                uint64_t offset, sliceSize;
+                memcpy(&offset, arch + offsetof(struct fat_arch_64, offset), sizeof(offset));
+                memcpy(&sliceSize, arch + offsetof(struct fat_arch_64, size), sizeof(sliceSize));
+                slice.offset = BIG_TO_HOST(offset);
+                slice.size = BIG_TO_HOST(sliceSize);
+            }
+            else {
+                slice.offset = verifier_read_big32(arch + offsetof(struct fat_arch, offset));
+                slice.size = verifier_read_big32(arch + offsetof(struct fat_arch, size));
+            }
+            // Slices pointing outside of the file can never be loaded
+            if (!verifier_range_valid(size, slice.offset, slice.size)) continue;
+            image->slices[image->sliceCount++] = slice;
+        }
+        return image->sliceCount ? VERIFIER_OK : VERIFIER_ERROR_NOT_MACHO;
+    }
+
+    magic = verifier_read_little32(image->data);
+    if ((magic != MH_MAGIC && magic != MH_MAGIC_64) || size < sizeof(struct mach_header)) return VERIFIER_ERROR_NOT_MACHO;
+    image->slices[0].cputype = (cpu_type_t)verifier_read_little32(image->data + offsetof(struct mach_header, cputype));
+    image->slices[0].cpusubtype = (cpu_subtype_t)verifier_read_little32(image->data + offsetof(struct mach_header, cpusubtype));
+    image->slices[0].offset = 0;
+    image->slices[0].size = size;
+    image->sliceCount = 1;
+    return VERIFIER_OK;
+}
+
+VerifierError verifier_image_open_fd(VerifierImage *image, int fd)
+{
+    if (!image) return VERIFIER_ERROR_INVALID_ARGUMENT;
+    memset(image, 0, sizeof(*image));
+    struct stat s;
+    if (fstat(fd, &s) != 0 || !S_ISREG(s.st_mode)) return VERIFIER_ERROR_OPEN_FAILED;
+    if (s.st_size == 0) return VERIFIER_ERROR_NOT_MACHO;
+    void *mapping = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) return VERIFIER_ERROR_OPEN_FAILED;
+
+    VerifierError error = verifier_image_open_buffer(image, mapping, s.st_size);
+    image->mapped = true;
+    if (error != VERIFIER_OK) verifier_image_close(image);
+    return error;
+}
+
+VerifierError verifier_image_open_path(VerifierImage *image, const char *path)
+{
+    if (!image || !path) return VERIFIER_ERROR_INVALID_ARGUMENT;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        memset(image, 0, sizeof(*image));
+        return VERIFIER_ERROR_OPEN_FAILED;
+    }
+    VerifierError error = verifier_image_open_fd(image, fd);
+    close(fd);
+    return error;
+}
+
+void verifier_image_close(VerifierImage *image)
+{
+    if (!image) return;
+    if (image->mapped && image->data) munmap((void *)image->data, image->size);
+    memset(image, 0, sizeof(*image));
+}
+
+const VerifierSlice *verifier_image_find_slice(const VerifierImage *image, cpu_type_t cputype, cpu_subtype_t cpusubtype)
+{
+    for (uint32_t i = 0; i < image->sliceCount; i++) {
+        if (image->slices[i].cputype == cputype && image->slices[i].cpusubtype == cpusubtype) return &image->slices[i];
+    }
+    return NULL;
+}
+
+const VerifierSlice *verifier_image_find_preferred_slice(const VerifierImage *image)
+{
+    // Same order as lazy_fat_find_preferred_slice and scan_find_preferred_slice
+    const VerifierSlice *slice = NULL;
+    cpu_type_t cputype;
+    cpu_subtype_t cpusubtype;
+    if (host_get_cpu_information(&cputype, &cpusubtype) == 0 && cputype == CPU_TYPE_ARM64) {
+        if (cpusubtype == CPU_SUBTYPE_ARM64E) {
+            slice = verifier_image_find_slice(image, cputype, CPU_SUBTYPE_ARM64E | CPU_SUBTYPE_ARM64E_ABI_V2);
+            if (!slice) slice = verifier_image_find_slice(image, cputype, CPU_SUBTYPE_ARM64E);
+        }
+        if (!slice) slice = verifier_image_find_slice(image, cputype, CPU_SUBTYPE_ARM64_V8);
+        if (!slice) slice = verifier_image_find_slice(image, cputype, CPU_SUBTYPE_ARM64_ALL);
+    }
+#if TARGET_OS_MAC && !TARGET_OS_IPHONE
+    if (!slice) slice = verifier_image_find_slice(image, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64_V8);
+    if (!slice) slice = verifier_image_find_slice(image, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64_ALL);
+    if (!slice) slice = verifier_image_find_slice(image, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64E | CPU_SUBTYPE_ARM64E_ABI_V2);
+    if (!slice) slice = verifier_image_find_slice(image, CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64E);
+#endif // TARGET_OS_MAC && !TARGET_OS_IPHONE
+    return slice;
+}
+
+// Bounds of the superblob inside the slice, from LC_CODE_SIGNATURE
+static VerifierError verifier_find_code_signature(const uint8_t *slice, uint64_t sliceSize, uint32_t *offsetOut, uint32_t *sizeOut)
+{
+    uint32_t magic = verifier_read_little32(slice);
+    uint64_t headerSize = magic == MH_MAGIC_64 ? sizeof(struct mach_header_64) : sizeof(struct mach_header);
+    uint32_t ncmds = verifier_read_little32(slice + offsetof(struct mach_header, ncmds));
+    uint32_t sizeofcmds = verifier_read_little32(slice + offsetof(struct mach_header, sizeofcmds));
+    if (!verifier_range_valid(sliceSize, headerSize, sizeofcmds)) return VERIFIER_ERROR_NOT_MACHO;
+
+    const uint8_t *commands = slice + headerSize;
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < ncmds && offset + sizeof(struct load_command) <= sizeofcmds; i++) {
+        uint32_t cmd = verifier_read_little32(commands + offset + offsetof(struct load_command, cmd));
+        uint32_t cmdsize = verifier_read_little32(commands + offset + offsetof(struct load_command, cmdsize));
+        if (cmdsize < sizeof(struct load_command) || offset + cmdsize > sizeofcmds) break;
+        if (cmd == LC_CODE_SIGNATURE && cmdsize >= sizeof(struct linkedit_data_command)) {
+            *offsetOut = verifier_read_little32(commands + offset + offsetof(struct linkedit_data_command, dataoff));
+            *sizeOut = verifier_read_little32(commands + offset + offsetof(struct linkedit_data_command, datasize));
+            return VERIFIER_OK;
+        }
+        offset += cmdsize;
+    }
+    return VERIFIER_ERROR_NO_SIGNATURE;
+}
+
+// Locate the CMS and primary code directory in the superblob and take the best cdhash on the way
+static VerifierError verifier_read_superblob(const uint8_t *superblob, uint64_t size, const uint8_t **cmsOut, size_t *cmsSizeOut,
+                                             const uint8_t **codeDirectoryOut, size_t *codeDirectorySizeOut, VerifierResult *result)
+{
+    if (size < sizeof(CS_SuperBlob) || verifier_read_big32(superblob) != CSMAGIC_EMBEDDED_SIGNATURE) return VERIFIER_ERROR_NO_SIGNATURE;
+    uint32_t length = verifier_read_big32(superblob + offsetof(CS_SuperBlob, length));
+    if (length < size) size = length;
+    uint32_t count = verifier_read_big32(superblob + offsetof(CS_SuperBlob, count));
+    if (!verifier_range_valid(size, sizeof(CS_SuperBlob), (uint64_t)count * sizeof(CS_BlobIndex))) return VERIFIER_ERROR_NO_SIGNATURE;
+
+    unsigned bestRank = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *index = superblob + sizeof(CS_SuperBlob) + i * sizeof(CS_BlobIndex);
+        uint32_t type = verifier_read_big32(index + offsetof(CS_BlobIndex, type));
+        uint32_t offset = verifier_read_big32(index + offsetof(CS_BlobIndex, offset));
+        if (!verifier_range_valid(size, offset, sizeof(CS_GenericBlob))) continue;
+        const uint8_t *blob = superblob + offset;
+        uint32_t blobMagic = verifier_read_big32(blob);
+        uint32_t blobLength = verifier_read_big32(blob + offsetof(CS_GenericBlob, length));
+        if (blobLength < sizeof(CS_GenericBlob) || !verifier_range_valid(size, offset, blobLength)) continue;
+
+        if (type == CSSLOT_SIGNATURESLOT) {
+            *cmsOut = blob + sizeof(CS_GenericBlob);
+            *cmsSizeOut = blobLength - sizeof(CS_GenericBlob);
+            continue;
+        }
+        if (type != CSSLOT_CODEDIRECTORY && (type < CSSLOT_ALTERNATE_CODEDIRECTORIES || type >= CSSLOT_ALTERNATE_CODEDIRECTORY_LIMIT)) continue;
+        if (blobMagic != CSMAGIC_CODEDIRECTORY || blobLength <= offsetof(CS_CodeDirectory, hashType)) continue;
+        if (type == CSSLOT_CODEDIRECTORY) {
+            *codeDirectoryOut = blob;
+            *codeDirectorySizeOut = blobLength;
+        }
+
+        uint8_t hashType = blob[offsetof(CS_CodeDirectory, hashType)];
+        unsigned rank = code_hash_type_get_rank(hashType);
+        uint8_t digest[HASH_MAX_DIGEST_SIZE];
+        if (rank > bestRank && code_hash_digest(hashType, blob, blobLength, digest) == 0) {
+            bestRank = rank;
+            memcpy(result->computedCDHash, digest, CS_CDHASH_LEN);
+            result->hasComputedCDHash = true;
+        }
+    }
+    return VERIFIER_OK;
+}
+
+static VerifierError verifier_finish(VerifierResult *result, VerifierError error)
+{
+    result->error = error;
+    return error;
+}
+
+static VerifierError verifier_evaluate(const uint8_t *cms, size_t cmsSize, const uint8_t *codeDirectory, size_t codeDirectorySize,
+                                       uint32_t flags, VerifierResult *result)
+{
+    const CT_uint8_t *digestData = NULL;
+    CT_size_t digestLength = 0;
+    const CT_uint8_t *leafCertificate = NULL;
+    CT_size_t leafCertificateLength = 0;
+    if (evaluator_evaluate_amfi_cms(cms, cmsSize, codeDirectory, codeDirectorySize, (flags & VERIFIER_FLAG_ALLOW_TEST_HIERARCHY) != 0,
+                                    &leafCertificate, &leafCertificateLength, &result->policyFlags, &result->cmsDigestType,
+                                    &result->hashAgilityDigestType, &digestData, &digestLength, &result->coreTrustResult) != 0) {
+        return verifier_finish(result, VERIFIER_ERROR_NO_EVALUATOR);
+    }
+    result->leafCertificate = leafCertificate;
+    result->leafCertificateLength = leafCertificateLength;
+    if (result->coreTrustResult != 0) return verifier_finish(result, VERIFIER_ERROR_EVALUATION_FAILED);
+
+    if (digestData && digestLength) {
+        result->expectedCDHashLength = digestLength < VERIFIER_MAX_DIGEST_LEN ? digestLength : VERIFIER_MAX_DIGEST_LEN;
+        memcpy(result->expectedCDHash, digestData, result->expectedCDHashLength);
+    }
+    result->cdhashMatches = result->hasComputedCDHash && result->expectedCDHashLength >= CS_CDHASH_LEN &&
+                            !memcmp(result->expectedCDHash, result->computedCDHash, CS_CDHASH_LEN);
+    return verifier_finish(result, VERIFIER_OK);
+}
+
+VerifierError verifier_evaluate_slice(const VerifierImage *image, const VerifierSlice *slice, uint32_t flags, VerifierResult *resultOut)
+{
+    if (!resultOut) return VERIFIER_ERROR_INVALID_ARGUMENT;
+    memset(resultOut, 0, sizeof(*resultOut));
+    if (!image || !image->data) return verifier_finish(resultOut, VERIFIER_ERROR_INVALID_ARGUMENT);
+    if (!slice) return verifier_finish(resultOut, VERIFIER_ERROR_NO_SLICE);
+    if (!verifier_range_valid(image->size, slice->offset, slice->size) || slice->size < sizeof(struct mach_header)) {
+        return verifier_finish(resultOut, VERIFIER_ERROR_NOT_MACHO);
+    }
+
+    const uint8_t *sliceData = image->data + slice->offset;
+    uint32_t magic = verifier_read_little32(sliceData);
+    if ((magic != MH_MAGIC && magic != MH_MAGIC_64) ||
+        (magic == MH_MAGIC_64 && slice->size < sizeof(struct mach_header_64))) {
+        return verifier_finish(resultOut, VERIFIER_ERROR_NOT_MACHO);
+    }
+    resultOut->cputype = (cpu_type_t)verifier_read_little32(sliceData + offsetof(struct mach_header, cputype));
+    resultOut->cpusubtype = (cpu_subtype_t)verifier_read_little32(sliceData + offsetof(struct mach_header, cpusubtype));
+    uint32_t filetype = verifier_read_little32(sliceData + offsetof(struct mach_header, filetype));
+    if (filetype == MH_OBJECT || filetype == MH_DSYM) return verifier_finish(resultOut, VERIFIER_ERROR_UNSUPPORTED_FILETYPE);
+
+    uint32_t signatureOffset = 0, signatureSize = 0;
+    VerifierError error = verifier_find_code_signature(sliceData, slice->size, &signatureOffset, &signatureSize);
+    if (error != VERIFIER_OK) return verifier_finish(resultOut, error);
+    if (!verifier_range_valid(slice->size, signatureOffset, signatureSize)) return verifier_finish(resultOut, VERIFIER_ERROR_NO_SIGNATURE);
+
+    const uint8_t *cms = NULL, *codeDirectory = NULL;
+    size_t cmsSize = 0, codeDirectorySize = 0;
+    error = verifier_read_superblob(sliceData + signatureOffset, signatureSize, &cms, &cmsSize, &codeDirectory, &codeDirectorySize, resultOut);
+    if (error != VERIFIER_OK) return verifier_finish(resultOut, error);
+    if (!cms) return verifier_finish(resultOut, VERIFIER_ERROR_NO_CMS);
+    if (!codeDirectory) return verifier_finish(resultOut, VERIFIER_ERROR_NO_CODE_DIRECTORY);
+    return verifier_evaluate(cms, cmsSize, codeDirectory, codeDirectorySize, flags, resultOut);
+}
+
+VerifierError verifier_evaluate_blobs(const uint8_t *cms, size_t cmsSize, const uint8_t *codeDirectory, size_t codeDirectorySize,
+                                      uint32_t flags, VerifierResult *resultOut)
+{
+    if (!resultOut) return VERIFIER_ERROR_INVALID_ARGUMENT;
+    memset(resultOut, 0, sizeof(*resultOut));
+    if (!cms) return verifier_finish(resultOut, VERIFIER_ERROR_NO_CMS);
+    if (!codeDirectory) return verifier_finish(resultOut, VERIFIER_ERROR_NO_CODE_DIRECTORY);
+
+    if (codeDirectorySize > offsetof(CS_CodeDirectory, hashType) && verifier_read_big32(codeDirectory) == CSMAGIC_CODEDIRECTORY) {
+        uint8_t digest[HASH_MAX_DIGEST_SIZE];
+        if (code_hash_digest(codeDirectory[offsetof(CS_CodeDirectory, hashType)], codeDirectory, codeDirectorySize, digest) == 0) {
+            memcpy(resultOut->computedCDHash, digest, CS_CDHASH_LEN);
+            resultOut->hasComputedCDHash = true;
+        }
+    }
+    return verifier_evaluate(cms, cmsSize, codeDirectory, codeDirectorySize, flags, resultOut);
+}
+
+const char *verifier_error_to_string(VerifierError error)
+{
+    switch (error) {
+        case VERIFIER_OK: return "ok";
+        case VERIFIER_ERROR_INVALID_ARGUMENT: return "invalid argument";
+        case VERIFIER_ERROR_OPEN_FAILED: return "open failed";
+        case VERIFIER_ERROR_NOT_MACHO: return "not a Mach-O";
+        case VERIFIER_ERROR_NO_SLICE: return "no matching slice";
+        case VERIFIER_ERROR_UNSUPPORTED_FILETYPE: return "object file or dSYM";
+        case VERIFIER_ERROR_NO_SIGNATURE: return "no code signature";
+        case VERIFIER_ERROR_NO_CMS: return "no CMS blob";
+        case VERIFIER_ERROR_NO_CODE_DIRECTORY: return "no code directory";
+        case VERIFIER_ERROR_NO_EVALUATOR: return "CoreTrust evaluator not available";
+        case VERIFIER_ERROR_EVALUATION_FAILED: return "CoreTrust evaluation failed";
+    }
+    return "unknown";
+}
@@ -0,0 +1,95 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <choma/FAT.h>
+#include <choma/CodeDirectory.h>
+
+#include "CoreTrust.h"
+
+// Embeddable signature verification, built into libcoretrust_cli (make lib) and used by the CLI's single file mode
+// Everything lives in caller provided structs and nothing is printed. Opening a path or descriptor maps the file,
+// an image opened from a buffer uses it in place. Evaluating walks the slice's headers, load commands and
+// superblob in that memory and hands CoreTrust pointers into it, so no evaluation allocates anything
+// All functions are thread safe, an image may be evaluated from several threads at once
+
+#define VERIFIER_MAX_SLICES 64
+#define VERIFIER_MAX_DIGEST_LEN 64
+
+typedef enum {
+    VERIFIER_OK = 0,
+    VERIFIER_ERROR_INVALID_ARGUMENT,
+    VERIFIER_ERROR_OPEN_FAILED,
+    VERIFIER_ERROR_NOT_MACHO,
+    VERIFIER_ERROR_NO_SLICE,
+    VERIFIER_ERROR_UNSUPPORTED_FILETYPE, // object files and dSYMs are never evaluated by AMFI
+    VERIFIER_ERROR_NO_SIGNATURE,
+    VERIFIER_ERROR_NO_CMS,
+    VERIFIER_ERROR_NO_CODE_DIRECTORY,
+    VERIFIER_ERROR_NO_EVALUATOR,
+    VERIFIER_ERROR_EVALUATION_FAILED, // CoreTrust rejected the signature, see coreTrustResult
+} VerifierError;
+
+// Evaluation flags
+#define VERIFIER_FLAG_ALLOW_TEST_HIERARCHY (1 << 0)
+
+typedef struct VerifierSlice {
+    cpu_type_t cputype;
+    cpu_subtype_t cpusubtype;
+    uint64_t offset;
+    uint64_t size;
+} VerifierSlice;
+
+typedef struct VerifierImage {
+    const uint8_t *data;
+    size_t size;
+    bool mapped; // data is a mapping owned by the image
+    bool isFat;
+    uint32_t sliceCount;
+    VerifierSlice slices[VERIFIER_MAX_SLICES];
+} VerifierImage;
+
+typedef struct VerifierResult {
+    VerifierError error;
+    cpu_type_t cputype; // 0 for verifier_evaluate_blobs
+    cpu_subtype_t cpusubtype;
+
+    CT_int coreTrustResult;
+    CoreTrustPolicyFlags policyFlags;
+    CoreTrustDigestType cmsDigestType;
+    CoreTrustDigestType hashAgilityDigestType; // 0 unless the CMS uses hash agility v2
+    const uint8_t *leafCertificate; // points into the CMS, valid as long as the image or buffer is
+    size_t leafCertificateLength;
+
+    // The cdhash AMFI will expect according to the CMS, empty without hash agility
+    uint8_t expectedCDHash[VERIFIER_MAX_DIGEST_LEN];
+    size_t expectedCDHashLength;
+
+    // Best cdhash of the code directories in the signature, also filled in for signatures without a CMS
+    bool hasComputedCDHash;
+    uint8_t computedCDHash[CS_CDHASH_LEN];
+    bool cdhashMatches;
+} VerifierResult;
+
+// The buffer is used in place and has to outlive the image
+VerifierError verifier_image_open_buffer(VerifierImage *image, const void *data, size_t size);
+// The file is mapped, the descriptor may be closed once this returns
+VerifierError verifier_image_open_fd(VerifierImage *image, int fd);
+VerifierError verifier_image_open_path(VerifierImage *image, const char *path);
+void verifier_image_close(VerifierImage *image);
+
+const VerifierSlice *verifier_image_find_slice(const VerifierImage *image, cpu_type_t cputype, cpu_subtype_t cpusubtype);
+// Same choice as the scan: the slice the kernel would load on this host, with an arm64 fallback on macOS
+const VerifierSlice *verifier_image_find_preferred_slice(const VerifierImage *image);
+
+// resultOut is filled in as far as the evaluation got, its error matches the return value
+VerifierError verifier_evaluate_slice(const VerifierImage *image, const VerifierSlice *slice, uint32_t flags, VerifierResult *resultOut);
+VerifierError verifier_evaluate_blobs(const uint8_t *cms, size_t cmsSize, const uint8_t *codeDirectory, size_t codeDirectorySize,
+                                      uint32_t flags, VerifierResult *resultOut);
+
+const char *verifier_error_to_string(VerifierError error);
+
+#endif // VERIFIER_H
@@ -0,0 +1,789 @@
+#include "Watch.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <mach-o/loader.h>
+#include <mach-o/fat.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#define WATCH_HAS_INOTIFY 1
+#endif
+#if defined(__APPLE__)
+#include <sys/event.h>
+#define WATCH_HAS_KQUEUE 1
+#endif
+
+#include "Clock.h"
+#include "Fnv.h"
+
+#if defined(__APPLE__)
+#define WATCH_STAT_MTIME(s) ((int64_t)(s)->st_mtimespec.tv_sec * 1000000000LL + (s)->st_mtimespec.tv_nsec)
+#else
+#define WATCH_STAT_MTIME(s) ((int64_t)(s)->st_mtim.tv_sec * 1000000000LL + (s)->st_mtim.tv_nsec)
+#endif
+
+#define WATCH_INOTIFY_MASK (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR)
+
+Watch *watch_init(const PipelineConfig *config, unsigned threadCount)
+{
+    Watch *watch = calloc(1, sizeof(Watch));
+    if (!watch) return NULL;
+    watch->config = *config;
+    watch->threadCount = threadCount ? threadCount : 1;
+    watch->debounceNanos = WATCH_DEFAULT_DEBOUNCE_MS * 1000000ULL;
+    watch->pollNanos = WATCH_DEFAULT_POLL_MS * 1000000ULL;
+    watch->backendFd = -1;
+    watch->wakeFds[0] = watch->wakeFds[1] = -1;
+    if (pipe(watch->wakeFds) != 0) {
+        printf("Error: failed to create the wake pipe!\n");
+        free(watch);
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(watch->wakeFds[i], F_SETFL, fcntl(watch->wakeFds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(watch->wakeFds[i], F_SETFD, FD_CLOEXEC);
+    }
+    pthread_mutex_init(&watch->lock, NULL);
+    pthread_cond_init(&watch->queueCond, NULL);
+    pthread_mutex_init(&watch->outputLock, NULL);
+    return watch;
+}
+
+int watch_add_root(Watch *watch, const char *path)
+{
+    struct stat s;
+    if (stat(path, &s) != 0 || !S_ISDIR(s.st_mode)) {
+        printf("Error: %s is not a directory!\n", path);
+        return -1;
+    }
+    char **roots = realloc(watch->roots, (watch->rootCount + 1) * sizeof(char *));
+    if (!roots) return -1;
+    watch->roots = roots;
+    // Trailing slashes would end up doubled in every path below the root
+    size_t length = strlen(path);
+    while (length > 1 && path[length - 1] == '/') length--;
+    watch->roots[watch->rootCount] = strndup(path, length);
+    if (!watch->roots[watch->rootCount]) return -1;
+    watch->rootCount++;
+    return 0;
+}
+
+int watch_parse_backend(Watch *watch, const char *string)
+{
+    if (!strcmp(string, "auto")) {
+        watch->backend = WATCH_BACKEND_AUTO;
+    }
+    else if (!strcmp(string, "poll")) {
+        watch->backend = WATCH_BACKEND_POLL;
+    }
+#ifdef WATCH_HAS_INOTIFY
+    else if (!strcmp(string, "inotify")) {
+        watch->backend = WATCH_BACKEND_INOTIFY;
+    }
+#endif
+#ifdef WATCH_HAS_KQUEUE
+    else if (!strcmp(string, "kqueue")) {
+        watch->backend = WATCH_BACKEND_KQUEUE;
+    }
+#endif
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+static const char *watch_backend_to_string(WatchBackendType backend)
+{
+    switch (backend) {
+        case WATCH_BACKEND_INOTIFY: return "inotify";
+        case WATCH_BACKEND_KQUEUE: return "kqueue";
+        case WATCH_BACKEND_POLL: return "poll";
+        default: return "auto";
+    }
+}
+
+static void watch_wake(Watch *watch)
+{
+    // A full pipe already guarantees a wakeup
+    char byte = 0;
+    ssize_t written = write(watch->wakeFds[1], &byte, 1);
+    (void)written;
+}
+
+void watch_stop(Watch *watch)
+{
+    atomic_store(&watch->stopping, true);
+    watch_wake(watch);
+}
+
+static int watch_grow_nodes(Watch *watch)
+{
+    uint64_t capacity = watch->nodeCapacity ? watch->nodeCapacity * 2 : 4096;
+    WatchNode **nodes = calloc(capacity, sizeof(WatchNode *));
+    if (!nodes) return -1;
+    for (uint64_t i = 0; i < watch->nodeCapacity; i++) {
+        WatchNode *node = watch->nodes[i];
+        if (!node) continue;
+        uint64_t slot;
+        for (slot = node->hash & (capacity - 1); nodes[slot]; slot = (slot + 1) & (capacity - 1));
+        nodes[slot] = node;
+    }
+    free(watch->nodes);
+    watch->nodes = nodes;
+    watch->nodeCapacity = capacity;
+    return 0;
+}
+
+// Nodes are never freed before the watch is, so workers may hold on to them
+static WatchNode *watch_get_node(Watch *watch, const char *path, bool create)
+{
+    uint64_t hash = fnv_hash_string(path);
+    if (watch->nodeCapacity) {
+        for (uint64_t slot = hash & (watch->nodeCapacity - 1); watch->nodes[slot]; slot = (slot + 1) & (watch->nodeCapacity - 1)) {
+            WatchNode *node = watch->nodes[slot];
+            if (node->hash == hash && !strcmp(node->path, path)) return node;
+        }
+    }
+    if (!create) return NULL;
+    if ((watch->nodeCount + 1) * 2 > watch->nodeCapacity && watch_grow_nodes(watch) != 0) return NULL;
+
+    WatchNode *node = calloc(1, sizeof(WatchNode));
+    if (!node) return NULL;
+    node->path = strdup(path);
+    if (!node->path) {
+        free(node);
+        return NULL;
+    }
+    node->hash = hash;
+    node->handle = -1;
+    uint64_t slot;
+    for (slot = hash & (watch->nodeCapacity - 1); watch->nodes[slot]; slot = (slot + 1) & (watch->nodeCapacity - 1));
+    watch->nodes[slot] = node;
+    watch->nodeCount++;
+    return node;
+}
+
+static char *watch_join_path(const char *directory, const char *name)
+{
+    size_t directoryLength = strlen(directory), nameLength = strlen(name);
+    char *path = malloc(directoryLength + nameLength + 2);
+    if (!path) return NULL;
+    memcpy(path, directory, directoryLength);
+    size_t offset = directoryLength;
+    if (!directoryLength || directory[directoryLength - 1] != '/') path[offset++] = '/';
+    memcpy(path + offset, name, nameLength + 1);
+    return path;
+}
+
+// Called with the lock held
+static int watch_add_pending(Watch *watch, WatchNode *node)
+{
+    if (watch->pendingCount == watch->pendingCapacity) {
+        uint64_t capacity = watch->pendingCapacity ? watch->pendingCapacity * 2 : 256;
+        WatchNode **pending = realloc(watch->pending, capacity * sizeof(WatchNode *));
+        if (!pending) return -1;
+        watch->pending = pending;
+        watch->pendingCapacity = capacity;
+    }
+    watch->pending[watch->pendingCount++] = node;
+    node->state = WATCH_FILE_PENDING;
+    return 0;
+}
+
+static void watch_note_change(Watch *watch, WatchNode *node, uint64_t changeTime)
+{
+    pthread_mutex_lock(&watch->lock);
+    watch->eventCount++;
+    if (changeTime > node->changeTime) node->changeTime = changeTime;
+    switch (node->state) {
+        case WATCH_FILE_IDLE:
+            watch_add_pending(watch, node);
+            break;
+        case WATCH_FILE_SCANNING:
+            node->changedWhileScanning = true;
+            watch->coalescedCount++;
+            break;
+        default:
+            // A queued file that changed again goes back to pending when a worker picks it up
+            watch->coalescedCount++;
+            break;
+    }
+    pthread_mutex_unlock(&watch->lock);
+}
+
+// Stat based change detection for rescans, the change time is taken from the mtime but never placed before
+// the previous rescan (files moved in keep their old mtime)
+static void watch_check_file(Watch *watch, const char *path, const struct stat *s, bool notify, uint64_t notBefore)
+{
+    WatchNode *node = watch_get_node(watch, path, true);
+    if (!node) return;
+    int64_t mtime = WATCH_STAT_MTIME(s);
+    bool changed = !node->exists || node->device != s->st_dev || node->inode != s->st_ino ||
+                   node->mtime != mtime || node->size != s->st_size;
+    node->exists = true;
+    node->device = s->st_dev;
+    node->inode = s->st_ino;
+    node->mtime = mtime;
+    node->size = s->st_size;
+    if (!changed || !notify) return;
+
+    uint64_t now = clock_now_ns();
+    struct timespec realNow;
+    clock_gettime(CLOCK_REALTIME, &realNow);
+    int64_t age = ((int64_t)realNow.tv_sec * 1000000000LL + realNow.tv_nsec) - mtime;
+    uint64_t changeTime = now;
+    if (age > 0) changeTime = (uint64_t)age < now ? now - (uint64_t)age : 0;
+    if (changeTime < notBefore) changeTime = notBefore;
+    watch_note_change(watch, node, changeTime);
+}
+
+static void watch_add_directory_watch(Watch *watch, WatchNode *directory)
+{
+    if (directory->handle >= 0) return;
+#ifdef WATCH_HAS_INOTIFY
+    if (watch->backend == WATCH_BACKEND_INOTIFY) {
+        int wd = inotify_add_watch(watch->backendFd, directory->path, WATCH_INOTIFY_MASK);
+        if (wd >= 0) {
+            if (wd >= watch->watchDescriptorCount) {
+                int count = watch->watchDescriptorCount ? watch->watchDescriptorCount : 1024;
+                while (count <= wd) count *= 2;
+                WatchNode **descriptors = realloc(watch->watchDescriptors, count * sizeof(WatchNode *));
+                if (!descriptors) {
+                    inotify_rm_watch(watch->backendFd, wd);
+                    return;
+                }
+                memset(descriptors + watch->watchDescriptorCount, 0, (count - watch->watchDescriptorCount) * sizeof(WatchNode *));
+                watch->watchDescriptors = descriptors;
+                watch->watchDescriptorCount = count;
+            }
+            watch->watchDescriptors[wd] = directory;
+            directory->handle = wd;
+            return;
+        }
+    }
+#endif
+#ifdef WATCH_HAS_KQUEUE
+    if (watch->backend == WATCH_BACKEND_KQUEUE) {
+        int fd = open(directory->path, O_EVTONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            struct kevent change;
+            EV_SET(&change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_DELETE | NOTE_RENAME, 0, directory);
+            if (kevent(watch->backendFd, &change, 1, NULL, 0, NULL) == 0) {
+                directory->handle = fd;
+                return;
+            }
+            close(fd);
+        }
+    }
+#endif
+    if (watch->backend == WATCH_BACKEND_POLL) return;
+    if (!watch->backendFailed) {
+        // Typically the inotify watch or open file limit, rescans still cover the directory
+        fprintf(stderr, "Warning: failed to watch %s (%s), falling back to rescanning every %llu ms!\n", directory->path,
+                strerror(errno), (unsigned long long)((watch->pollNanos ? watch->pollNanos : WATCH_DEFAULT_POLL_MS * 1000000ULL) / 1000000ULL));
+        watch->backendFailed = true;
+        if (!watch->pollNanos) watch->pollNanos = WATCH_DEFAULT_POLL_MS * 1000000ULL;
+    }
+}
+
+// Directories are only descended into if recursive is set or they have not been seen before
+static void watch_walk(Watch *watch, const char *directoryPath, bool recursive, bool notify, uint64_t notBefore)
+{
+    WatchNode *directory = watch_get_node(watch, directoryPath, true);
+    if (!directory) return;
+    if (!directory->exists) {
+        directory->exists = true;
+        directory->isDirectory = true;
+        watch->directoryCount++;
+    }
+    // Watch before listing, so files created in between are reported rather than missed
+    watch_add_directory_watch(watch, directory);
+
+    DIR *dir = opendir(directoryPath);
+    if (!dir) return;
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir))) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        char *path = watch_join_path(directoryPath, entry->d_name);
+        if (!path) break;
+        struct stat s;
+        // Symlinks are not followed, they could lead out of the roots or into a cycle
+        if (lstat(path, &s) == 0) {
+            if (S_ISDIR(s.st_mode)) {
+                WatchNode *subdirectory = watch_get_node(watch, path, false);
+                if (recursive || !subdirectory || !subdirectory->exists) {
+                    watch_walk(watch, path, recursive, notify, notBefore);
+                }
+            }
+            else if (S_ISREG(s.st_mode)) {
+                watch_check_file(watch, path, &s, notify, notBefore);
+            }
+        }
+        free(path);
+    }
+    closedir(dir);
+}
+
+static void watch_rescan(Watch *watch, bool notify)
+{
+    uint64_t notBefore = watch->lastWalkTime;
+    watch->lastWalkTime = clock_now_ns();
+    for (unsigned i = 0; i < watch->rootCount; i++) {
+        watch_walk(watch, watch->roots[i], true, notify, notBefore);
+    }
+    pthread_mutex_lock(&watch->lock);
+    watch->rescanCount++;
+    pthread_mutex_unlock(&watch->lock);
+}
+
+static void watch_forget_directory(Watch *watch, WatchNode *directory)
+{
+    if (directory->exists) {
+        directory->exists = false;
+        watch->directoryCount--;
+    }
+#ifdef WATCH_HAS_KQUEUE
+    if (watch->backend == WATCH_BACKEND_KQUEUE && directory->handle >= 0) close(directory->handle);
+#endif
+    directory->handle = -1;
+}
+
+#ifdef WATCH_HAS_INOTIFY
+static void watch_read_inotify(Watch *watch)
+{
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t length = read(watch->backendFd, buffer, sizeof(buffer));
+        if (length <= 0) break;
+        uint64_t now = clock_now_ns();
+        for (char *cur = buffer; cur < buffer + length; ) {
+            struct inotify_event *event = (struct inotify_event *)cur;
+            cur += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were dropped, only a full rescan can tell what changed
+                pthread_mutex_lock(&watch->lock);
+                watch->overflowCount++;
+                pthread_mutex_unlock(&watch->lock);
+                watch_rescan(watch, true);
+                continue;
+            }
+            if (event->wd < 0 || event->wd >= watch->watchDescriptorCount) continue;
+            WatchNode *directory = watch->watchDescriptors[event->wd];
+            if (!directory) continue;
+            if (event->mask & IN_IGNORED) {
+                // The directory is gone (or its watch was removed), its wd may be handed out again
+                watch->watchDescriptors[event->wd] = NULL;
+                watch_forget_directory(watch, directory);
+                continue;
+            }
+            if (!event->len) continue;
+
+            char *path = watch_join_path(directory->path, event->name);
+            if (!path) continue;
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                WatchNode *node = watch_get_node(watch, path, false);
+                if (node && !node->isDirectory) node->exists = false;
+            }
+            else if (event->mask & IN_ISDIR) {
+                // Files may have landed in a new directory before its watch was added
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) watch_walk(watch, path, true, true, now);
+            }
+            else {
+                struct stat s;
+                WatchNode *node = lstat(path, &s) == 0 && S_ISREG(s.st_mode) ? watch_get_node(watch, path, true) : NULL;
+                if (node) {
+                    node->exists = true;
+                    node->device = s.st_dev;
+                    node->inode = s.st_ino;
+                    node->mtime = WATCH_STAT_MTIME(&s);
+                    node->size = s.st_size;
+                    watch_note_change(watch, node, now);
+                }
+            }
+            free(path);
+        }
+    }
+}
+#endif
+
+#ifdef WATCH_HAS_KQUEUE
+static void watch_read_kqueue(Watch *watch)
+{
+    struct kevent events[64];
+    struct timespec timeout = { 0, 0 };
+    int count;
+    while ((count = kevent(watch->backendFd, NULL, 0, events, 64, &timeout)) > 0) {
+        uint64_t notBefore = clock_now_ns();
+        for (int i = 0; i < count; i++) {
+            WatchNode *directory = events[i].udata;
+            if (events[i].fflags & (NOTE_DELETE | NOTE_RENAME)) {
+                // Closing the descriptor removes the event, a rescan picks the directory up again if it moved
+                watch_forget_directory(watch, directory);
+                continue;
+            }
+            // An entry was added, removed or renamed, only this directory and new subdirectories need a look
+            watch_walk(watch, directory->path, false, true, notBefore);
+        }
+        if (count < 64) break;
+    }
+}
+#endif
+
+static int watch_open_backend(Watch *watch)
+{
+    if (watch->backend == WATCH_BACKEND_AUTO) {
+#if defined(WATCH_HAS_INOTIFY)
+        watch->backend = WATCH_BACKEND_INOTIFY;
+#elif defined(WATCH_HAS_KQUEUE)
+        watch->backend = WATCH_BACKEND_KQUEUE;
+#else
+        watch->backend = WATCH_BACKEND_POLL;
+#endif
+    }
+#ifdef WATCH_HAS_INOTIFY
+    if (watch->backend == WATCH_BACKEND_INOTIFY) {
+        watch->backendFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        // Every change is reported, rescans are only needed after an overflow or a failed watch
+        if (watch->backendFd >= 0) watch->pollNanos = 0;
+    }
+#endif
+#ifdef WATCH_HAS_KQUEUE
+    if (watch->backend == WATCH_BACKEND_KQUEUE) {
+        watch->backendFd = kqueue();
+        if (watch->backendFd >= 0) fcntl(watch->backendFd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (watch->backend != WATCH_BACKEND_POLL && watch->backendFd < 0) {
+        fprintf(stderr, "Warning: failed to initialize %s (%s), falling back to polling!\n", watch_backend_to_string(watch->backend), strerror(errno));
+        watch->backend = WATCH_BACKEND_POLL;
+    }
+    if (watch->backend != WATCH_BACKEND_INOTIFY && !watch->pollNanos) {
+        watch->pollNanos = WATCH_DEFAULT_POLL_MS * 1000000ULL;
+    }
+    return 0;
+}
+
+static bool watch_is_macho(const char *path, bool *goneOut)
+{
+    *goneOut = false;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *goneOut = true;
+        return false;
+    }
+    uint32_t magic = 0;
+    bool isMachO = pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+                   (magic == MH_MAGIC || magic == MH_MAGIC_64 || magic == MH_CIGAM || magic == MH_CIGAM_64 ||
+                    magic == FAT_MAGIC || magic == FAT_MAGIC_64 || magic == FAT_CIGAM || magic == FAT_CIGAM_64);
+    close(fd);
+    return isMachO;
+}
+
+static void watch_histogram_add(WatchHistogram *histogram, uint64_t nanos)
+{
+    uint64_t micros = nanos / 1000;
+    unsigned index;
+    if (micros < 4) {
+        index = (unsigned)micros;
+    }
+    else {
+        unsigned msb = 63 - __builtin_clzll(micros);
+        index = msb * 4 + ((micros >> (msb - 2)) & 3);
+    }
+    if (index >= WATCH_LATENCY_BUCKETS) index = WATCH_LATENCY_BUCKETS - 1;
+    histogram->buckets[index]++;
+    histogram->count++;
+    histogram->sum += nanos;
+    if (nanos > histogram->max) histogram->max = nanos;
+}
+
+// Upper bound of a bucket in nanoseconds
+static uint64_t watch_histogram_bucket_limit(unsigned index)
+{
+    if (index < 4) return (index + 1) * 1000ULL;
+    unsigned msb = index / 4;
+    return (((4ULL | (index & 3)) + 1) << (msb - 2)) * 1000ULL;
+}
+
+static uint64_t watch_histogram_percentile(const WatchHistogram *histogram, double percentile)
+{
+    uint64_t target = (uint64_t)(histogram->count * percentile);
+    if (target >= histogram->count) target = histogram->count - 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < WATCH_LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > target) {
+            uint64_t limit = watch_histogram_bucket_limit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+static void watch_scan_file(Watch *watch, const char *path)
+{
+    ScanItem *item = scan_item_init(path);
+    if (!item) return;
+    item->budget = &watch->config.budget;
+    item->auditEnabled = watch->config.audit;
+    item->prescreen = watch->config.prescreen;
+    item->trustCaches = watch->config.trustCaches;
+    if (watch->config.reader == PIPELINE_READER_MMAP) {
+        scan_item_prefetch(item);
+    }
+    else {
+        scan_item_prefetch_regions(item);
+    }
+    scan_item_parse(item);
+    scan_item_evaluate(item);
+    scan_item_calculate_cdhash(item);
+    // Flushed per record, whoever reads the output wants the verdict now
+    pthread_mutex_lock(&watch->outputLock);
+    scan_item_print(item, watch->config.output);
+    fflush(watch->config.output);
+    pthread_mutex_unlock(&watch->outputLock);
+    scan_item_free(item);
+}
+
+static void *watch_worker(void *arg)
+{
+    Watch *watch = arg;
+    pthread_mutex_lock(&watch->lock);
+    while (true) {
+        while (!watch->queueHead && !atomic_load(&watch->stopping)) {
+            pthread_cond_wait(&watch->queueCond, &watch->lock);
+        }
+        if (atomic_load(&watch->stopping)) break;
+        WatchNode *node = watch->queueHead;
+        watch->queueHead = node->nextQueued;
+        if (!watch->queueHead) watch->queueTail = NULL;
+        node->nextQueued = NULL;
+
+        uint64_t start = clock_now_ns();
+        if (start - node->changeTime < watch->debounceNanos) {
+            // Written to again while it was queued
+            watch_add_pending(watch, node);
+            watch_wake(watch);
+            continue;
+        }
+        node->state = WATCH_FILE_SCANNING;
+        uint64_t changeTime = node->changeTime;
+        pthread_mutex_unlock(&watch->lock);
+
+        bool gone = false;
+        bool isMachO = watch_is_macho(node->path, &gone);
+        if (isMachO) {
+            watch_scan_file(watch, node->path);
+        }
+        uint64_t end = clock_now_ns();
+
+        pthread_mutex_lock(&watch->lock);
+        if (isMachO) {
+            watch->evaluatedCount++;
+            watch_histogram_add(&watch->latency, end - changeTime);
+            watch_histogram_add(&watch->scanTime, end - start);
+        }
+        else {
+            watch->ignoredCount++;
+        }
+        if (node->changedWhileScanning) {
+            node->changedWhileScanning = false;
+            watch_add_pending(watch, node);
+            watch_wake(watch);
+        }
+        else {
+            node->state = WATCH_FILE_IDLE;
+        }
+    }
+    pthread_mutex_unlock(&watch->lock);
+    return NULL;
+}
+
+// Queue every pending file that has been quiet for the debounce period, returns when the next one will be
+static uint64_t watch_queue_ready(Watch *watch, uint64_t now)
+{
+    uint64_t nextDeadline = UINT64_MAX;
+    pthread_mutex_lock(&watch->lock);
+    bool queued = false;
+    for (uint64_t i = 0; i < watch->pendingCount; ) {
+        WatchNode *node = watch->pending[i];
+        uint64_t deadline = node->changeTime + watch->debounceNanos;
+        if (deadline > now) {
+            if (deadline < nextDeadline) nextDeadline = deadline;
+            i++;
+            continue;
+        }
+        watch->pending[i] = watch->pending[--watch->pendingCount];
+        node->state = WATCH_FILE_QUEUED;
+        if (watch->queueTail) watch->queueTail->nextQueued = node;
+        else watch->queueHead = node;
+        watch->queueTail = node;
+        queued = true;
+    }
+    if (queued) pthread_cond_broadcast(&watch->queueCond);
+    pthread_mutex_unlock(&watch->lock);
+    return nextDeadline;
+}
+
+int watch_run(Watch *watch)
+{
+    if (!watch->rootCount) {
+        printf("Error: no directories to watch!\n");
+        return -1;
+    }
+    watch->startTime = clock_now_ns();
+    watch->endTime = 0;
+    watch_open_backend(watch);
+
+    // Existing files are only recorded, unless they should be evaluated as well
+    watch->lastWalkTime = watch->startTime;
+    for (unsigned i = 0; i < watch->rootCount; i++) {
+        watch_walk(watch, watch->roots[i], true, watch->initialScan, watch->startTime);
+    }
+    if (watch->initialScan) {
+        // Nothing to wait for, they were written before the watch started
+        pthread_mutex_lock(&watch->lock);
+        for (uint64_t i = 0; i < watch->pendingCount; i++) {
+            watch->pending[i]->changeTime = watch->startTime - watch->debounceNanos;
+        }
+        pthread_mutex_unlock(&watch->lock);
+    }
+    fprintf(stderr, "watch: %u roots, %llu directories, %llu files (%s)\n", watch->rootCount,
+            (unsigned long long)watch->directoryCount, (unsigned long long)(watch->nodeCount - watch->directoryCount),
+            watch_backend_to_string(watch->backend));
+
+    watch->threads = calloc(watch->threadCount, sizeof(pthread_t));
+    if (!watch->threads) return -1;
+    unsigned started = 0;
+    for (; started < watch->threadCount; started++) {
+        if (pthread_create(&watch->threads[started], NULL, watch_worker, watch) != 0) break;
+    }
+    if (started == 0) {
+        printf("Error: failed to create watch threads!\n");
+        return -1;
+    }
+
+    uint64_t nextRescan = watch->pollNanos ? watch->startTime + watch->pollNanos : UINT64_MAX;
+    uint64_t statsNanos = watch->config.statsInterval * 1000000000ULL;
+    uint64_t nextStats = statsNanos ? watch->startTime + statsNanos : UINT64_MAX;
+    while (!atomic_load(&watch->stopping)) {
+        uint64_t now = clock_now_ns();
+        if (now >= nextRescan) {
+            watch_rescan(watch, true);
+            now = clock_now_ns();
+            nextRescan = watch->pollNanos ? now + watch->pollNanos : UINT64_MAX;
+        }
+        // A failed watch may have turned rescans on
+        if (nextRescan == UINT64_MAX && watch->pollNanos) nextRescan = now + watch->pollNanos;
+        if (now >= nextStats) {
+            watch_print_stats(watch, stderr);
+            nextStats = now + statsNanos;
+        }
+
+        uint64_t deadline = watch_queue_ready(watch, now);
+        if (nextRescan < deadline) deadline = nextRescan;
+        if (nextStats < deadline) deadline = nextStats;
+        int timeout = -1;
+        if (deadline != UINT64_MAX) {
+            uint64_t millis = deadline > now ? (deadline - now + 999999) / 1000000 : 0;
+            timeout = millis > INT32_MAX ? INT32_MAX : (int)millis;
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = watch->wakeFds[0], .events = POLLIN },
+            { .fd = watch->backendFd, .events = POLLIN },
+        };
+        int r = poll(fds, watch->backendFd >= 0 ? 2 : 1, timeout);
+        if (r < 0 && errno != EINTR) {
+            printf("Error: failed to wait for changes (%s)!\n", strerror(errno));
+            break;
+        }
+        if (r <= 0) continue;
+        if (fds[0].revents & POLLIN) {
+            char drain[256];
+            while (read(watch->wakeFds[0], drain, sizeof(drain)) > 0);
+        }
+        if (watch->backendFd >= 0 && (fds[1].revents & POLLIN)) {
+#ifdef WATCH_HAS_INOTIFY
+            if (watch->backend == WATCH_BACKEND_INOTIFY) watch_read_inotify(watch);
+#endif
+#ifdef WATCH_HAS_KQUEUE
+            if (watch->backend == WATCH_BACKEND_KQUEUE) watch_read_kqueue(watch);
+#endif
+        }
+    }
+
+    atomic_store(&watch->stopping, true);
+    pthread_mutex_lock(&watch->lock);
+    pthread_cond_broadcast(&watch->queueCond);
+    pthread_mutex_unlock(&watch->lock);
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(watch->threads[i], NULL);
+    }
+    watch->endTime = clock_now_ns();
+    return 0;
+}
+
+static void watch_print_histogram(const char *name, const WatchHistogram *histogram, FILE *output)
+{
+    if (!histogram->count) return;
+    fprintf(output, "%s: mean %.1f ms, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", name,
+            histogram->sum / 1e6 / histogram->count,
+            watch_histogram_percentile(histogram, 0.50) / 1e6,
+            watch_histogram_percentile(histogram, 0.90) / 1e6,
+            watch_histogram_percentile(histogram, 0.99) / 1e6,
+            histogram->max / 1e6);
+}
+
+void watch_print_stats(Watch *watch, FILE *output)
+{
+    pthread_mutex_lock(&watch->lock);
+    uint64_t end = watch->endTime ? watch->endTime : clock_now_ns();
+    fprintf(output, "watch: %.1f s, %llu events, %llu coalesced, %llu evaluated, %llu ignored, %llu pending, %llu rescans",
+            (end - watch->startTime) / 1e9, (unsigned long long)watch->eventCount, (unsigned long long)watch->coalescedCount,
+            (unsigned long long)watch->evaluatedCount, (unsigned long long)watch->ignoredCount,
+            (unsigned long long)watch->pendingCount, (unsigned long long)watch->rescanCount);
+    if (watch->overflowCount) {
+        fprintf(output, ", %llu overflows", (unsigned long long)watch->overflowCount);
+    }
+    fprintf(output, "\n");
+    // Includes the debounce period, which is the price for evaluating a burst of writes once
+    watch_print_histogram("change to verdict", &watch->latency, output);
+    watch_print_histogram("scan", &watch->scanTime, output);
+    pthread_mutex_unlock(&watch->lock);
+}
+
+void watch_free(Watch *watch)
+{
+    for (uint64_t i = 0; i < watch->nodeCapacity; i++) {
+        WatchNode *node = watch->nodes[i];
+        if (!node) continue;
+#ifdef WATCH_HAS_KQUEUE
+        if (watch->backend == WATCH_BACKEND_KQUEUE && node->handle >= 0) close(node->handle);
+#endif
+        free(node->path);
+        free(node);
+    }
+    free(watch->nodes);
+    free(watch->watchDescriptors);
+    free(watch->pending);
+    free(watch->threads);
+    for (unsigned i = 0; i < watch->rootCount; i++) {
+        free(watch->roots[i]);
+    }
+    free(watch->roots);
+    // Closing the inotify descriptor drops all of its watches
+    if (watch->backendFd >= 0) close(watch->backendFd);
+    close(watch->wakeFds[0]);
+    close(watch->wakeFds[1]);
+    pthread_mutex_destroy(&watch->outputLock);
+    pthread_cond_destroy(&watch->queueCond);
+    pthread_mutex_destroy(&watch->lock);
+    free(watch);
+}
@@ -0,0 +1,130 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "Pipeline.h"
+
+// Watch mode: evaluate binaries as soon as they are written under a set of directory roots
+// Changes come from inotify on Linux, from kqueue directory watches on Apple platforms (which miss in-place
+// writes to existing files, so the roots are also rescanned periodically) or from periodic rescans alone
+// A changed file waits until it has been quiet for the debounce period, so a burst of writes is evaluated
+// once. Mach-Os are then run through the normal scan on a pool of threads and printed as they complete
+
+#define WATCH_DEFAULT_DEBOUNCE_MS 200
+#define WATCH_DEFAULT_POLL_MS 2000
+#define WATCH_LATENCY_BUCKETS 256 // 4 per power of two of microseconds
+
+typedef enum {
+    WATCH_BACKEND_AUTO = 0,
+    WATCH_BACKEND_INOTIFY,
+    WATCH_BACKEND_KQUEUE,
+    WATCH_BACKEND_POLL,
+} WatchBackendType;
+
+typedef enum {
+    WATCH_FILE_IDLE = 0,
+    WATCH_FILE_PENDING,  // changed, waiting for the debounce period
+    WATCH_FILE_QUEUED,   // waiting for a worker
+    WATCH_FILE_SCANNING,
+} WatchFileState;
+
+typedef struct WatchNode {
+    char *path;
+    uint64_t hash;
+    bool isDirectory;
+    int handle; // inotify watch descriptor or kqueue file descriptor of a directory, -1 if not watched
+
+    // Last stat of the file, only used by the thread running the watch
+    bool exists;
+    dev_t device;
+    ino_t inode;
+    int64_t mtime;
+    off_t size;
+
+    // Guarded by the watch lock
+    WatchFileState state;
+    bool changedWhileScanning;
+    uint64_t changeTime; // latest change, the debounce period and the latency are measured from here
+    struct WatchNode *nextQueued;
+} WatchNode;
+
+typedef struct WatchHistogram {
+    uint64_t buckets[WATCH_LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} WatchHistogram;
+
+typedef struct Watch {
+    PipelineConfig config;
+    WatchBackendType backend;
+    unsigned threadCount;
+    uint64_t debounceNanos;
+    uint64_t pollNanos; // 0 disables periodic rescans
+    bool initialScan; // evaluate the binaries that already exist when the watch starts
+
+    char **roots;
+    unsigned rootCount;
+
+    // Every file and directory seen under the roots, open addressing on the path hash
+    WatchNode **nodes;
+    uint64_t nodeCount;
+    uint64_t nodeCapacity;
+    uint64_t directoryCount;
+    WatchNode **watchDescriptors; // inotify watch descriptor to directory
+    int watchDescriptorCount;
+    int backendFd;
+    bool backendFailed; // some directory could not be watched, the rescans cover it
+    uint64_t lastWalkTime;
+
+    int wakeFds[2];
+    _Atomic bool stopping;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t queueCond;
+    WatchNode **pending;
+    uint64_t pendingCount;
+    uint64_t pendingCapacity;
+    WatchNode *queueHead;
+    WatchNode *queueTail;
+    pthread_mutex_t outputLock;
+
+    // Statistics, guarded by the watch lock
+    uint64_t startTime;
+    uint64_t endTime;
+    uint64_t eventCount;
+    uint64_t coalescedCount;
+    uint64_t evaluatedCount;
+    uint64_t ignoredCount; // not a Mach-O or gone by the time it was scanned
+    uint64_t rescanCount;
+    uint64_t overflowCount;
+    WatchHistogram latency; // change to verdict
+    WatchHistogram scanTime; // worker picking the file up to verdict
+} Watch;
+
+// Uses the budget, audit, prescreen, trust cache, reader, stats interval and output settings of config
+Watch *watch_init(const PipelineConfig *config, unsigned threadCount);
+
+int watch_add_root(Watch *watch, const char *path);
+
+// Parse a backend name (auto, inotify, kqueue or poll)
+int watch_parse_backend(Watch *watch, const char *string);
+
+// Watch the roots until watch_stop is called, records are printed to config->output as they complete
+int watch_run(Watch *watch);
+
+// Async-signal-safe, in-flight scans finish and queued files are dropped
+void watch_stop(Watch *watch);
+
+// Counts and change to verdict latency percentiles
+void watch_print_stats(Watch *watch, FILE *output);
+
+void watch_free(Watch *watch);
+
+#endif // WATCH_H
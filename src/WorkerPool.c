@@ -0,0 +1,385 @@
+#include "WorkerPool.h"
+
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "Clock.h"
+
+static void worker_pool_backoff(unsigned *attempt)
+{
+    if (*attempt < 64) {
+#if defined(__aarch64__)
+        __asm__ volatile("yield");
+#elif defined(__x86_64__) || defined(__i386__)
+        __asm__ volatile("pause");
+#endif
+    }
+    else if (*attempt < 128) {
+        sched_yield();
+    }
+    else {
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 50000 };
+        nanosleep(&ts, NULL);
+    }
+    (*attempt)++;
+}
+
+static void worker_pool_set_output(WorkerSlot *slot, const char *output, size_t length)
+{
+    slot->outputTruncated = length > WORKER_POOL_OUTPUT_MAX;
+    if (slot->outputTruncated) {
+        // Keep the record on its own line
+        length = WORKER_POOL_OUTPUT_MAX;
+        memcpy(slot->output, output, length - 1);
+        slot->output[length - 1] = '\n';
+    }
+    else {
+        memcpy(slot->output, output, length);
+    }
+    slot->outputLength = (uint32_t)length;
+}
+
+// Runs in the worker, everything that may crash on a malformed signature happens in here
+static void worker_pool_scan_slot(WorkerPool *pool, WorkerSlot *slot)
+{
+    char *output = NULL;
+    size_t outputLength = 0;
+    FILE *stream = open_memstream(&output, &outputLength);
+    ScanItem *item = stream ? scan_item_init(slot->path) : NULL;
+    if (!item) {
+        if (stream) fclose(stream);
+        free(output);
+        // Paths are shorter than WORKER_POOL_PATH_MAX, so the record always fits
+        int length = snprintf(slot->output, WORKER_POOL_OUTPUT_MAX, "%s\t%s\n", slot->path, scan_status_to_string(SCAN_STATUS_OPEN_FAILED));
+        slot->outputLength = (uint32_t)length;
+        slot->outputTruncated = false;
+        return;
+    }
+
+    item->budget = &pool->config.budget;
+    item->auditEnabled = pool->config.audit;
+    item->prescreen = pool->config.prescreen;
+    item->trustCaches = pool->config.trustCaches;
+    if (pool->config.reader == PIPELINE_READER_MMAP) {
+        scan_item_prefetch(item);
+    }
+    else {
+        scan_item_prefetch_regions(item);
+    }
+    scan_item_parse(item);
+    scan_item_evaluate(item);
+    scan_item_calculate_cdhash(item);
+    scan_item_print(item, stream);
+    scan_item_free(item);
+
+    fclose(stream);
+    worker_pool_set_output(slot, output, outputLength);
+    free(output);
+}
+
+static void worker_pool_worker_main(WorkerPool *pool, Worker *worker)
+{
+    WorkerRing *ring = worker->ring;
+    unsigned attempt = 0;
+    while (true) {
+        uint64_t done = atomic_load_explicit(&ring->done, memory_order_relaxed);
+        if (done == atomic_load_explicit(&ring->submitted, memory_order_acquire)) {
+            // Closed is set after the last submit, so look at submitted once more before leaving
+            if (atomic_load_explicit(&ring->closed, memory_order_acquire) &&
+                done == atomic_load_explicit(&ring->submitted, memory_order_acquire)) {
+                break;
+            }
+            if (getppid() != pool->supervisor) break;
+            worker_pool_backoff(&attempt);
+            continue;
+        }
+        attempt = 0;
+        worker_pool_scan_slot(pool, &ring->slots[done % pool->depth]);
+        atomic_store_explicit(&ring->done, done + 1, memory_order_release);
+    }
+    _exit(0);
+}
+
+static int worker_pool_spawn(WorkerPool *pool, Worker *worker)
+{
+    // Anything still buffered would otherwise be printed by the child as well
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Error: failed to fork worker!\n");
+        return -1;
+    }
+    if (pid == 0) {
+        worker_pool_worker_main(pool, worker);
+    }
+    worker->pid = pid;
+    return 0;
+}
+
+WorkerPool *worker_pool_init(const PipelineConfig *config, unsigned workerCount)
+{
+    if (workerCount == 0) return NULL;
+    WorkerPool *pool = calloc(1, sizeof(WorkerPool));
+    if (!pool) return NULL;
+    pool->config = *config;
+    if (!pool->config.output) pool->config.output = stdout;
+    pool->workerCount = workerCount;
+    pool->depth = WORKER_POOL_DEFAULT_DEPTH;
+    pool->timeoutNanos = WORKER_POOL_DEFAULT_TIMEOUT_MS * 1000000ULL;
+
+    size_t ringSize = sizeof(WorkerRing) + pool->depth * sizeof(WorkerSlot);
+    pool->ringSize = (ringSize + QUEUE_CACHELINE_SIZE - 1) & ~(size_t)(QUEUE_CACHELINE_SIZE - 1);
+    pool->sharedSize = pool->ringSize * workerCount;
+    void *mapping = mmap(NULL, pool->sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+    if (mapping == MAP_FAILED) {
+        printf("Error: failed to map worker rings!\n");
+        free(pool);
+        return NULL;
+    }
+    pool->sharedMapping = mapping;
+
+    pool->workers = calloc(workerCount, sizeof(Worker));
+    if (!pool->workers) {
+        worker_pool_free(pool);
+        return NULL;
+    }
+    for (unsigned i = 0; i < workerCount; i++) {
+        pool->workers[i].ring = (WorkerRing *)(pool->sharedMapping + i * pool->ringSize);
+    }
+    return pool;
+}
+
+static Worker *worker_pool_find_worker(WorkerPool *pool, pid_t pid)
+{
+    for (unsigned i = 0; i < pool->workerCount; i++) {
+        if (pool->workers[i].pid == pid) return &pool->workers[i];
+    }
+    return NULL;
+}
+
+// Collect dead workers, blame the slot each one was working on and start a replacement
+static int worker_pool_reap(WorkerPool *pool, bool *progress)
+{
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        Worker *worker = worker_pool_find_worker(pool, pid);
+        if (!worker) continue;
+        worker->pid = 0;
+        *progress = true;
+        bool timedOut = worker->timedOut;
+        worker->timedOut = false;
+
+        WorkerRing *ring = worker->ring;
+        uint64_t done = atomic_load_explicit(&ring->done, memory_order_acquire);
+        uint64_t submitted = atomic_load_explicit(&ring->submitted, memory_order_relaxed);
+        // A worker that finished its slot just before the kill is not blamed, its replacement takes over the rest
+        bool blame = done < submitted && (!timedOut || done == worker->watchedDone);
+        if (blame) {
+            WorkerSlot *slot = &ring->slots[done % pool->depth];
+            char output[WORKER_POOL_PATH_MAX + 64];
+            int length = 0;
+            if (timedOut) {
+                length = snprintf(output, sizeof(output), "%s\t%s\ttimeout=%llums\n", slot->path, scan_status_to_string(SCAN_STATUS_CRASHED),
+                                  (unsigned long long)(pool->timeoutNanos / 1000000ULL));
+                pool->timeoutCount++;
+            }
+            else if (WIFSIGNALED(status)) {
+                length = snprintf(output, sizeof(output), "%s\t%s\tsignal=%d\n", slot->path, scan_status_to_string(SCAN_STATUS_CRASHED), WTERMSIG(status));
+                pool->crashCount++;
+            }
+            else {
+                length = snprintf(output, sizeof(output), "%s\t%s\texit=%d\n", slot->path, scan_status_to_string(SCAN_STATUS_CRASHED), WEXITSTATUS(status));
+                pool->crashCount++;
+            }
+            worker_pool_set_output(slot, output, length < (int)sizeof(output) ? (size_t)length : sizeof(output) - 1);
+            atomic_store_explicit(&ring->done, done + 1, memory_order_release);
+            done++;
+        }
+
+        // A closed and drained ring needs no worker anymore
+        if (done < submitted || !atomic_load_explicit(&ring->closed, memory_order_relaxed)) {
+            if (worker_pool_spawn(pool, worker) != 0) return -1;
+            pool->respawnCount++;
+        }
+    }
+    return 0;
+}
+
+// Kill workers that have been on the same slot for longer than the timeout, worker_pool_reap reports the slot
+static void worker_pool_check_timeouts(WorkerPool *pool, uint64_t now)
+{
+    if (!pool->timeoutNanos) return;
+    for (unsigned i = 0; i < pool->workerCount; i++) {
+        Worker *worker = &pool->workers[i];
+        if (worker->pid <= 0 || worker->timedOut) continue;
+        uint64_t done = atomic_load_explicit(&worker->ring->done, memory_order_acquire);
+        uint64_t submitted = atomic_load_explicit(&worker->ring->submitted, memory_order_relaxed);
+        if (done == submitted) {
+            worker->watchedSince = 0;
+            continue;
+        }
+        if (!worker->watchedSince || done != worker->watchedDone) {
+            worker->watchedDone = done;
+            worker->watchedSince = now;
+            continue;
+        }
+        if (now - worker->watchedSince > pool->timeoutNanos) {
+            kill(worker->pid, SIGKILL);
+            worker->timedOut = true;
+        }
+    }
+}
+
+static void worker_pool_print_records(WorkerPool *pool, bool *progress)
+{
+    FILE *output = pool->config.output;
+    for (unsigned i = 0; i < pool->workerCount; i++) {
+        Worker *worker = &pool->workers[i];
+        uint64_t done = atomic_load_explicit(&worker->ring->done, memory_order_acquire);
+        while (worker->consumed < done) {
+            WorkerSlot *slot = &worker->ring->slots[worker->consumed % pool->depth];
+            fwrite(slot->output, 1, slot->outputLength, output);
+            if (slot->outputTruncated) pool->truncatedCount++;
+            worker->consumed++;
+            *progress = true;
+        }
+    }
+}
+
+// The worker with the fewest files in flight that still has a free slot
+static Worker *worker_pool_pick_worker(WorkerPool *pool)
+{
+    Worker *best = NULL;
+    uint64_t bestInFlight = UINT64_MAX;
+    for (unsigned i = 0; i < pool->workerCount; i++) {
+        Worker *worker = &pool->workers[i];
+        uint64_t submitted = atomic_load_explicit(&worker->ring->submitted, memory_order_relaxed);
+        if (submitted - worker->consumed >= pool->depth) continue;
+        uint64_t inFlight = submitted - atomic_load_explicit(&worker->ring->done, memory_order_relaxed);
+        if (inFlight < bestInFlight) {
+            best = worker;
+            bestInFlight = inFlight;
+        }
+    }
+    return best;
+}
+
+int worker_pool_run_paths_from_file(WorkerPool *pool, FILE *input)
+{
+    pool->startTime = clock_now_ns();
+    pool->supervisor = getpid();
+    // Resolved once here and inherited, instead of every (re)spawned worker loading it again
+    evaluator_load();
+    int r = 0;
+    bool inputOpen = true, hasPending = false;
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLen = 0;
+    unsigned attempt = 0;
+    for (unsigned i = 0; i < pool->workerCount; i++) {
+        if (worker_pool_spawn(pool, &pool->workers[i]) != 0) {
+            r = -1;
+            goto shutdown;
+        }
+    }
+
+    while (true) {
+        bool progress = false;
+        worker_pool_print_records(pool, &progress);
+        worker_pool_check_timeouts(pool, clock_now_ns());
+        if (worker_pool_reap(pool, &progress) != 0) {
+            r = -1;
+            break;
+        }
+
+        while (inputOpen) {
+            if (!hasPending) {
+                lineLen = getdelim(&line, &lineCapacity, '\0', input);
+                if (lineLen <= 0) {
+                    inputOpen = false;
+                    for (unsigned i = 0; i < pool->workerCount; i++) {
+                        atomic_store_explicit(&pool->workers[i].ring->closed, true, memory_order_release);
+                    }
+                    break;
+                }
+                // The last path may not be terminated, getdelim returns it without the delimiter
+                if (line[lineLen - 1] == '\0') lineLen--;
+                if (lineLen == 0) continue;
+                pool->pathCount++;
+                if ((size_t)lineLen >= WORKER_POOL_PATH_MAX) {
+                    fprintf(pool->config.output, "%.*s\t%s\n", (int)lineLen, line, scan_status_to_string(SCAN_STATUS_OPEN_FAILED));
+                    continue;
+                }
+                hasPending = true;
+            }
+            Worker *worker = worker_pool_pick_worker(pool);
+            if (!worker) break;
+            uint64_t submitted = atomic_load_explicit(&worker->ring->submitted, memory_order_relaxed);
+            WorkerSlot *slot = &worker->ring->slots[submitted % pool->depth];
+            memcpy(slot->path, line, lineLen);
+            slot->path[lineLen] = '\0';
+            slot->pathLength = (uint32_t)lineLen;
+            atomic_store_explicit(&worker->ring->submitted, submitted + 1, memory_order_release);
+            hasPending = false;
+            progress = true;
+        }
+
+        if (!inputOpen) {
+            bool drained = true;
+            for (unsigned i = 0; i < pool->workerCount && drained; i++) {
+                drained = pool->workers[i].consumed == atomic_load_explicit(&pool->workers[i].ring->submitted, memory_order_relaxed);
+            }
+            if (drained) break;
+        }
+        if (progress) {
+            attempt = 0;
+        }
+        else {
+            worker_pool_backoff(&attempt);
+        }
+    }
+    free(line);
+
+shutdown:
+    // Workers leave on their own once their ring is closed and drained, after a failure (a fork that did not
+    // succeed, at startup or on respawn) the ones still running are killed and reaped instead
+    for (unsigned i = 0; i < pool->workerCount; i++) {
+        atomic_store_explicit(&pool->workers[i].ring->closed, true, memory_order_release);
+    }
+    for (unsigned i = 0; i < pool->workerCount; i++) {
+        Worker *worker = &pool->workers[i];
+        if (worker->pid > 0) {
+            if (r != 0) kill(worker->pid, SIGKILL);
+            waitpid(worker->pid, NULL, 0);
+            worker->pid = 0;
+        }
+    }
+    fflush(pool->config.output);
+    pool->endTime = clock_now_ns();
+    return r;
+}
+
+void worker_pool_print_stats(WorkerPool *pool, FILE *output)
+{
+    uint64_t elapsed = (pool->endTime ? pool->endTime : clock_now_ns()) - pool->startTime;
+    double seconds = (double)elapsed / 1e9;
+    fprintf(output, "workers: %u processes, %llu files in %.2f s (%.0f files/s), crashed %llu, timed out %llu, respawned %llu",
+            pool->workerCount, (unsigned long long)pool->pathCount, seconds, seconds > 0 ? (double)pool->pathCount / seconds : 0.0,
+            (unsigned long long)pool->crashCount, (unsigned long long)pool->timeoutCount, (unsigned long long)pool->respawnCount);
+    if (pool->truncatedCount) {
+        fprintf(output, ", truncated %llu", (unsigned long long)pool->truncatedCount);
+    }
+    fprintf(output, "\n");
+}
+
+void worker_pool_free(WorkerPool *pool)
+{
+    if (!pool) return;
+    if (pool->sharedMapping) munmap(pool->sharedMapping, pool->sharedSize);
+    free(pool->workers);
+    free(pool);
+}
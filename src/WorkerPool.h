@@ -0,0 +1,80 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#include "Pipeline.h"
+
+// Prefork pool of long-lived worker processes for crash isolation
+// Every worker owns a single-producer single-consumer ring in shared memory: the supervisor writes a path
+// into a slot, the worker runs the whole scan on it and writes the record into the same slot
+// A slot is only marked done after its record is complete, so when a worker dies the slot it was working
+// on is exactly the file that killed it. A worker that spends longer than the timeout on one slot is killed
+// the same way, so a hang in the evaluator costs one file instead of the whole scan
+
+#define WORKER_POOL_DEFAULT_DEPTH 4
+#define WORKER_POOL_PATH_MAX 4096
+#define WORKER_POOL_OUTPUT_MAX 16384
+#define WORKER_POOL_DEFAULT_TIMEOUT_MS 60000
+
+typedef struct WorkerSlot {
+    uint32_t pathLength;
+    uint32_t outputLength;
+    bool outputTruncated;
+    char path[WORKER_POOL_PATH_MAX];
+    char output[WORKER_POOL_OUTPUT_MAX];
+} WorkerSlot;
+
+typedef struct WorkerRing {
+    _Alignas(QUEUE_CACHELINE_SIZE) _Atomic uint64_t submitted; // written by the supervisor
+    _Alignas(QUEUE_CACHELINE_SIZE) _Atomic uint64_t done;      // written by the worker, or the supervisor after a crash
+    _Alignas(QUEUE_CACHELINE_SIZE) _Atomic bool closed;
+    WorkerSlot slots[];
+} WorkerRing;
+
+typedef struct Worker {
+    pid_t pid;
+    WorkerRing *ring; // points into the pool's shared mapping
+    uint64_t consumed; // records already printed, supervisor only
+    // Hang detection, supervisor only: the slot at the head of the ring and when it got there
+    uint64_t watchedDone;
+    uint64_t watchedSince;
+    bool timedOut; // killed for running past the timeout, not reaped yet
+} Worker;
+
+typedef struct WorkerPool {
+    PipelineConfig config;
+    unsigned workerCount;
+    unsigned depth;
+    Worker *workers;
+    uint8_t *sharedMapping;
+    size_t sharedSize;
+    size_t ringSize;
+    pid_t supervisor;
+    uint64_t timeoutNanos; // per slot, 0 for none
+
+    uint64_t startTime;
+    uint64_t endTime;
+    uint64_t pathCount;
+    uint64_t crashCount;
+    uint64_t timeoutCount;
+    uint64_t respawnCount;
+    uint64_t truncatedCount;
+} WorkerPool;
+
+// Uses the budget, audit, prescreen, trust cache, reader and output settings of config
+// Snapshots, tracing and retries need the records in-process and are not supported
+WorkerPool *worker_pool_init(const PipelineConfig *config, unsigned workerCount);
+
+// Feed NUL delimited paths, print every record to config->output and wait for all workers to exit
+int worker_pool_run_paths_from_file(WorkerPool *pool, FILE *input);
+
+void worker_pool_print_stats(WorkerPool *pool, FILE *output);
+
+void worker_pool_free(WorkerPool *pool);
+
+#endif // WORKER_POOL_H
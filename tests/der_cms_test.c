@@ -0,0 +1,290 @@
+#include <string.h>
+
+#include "Der.h"
+#include "Cms.h"
+#include "test.h"
+
+// Der reader and CMS parser on hand built SignedData blobs and on malformed and truncated variants of them
+
+typedef struct TestDer {
+    uint8_t data[2048];
+    size_t size;
+} TestDer;
+
+static void test_der_append_bytes(TestDer *der, uint8_t identifier, const void *bytes, size_t size)
+{
+    der->data[der->size++] = identifier;
+    if (size < 0x80) {
+        der->data[der->size++] = (uint8_t)size;
+    }
+    else {
+        der->data[der->size++] = 0x82;
+        der->data[der->size++] = (uint8_t)(size >> 8);
+        der->data[der->size++] = (uint8_t)size;
+    }
+    memcpy(der->data + der->size, bytes, size);
+    der->size += size;
+}
+
+static void test_der_append(TestDer *der, uint8_t identifier, const TestDer *content)
+{
+    test_der_append_bytes(der, identifier, content->data, content->size);
+}
+
+static const uint8_t gOidSignedData[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x07, 0x02 };
+static const uint8_t gOidData[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x07, 0x01 };
+static const uint8_t gOidMessageDigest[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x09, 0x04 };
+static const uint8_t gOidSigningTime[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x09, 0x05 };
+static const uint8_t gOidAppleHashAgilityV2[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x63, 0x64, 0x09, 0x02 };
+static const uint8_t gOidSha1[] = { 0x2b, 0x0e, 0x03, 0x02, 0x1a };
+static const uint8_t gOidSha256[] = { 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01 };
+static const uint8_t gOidRsa[] = { 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x01 };
+
+static void test_append_algorithm(TestDer *der, const uint8_t *oid, size_t oidSize)
+{
+    TestDer algorithm = { 0 };
+    test_der_append_bytes(&algorithm, 0x06, oid, oidSize);
+    test_der_append(der, 0x30, &algorithm);
+}
+
+static void test_append_attribute(TestDer *der, const uint8_t *oid, size_t oidSize, const TestDer *values)
+{
+    TestDer attribute = { 0 };
+    test_der_append_bytes(&attribute, 0x06, oid, oidSize);
+    test_der_append(&attribute, 0x31, values);
+    test_der_append(der, 0x30, &attribute);
+}
+
+static void test_append_certificate(TestDer *der, uint8_t serial, const TestDer *issuer)
+{
+    TestDer tbs = { 0 }, version = { 0 }, certificate = { 0 };
+    test_der_append_bytes(&version, 0x02, "\x02", 1);
+    test_der_append(&tbs, 0xa0, &version);
+    test_der_append_bytes(&tbs, 0x02, &serial, 1);
+    test_append_algorithm(&tbs, gOidRsa, sizeof(gOidRsa));
+    test_der_append(&tbs, 0x30, issuer);
+    test_der_append(&certificate, 0x30, &tbs);
+    test_append_algorithm(&certificate, gOidRsa, sizeof(gOidRsa));
+    test_der_append_bytes(&certificate, 0x03, "\x00\x01", 2);
+    test_der_append(der, 0x30, &certificate);
+}
+
+// ContentInfo with SignedData, two certificates (the second one issued the signer) and one or no SignerInfo
+static void test_build_signed_data(TestDer *out, bool withSigner)
+{
+    TestDer issuer = { 0 }, name = { 0 };
+    test_der_append_bytes(&name, 0x0c, "Test CA", 7);
+    test_der_append(&issuer, 0x31, &name);
+
+    TestDer attributes = { 0 }, values = { 0 };
+    uint8_t digest[32];
+    memset(digest, 0xab, sizeof(digest));
+    test_der_append_bytes(&values, 0x04, digest, sizeof(digest));
+    test_append_attribute(&attributes, gOidMessageDigest, sizeof(gOidMessageDigest), &values);
+    values.size = 0;
+    test_der_append_bytes(&values, 0x17, "250102030405Z", 13);
+    test_append_attribute(&attributes, gOidSigningTime, sizeof(gOidSigningTime), &values);
+    values.size = 0;
+    TestDer entry = { 0 };
+    test_der_append_bytes(&entry, 0x06, gOidSha1, sizeof(gOidSha1));
+    test_der_append_bytes(&entry, 0x04, digest, 20);
+    test_der_append(&values, 0x30, &entry);
+    entry.size = 0;
+    test_der_append_bytes(&entry, 0x06, gOidSha256, sizeof(gOidSha256));
+    test_der_append_bytes(&entry, 0x04, digest, 32);
+    test_der_append(&values, 0x30, &entry);
+    test_append_attribute(&attributes, gOidAppleHashAgilityV2, sizeof(gOidAppleHashAgilityV2), &values);
+
+    TestDer signerInfo = { 0 }, sid = { 0 }, issuerName = { 0 };
+    test_der_append_bytes(&signerInfo, 0x02, "\x01", 1);
+    test_der_append(&issuerName, 0x30, &issuer);
+    memcpy(sid.data, issuerName.data, issuerName.size);
+    sid.size = issuerName.size;
+    test_der_append_bytes(&sid, 0x02, "\x07", 1);
+    test_der_append(&signerInfo, 0x30, &sid);
+    test_append_algorithm(&signerInfo, gOidSha256, sizeof(gOidSha256));
+    test_der_append(&signerInfo, 0xa0, &attributes);
+    test_append_algorithm(&signerInfo, gOidRsa, sizeof(gOidRsa));
+    test_der_append_bytes(&signerInfo, 0x04, "\x01\x02\x03\x04", 4);
+
+    TestDer signedData = { 0 }, digestAlgorithms = { 0 }, encapContentInfo = { 0 }, certificates = { 0 }, signerInfos = { 0 };
+    test_der_append_bytes(&signedData, 0x02, "\x01", 1);
+    test_append_algorithm(&digestAlgorithms, gOidSha256, sizeof(gOidSha256));
+    test_der_append(&signedData, 0x31, &digestAlgorithms);
+    test_der_append_bytes(&encapContentInfo, 0x06, gOidData, sizeof(gOidData));
+    test_der_append(&signedData, 0x30, &encapContentInfo);
+    test_append_certificate(&certificates, 0x05, &issuer);
+    test_append_certificate(&certificates, 0x07, &issuer);
+    test_der_append(&signedData, 0xa0, &certificates);
+    if (withSigner) test_der_append(&signerInfos, 0x30, &signerInfo);
+    test_der_append(&signedData, 0x31, &signerInfos);
+
+    TestDer content = { 0 }, explicitContent = { 0 }, contentInfo = { 0 };
+    test_der_append(&content, 0x30, &signedData);
+    test_der_append(&explicitContent, 0xa0, &content);
+    test_der_append_bytes(&contentInfo, 0x06, gOidSignedData, sizeof(gOidSignedData));
+    memcpy(contentInfo.data + contentInfo.size, explicitContent.data, explicitContent.size);
+    contentInfo.size += explicitContent.size;
+    out->size = 0;
+    test_der_append(out, 0x30, &contentInfo);
+}
+
+static void test_der_items(void)
+{
+    DerItem item;
+    const uint8_t primitive[] = { 0x04, 0x03, 'a', 'b', 'c' };
+    TEST_CHECK(der_read_item(primitive, sizeof(primitive), &item) == 0);
+    TEST_CHECK(item.contentSize == 3 && item.totalSize == 5 && !item.constructed);
+
+    // Content longer than the buffer, in short and long form
+    TEST_CHECK(der_read_item(primitive, sizeof(primitive) - 1, &item) != 0);
+    const uint8_t longLength[] = { 0x04, 0x82, 0xff, 0xff, 0x00 };
+    TEST_CHECK(der_read_item(longLength, sizeof(longLength), &item) != 0);
+    // Length of length wider than size_t or than the buffer
+    const uint8_t wideLength[] = { 0x04, 0x89, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+    TEST_CHECK(der_read_item(wideLength, sizeof(wideLength), &item) != 0);
+    const uint8_t cutLength[] = { 0x04, 0x84, 0x00 };
+    TEST_CHECK(der_read_item(cutLength, sizeof(cutLength), &item) != 0);
+    TEST_CHECK(der_read_item(primitive, 1, &item) != 0);
+    TEST_CHECK(der_read_item(NULL, 0, &item) != 0);
+
+    // High tag numbers are limited to four bytes
+    const uint8_t highTag[] = { 0x1f, 0x81, 0x01, 0x00 };
+    TEST_CHECK(der_read_item(highTag, sizeof(highTag), &item) == 0 && item.tag == 0x81);
+    const uint8_t longTag[] = { 0x1f, 0x81, 0x81, 0x81, 0x81, 0x01, 0x00 };
+    TEST_CHECK(der_read_item(longTag, sizeof(longTag), &item) != 0);
+    const uint8_t cutTag[] = { 0x1f, 0x81 };
+    TEST_CHECK(der_read_item(cutTag, sizeof(cutTag), &item) != 0);
+
+    // Indefinite lengths: constructed only, need an EOC and a bounded depth
+    const uint8_t indefinite[] = { 0x30, 0x80, 0x04, 0x01, 'x', 0x00, 0x00 };
+    TEST_CHECK(der_read_item(indefinite, sizeof(indefinite), &item) == 0);
+    TEST_CHECK(item.indefinite && item.contentSize == 3 && item.totalSize == sizeof(indefinite));
+    TEST_CHECK(der_read_item(indefinite, sizeof(indefinite) - 2, &item) != 0);
+    const uint8_t indefinitePrimitive[] = { 0x04, 0x80, 0x00, 0x00 };
+    TEST_CHECK(der_read_item(indefinitePrimitive, sizeof(indefinitePrimitive), &item) != 0);
+
+    uint8_t nested[2 * (DER_MAX_DEPTH + 2) * 2];
+    size_t depth = DER_MAX_DEPTH + 2;
+    for (size_t i = 0; i < depth; i++) {
+        nested[2 * i] = 0x30;
+        nested[2 * i + 1] = 0x80;
+    }
+    memset(nested + 2 * depth, 0, 2 * depth);
+    TEST_CHECK(der_read_item(nested, sizeof(nested), &item) != 0);
+    TEST_CHECK(der_read_item(nested + 2 * 3, sizeof(nested) - 2 * 3 * 2, &item) == 0);
+
+    // A child that overruns its parent
+    const uint8_t overrun[] = { 0x30, 0x03, 0x04, 0x05, 'a', 'b', 'c', 'd' };
+    DerReader reader;
+    DerItem child;
+    TEST_CHECK(der_read_item(overrun, sizeof(overrun), &item) == 0);
+    TEST_CHECK(der_reader_init_children(&reader, &item) == 0);
+    TEST_CHECK(der_reader_next(&reader, &child) == -1);
+    TEST_CHECK(der_read_item(primitive, sizeof(primitive), &item) == 0 && der_reader_init_children(&reader, &item) != 0);
+}
+
+static void test_der_time(void)
+{
+    DerItem item = { .tagClass = DER_CLASS_UNIVERSAL, .tag = DER_TAG_UTC_TIME };
+    int64_t seconds = 0;
+    item.content = (const uint8_t *)"700101000001Z";
+    item.contentSize = 13;
+    TEST_CHECK(der_parse_time(&item, &seconds) == 0 && seconds == 1);
+    item.content = (const uint8_t *)"491231235959Z";
+    TEST_CHECK(der_parse_time(&item, &seconds) == 0 && seconds == 2524607999LL);
+    item.content = (const uint8_t *)"701301000000Z";
+    TEST_CHECK(der_parse_time(&item, &seconds) != 0);
+    item.content = (const uint8_t *)"7001010000001";
+    TEST_CHECK(der_parse_time(&item, &seconds) != 0);
+    item.content = (const uint8_t *)"70010100000AZ";
+    TEST_CHECK(der_parse_time(&item, &seconds) != 0);
+    item.contentSize = 12;
+    TEST_CHECK(der_parse_time(&item, &seconds) != 0);
+
+    item.tag = DER_TAG_GENERALIZED_TIME;
+    item.content = (const uint8_t *)"20380119031408Z";
+    item.contentSize = 15;
+    TEST_CHECK(der_parse_time(&item, &seconds) == 0 && seconds == 2147483648LL);
+    item.constructed = true;
+    TEST_CHECK(der_parse_time(&item, &seconds) != 0);
+}
+
+static void test_cms_valid(void)
+{
+    TestDer blob;
+    CmsInfo info;
+    test_build_signed_data(&blob, true);
+    TEST_CHECK(cms_parse(blob.data, blob.size, &info) == CMS_PARSE_OK);
+    TEST_CHECK(info.signerCount == 1 && info.certificateCount == 2);
+    TEST_CHECK(info.digestAlgorithm == CMS_DIGEST_SHA256);
+    TEST_CHECK(info.messageDigest.size == 32 && info.messageDigest.data[0] == 0xab);
+    TEST_CHECK(info.hasSigningTime && info.signingTime == 1735787045LL);
+    TEST_CHECK(info.hasAgilityV2 && info.agilityV2Algorithm == CMS_DIGEST_SHA256 && info.agilityV2Digest.size == 32);
+    TEST_CHECK(info.signerSerial.size == 1 && info.signerSerial.data[0] == 0x07);
+
+    // The leaf is the certificate matching the signer, not the first one
+    DerItem leaf, tbs, version, serial;
+    DerReader reader;
+    TEST_CHECK(der_read_item(info.leafCertificate.data, info.leafCertificate.size, &leaf) == 0);
+    der_reader_init_children(&reader, &leaf);
+    TEST_CHECK(der_reader_next(&reader, &tbs) == 1);
+    der_reader_init_children(&reader, &tbs);
+    TEST_CHECK(der_reader_next(&reader, &version) == 1 && der_reader_next(&reader, &serial) == 1);
+    TEST_CHECK(serial.contentSize == 1 && serial.content[0] == 0x07);
+
+    CmsInfo again;
+    cms_parse(blob.data, blob.size, &again);
+    TEST_CHECK(cms_info_get_signer_id(&info) == cms_info_get_signer_id(&again));
+
+    test_build_signed_data(&blob, false);
+    TEST_CHECK(cms_parse(blob.data, blob.size, &info) == CMS_PARSE_NO_SIGNER);
+}
+
+static void test_cms_malformed(void)
+{
+    TestDer blob;
+    CmsInfo info;
+    TEST_CHECK(cms_parse(NULL, 0, &info) == CMS_PARSE_EMPTY);
+    TEST_CHECK(cms_parse((const uint8_t *)"", 0, &info) == CMS_PARSE_EMPTY);
+    const uint8_t garbage[] = { 0xde, 0xad, 0xbe, 0xef };
+    TEST_CHECK(cms_parse(garbage, sizeof(garbage), &info) == CMS_PARSE_MALFORMED);
+    const uint8_t emptySequence[] = { 0x30, 0x00 };
+    TEST_CHECK(cms_parse(emptySequence, sizeof(emptySequence), &info) == CMS_PARSE_MALFORMED);
+
+    test_build_signed_data(&blob, true);
+
+    // Every truncation is rejected, either by the outer length or by a child overrunning its parent
+    for (size_t size = 1; size < blob.size; size++) {
+        TEST_CHECK(cms_parse(blob.data, size, &info) == CMS_PARSE_MALFORMED);
+    }
+
+    // Wrong content type, the OID follows the outer header (long form length) and its own tag and length
+    TestDer wrongType = blob;
+    wrongType.data[4 + 2 + sizeof(gOidSignedData) - 1] ^= 0x01;
+    TEST_CHECK(cms_parse(wrongType.data, wrongType.size, &info) == CMS_PARSE_MALFORMED);
+
+    // Single bit flips may turn into anything, but never into an out of bounds read (run with a sanitizer)
+    // and never into an OK result whose slices point outside of the blob
+    for (size_t i = 0; i < blob.size; i++) {
+        for (unsigned bit = 0; bit < 8; bit++) {
+            TestDer flipped = blob;
+            flipped.data[i] ^= (uint8_t)(1 << bit);
+            if (cms_parse(flipped.data, flipped.size, &info) != CMS_PARSE_OK) continue;
+            const CmsSlice *slices[] = { &info.leafCertificate, &info.signerIssuer, &info.signerSerial, &info.messageDigest, &info.agilityV2Digest };
+            for (size_t s = 0; s < sizeof(slices) / sizeof(slices[0]); s++) {
+                if (!slices[s]->size) continue;
+                TEST_CHECK(slices[s]->data >= flipped.data && slices[s]->data + slices[s]->size <= flipped.data + flipped.size);
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    test_der_items();
+    test_der_time();
+    test_cms_valid();
+    test_cms_malformed();
+    return test_finish("der_cms_test");
+}
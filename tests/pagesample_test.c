@@ -0,0 +1,346 @@
+#include <string.h>
+#include <math.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <mach-o/loader.h>
+
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+
+#include "PageSample.h"
+#include "Hash.h"
+#include "CodeHash.h"
+#include "test.h"
+
+// Page sampling on generated thin arm64 binaries: fixed pages, escalation, the detection probability against the
+// observed detection rate over many seeds, and malformed code directories and layouts
+
+#define TEST_PAGE_SIZE 4096
+#define TEST_PAGE_COUNT 300
+#define TEST_ENTRY_OFFSET 0x5432 // page 5
+#define TEST_TEXT_OFFSET 0x3000  // page 3
+#define TEST_SEED_COUNT 4000
+// Room for the fields up to codeLimit64, zero unless a test sets them
+#define TEST_CODE_DIRECTORY_HEADER_SIZE (CODE_DIRECTORY_CODE_LIMIT_64_OFFSET + 8)
+
+static char gTestDirectory[] = "/tmp/pagesample_test.XXXXXX";
+
+typedef struct TestBinary {
+    uint8_t *data;
+    size_t size;
+    uint32_t codeLimit;
+    size_t codeDirectoryOffset; // offset of the code directory in data
+} TestBinary;
+
+static void test_put_big32(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+// mach_header_64, __TEXT with __text, LC_MAIN and LC_CODE_SIGNATURE, pseudo random code up to a codeLimit that ends
+// inside the last page, then a superblob with one SHA-256 code directory
+static void test_build_binary(TestBinary *binary, uint32_t pageCount, uint64_t entryOffset, uint32_t textOffset)
+{
+    uint32_t codeLimit = pageCount * TEST_PAGE_SIZE - 0x123;
+    const char identifier[] = "com.test";
+    uint32_t hashOffset = TEST_CODE_DIRECTORY_HEADER_SIZE + sizeof(identifier);
+    uint32_t codeDirectoryLength = hashOffset + pageCount * 32;
+    uint32_t superblobLength = sizeof(CS_SuperBlob) + sizeof(CS_BlobIndex) + codeDirectoryLength;
+    binary->size = codeLimit + superblobLength;
+    binary->data = calloc(1, binary->size);
+    binary->codeLimit = codeLimit;
+    binary->codeDirectoryOffset = codeLimit + sizeof(CS_SuperBlob) + sizeof(CS_BlobIndex);
+    uint8_t *data = binary->data;
+
+    uint64_t state = pageCount;
+    for (uint32_t i = 0; i < codeLimit; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        data[i] = (uint8_t)(state >> 56);
+    }
+
+    struct mach_header_64 header = { MH_MAGIC_64, 0x0100000c, 0, MH_EXECUTE, 3, 0, 0, 0 };
+    struct segment_command_64 segment = { LC_SEGMENT_64, sizeof(struct segment_command_64) + sizeof(struct section_64), SEG_TEXT,
+                                          0x100000000ULL, (uint64_t)pageCount * TEST_PAGE_SIZE, 0, (uint64_t)pageCount * TEST_PAGE_SIZE, 5, 5, 1, 0 };
+    struct section_64 section = { SECT_TEXT, SEG_TEXT, 0x100000000ULL + textOffset, 0x100, textOffset, 0, 0, 0, 0, 0, 0, 0 };
+    struct entry_point_command entry = { LC_MAIN, sizeof(struct entry_point_command), entryOffset, 0 };
+    struct linkedit_data_command signature = { LC_CODE_SIGNATURE, sizeof(struct linkedit_data_command), codeLimit, superblobLength };
+    header.sizeofcmds = segment.cmdsize + entry.cmdsize + signature.cmdsize;
+    uint8_t *cur = data;
+    memcpy(cur, &header, sizeof(header));
+    cur += sizeof(header);
+    memcpy(cur, &segment, sizeof(segment));
+    cur += sizeof(segment);
+    memcpy(cur, &section, sizeof(section));
+    cur += sizeof(section);
+    memcpy(cur, &entry, sizeof(entry));
+    cur += sizeof(entry);
+    memcpy(cur, &signature, sizeof(signature));
+
+    uint8_t *superblob = data + codeLimit;
+    test_put_big32(superblob + offsetof(CS_SuperBlob, magic), CSMAGIC_EMBEDDED_SIGNATURE);
+    test_put_big32(superblob + offsetof(CS_SuperBlob, length), superblobLength);
+    test_put_big32(superblob + offsetof(CS_SuperBlob, count), 1);
+    test_put_big32(superblob + sizeof(CS_SuperBlob) + offsetof(CS_BlobIndex, type), CSSLOT_CODEDIRECTORY);
+    test_put_big32(superblob + sizeof(CS_SuperBlob) + offsetof(CS_BlobIndex, offset), sizeof(CS_SuperBlob) + sizeof(CS_BlobIndex));
+
+    uint8_t *codeDirectory = data + binary->codeDirectoryOffset;
+    test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, magic), CSMAGIC_CODEDIRECTORY);
+    test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, length), codeDirectoryLength);
+    test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, version), 0x20100);
+    test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, hashOffset), hashOffset);
+    test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, identOffset), TEST_CODE_DIRECTORY_HEADER_SIZE);
+    test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, nCodeSlots), pageCount);
+    test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, codeLimit), codeLimit);
+    codeDirectory[offsetof(CS_CodeDirectory, hashSize)] = 32;
+    codeDirectory[offsetof(CS_CodeDirectory, hashType)] = CS_HASHTYPE_SHA256_256;
+    codeDirectory[offsetof(CS_CodeDirectory, pageSize)] = 12;
+    memcpy(codeDirectory + TEST_CODE_DIRECTORY_HEADER_SIZE, identifier, sizeof(identifier));
+    for (uint32_t i = 0; i < pageCount; i++) {
+        uint32_t pageEnd = (i + 1) * TEST_PAGE_SIZE < codeLimit ? (i + 1) * TEST_PAGE_SIZE : codeLimit;
+        hash_digest(HASH_ALGORITHM_SHA256, data + i * TEST_PAGE_SIZE, pageEnd - i * TEST_PAGE_SIZE, codeDirectory + hashOffset + i * 32);
+    }
+}
+
+static const char *test_write_binary(const char *name, const uint8_t *data, size_t size)
+{
+    static char path[256];
+    snprintf(path, sizeof(path), "%s/%s", gTestDirectory, name);
+    FILE *f = fopen(path, "wb");
+    if (!f) return NULL;
+    fwrite(data, 1, size, f);
+    fclose(f);
+    return path;
+}
+
+static PageSampleStatus test_verify(const char *name, const uint8_t *data, size_t size, const PageSampleConfig *config, PageSampleResult *result)
+{
+    page_sample_verify_path(test_write_binary(name, data, size), config, result);
+    return result->status;
+}
+
+static void test_detection_probability(void)
+{
+    TEST_CHECK(page_sample_detection_probability(100, 16, 0) == 0.0);
+    TEST_CHECK(page_sample_detection_probability(100, 0, 5) == 0.0);
+    TEST_CHECK(page_sample_detection_probability(0, 16, 1) == 0.0);
+    TEST_CHECK(fabs(page_sample_detection_probability(100, 16, 1) - 0.16) < 1e-12);
+    TEST_CHECK(page_sample_detection_probability(10, 16, 1) == 1.0);
+    TEST_CHECK(page_sample_detection_probability(10, 10, 1) == 1.0);
+    TEST_CHECK(page_sample_detection_probability(10, 5, 6) == 1.0); // every draw of 5 hits one of 6 pages
+    TEST_CHECK(page_sample_detection_probability(10, 4, 6) < 1.0);
+
+    // 1 - C(N - t, k) / C(N, k) for N = 100, k = 16, t = 10 is 1 - 0.1535...
+    double expected = 1.0;
+    for (int i = 0; i < 16; i++) expected *= (90.0 - i) / (100.0 - i);
+    TEST_CHECK(fabs(page_sample_detection_probability(100, 16, 10) - (1.0 - expected)) < 1e-12);
+
+    // More pages drawn or more pages modified never lowers the probability
+    for (uint64_t k = 1; k < 64; k++) {
+        TEST_CHECK(page_sample_detection_probability(1000, k + 1, 3) >= page_sample_detection_probability(1000, k, 3));
+        TEST_CHECK(page_sample_detection_probability(1000, 16, k + 1) >= page_sample_detection_probability(1000, 16, k));
+    }
+}
+
+static void test_sampling(const TestBinary *binary)
+{
+    PageSampleConfig config;
+    PageSampleResult result;
+    page_sample_config_init(&config);
+    config.seed = 1;
+
+    TEST_CHECK(test_verify("good", binary->data, binary->size, &config, &result) == PAGE_SAMPLE_OK);
+    TEST_CHECK(result.pageCount == TEST_PAGE_COUNT && result.hashType == CS_HASHTYPE_SHA256_256);
+    TEST_CHECK(result.sampledCount == 4 + PAGE_SAMPLE_DEFAULT_RANDOM_PAGES && result.hashedCount == result.sampledCount);
+    TEST_CHECK(!result.escalated && result.mismatches == 0);
+    TEST_CHECK(fabs(result.detectionProbability - 16.0 / (TEST_PAGE_COUNT - 4)) < 1e-9);
+
+    config.full = true;
+    TEST_CHECK(test_verify("good", binary->data, binary->size, &config, &result) == PAGE_SAMPLE_OK);
+    TEST_CHECK(result.sampledCount == TEST_PAGE_COUNT && result.hashedCount == TEST_PAGE_COUNT && result.detectionProbability == 1.0);
+    config.full = false;
+
+    // The fixed pages are always in the sample, a change to one of them always escalates
+    const size_t fixedOffsets[] = { 7, TEST_ENTRY_OFFSET, TEST_TEXT_OFFSET + 0x80, binary->codeLimit - 1 };
+    uint8_t *tampered = malloc(binary->size);
+    for (size_t i = 0; i < sizeof(fixedOffsets) / sizeof(fixedOffsets[0]); i++) {
+        memcpy(tampered, binary->data, binary->size);
+        tampered[fixedOffsets[i]] ^= 0x01;
+        for (uint64_t seed = 0; seed < 16; seed++) {
+            config.seed = seed;
+            TEST_CHECK(test_verify("fixed", tampered, binary->size, &config, &result) == PAGE_SAMPLE_TAMPERED);
+            TEST_CHECK(result.escalated && result.sampleMismatches == 1 && result.mismatches == 1);
+            TEST_CHECK(result.hashedCount == result.sampledCount + TEST_PAGE_COUNT);
+        }
+    }
+
+    // Escalation counts every bad page, not only the sampled ones
+    memcpy(tampered, binary->data, binary->size);
+    tampered[TEST_ENTRY_OFFSET] ^= 0x01;
+    for (uint32_t page = 100; page < 110; page++) tampered[page * TEST_PAGE_SIZE + 11] ^= 0x01;
+    config.seed = 1;
+    TEST_CHECK(test_verify("many", tampered, binary->size, &config, &result) == PAGE_SAMPLE_TAMPERED);
+    TEST_CHECK(result.escalated && result.mismatches == 11 && result.sampleMismatches >= 1 && result.sampleMismatches <= 11);
+
+    // A sample that covers every page needs no escalation
+    memcpy(tampered, binary->data, binary->size);
+    tampered[150 * TEST_PAGE_SIZE] ^= 0x01;
+    config.randomPages = TEST_PAGE_COUNT;
+    TEST_CHECK(test_verify("middle", tampered, binary->size, &config, &result) == PAGE_SAMPLE_TAMPERED);
+    TEST_CHECK(result.sampledCount == TEST_PAGE_COUNT && !result.escalated && result.mismatches == 1 && result.detectionProbability == 1.0);
+
+    // The same seed and path give the same sample
+    config.randomPages = PAGE_SAMPLE_DEFAULT_RANDOM_PAGES;
+    unsigned agreements = 0;
+    for (uint64_t seed = 0; seed < 64; seed++) {
+        PageSampleResult again;
+        config.seed = seed;
+        test_verify("middle", tampered, binary->size, &config, &result);
+        test_verify("middle", tampered, binary->size, &config, &again);
+        agreements += result.status == again.status && result.hashedCount == again.hashedCount;
+    }
+    TEST_CHECK(agreements == 64);
+
+    // Over many seeds a change to one page outside the fixed set is caught as often as predicted
+    const char *path = test_write_binary("middle", tampered, binary->size);
+    unsigned detected = 0;
+    double predicted = 0.0;
+    for (uint64_t seed = 0; seed < TEST_SEED_COUNT; seed++) {
+        config.seed = seed * 0x9e3779b97f4a7c15ULL;
+        page_sample_verify_path(path, &config, &result);
+        detected += result.status == PAGE_SAMPLE_TAMPERED;
+        predicted = result.detectionProbability;
+    }
+    double rate = (double)detected / TEST_SEED_COUNT;
+    double sigma = sqrt(predicted * (1.0 - predicted) / TEST_SEED_COUNT);
+    printf("detection rate %.4f, predicted %.4f\n", rate, predicted);
+    TEST_CHECK(fabs(rate - predicted) < 4.0 * sigma);
+    free(tampered);
+
+    // codeLimit64 takes over from codeLimit once the version has it and it is set, as it is for binaries over 4 GiB
+    uint8_t *limited = malloc(binary->size);
+    uint8_t *codeDirectory = limited + binary->codeDirectoryOffset;
+    for (unsigned variant = 0; variant < 4; variant++) {
+        memcpy(limited, binary->data, binary->size);
+        uint32_t version = variant == 3 ? 0x20200 : CODE_DIRECTORY_SUPPORTS_CODE_LIMIT_64;
+        uint64_t codeLimit64 = variant == 2 ? binary->codeLimit + TEST_PAGE_SIZE : binary->codeLimit;
+        test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, version), version);
+        test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, codeLimit), variant == 1 ? binary->codeLimit : 0);
+        test_put_big32(codeDirectory + CODE_DIRECTORY_CODE_LIMIT_64_OFFSET, (uint32_t)(codeLimit64 >> 32));
+        test_put_big32(codeDirectory + CODE_DIRECTORY_CODE_LIMIT_64_OFFSET + 4, (uint32_t)codeLimit64);
+        PageSampleStatus status = test_verify("limit64", limited, binary->size, &config, &result);
+        TEST_CHECK(status == (variant < 2 ? PAGE_SAMPLE_OK : PAGE_SAMPLE_MALFORMED));
+    }
+    free(limited);
+
+    // Binaries with fewer pages than the sample are checked completely
+    TestBinary small;
+    test_build_binary(&small, 3, 0x100, 0x200);
+    TEST_CHECK(test_verify("small", small.data, small.size, &config, &result) == PAGE_SAMPLE_OK);
+    TEST_CHECK(result.pageCount == 3 && result.sampledCount == 3 && result.detectionProbability == 1.0);
+    free(small.data);
+}
+
+static void test_malformed(const TestBinary *binary)
+{
+    PageSampleConfig config;
+    PageSampleResult result;
+    page_sample_config_init(&config);
+    uint8_t *copy = malloc(binary->size);
+    uint8_t *codeDirectory = copy + binary->codeDirectoryOffset;
+
+    // Code directory fields that do not describe the slice
+    for (unsigned field = 0; field < 7; field++) {
+        memcpy(copy, binary->data, binary->size);
+        switch (field) {
+            case 0: codeDirectory[offsetof(CS_CodeDirectory, hashSize)] = 0; break;
+            case 1: codeDirectory[offsetof(CS_CodeDirectory, hashSize)] = 64; break; // wider than SHA-256
+            case 2: codeDirectory[offsetof(CS_CodeDirectory, pageSize)] = 0; break;
+            case 3: codeDirectory[offsetof(CS_CodeDirectory, pageSize)] = 32; break;
+            case 4: test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, nCodeSlots), 0); break;
+            case 5: test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, nCodeSlots), 0x10000000); break; // slots past the blob
+            case 6: test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, codeLimit), (uint32_t)binary->size + 1); break;
+        }
+        TEST_CHECK(test_verify("field", copy, binary->size, &config, &result) == PAGE_SAMPLE_MALFORMED);
+    }
+
+    // A codeLimit past the last slot's page would leave code unchecked, one that ends before it an oversized page
+    memcpy(copy, binary->data, binary->size);
+    test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, nCodeSlots), TEST_PAGE_COUNT - 1);
+    TEST_CHECK(test_verify("limit", copy, binary->size, &config, &result) == PAGE_SAMPLE_MALFORMED);
+    memcpy(copy, binary->data, binary->size);
+    test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, codeLimit), (TEST_PAGE_COUNT - 1) * TEST_PAGE_SIZE);
+    TEST_CHECK(test_verify("limit", copy, binary->size, &config, &result) == PAGE_SAMPLE_MALFORMED);
+
+    // Broken signature containers
+    memcpy(copy, binary->data, binary->size);
+    copy[binary->codeLimit] ^= 0xff;
+    TEST_CHECK(test_verify("superblob", copy, binary->size, &config, &result) == PAGE_SAMPLE_NO_SIGNATURE);
+    memcpy(copy, binary->data, binary->size);
+    test_put_big32(copy + binary->codeLimit + offsetof(CS_SuperBlob, count), 0x10000000);
+    TEST_CHECK(test_verify("superblob", copy, binary->size, &config, &result) == PAGE_SAMPLE_NO_SIGNATURE);
+    memcpy(copy, binary->data, binary->size);
+    codeDirectory[0] ^= 0xff;
+    TEST_CHECK(test_verify("magic", copy, binary->size, &config, &result) == PAGE_SAMPLE_NO_CODE_DIRECTORY);
+    memcpy(copy, binary->data, binary->size);
+    codeDirectory[offsetof(CS_CodeDirectory, hashType)] = 0x7f; // never chosen as the best code directory
+    TEST_CHECK(test_verify("magic", copy, binary->size, &config, &result) == PAGE_SAMPLE_NO_CODE_DIRECTORY);
+    memcpy(copy, binary->data, binary->size);
+    test_put_big32(codeDirectory + offsetof(CS_CodeDirectory, length), 0x7fffffff);
+    TEST_CHECK(test_verify("length", copy, binary->size, &config, &result) == PAGE_SAMPLE_NO_CODE_DIRECTORY);
+
+    // No LC_CODE_SIGNATURE, or one pointing past the file
+    memcpy(copy, binary->data, binary->size);
+    ((struct mach_header_64 *)copy)->ncmds = 2;
+    TEST_CHECK(test_verify("unsigned", copy, binary->size, &config, &result) == PAGE_SAMPLE_NO_SIGNATURE);
+    memcpy(copy, binary->data, binary->size);
+    struct linkedit_data_command *signature = (struct linkedit_data_command *)(copy + sizeof(struct mach_header_64) +
+        sizeof(struct segment_command_64) + sizeof(struct section_64) + sizeof(struct entry_point_command));
+    signature->datasize = 0xffffff00;
+    TEST_CHECK(test_verify("signature", copy, binary->size, &config, &result) == PAGE_SAMPLE_NO_SIGNATURE);
+
+    // Load commands that overrun sizeofcmds are not followed
+    memcpy(copy, binary->data, binary->size);
+    ((struct mach_header_64 *)copy)->sizeofcmds = 0xfffffff0;
+    TEST_CHECK(test_verify("commands", copy, binary->size, &config, &result) != PAGE_SAMPLE_OK);
+
+    const char junk[] = "not a binary, not a binary, not a binary";
+    TEST_CHECK(test_verify("junk", (const uint8_t *)junk, sizeof(junk), &config, &result) == PAGE_SAMPLE_NOT_MACHO);
+    page_sample_verify_path("/nonexistent/binary", &config, &result);
+    TEST_CHECK(result.status == PAGE_SAMPLE_OPEN_FAILED);
+
+    // Truncated files never verify (run with a sanitizer to catch reads past the end)
+    for (size_t length = 0; length < binary->size; length += length < 4096 ? 97 : 4099) {
+        PageSampleStatus status = test_verify("truncated", binary->data, length, &config, &result);
+        TEST_CHECK(status != PAGE_SAMPLE_OK && status != PAGE_SAMPLE_TAMPERED);
+    }
+    TEST_CHECK(test_verify("truncated", binary->data, binary->size - 1, &config, &result) != PAGE_SAMPLE_OK);
+    free(copy);
+}
+
+int main(void)
+{
+    if (!mkdtemp(gTestDirectory)) {
+        printf("Error: failed to create %s!\n", gTestDirectory);
+        return 1;
+    }
+    TestBinary binary;
+    test_build_binary(&binary, TEST_PAGE_COUNT, TEST_ENTRY_OFFSET, TEST_TEXT_OFFSET);
+
+    test_detection_probability();
+    test_sampling(&binary);
+    test_malformed(&binary);
+    free(binary.data);
+
+    const char *names[] = { "good", "fixed", "many", "middle", "small", "field", "limit", "limit64", "superblob", "magic", "length",
+                            "unsigned", "signature", "commands", "junk", "truncated" };
+    char path[256];
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", gTestDirectory, names[i]);
+        unlink(path);
+    }
+    rmdir(gTestDirectory);
+    return test_finish("pagesample_test");
+}
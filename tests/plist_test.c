@@ -0,0 +1,163 @@
+#include <string.h>
+
+#include "Plist.h"
+#include "test.h"
+
+// XML plist reader on a CodeResources shaped document and on malformed variants of it
+
+static const char gTestPlist[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+    "<plist version=\"1.0\">\n"
+    "<dict>\n"
+    "\t<!-- comment -->\n"
+    "\t<key>files2</key>\n"
+    "\t<dict>\n"
+    "\t\t<key>Resources/a &amp; b.png</key>\n"
+    "\t\t<dict>\n"
+    "\t\t\t<key>hash2</key>\n"
+    "\t\t\t<data>\n"
+    "\t\t\tAAECAwQFBgcICQoLDA0ODxAREhMUFRYXGBkaGxwdHh8=\n"
+    "\t\t\t</data>\n"
+    "\t\t\t<key>optional</key>\n"
+    "\t\t\t<true/>\n"
+    "\t\t</dict>\n"
+    "\t\t<key>Resources/&#x4e2d;&#25991;.txt</key>\n"
+    "\t\t<dict>\n"
+    "\t\t\t<key>symlink</key>\n"
+    "\t\t\t<string>../target</string>\n"
+    "\t\t</dict>\n"
+    "\t</dict>\n"
+    "\t<key>rules</key>\n"
+    "\t<array>\n"
+    "\t\t<integer>-0x10</integer>\n"
+    "\t\t<real>1.5</real>\n"
+    "\t\t<date>2025-01-02T03:04:05Z</date>\n"
+    "\t\t<false></false>\n"
+    "\t\t<string/>\n"
+    "\t\t<array/>\n"
+    "\t</array>\n"
+    "\t<key></key>\n"
+    "\t<string>&lt;&gt;&quot;&apos;</string>\n"
+    "</dict>\n"
+    "</plist>\n";
+
+static PlistNode *test_parse(const char *xml)
+{
+    return plist_parse_xml(xml, strlen(xml));
+}
+
+static void test_valid(void)
+{
+    PlistNode *root = test_parse(gTestPlist);
+    TEST_CHECK(root && root->type == PLIST_DICT && root->childCount == 3);
+    if (!root) return;
+
+    PlistNode *files = plist_dict_get(root, "files2");
+    TEST_CHECK(files && files->type == PLIST_DICT && files->childCount == 2);
+    PlistNode *entry = plist_dict_get(files, "Resources/a & b.png");
+    TEST_CHECK(entry != NULL);
+    PlistNode *hash = plist_dict_get(entry, "hash2");
+    TEST_CHECK(hash && hash->type == PLIST_DATA && hash->dataSize == 32);
+    if (hash && hash->dataSize == 32) {
+        bool sequential = true;
+        for (unsigned i = 0; i < 32; i++) sequential &= hash->data[i] == i;
+        TEST_CHECK(sequential);
+    }
+    TEST_CHECK(plist_dict_get_bool(entry, "optional", false));
+    TEST_CHECK(plist_dict_get_bool(entry, "missing", true));
+    TEST_CHECK(plist_dict_get_bool(entry, "hash2", true));
+
+    PlistNode *unicode = plist_dict_get(files, "Resources/\xe4\xb8\xad\xe6\x96\x87.txt");
+    TEST_CHECK(unicode && !strcmp(plist_dict_get_string(unicode, "symlink"), "../target"));
+
+    PlistNode *rules = plist_dict_get(root, "rules");
+    TEST_CHECK(rules && rules->type == PLIST_ARRAY && rules->childCount == 6);
+    if (rules && rules->childCount == 6) {
+        TEST_CHECK(rules->children[0]->type == PLIST_INTEGER && rules->children[0]->integer == -16);
+        TEST_CHECK(rules->children[1]->type == PLIST_REAL && !strcmp(rules->children[1]->string, "1.5"));
+        TEST_CHECK(rules->children[2]->type == PLIST_DATE);
+        TEST_CHECK(rules->children[3]->type == PLIST_BOOL && !rules->children[3]->boolean);
+        TEST_CHECK(rules->children[4]->type == PLIST_STRING && !strcmp(rules->children[4]->string, ""));
+        TEST_CHECK(rules->children[5]->type == PLIST_ARRAY && rules->children[5]->childCount == 0);
+        TEST_CHECK(rules->children[0]->key == NULL);
+    }
+    TEST_CHECK(!strcmp(plist_dict_get_string(root, ""), "<>\"'"));
+    TEST_CHECK(plist_dict_get(rules, "files2") == NULL);
+    TEST_CHECK(plist_dict_get_string(root, "rules") == NULL);
+    plist_free(root);
+}
+
+static void test_malformed(void)
+{
+    const char *documents[] = {
+        "",
+        "<plist/>",
+        "<dict></dict>",
+        "<plist><dict></dict>",
+        "<plist><dict></array></plist>",
+        "<plist><dict><string>value</string></dict></plist>",          // value without a key
+        "<plist><dict><key>a</key></dict></plist>",                    // key without a value
+        "<plist><dict><key>a</key><string>b</key></dict></plist>",     // mismatched closing tag
+        "<plist><string>a &unknown; b</string></plist>",
+        "<plist><string>a & b</string></plist>",                       // unterminated entity
+        "<plist><string>&#0;</string></plist>",
+        "<plist><string>&#x110000;</string></plist>",
+        "<plist><string>&#;</string></plist>",
+        "<plist><data>AAE*</data></plist>",                            // not base64
+        "<plist><unknown>1</unknown></plist>",
+        "<plist><true>x</true></plist>",
+        "<plist></plist>",
+        "<plist><!-- unterminated comment </plist>",
+        "<?xml unterminated <plist><dict/></plist>",
+        "<plist><dict/>",
+    };
+    for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); i++) {
+        PlistNode *root = test_parse(documents[i]);
+        if (root) printf("unexpectedly parsed: %s\n", documents[i]);
+        TEST_CHECK(root == NULL);
+        plist_free(root);
+    }
+
+    // Nesting beyond PLIST_MAX_DEPTH is rejected, nesting up to it is not
+    char nested[16 + (PLIST_MAX_DEPTH + 2) * 16];
+    for (unsigned depth = PLIST_MAX_DEPTH; depth <= PLIST_MAX_DEPTH + 1; depth++) {
+        size_t length = (size_t)sprintf(nested, "<plist>");
+        for (unsigned i = 0; i <= depth; i++) length += (size_t)sprintf(nested + length, "<array>");
+        for (unsigned i = 0; i <= depth; i++) length += (size_t)sprintf(nested + length, "</array>");
+        sprintf(nested + length, "</plist>");
+        PlistNode *root = test_parse(nested);
+        TEST_CHECK((root != NULL) == (depth == PLIST_MAX_DEPTH));
+        plist_free(root);
+    }
+
+    // No truncation of a valid document parses (run with a sanitizer to catch reads past the end)
+    size_t size = strlen(gTestPlist);
+    for (size_t length = 0; length + 1 < size; length++) {
+        char *copy = malloc(length ? length : 1);
+        memcpy(copy, gTestPlist, length);
+        PlistNode *root = plist_parse_xml(copy, length);
+        TEST_CHECK(root == NULL);
+        plist_free(root);
+        free(copy);
+    }
+
+    // Byte changes anywhere may or may not parse, but must stay in bounds and free cleanly
+    const char replacements[] = { '<', '>', '/', '&', ';', '\0', '=' };
+    for (size_t i = 0; i < size; i++) {
+        for (size_t r = 0; r < sizeof(replacements); r++) {
+            char *copy = malloc(size);
+            memcpy(copy, gTestPlist, size);
+            copy[i] = replacements[r];
+            plist_free(plist_parse_xml(copy, size));
+            free(copy);
+        }
+    }
+}
+
+int main(void)
+{
+    test_valid();
+    test_malformed();
+    return test_finish("plist_test");
+}
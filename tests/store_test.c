@@ -0,0 +1,327 @@
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "Store.h"
+#include "test.h"
+
+// Results store round trip and segment validation on corrupted, truncated and mismatched segments
+
+#define TEST_RECORD_COUNT 100
+
+static char gTestDirectory[] = "/tmp/store_test.XXXXXX";
+
+// Store.c only needs this from the scan for printing, the rest of Scan.c is not linked in
+const char *scan_status_to_string(ScanStatus status)
+{
+    return status == SCAN_STATUS_OK ? "ok" : "other";
+}
+
+static void test_remove_segments(void)
+{
+    DIR *dir = opendir(gTestDirectory);
+    if (!dir) return;
+    struct dirent *entry;
+    char path[512];
+    while ((entry = readdir(dir)) != NULL) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        snprintf(path, sizeof(path), "%s/%s", gTestDirectory, entry->d_name);
+        unlink(path);
+    }
+    closedir(dir);
+}
+
+// Records i = 0..99: path /bin/tool<i>, team TEAM<i % 3> for even i only, identifier com.test.<i % 10>, cdhash byte 0 = i * 37 % 100
+static int test_write_segment(void)
+{
+    StoreWriter *writer = store_writer_init(gTestDirectory);
+    if (!writer) return -1;
+    int r = 0;
+    for (unsigned i = 0; i < TEST_RECORD_COUNT && r == 0; i++) {
+        ScanItem item;
+        memset(&item, 0, sizeof(item));
+        char path[64], teamId[16], identifier[32];
+        snprintf(path, sizeof(path), "/bin/tool%u", i);
+        snprintf(teamId, sizeof(teamId), "TEAM%u", i % 3);
+        snprintf(identifier, sizeof(identifier), "com.test.%u", i % 10);
+        item.path = path;
+        item.teamId = i % 2 == 0 ? teamId : NULL;
+        item.identifier = identifier;
+        item.status = SCAN_STATUS_OK;
+        item.policyFlags = i % 4;
+        item.hashAgilityVersion = i % 3;
+        item.hasCDHash = true;
+        // Ingest order differs from key order so the indexes are actually sorted
+        item.cdhash[0] = (uint8_t)((i * 37) % TEST_RECORD_COUNT);
+        r = store_writer_add_item(writer, &item);
+    }
+    if (r == 0) r = store_writer_finish(writer);
+    store_writer_free(writer);
+    return r;
+}
+
+static void test_count_callback(const StoreSegment *segment, const StoreRecord *record, void *context)
+{
+    (void)segment;
+    (void)record;
+    (*(uint64_t *)context)++;
+}
+
+static int test_count(const Store *store, const StoreQuery *query, uint64_t *countOut)
+{
+    *countOut = 0;
+    return store_query(store, query, test_count_callback, countOut, NULL);
+}
+
+static void test_round_trip(void)
+{
+    TEST_CHECK(test_write_segment() == 0);
+    Store *store = store_open(gTestDirectory);
+    TEST_CHECK(store && store->segmentCount == 1 && store->recordCount == TEST_RECORD_COUNT);
+    if (!store) return;
+
+    StoreQuery query;
+    uint64_t count = 0;
+    store_query_init(&query);
+    TEST_CHECK(test_count(store, &query, &count) == 0 && count == TEST_RECORD_COUNT);
+
+    store_query_init(&query);
+    TEST_CHECK(store_query_set_cdhash(&query, "2500000000000000000000000000000000000000") == 0);
+    TEST_CHECK(test_count(store, &query, &count) == 0 && count == 1);
+    TEST_CHECK(store_query_set_cdhash(&query, "ff00000000000000000000000000000000000000") == 0);
+    TEST_CHECK(test_count(store, &query, &count) == 0 && count == 0);
+    TEST_CHECK(store_query_set_cdhash(&query, "25") != 0);
+    TEST_CHECK(store_query_set_cdhash(&query, "zz00000000000000000000000000000000000000") != 0);
+
+    store_query_init(&query);
+    query.teamId = "TEAM1";
+    TEST_CHECK(test_count(store, &query, &count) == 0 && count == 16);
+    query.teamId = "TEAM";
+    TEST_CHECK(test_count(store, &query, &count) == 0 && count == 0);
+
+    store_query_init(&query);
+    query.identifier = "com.test.7";
+    TEST_CHECK(test_count(store, &query, &count) == 0 && count == 10);
+    query.policyAll = 0x3;
+    TEST_CHECK(test_count(store, &query, &count) == 0 && count == 5);
+
+    store_query_init(&query);
+    query.path = "/bin/tool42";
+    TEST_CHECK(test_count(store, &query, &count) == 0 && count == 1);
+    store_query_init(&query);
+    query.pathPrefix = "/bin/tool4";
+    TEST_CHECK(test_count(store, &query, &count) == 0 && count == 11);
+    query.hashAgilityVersion = 0;
+    TEST_CHECK(test_count(store, &query, &count) == 0 && count == 3);
+    store_free(store);
+}
+
+static const char *test_segment_path(char *path, size_t size)
+{
+    DIR *dir = opendir(gTestDirectory);
+    if (!dir) return NULL;
+    struct dirent *entry;
+    const char *found = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length > strlen(STORE_SEGMENT_SUFFIX) && !strcmp(entry->d_name + length - strlen(STORE_SEGMENT_SUFFIX), STORE_SEGMENT_SUFFIX)) {
+            snprintf(path, size, "%s/%s", gTestDirectory, entry->d_name);
+            found = path;
+            break;
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+static uint8_t *test_read_file(const char *path, size_t *sizeOut)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size);
+    if (data && fread(data, 1, size, f) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *sizeOut = (size_t)size;
+    return data;
+}
+
+static void test_write_file(const char *path, const void *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) return;
+    fwrite(data, 1, size, f);
+    fclose(f);
+}
+
+#define TEST_HEADER_CORRUPTION_COUNT 15
+
+// Every case breaks one of the checks store_segment_open makes on the header
+static void test_corrupt_header(StoreSegmentHeader *header, size_t size, unsigned corruption)
+{
+    switch (corruption) {
+        case 0: header->magic[7] = '2'; break;
+        case 1: header->version = STORE_SEGMENT_VERSION + 1; break;
+        case 2: header->recordSize = sizeof(StoreRecord) - 8; break;
+        case 3: header->recordsOffset = 8; break; // records overlapping the header
+        case 4: header->recordsOffset += 4; break; // misaligned records
+        case 5: header->recordsOffset = size + 8; break;
+        case 6: header->recordCount = size / sizeof(StoreRecord) + 1; break;
+        case 7: header->recordCount = UINT64_MAX / sizeof(StoreRecord) + 2; break; // overflows the size product
+        case 8: header->stringsOffset = size + 1; break;
+        case 9: header->stringsSize++; break;
+        case 10: header->stringsSize = UINT64_MAX; break;
+        case 11: header->indexOffsets[STORE_INDEX_PATH] += 2; break;
+        case 12: header->indexOffsets[STORE_INDEX_TEAM_ID] = size + 4; break;
+        case 13: header->indexCounts[STORE_INDEX_CDHASH] = header->recordCount + 1; break;
+        case 14:
+            header->indexOffsets[STORE_INDEX_CDHASH] = (size - 4) & ~(uint64_t)3;
+            header->indexCounts[STORE_INDEX_CDHASH] = 2;
+            break;
+    }
+}
+
+static void test_corrupt_headers(const uint8_t *segment, size_t size, const char *path)
+{
+    uint8_t *copy = malloc(size);
+    for (unsigned i = 0; i < TEST_HEADER_CORRUPTION_COUNT; i++) {
+        memcpy(copy, segment, size);
+        test_corrupt_header((StoreSegmentHeader *)copy, size, i);
+        test_write_file(path, copy, size);
+        Store *store = store_open(gTestDirectory);
+        if (store) printf("header corruption %u was accepted\n", i);
+        TEST_CHECK(store == NULL);
+        if (store) store_free(store);
+    }
+    free(copy);
+
+    // Every truncation leaves the strings (the last section) past the end of the file
+    for (size_t length = 0; length < size; length++) {
+        test_write_file(path, segment, length);
+        Store *store = store_open(gTestDirectory);
+        TEST_CHECK(store == NULL);
+        if (store) store_free(store);
+    }
+}
+
+static void test_corrupt_contents(const uint8_t *segment, size_t size, const char *path)
+{
+    const StoreSegmentHeader *header = (const StoreSegmentHeader *)segment;
+    uint8_t *copy = malloc(size);
+
+    // A record number past the records in an index is reported, not followed
+    memcpy(copy, segment, size);
+    uint32_t *cdhashIndex = (uint32_t *)(copy + header->indexOffsets[STORE_INDEX_CDHASH]);
+    cdhashIndex[header->indexCounts[STORE_INDEX_CDHASH] / 2] = TEST_RECORD_COUNT;
+    test_write_file(path, copy, size);
+    Store *store = store_open(gTestDirectory);
+    TEST_CHECK(store != NULL);
+    if (store) {
+        StoreQuery query;
+        uint64_t count = 0;
+        store_query_init(&query);
+        store_query_set_cdhash(&query, "0000000000000000000000000000000000000000");
+        TEST_CHECK(test_count(store, &query, &count) != 0);
+        store_free(store);
+    }
+
+    // String offsets and lengths outside of the string table, or without a terminator
+    memcpy(copy, segment, size);
+    StoreRecord *records = (StoreRecord *)(copy + header->recordsOffset);
+    records[0].pathOffset = header->stringsSize;
+    records[1].pathLength = (uint32_t)header->stringsSize;
+    records[2].pathOffset = UINT64_MAX;
+    records[3].identifierLength++;
+    records[4].teamIdOffset = header->stringsSize - 1;
+    test_write_file(path, copy, size);
+    store = store_open(gTestDirectory);
+    TEST_CHECK(store != NULL);
+    if (store) {
+        const StoreSegment *opened = &store->segments[0];
+        TEST_CHECK(store_record_get_path(opened, &opened->records[0]) == NULL);
+        TEST_CHECK(store_record_get_path(opened, &opened->records[1]) == NULL);
+        TEST_CHECK(store_record_get_path(opened, &opened->records[2]) == NULL);
+        TEST_CHECK(store_record_get_identifier(opened, &opened->records[3]) == NULL);
+        TEST_CHECK(store_record_get_team_id(opened, &opened->records[4]) == NULL);
+        TEST_CHECK(store_record_get_path(opened, &opened->records[5]) != NULL);
+
+        // Sequential queries skip them, indexed ones hit them during the search and report the index as corrupt
+        StoreQuery query;
+        uint64_t count = 0;
+        store_query_init(&query);
+        query.pathPrefix = "/bin/tool";
+        query.policyAll = 0;
+        TEST_CHECK(test_count(store, &query, &count) != 0 || count == TEST_RECORD_COUNT - 3);
+        store_query_init(&query);
+        query.evaluatedOnly = true;
+        TEST_CHECK(test_count(store, &query, &count) == 0 && count == TEST_RECORD_COUNT);
+
+        FILE *null = fopen("/dev/null", "w");
+        for (uint64_t i = 0; i < 5 && null; i++) {
+            store_record_print(opened, &opened->records[i], null);
+        }
+        if (null) fclose(null);
+        store_free(store);
+    }
+    free(copy);
+    test_write_file(path, segment, size);
+}
+
+static void test_directory_entries(void)
+{
+    // Segments still being written and unrelated files are skipped
+    char path[512];
+    snprintf(path, sizeof(path), "%s/.00000000000000000001-1.tmp", gTestDirectory);
+    test_write_file(path, "partial", 7);
+    snprintf(path, sizeof(path), "%s/notes.txt", gTestDirectory);
+    test_write_file(path, "notes", 5);
+    snprintf(path, sizeof(path), "%s/%s", gTestDirectory, STORE_SEGMENT_SUFFIX);
+    test_write_file(path, "", 0);
+    Store *store = store_open(gTestDirectory);
+    TEST_CHECK(store && store->segmentCount == 1);
+    if (store) store_free(store);
+
+    // A second segment is queried after the first one
+    TEST_CHECK(test_write_segment() == 0);
+    store = store_open(gTestDirectory);
+    TEST_CHECK(store && store->segmentCount == 2 && store->recordCount == 2 * TEST_RECORD_COUNT);
+    if (store) {
+        StoreQuery query;
+        uint64_t count = 0;
+        store_query_init(&query);
+        query.path = "/bin/tool7";
+        TEST_CHECK(test_count(store, &query, &count) == 0 && count == 2);
+        store_free(store);
+    }
+    TEST_CHECK(store_open("/nonexistent/store") == NULL);
+}
+
+int main(void)
+{
+    if (!mkdtemp(gTestDirectory)) {
+        printf("Error: failed to create %s!\n", gTestDirectory);
+        return 1;
+    }
+    test_round_trip();
+
+    char path[512];
+    size_t size = 0;
+    uint8_t *segment = test_segment_path(path, sizeof(path)) ? test_read_file(path, &size) : NULL;
+    TEST_CHECK(segment != NULL && size > sizeof(StoreSegmentHeader));
+    if (segment) {
+        test_corrupt_headers(segment, size, path);
+        test_corrupt_contents(segment, size, path);
+        test_directory_entries();
+        free(segment);
+    }
+
+    test_remove_segments();
+    rmdir(gTestDirectory);
+    return test_finish("store_test");
+}
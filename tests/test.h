@@ -0,0 +1,27 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// Minimal checks shared by the regression tests, a test binary prints every failed check and exits non-zero
+
+static unsigned gTestFailures = 0;
+
+#define TEST_CHECK(condition) do { \
+        if (!(condition)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            gTestFailures++; \
+        } \
+    } while (0)
+
+static inline int test_finish(const char *name)
+{
+    if (gTestFailures) {
+        printf("%s: %u checks failed\n", name, gTestFailures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif // TEST_H
@@ -0,0 +1,201 @@
+#include <string.h>
+#include <unistd.h>
+
+#include "TrustCache.h"
+#include "test.h"
+
+// Trust cache loading (v0, v1, v2 payloads and raw lists) and lookups, on well formed and malformed files
+
+#define TEST_ENTRY_COUNT 257
+
+static char gTestDirectory[] = "/tmp/trustcache_test.XXXXXX";
+
+// Deterministic pseudo random cdhashes, the low bytes also make consecutive entries unsorted
+static void test_cdhash(unsigned index, uint8_t *cdhash)
+{
+    uint64_t state = 0x9e3779b97f4a7c15ULL * (index + 1);
+    for (unsigned i = 0; i < TRUST_CACHE_CDHASH_LEN; i++) {
+        state ^= state >> 29;
+        state *= 0xbf58476d1ce4e5b9ULL;
+        cdhash[i] = (uint8_t)(state >> 56);
+    }
+}
+
+static int test_compare_cdhash(const void *a, const void *b)
+{
+    return memcmp(a, b, TRUST_CACHE_CDHASH_LEN);
+}
+
+static const char *test_write_file(const char *name, const void *data, size_t size)
+{
+    static char path[256];
+    snprintf(path, sizeof(path), "%s/%s", gTestDirectory, name);
+    FILE *f = fopen(path, "wb");
+    if (!f) return NULL;
+    fwrite(data, 1, size, f);
+    fclose(f);
+    return path;
+}
+
+static void test_put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+// Payload with count sorted entries of the given version, the extra bytes of v1 / v2 entries are filled with junk
+static size_t test_build_payload(uint8_t *out, uint32_t version, uint32_t count)
+{
+    static const uint32_t strides[] = { 20, 22, 24 };
+    uint8_t cdhashes[TEST_ENTRY_COUNT][TRUST_CACHE_CDHASH_LEN];
+    for (unsigned i = 0; i < count; i++) {
+        test_cdhash(i, cdhashes[i]);
+    }
+    qsort(cdhashes, count, TRUST_CACHE_CDHASH_LEN, test_compare_cdhash);
+
+    memset(out, 0, sizeof(TrustCacheHeader));
+    test_put_le32(out, version);
+    test_put_le32(out + 20, count);
+    uint8_t *entry = out + sizeof(TrustCacheHeader);
+    for (unsigned i = 0; i < count; i++) {
+        memset(entry, 0xee, strides[version]);
+        memcpy(entry, cdhashes[i], TRUST_CACHE_CDHASH_LEN);
+        entry += strides[version];
+    }
+    return (size_t)(entry - out);
+}
+
+static void test_check_lookups(TrustCacheSet *set, unsigned count, int expectedIndex)
+{
+    uint8_t cdhash[TRUST_CACHE_CDHASH_LEN];
+    unsigned found = 0;
+    for (unsigned i = 0; i < count; i++) {
+        test_cdhash(i, cdhash);
+        found += trust_cache_set_lookup(set, cdhash) == expectedIndex;
+    }
+    TEST_CHECK(found == count);
+
+    // Absent cdhashes, including neighbours of present ones and the extremes
+    unsigned absent = 0;
+    for (unsigned i = TEST_ENTRY_COUNT; i < TEST_ENTRY_COUNT + 1000; i++) {
+        test_cdhash(i, cdhash);
+        absent += trust_cache_set_lookup(set, cdhash) == -1;
+    }
+    TEST_CHECK(absent == 1000);
+    test_cdhash(0, cdhash);
+    cdhash[TRUST_CACHE_CDHASH_LEN - 1] ^= 0x01;
+    TEST_CHECK(trust_cache_set_lookup(set, cdhash) == -1);
+    memset(cdhash, 0x00, sizeof(cdhash));
+    TEST_CHECK(trust_cache_set_lookup(set, cdhash) == -1);
+    memset(cdhash, 0xff, sizeof(cdhash));
+    TEST_CHECK(trust_cache_set_lookup(set, cdhash) == -1);
+}
+
+static void test_versions(void)
+{
+    static uint8_t payload[sizeof(TrustCacheHeader) + TEST_ENTRY_COUNT * 24];
+    for (uint32_t version = 0; version <= 2; version++) {
+        // Counts around the powers of two the branch-free search halves through
+        const unsigned counts[] = { 1, 2, 3, 64, 255, TEST_ENTRY_COUNT };
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+            size_t size = test_build_payload(payload, version, counts[c]);
+            TrustCacheSet *set = trust_cache_set_init();
+            TEST_CHECK(trust_cache_set_add_file(set, test_write_file("payload", payload, size)) == 0);
+            TEST_CHECK(set->count == 1 && set->caches[0]->version == (int)version);
+            TEST_CHECK(trust_cache_set_get_entry_count(set) == counts[c]);
+            test_check_lookups(set, counts[c], 0);
+            TEST_CHECK(trust_cache_set_build_filter(set, TRUST_CACHE_DEFAULT_BLOOM_BITS) == 0);
+            test_check_lookups(set, counts[c], 0);
+            trust_cache_set_free(set);
+        }
+    }
+
+    // An empty payload is valid and contains nothing
+    size_t size = test_build_payload(payload, 2, 0);
+    TrustCacheSet *set = trust_cache_set_init();
+    TEST_CHECK(trust_cache_set_add_file(set, test_write_file("empty_payload", payload, size)) == 0);
+    TEST_CHECK(trust_cache_set_get_entry_count(set) == 0);
+    uint8_t cdhash[TRUST_CACHE_CDHASH_LEN] = { 0 };
+    TEST_CHECK(trust_cache_set_lookup(set, cdhash) == -1);
+    TEST_CHECK(trust_cache_set_build_filter(set, TRUST_CACHE_DEFAULT_BLOOM_BITS) == 0);
+    trust_cache_set_free(set);
+}
+
+static void test_raw_lists(void)
+{
+    // Unsorted raw cdhashes are sorted at load
+    static uint8_t raw[TEST_ENTRY_COUNT * TRUST_CACHE_CDHASH_LEN];
+    for (unsigned i = 0; i < TEST_ENTRY_COUNT; i++) {
+        test_cdhash(i, raw + i * TRUST_CACHE_CDHASH_LEN);
+    }
+    TrustCacheSet *set = trust_cache_set_init();
+    TEST_CHECK(trust_cache_set_add_file(set, test_write_file("raw", raw, sizeof(raw))) == 0);
+    TEST_CHECK(set->caches[0]->version == -1 && set->caches[0]->sortedCopy != NULL);
+    test_check_lookups(set, TEST_ENTRY_COUNT, 0);
+
+    // The first cache containing the cdhash wins
+    TEST_CHECK(trust_cache_set_add_file(set, test_write_file("raw_again", raw, 10 * TRUST_CACHE_CDHASH_LEN)) == 0);
+    test_check_lookups(set, TEST_ENTRY_COUNT, 0);
+    TEST_CHECK(trust_cache_set_get_path(set, 1) != NULL && trust_cache_set_get_path(set, 2) == NULL && trust_cache_set_get_path(set, -1) == NULL);
+    trust_cache_set_free(set);
+}
+
+static void test_malformed(void)
+{
+    static uint8_t payload[sizeof(TrustCacheHeader) + TEST_ENTRY_COUNT * 24 + 1];
+    TrustCacheSet *set = trust_cache_set_init();
+
+    TEST_CHECK(trust_cache_set_add_file(set, test_write_file("zero", payload, 0)) != 0);
+    TEST_CHECK(trust_cache_set_add_file(set, "/nonexistent/trustcache") != 0);
+
+    // A payload with a byte missing or one too many is neither a payload nor a raw list
+    size_t size = test_build_payload(payload, 1, 3);
+    TEST_CHECK(trust_cache_set_add_file(set, test_write_file("short", payload, size - 1)) != 0);
+    TEST_CHECK(trust_cache_set_add_file(set, test_write_file("long", payload, size + 1)) != 0);
+
+    // Entry counts that do not match the size, including ones that would overflow a 32 bit product
+    const uint32_t counts[] = { 4, 2, 0xffffffff, 0x80000000 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        test_put_le32(payload + 20, counts[i]);
+        TEST_CHECK(trust_cache_set_add_file(set, test_write_file("count", payload, size)) != 0);
+    }
+
+    // Unknown versions are not taken as a header, and the header makes the size no multiple of a cdhash
+    size = test_build_payload(payload, 0, 5);
+    test_put_le32(payload, 3);
+    TEST_CHECK(trust_cache_set_add_file(set, test_write_file("version", payload, size)) != 0);
+    TEST_CHECK(set->count == 0);
+
+    // A raw list that starts like a v0 header is only taken as one if the entry count matches the size
+    memset(payload, 0, 6 * TRUST_CACHE_CDHASH_LEN);
+    test_put_le32(payload + 20, 4);
+    TEST_CHECK(trust_cache_set_add_file(set, test_write_file("version", payload, 6 * TRUST_CACHE_CDHASH_LEN)) == 0);
+    TEST_CHECK(set->count == 1 && set->caches[0]->version == -1 && set->caches[0]->entryCount == 6);
+
+    // Shorter than a header but a whole cdhash
+    TEST_CHECK(trust_cache_set_add_file(set, test_write_file("tiny", payload + sizeof(TrustCacheHeader), TRUST_CACHE_CDHASH_LEN)) == 0);
+    TEST_CHECK(set->count == 2 && set->caches[1]->entryCount == 1);
+    trust_cache_set_free(set);
+}
+
+int main(void)
+{
+    if (!mkdtemp(gTestDirectory)) {
+        printf("Error: failed to create %s!\n", gTestDirectory);
+        return 1;
+    }
+    test_versions();
+    test_raw_lists();
+    test_malformed();
+
+    const char *names[] = { "payload", "empty_payload", "raw", "raw_again", "zero", "short", "long", "count", "version", "tiny" };
+    char path[256];
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", gTestDirectory, names[i]);
+        unlink(path);
+    }
+    rmdir(gTestDirectory);
+    return test_finish("trustcache_test");
+}
@@ -0,0 +1,68 @@
+#include "CoreTrust.h"
+#include "Cms.h"
+
+// Stand-in for CTEvaluateAMFICodeSignatureCMS where CoreTrust does not exist (Linux)
+// Only the CMS structure is checked: no signature, certificate chain or detached data is verified
+// and no policy is ever matched, so policyFlags is always 0
+
+#define STANDIN_ERROR_MALFORMED 0x1
+#define STANDIN_ERROR_NO_SIGNER 0x2
+
+static CoreTrustDigestType standin_digest_type(CmsDigestAlgorithm algorithm)
+{
+    switch (algorithm) {
+        case CMS_DIGEST_SHA1:
+            return CORETRUST_DIGEST_TYPE_SHA1;
+        case CMS_DIGEST_SHA256:
+            return CORETRUST_DIGEST_TYPE_SHA256;
+        case CMS_DIGEST_SHA384:
+            return CORETRUST_DIGEST_TYPE_SHA384;
+        case CMS_DIGEST_SHA512:
+            return CORETRUST_DIGEST_TYPE_SHA512;
+        default:
+            return 0;
+    }
+}
+
+__attribute__((visibility("default")))
+CT_int CTEvaluateAMFICodeSignatureCMS(
+    const CT_uint8_t *cmsData, CT_size_t cmsLen,
+    const CT_uint8_t *detachedData, CT_size_t detachedDataLen,
+    CT_bool allow_test_hierarchy,
+    const CT_uint8_t **leafCert, CT_size_t *leafCertLen,
+    CoreTrustPolicyFlags *policyFlags,
+    CoreTrustDigestType *cmsDigestType,
+    CoreTrustDigestType *hashAgilityDigestType,
+    const CT_uint8_t **digestData, CT_size_t *digestLen)
+{
+    (void)detachedData;
+    (void)detachedDataLen;
+    (void)allow_test_hierarchy;
+
+    *leafCert = NULL;
+    *leafCertLen = 0;
+    *policyFlags = 0;
+    *cmsDigestType = 0;
+    *hashAgilityDigestType = 0;
+    *digestData = NULL;
+    *digestLen = 0;
+
+    CmsInfo info;
+    CmsParseResult result = cms_parse(cmsData, cmsLen, &info);
+    if (result == CMS_PARSE_NO_SIGNER) return STANDIN_ERROR_NO_SIGNER;
+    if (result != CMS_PARSE_OK) return STANDIN_ERROR_MALFORMED;
+
+    *leafCert = info.leafCertificate.data;
+    *leafCertLen = info.leafCertificate.size;
+    *cmsDigestType = standin_digest_type(info.digestAlgorithm);
+    if (info.hasAgilityV2) {
+        *hashAgilityDigestType = standin_digest_type(info.agilityV2Algorithm);
+        *digestData = info.agilityV2Digest.data;
+        *digestLen = info.agilityV2Digest.size;
+    }
+    else if (info.hasAgilityV1) {
+        *digestData = info.agilityV1.data;
+        *digestLen = info.agilityV1.size;
+    }
+    return 0;
+}
@@ -0,0 +1,637 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <choma/MachO.h>
+#include <choma/FAT.h>
+#include <choma/MemoryStream.h>
+#include <choma/FileStream.h>
+#include <choma/CSBlob.h>
+#include <choma/CodeDirectory.h>
+#include <choma/MachOByteOrder.h>
+
+#include "CodeHash.h"
+
+// Synthetic signed Mach-O generator for load and scale testing
+// Every file is derived from (seed, index) only, so a corpus can be regenerated bit for bit anywhere
+
+#define CORPUS_PAGE_SIZE 0x4000
+#define CORPUS_PAGE_SHIFT 14
+#define CORPUS_SPECIAL_SLOTS 7
+#define CORPUS_MAX_SLICES 7
+#define CORPUS_MAX_CODE_DIRECTORIES 5
+// Pages past this are left as holes in a sparse file, a 2 GB code limit should not cost 2 GB of writes
+#define CORPUS_MAX_FILLED_SIZE (64 * 1024 * 1024)
+#define CORPUS_TEXT_VMADDR 0x100000000ULL
+#define CS_ADHOC 0x2
+
+typedef struct CorpusRange {
+    uint64_t min;
+    uint64_t max;
+} CorpusRange;
+
+typedef struct CorpusProfile {
+    const char *name;
+    CorpusRange slices;
+    CorpusRange codeSize;
+    CorpusRange codeDirectories;
+    CorpusRange entitlementsSize;
+    CorpusRange loadCommands;
+} CorpusProfile;
+
+static const CorpusProfile gProfiles[] = {
+    { "tiny",  { 1, 1 }, { 0x4000, 0x10000 },          { 1, 1 }, { 0, 0 },          { 0, 4 } },
+    { "small", { 1, 2 }, { 0x10000, 0x400000 },        { 1, 2 }, { 0, 0x1000 },     { 4, 32 } },
+    { "mixed", { 1, 4 }, { 0x4000, 0x4000000 },        { 1, 5 }, { 0, 0x10000 },    { 0, 128 } },
+    { "fat",   { 2, 7 }, { 0x4000, 0x100000 },         { 1, 2 }, { 0, 0x1000 },     { 4, 16 } },
+    { "huge",  { 1, 1 }, { 0x40000000, 0x80000000 },   { 1, 5 }, { 0x10000, 0x100000 }, { 64, 512 } },
+};
+
+typedef struct CorpusSliceArch {
+    cpu_type_t cputype;
+    cpu_subtype_t cpusubtype;
+} CorpusSliceArch;
+
+static const CorpusSliceArch gSliceArchs[CORPUS_MAX_SLICES] = {
+    { CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64_ALL },
+    { CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64E },
+    { CPU_TYPE_X86_64, CPU_SUBTYPE_X86_64_ALL },
+    { CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64_V8 },
+    { CPU_TYPE_X86_64, 8 }, // x86_64h
+    { CPU_TYPE_ARM64, CPU_SUBTYPE_ARM64E | 0x80000000 },
+    { CPU_TYPE_ARM64, 3 },
+};
+
+static const uint8_t gHashTypes[] = { CS_HASHTYPE_SHA256_256, CS_HASHTYPE_SHA160_160, CS_HASHTYPE_SHA384_384, CS_HASHTYPE_SHA256_160 };
+
+typedef struct CorpusConfig {
+    CorpusProfile profile;
+    const char *outputDir;
+    uint64_t seed;
+    uint64_t count;
+    unsigned threadCount;
+    uint8_t *cmsData; // NULL for ad-hoc signatures
+    size_t cmsLen;
+} CorpusConfig;
+
+typedef struct CorpusWorker {
+    const CorpusConfig *config;
+    unsigned index;
+    uint64_t generated;
+    uint64_t failed;
+    pthread_t thread;
+} CorpusWorker;
+
+// splitmix64, the state of every file is seeded from (seed, index) so threads never share a generator
+static uint64_t corpus_random_next(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t corpus_random_range(uint64_t *state, CorpusRange range)
+{
+    if (range.max <= range.min) return range.min;
+    return range.min + corpus_random_next(state) % (range.max - range.min + 1);
+}
+
+static void corpus_random_fill(uint64_t *state, uint8_t *buf, size_t size)
+{
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t value = corpus_random_next(state);
+        memcpy(buf + i, &value, sizeof(value));
+    }
+    uint64_t value = corpus_random_next(state);
+    memcpy(buf + i, &value, size - i);
+}
+
+static uint64_t corpus_align(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static CS_GenericBlob *corpus_generic_blob_create(uint32_t magic, const void *data, size_t size)
+{
+    CS_GenericBlob *blob = malloc(sizeof(CS_GenericBlob) + size);
+    if (!blob) return NULL;
+    blob->magic = HOST_TO_BIG(magic);
+    blob->length = HOST_TO_BIG((uint32_t)(sizeof(CS_GenericBlob) + size));
+    if (size) memcpy(blob->data, data, size);
+    return blob;
+}
+
+static CS_DecodedBlob *corpus_entitlements_create(uint64_t *state, size_t targetSize)
+{
+    static const char *header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+        "<plist version=\"1.0\">\n<dict>\n";
+    static const char *footer = "</dict>\n</plist>\n";
+
+    size_t capacity = strlen(header) + strlen(footer) + targetSize + 128;
+    char *plist = malloc(capacity);
+    if (!plist) return NULL;
+    size_t len = snprintf(plist, capacity, "%s", header);
+    while (len + strlen(footer) < targetSize) {
+        len += snprintf(plist + len, capacity - len, "\t<key>com.corpus.entitlement.%016llx</key>\n\t<true/>\n", (unsigned long long)corpus_random_next(state));
+    }
+    len += snprintf(plist + len, capacity - len, "%s", footer);
+
+    CS_GenericBlob *blob = corpus_generic_blob_create(CSMAGIC_EMBEDDED_ENTITLEMENTS, plist, len);
+    free(plist);
+    if (!blob) return NULL;
+    CS_DecodedBlob *decodedBlob = csd_blob_init(CSSLOT_ENTITLEMENTS, blob);
+    free(blob);
+    return decodedBlob;
+}
+
+static CS_DecodedBlob *corpus_code_directory_create(uint8_t hashType, uint32_t slot, uint64_t codeLimit, bool adhoc, const char *identifier, const char *teamID)
+{
+    uint8_t hashSize = code_hash_type_get_size(hashType);
+    uint32_t nCodeSlots = (uint32_t)((codeLimit + CORPUS_PAGE_SIZE - 1) >> CORPUS_PAGE_SHIFT);
+    size_t identLen = strlen(identifier) + 1;
+    size_t teamLen = strlen(teamID) + 1;
+
+    uint32_t identOffset = sizeof(CS_CodeDirectory);
+    uint32_t teamOffset = identOffset + identLen;
+    uint32_t hashOffset = teamOffset + teamLen + CORPUS_SPECIAL_SLOTS * hashSize;
+    uint32_t length = hashOffset + nCodeSlots * hashSize;
+
+    uint8_t *buf = calloc(1, length);
+    if (!buf) return NULL;
+    CS_CodeDirectory *codeDir = (CS_CodeDirectory *)buf;
+    codeDir->magic = CSMAGIC_CODEDIRECTORY;
+    codeDir->length = length;
+    codeDir->version = 0x20100;
+    codeDir->flags = adhoc ? CS_ADHOC : 0;
+    codeDir->hashOffset = hashOffset;
+    codeDir->identOffset = identOffset;
+    codeDir->nSpecialSlots = CORPUS_SPECIAL_SLOTS;
+    codeDir->nCodeSlots = nCodeSlots;
+    codeDir->codeLimit = (uint32_t)codeLimit;
+    codeDir->hashSize = hashSize;
+    codeDir->hashType = hashType;
+    codeDir->pageSize = CORPUS_PAGE_SHIFT;
+    codeDir->teamOffset = teamOffset;
+    CODE_DIRECTORY_APPLY_BYTE_ORDER(codeDir, HOST_TO_BIG_APPLIER);
+    memcpy(buf + identOffset, identifier, identLen);
+    memcpy(buf + teamOffset, teamID, teamLen);
+
+    CS_DecodedBlob *blob = csd_blob_init(slot, (CS_GenericBlob *)buf);
+    free(buf);
+    return blob;
+}
+
+// Special slots are hashed here, csd_code_directory_update only takes care of the code slots
+static void corpus_code_directory_update_special_slots(CS_DecodedBlob *codeDirBlob, CS_DecodedSuperBlob *superblob)
+{
+    CS_CodeDirectory codeDir;
+    csd_blob_read(codeDirBlob, 0, sizeof(codeDir), &codeDir);
+    CODE_DIRECTORY_APPLY_BYTE_ORDER(&codeDir, BIG_TO_HOST_APPLIER);
+
+    for (CS_DecodedBlob *blob = superblob->firstBlob; blob; blob = blob->next) {
+        uint32_t type = csd_blob_get_type(blob);
+        if (type == CSSLOT_CODEDIRECTORY || type > CORPUS_SPECIAL_SLOTS) continue;
+
+        size_t size = csd_blob_get_size(blob);
+        uint8_t *data = malloc(size);
+        if (!data) continue;
+        csd_blob_read(blob, 0, size, data);
+        uint8_t hash[HASH_MAX_DIGEST_SIZE];
+        code_hash_digest(codeDir.hashType, data, size, hash);
+        free(data);
+        csd_blob_write(codeDirBlob, codeDir.hashOffset - type * codeDir.hashSize, codeDir.hashSize, hash);
+    }
+}
+
+static uint32_t corpus_rpath_command_size(void)
+{
+    return corpus_align(sizeof(struct rpath_command) + sizeof("@loader_path/../Frameworks/0000000000000000"), 8);
+}
+
+static uint32_t corpus_commands_size(uint32_t fillerCount)
+{
+    return sizeof(struct segment_command_64) * 2 + sizeof(struct section_64) +
+           sizeof(struct build_version_command) + sizeof(struct entry_point_command) +
+           sizeof(struct linkedit_data_command) + fillerCount * corpus_rpath_command_size();
+}
+
+// Everything up to the code signature is code, so the headers have to fit into the code limit
+static uint64_t corpus_code_size(uint64_t codeSize, uint32_t fillerCount)
+{
+    uint64_t textOffset = corpus_align(sizeof(struct mach_header_64) + corpus_commands_size(fillerCount), 16);
+    return corpus_align(codeSize > textOffset ? codeSize : textOffset + 1, CORPUS_PAGE_SIZE);
+}
+
+static int corpus_write_macho_template(const char *path, uint64_t *state, const CorpusSliceArch *arch, uint64_t codeSize, uint32_t fillerCount, uint32_t signatureSize)
+{
+    uint32_t commandsSize = corpus_commands_size(fillerCount);
+    uint32_t rpathCommandSize = corpus_rpath_command_size();
+    uint64_t textOffset = corpus_align(sizeof(struct mach_header_64) + commandsSize, 16);
+    uint64_t filledSize = codeSize < CORPUS_MAX_FILLED_SIZE ? codeSize : CORPUS_MAX_FILLED_SIZE;
+
+    uint8_t *buf = calloc(1, filledSize);
+    if (!buf) return -1;
+    corpus_random_fill(state, buf + textOffset, filledSize - textOffset);
+
+    struct mach_header_64 *header = (struct mach_header_64 *)buf;
+    header->magic = MH_MAGIC_64;
+    header->cputype = arch->cputype;
+    header->cpusubtype = arch->cpusubtype;
+    header->filetype = MH_EXECUTE;
+    header->ncmds = 6 + fillerCount;
+    header->sizeofcmds = commandsSize;
+    header->flags = MH_PIE;
+    uint8_t *cur = buf + sizeof(struct mach_header_64);
+
+    struct segment_command_64 *text = (struct segment_command_64 *)cur;
+    text->cmd = LC_SEGMENT_64;
+    text->cmdsize = sizeof(struct segment_command_64) + sizeof(struct section_64);
+    strncpy(text->segname, "__TEXT", sizeof(text->segname));
+    text->vmaddr = CORPUS_TEXT_VMADDR;
+    text->vmsize = codeSize;
+    text->fileoff = 0;
+    text->filesize = codeSize;
+    text->maxprot = text->initprot = VM_PROT_READ | VM_PROT_EXECUTE;
+    text->nsects = 1;
+    struct section_64 *textSection = (struct section_64 *)(cur + sizeof(struct segment_command_64));
+    strncpy(textSection->sectname, "__text", sizeof(textSection->sectname));
+    strncpy(textSection->segname, "__TEXT", sizeof(textSection->segname));
+    textSection->addr = CORPUS_TEXT_VMADDR + textOffset;
+    textSection->size = codeSize - textOffset;
+    textSection->offset = (uint32_t)textOffset;
+    textSection->align = 4;
+    cur += text->cmdsize;
+
+    struct segment_command_64 *linkedit = (struct segment_command_64 *)cur;
+    linkedit->cmd = LC_SEGMENT_64;
+    linkedit->cmdsize = sizeof(struct segment_command_64);
+    strncpy(linkedit->segname, "__LINKEDIT", sizeof(linkedit->segname));
+    linkedit->vmaddr = CORPUS_TEXT_VMADDR + codeSize;
+    linkedit->vmsize = corpus_align(signatureSize, CORPUS_PAGE_SIZE);
+    linkedit->fileoff = codeSize;
+    linkedit->filesize = signatureSize;
+    linkedit->maxprot = linkedit->initprot = VM_PROT_READ;
+    cur += linkedit->cmdsize;
+
+    struct build_version_command *buildVersion = (struct build_version_command *)cur;
+    buildVersion->cmd = LC_BUILD_VERSION;
+    buildVersion->cmdsize = sizeof(struct build_version_command);
+    buildVersion->platform = 1; // macOS
+    buildVersion->minos = 0xb0000;
+    buildVersion->sdk = 0xb0000;
+    cur += buildVersion->cmdsize;
+
+    struct entry_point_command *entryPoint = (struct entry_point_command *)cur;
+    entryPoint->cmd = LC_MAIN;
+    entryPoint->cmdsize = sizeof(struct entry_point_command);
+    entryPoint->entryoff = textOffset;
+    cur += entryPoint->cmdsize;
+
+    for (uint32_t i = 0; i < fillerCount; i++) {
+        struct rpath_command *rpath = (struct rpath_command *)cur;
+        rpath->cmd = LC_RPATH;
+        rpath->cmdsize = rpathCommandSize;
+        rpath->path.offset = sizeof(struct rpath_command);
+        snprintf((char *)cur + sizeof(struct rpath_command), rpathCommandSize - sizeof(struct rpath_command), "@loader_path/../Frameworks/%016llx", (unsigned long long)corpus_random_next(state));
+        cur += rpathCommandSize;
+    }
+
+    struct linkedit_data_command *codeSignature = (struct linkedit_data_command *)cur;
+    codeSignature->cmd = LC_CODE_SIGNATURE;
+    codeSignature->cmdsize = sizeof(struct linkedit_data_command);
+    codeSignature->dataoff = (uint32_t)codeSize;
+    codeSignature->datasize = signatureSize;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(buf);
+        return -1;
+    }
+    int r = 0;
+    if (pwrite(fd, buf, filledSize, 0) != (ssize_t)filledSize || ftruncate(fd, codeSize + signatureSize) != 0) {
+        r = -1;
+    }
+    close(fd);
+    free(buf);
+    return r;
+}
+
+static int corpus_generate_slice(const CorpusConfig *config, const char *path, uint64_t *state, const CorpusSliceArch *arch, uint64_t index)
+{
+    const CorpusProfile *profile = &config->profile;
+    uint64_t codeSize = corpus_random_range(state, profile->codeSize);
+    uint32_t codeDirectoryCount = (uint32_t)corpus_random_range(state, profile->codeDirectories);
+    size_t entitlementsSize = corpus_random_range(state, profile->entitlementsSize);
+    uint32_t fillerCount = (uint32_t)corpus_random_range(state, profile->loadCommands);
+    if (codeDirectoryCount < 1) codeDirectoryCount = 1;
+    if (codeDirectoryCount > CORPUS_MAX_CODE_DIRECTORIES) codeDirectoryCount = CORPUS_MAX_CODE_DIRECTORIES;
+    codeSize = corpus_code_size(codeSize, fillerCount);
+
+    char identifier[64], teamID[16];
+    snprintf(identifier, sizeof(identifier), "com.corpus.%llx.%llu", (unsigned long long)config->seed, (unsigned long long)index);
+    snprintf(teamID, sizeof(teamID), "%010llX", (unsigned long long)(corpus_random_next(state) % 10000000000ULL));
+
+    CS_DecodedSuperBlob *superblob = csd_superblob_init();
+    if (!superblob) return -1;
+
+    // Build the superblob first, its encoded size is needed for the LC_CODE_SIGNATURE placeholder
+    CS_DecodedBlob *codeDirectories[CORPUS_MAX_CODE_DIRECTORIES] = { 0 };
+    bool adhoc = config->cmsData == NULL;
+    codeDirectories[0] = corpus_code_directory_create(gHashTypes[corpus_random_next(state) % 2], CSSLOT_CODEDIRECTORY, codeSize, adhoc, identifier, teamID);
+    if (!codeDirectories[0]) goto fail;
+    csd_superblob_append_blob(superblob, codeDirectories[0]);
+
+    static const uint8_t emptyRequirements[] = { 0, 0, 0, 0 };
+    CS_GenericBlob *requirementsData = corpus_generic_blob_create(CSMAGIC_REQUIREMENTS, emptyRequirements, sizeof(emptyRequirements));
+    if (!requirementsData) goto fail;
+    CS_DecodedBlob *requirements = csd_blob_init(CSSLOT_REQUIREMENTS, requirementsData);
+    free(requirementsData);
+    if (!requirements) goto fail;
+    csd_superblob_append_blob(superblob, requirements);
+
+    if (entitlementsSize) {
+        CS_DecodedBlob *entitlements = corpus_entitlements_create(state, entitlementsSize);
+        if (!entitlements) goto fail;
+        csd_superblob_append_blob(superblob, entitlements);
+    }
+
+    for (uint32_t i = 1; i < codeDirectoryCount; i++) {
+        uint8_t hashType = gHashTypes[corpus_random_next(state) % sizeof(gHashTypes)];
+        codeDirectories[i] = corpus_code_directory_create(hashType, CSSLOT_ALTERNATE_CODEDIRECTORIES + i - 1, codeSize, adhoc, identifier, teamID);
+        if (!codeDirectories[i]) goto fail;
+        csd_superblob_append_blob(superblob, codeDirectories[i]);
+    }
+
+    CS_GenericBlob *signatureData = corpus_generic_blob_create(CSMAGIC_BLOBWRAPPER, config->cmsData, config->cmsLen);
+    if (!signatureData) goto fail;
+    CS_DecodedBlob *signature = csd_blob_init(CSSLOT_SIGNATURESLOT, signatureData);
+    free(signatureData);
+    if (!signature) goto fail;
+    csd_superblob_append_blob(superblob, signature);
+
+    uint32_t signatureSize = sizeof(CS_SuperBlob);
+    for (CS_DecodedBlob *blob = superblob->firstBlob; blob; blob = blob->next) {
+        signatureSize += sizeof(CS_BlobIndex) + csd_blob_get_size(blob);
+    }
+    if (corpus_write_macho_template(path, state, arch, codeSize, fillerCount, signatureSize) != 0) goto fail;
+
+    MachO *macho = macho_init_for_writing(path);
+    if (!macho) goto fail;
+    for (uint32_t i = 0; i < codeDirectoryCount; i++) {
+        corpus_code_directory_update_special_slots(codeDirectories[i], superblob);
+        csd_code_directory_update(codeDirectories[i], macho);
+    }
+    CS_SuperBlob *encoded = csd_superblob_encode(superblob);
+    int r = encoded ? macho_replace_code_signature(macho, encoded) : -1;
+    free(encoded);
+    macho_free(macho);
+    csd_superblob_free(superblob);
+    return r;
+
+fail:
+    csd_superblob_free(superblob);
+    return -1;
+}
+
+static int corpus_generate_file(const CorpusConfig *config, uint64_t index)
+{
+    uint64_t state = config->seed ^ (index * 0xD1B54A32D192ED03ULL);
+    uint32_t sliceCount = (uint32_t)corpus_random_range(&state, config->profile.slices);
+    if (sliceCount < 1) sliceCount = 1;
+    if (sliceCount > CORPUS_MAX_SLICES) sliceCount = CORPUS_MAX_SLICES;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%03llu", config->outputDir, (unsigned long long)(index / 1000));
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%03llu/%llu", config->outputDir, (unsigned long long)(index / 1000), (unsigned long long)index);
+
+    if (sliceCount == 1) {
+        return corpus_generate_slice(config, path, &state, &gSliceArchs[0], index);
+    }
+
+    char *slicePaths[CORPUS_MAX_SLICES] = { 0 };
+    MachO *slices[CORPUS_MAX_SLICES] = { 0 };
+    int r = -1;
+    for (uint32_t i = 0; i < sliceCount; i++) {
+        if (asprintf(&slicePaths[i], "%s.slice%u", path, i) < 0) {
+            slicePaths[i] = NULL;
+            goto out;
+        }
+        if (corpus_generate_slice(config, slicePaths[i], &state, &gSliceArchs[i], index) != 0) goto out;
+        slices[i] = macho_init_for_writing(slicePaths[i]);
+        if (!slices[i]) goto out;
+    }
+
+    FAT *fat = fat_create_for_macho_array(slicePaths[0], slices, sliceCount);
+    if (fat) {
+        MemoryStream *fatStream = fat_get_stream(fat);
+        MemoryStream *outStream = file_stream_init_from_path(path, 0, 0, FILE_STREAM_FLAG_WRITABLE | FILE_STREAM_FLAG_AUTO_EXPAND);
+        if (outStream) {
+            r = memory_stream_copy_data(fatStream, 0, outStream, 0, memory_stream_get_size(fatStream));
+            memory_stream_free(outStream);
+        }
+        fat_free(fat);
+    }
+
+out:
+    for (uint32_t i = 0; i < sliceCount; i++) {
+        if (slices[i]) macho_free(slices[i]);
+        if (slicePaths[i]) {
+            unlink(slicePaths[i]);
+            free(slicePaths[i]);
+        }
+    }
+    return r;
+}
+
+static void *corpus_worker_thread(void *arg)
+{
+    CorpusWorker *worker = arg;
+    const CorpusConfig *config = worker->config;
+    for (uint64_t index = worker->index; index < config->count; index += config->threadCount) {
+        if (corpus_generate_file(config, index) == 0) {
+            worker->generated++;
+        }
+        else {
+            worker->failed++;
+        }
+    }
+    return NULL;
+}
+
+static int corpus_parse_range(const char *string, CorpusRange *rangeOut)
+{
+    char *end = NULL;
+    uint64_t values[2];
+    for (int i = 0; i < 2; i++) {
+        values[i] = strtoull(string, &end, 0);
+        if (end == string) return -1;
+        switch (*end) {
+            case 'k': case 'K': values[i] <<= 10; end++; break;
+            case 'm': case 'M': values[i] <<= 20; end++; break;
+            case 'g': case 'G': values[i] <<= 30; end++; break;
+        }
+        if (i == 0) {
+            if (*end != '-') {
+                values[1] = values[0];
+                break;
+            }
+            string = end + 1;
+        }
+    }
+    if (*end != '\0' && *end != ',') return -1;
+    rangeOut->min = values[0];
+    rangeOut->max = values[1] < values[0] ? values[0] : values[1];
+    return 0;
+}
+
+// Overrides in the form slices=1-4,code=16k-2g,cds=1-5,ents=0-64k,lcs=4-200
+static int corpus_parse_profile_overrides(CorpusProfile *profile, char *string)
+{
+    for (char *entry = strtok(string, ","); entry; entry = strtok(NULL, ",")) {
+        char *value = strchr(entry, '=');
+        if (!value) return -1;
+        *value++ = '\0';
+        CorpusRange *range = NULL;
+        if (!strcmp(entry, "slices")) range = &profile->slices;
+        else if (!strcmp(entry, "code")) range = &profile->codeSize;
+        else if (!strcmp(entry, "cds")) range = &profile->codeDirectories;
+        else if (!strcmp(entry, "ents")) range = &profile->entitlementsSize;
+        else if (!strcmp(entry, "lcs")) range = &profile->loadCommands;
+        if (!range || corpus_parse_range(value, range) != 0) return -1;
+    }
+    // Code sizes are rounded up to a page and end up in 32-bit codeLimit and dataoff fields
+    if (profile->codeSize.max > UINT32_MAX - CORPUS_PAGE_SIZE + 1) return -1;
+    return 0;
+}
+
+static void print_usage(const char *self)
+{
+    printf("Options: \n");
+    printf("\t-o: output directory\n");
+    printf("\t-n: number of files to generate\n");
+    printf("\t-s: seed\n");
+    printf("\t-p: size profile (tiny, small, mixed, fat, huge)\n");
+    printf("\t-P: profile overrides (slices=1-4,code=16k-2g,cds=1-5,ents=0-64k,lcs=4-200)\n");
+    printf("\t-c: CMS blob to embed instead of an ad-hoc signature (e.g. one signed with a test root)\n");
+    printf("\t-j: number of threads\n");
+    printf("\t-h: print this help message\n");
+    printf("Examples:\n");
+    printf("\t%s -o corpus -n 1000000 -s 42 -p mixed -j 16\n", self);
+}
+
+static char *get_argument_value(int argc, char *argv[], const char *flag)
+{
+    for (int i = 0; i < argc; i++) {
+        if (!strcmp(argv[i], flag) && i + 1 < argc) {
+            return argv[i + 1];
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    CorpusConfig config = { 0 };
+    config.profile = gProfiles[0];
+    config.count = 1;
+    config.threadCount = 1;
+
+    config.outputDir = get_argument_value(argc, argv, "-o");
+    if (!config.outputDir) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    const char *count = get_argument_value(argc, argv, "-n");
+    if (count) config.count = strtoull(count, NULL, 0);
+    const char *seed = get_argument_value(argc, argv, "-s");
+    if (seed) config.seed = strtoull(seed, NULL, 0);
+    const char *threads = get_argument_value(argc, argv, "-j");
+    if (threads) config.threadCount = (unsigned)strtoul(threads, NULL, 0);
+    if (config.threadCount == 0) config.threadCount = 1;
+
+    const char *profileName = get_argument_value(argc, argv, "-p");
+    if (profileName) {
+        bool found = false;
+        for (size_t i = 0; i < sizeof(gProfiles) / sizeof(gProfiles[0]); i++) {
+            if (!strcmp(gProfiles[i].name, profileName)) {
+                config.profile = gProfiles[i];
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            printf("Error: unknown profile %s!\n", profileName);
+            return -1;
+        }
+    }
+    const char *overrides = get_argument_value(argc, argv, "-P");
+    if (overrides) {
+        char *copy = strdup(overrides);
+        int r = corpus_parse_profile_overrides(&config.profile, copy);
+        free(copy);
+        if (r != 0) {
+            printf("Error: invalid profile overrides %s!\n", overrides);
+            return -1;
+        }
+    }
+
+    const char *cmsPath = get_argument_value(argc, argv, "-c");
+    if (cmsPath) {
+        FILE *f = fopen(cmsPath, "rb");
+        if (!f) {
+            printf("Error: failed to open %s!\n", cmsPath);
+            return -1;
+        }
+        fseek(f, 0, SEEK_END);
+        config.cmsLen = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        config.cmsData = malloc(config.cmsLen);
+        if (!config.cmsData || fread(config.cmsData, 1, config.cmsLen, f) != config.cmsLen) {
+            printf("Error: failed to read %s!\n", cmsPath);
+            fclose(f);
+            return -1;
+        }
+        fclose(f);
+    }
+
+    if (mkdir(config.outputDir, 0755) != 0 && errno != EEXIST) {
+        printf("Error: failed to create %s!\n", config.outputDir);
+        return -1;
+    }
+
+    CorpusWorker *workers = calloc(config.threadCount, sizeof(CorpusWorker));
+    if (!workers) return -1;
+    unsigned started = 0;
+    for (; started < config.threadCount; started++) {
+        workers[started].config = &config;
+        workers[started].index = started;
+        if (pthread_create(&workers[started].thread, NULL, corpus_worker_thread, &workers[started]) != 0) break;
+    }
+    // Files are split by index, so the share of every worker that could not be started is generated here
+    for (unsigned i = started; i < config.threadCount; i++) {
+        workers[i].config = &config;
+        workers[i].index = i;
+        corpus_worker_thread(&workers[i]);
+    }
+    uint64_t generated = 0, failed = 0;
+    for (unsigned i = 0; i < config.threadCount; i++) {
+        if (i < started) pthread_join(workers[i].thread, NULL);
+        generated += workers[i].generated;
+        failed += workers[i].failed;
+    }
+    free(workers);
+    free(config.cmsData);
+
+    printf("Generated %llu files (%llu failed) in %s.\n", (unsigned long long)generated, (unsigned long long)failed, config.outputDir);
+    return failed ? -1 : 0;
+}